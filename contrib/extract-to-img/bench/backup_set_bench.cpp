@@ -0,0 +1,97 @@
+/**
+ * @file backup_set_bench.cpp
+ * @brief Benchmarks for resolving backup chains
+ *
+ * Measures BuildPartitionBackupSet for every partition of the first disk,
+ * which reads the layout of each file in the chain and overlays the delta
+ * indexes onto the full backup's index, and BuildLazyPartitionBackupSet,
+ * which only sorts and filters the delta indexes. The chain named in the
+ * backup's file history must be complete for these benchmarks to run. The
+ * bundled samples are missing their older files or only carry metadata stubs
+ * for them, so with the default backup file both benchmarks are reported as
+ * skipped. Pass a complete chain, such as one written by generate_chain, to
+ * time them.
+ */
+
+#include <stdexcept>
+
+#include "../libs/restore/backup_set.h"
+#include "bench_harness.h"
+
+/**
+ * @brief Checks that the chain of every partition on disk 0 can be resolved
+ *
+ * Resolves each partition once before timing, so an incomplete chain skips
+ * the benchmark instead of failing it.
+ *
+ * @param state The benchmark state
+ * @param layout Layout of the benchmarked backup file
+ * @return true if every partition's chain resolves
+ */
+bool checkBenchmarkChain(BenchmarkState& state, file_structs::File_Layout& layout)
+{
+    try {
+        for (auto& partition : layout.disks[0].partitions) {
+            PartitionBackupSet backupSet;
+            BuildLazyPartitionBackupSet(backupSet, benchmarkBackupFile(state), partition, 0);
+        }
+    }
+    catch (const std::exception& e) {
+        SkipWithMessage(state, std::string("Backup chain is incomplete (") + e.what() +
+            "); pass a complete chain, such as one written by generate_chain");
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Times building the backup set of every partition on disk 0
+ *
+ * @param state The benchmark state
+ */
+void BM_BuildPartitionBackupSet(BenchmarkState& state)
+{
+    file_structs::File_Layout layout;
+    readBackupFileLayout(layout, benchmarkBackupFile(state));
+    if (!checkBenchmarkChain(state, layout)) { return; }
+
+    size_t blockCount = 0;
+    while (KeepRunning(state)) {
+        blockCount = 0;
+        for (auto& partition : layout.disks[0].partitions) {
+            PartitionBackupSet backupSet;
+            BuildPartitionBackupSet(backupSet, benchmarkBackupFile(state), partition, 0);
+            blockCount += backupSet.backupSetBlockIndex.size();
+        }
+    }
+    state.counters["partitions"] = static_cast<double>(layout.disks[0].partitions.size());
+    state.counters["blocks"] = static_cast<double>(blockCount);
+}
+BENCHMARK(BM_BuildPartitionBackupSet);
+
+/**
+ * @brief Times building the on-demand backup set of every partition on disk 0
+ *
+ * @param state The benchmark state
+ */
+void BM_BuildLazyPartitionBackupSet(BenchmarkState& state)
+{
+    file_structs::File_Layout layout;
+    readBackupFileLayout(layout, benchmarkBackupFile(state));
+    if (!checkBenchmarkChain(state, layout)) { return; }
+
+    size_t blockCount = 0;
+    while (KeepRunning(state)) {
+        blockCount = 0;
+        for (auto& partition : layout.disks[0].partitions) {
+            PartitionBackupSet backupSet;
+            BuildLazyPartitionBackupSet(backupSet, benchmarkBackupFile(state), partition, 0);
+            blockCount += GetBackupSetBlockCount(backupSet);
+        }
+    }
+    state.counters["partitions"] = static_cast<double>(layout.disks[0].partitions.size());
+    state.counters["blocks"] = static_cast<double>(blockCount);
+}
+BENCHMARK(BM_BuildLazyPartitionBackupSet);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,290 @@
+/**
+ * @file bench_harness.cpp
+ * @brief Implementation of the microbenchmark harness
+ *
+ * This file implements benchmark registration, the timed loop, and the
+ * console and JSON reporters. The JSON output follows the Google Benchmark
+ * schema ("context" and "benchmarks"), so results can be compared with the
+ * same scripts across releases.
+ */
+
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <thread>
+
+#include "../dependencies/include/nlohmann/json.hpp"
+#include "bench_harness.h"
+
+/**
+ * @brief A benchmark registered with the harness
+ */
+struct RegisteredBenchmark
+{
+    std::string name;
+    BenchmarkFunction function;
+};
+
+/**
+ * @brief Returns the list of registered benchmarks
+ *
+ * A function-local static avoids depending on static initialisation order
+ * between the benchmark translation units and this one.
+ *
+ * @return std::vector<RegisteredBenchmark>& The registered benchmarks
+ */
+std::vector<RegisteredBenchmark>& registeredBenchmarks()
+{
+    static std::vector<RegisteredBenchmark> benchmarks;
+    return benchmarks;
+}
+
+/**
+ * @brief Records the elapsed real and CPU time of the timed loop
+ *
+ * @param state The benchmark state
+ */
+void stopTimer(BenchmarkState& state)
+{
+    if (!state.started) { return; }
+    state.realSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - state.startTime).count();
+    state.cpuSeconds = static_cast<double>(std::clock() - state.startCpu) / CLOCKS_PER_SEC;
+}
+
+/**
+ * @brief Returns the backup file a benchmark should read
+ *
+ * @param state The benchmark state
+ * @return std::string The first positional argument, or the bundled sample
+ */
+std::string benchmarkBackupFile(const BenchmarkState& state)
+{
+    return state.args.empty() ? DEFAULT_BENCHMARK_BACKUP_FILE : state.args[0];
+}
+
+/**
+ * @brief Controls the timed loop of a benchmark
+ *
+ * @param state The benchmark state
+ * @return true while another iteration should run
+ */
+bool KeepRunning(BenchmarkState& state)
+{
+    if (!state.errorMessage.empty()) {
+        stopTimer(state);
+        return false;
+    }
+
+    if (!state.started) {
+        state.started = true;
+        state.startCpu = std::clock();
+        state.startTime = std::chrono::steady_clock::now();
+        return true;
+    }
+
+    state.iterations++;
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - state.startTime).count();
+    if (elapsed < state.minTime && state.iterations < state.maxIterations) {
+        return true;
+    }
+
+    stopTimer(state);
+    return false;
+}
+
+/**
+ * @brief Marks a benchmark as failed and stops its loop
+ *
+ * @param state The benchmark state
+ * @param message Reason the benchmark could not run
+ */
+void SkipWithError(BenchmarkState& state, const std::string& message)
+{
+    state.errorMessage = message;
+}
+
+/**
+ * @brief Marks a benchmark as skipped and stops its loop
+ *
+ * @param state The benchmark state
+ * @param message Reason the benchmark was skipped
+ */
+void SkipWithMessage(BenchmarkState& state, const std::string& message)
+{
+    state.errorMessage = message;
+    state.skipped = true;
+}
+
+/**
+ * @brief Registers a benchmark function under a name
+ *
+ * @param name Name reported in the results
+ * @param function The function to run
+ * @return int Always 0
+ */
+int RegisterBenchmark(const std::string& name, BenchmarkFunction function)
+{
+    registeredBenchmarks().push_back({ name, function });
+    return 0;
+}
+
+/**
+ * @brief Converts a benchmark result to a Google Benchmark JSON entry
+ *
+ * @param name Benchmark name
+ * @param state The finished benchmark state
+ * @return nlohmann::json The result entry
+ */
+nlohmann::json resultToJSON(const std::string& name, const BenchmarkState& state)
+{
+    nlohmann::json result;
+    result["name"] = name;
+    result["run_name"] = name;
+    result["run_type"] = "iteration";
+    result["repetitions"] = 1;
+    result["repetition_index"] = 0;
+    result["threads"] = 1;
+    result["iterations"] = state.iterations;
+
+    double iterations = state.iterations > 0 ? static_cast<double>(state.iterations) : 1.0;
+    result["real_time"] = state.realSeconds * 1e9 / iterations;
+    result["cpu_time"] = state.cpuSeconds * 1e9 / iterations;
+    result["time_unit"] = "ns";
+
+    if (state.bytesProcessed > 0 && state.realSeconds > 0) {
+        result["bytes_per_second"] = state.bytesProcessed / state.realSeconds;
+    }
+    for (auto& counter : state.counters) {
+        result[counter.first] = counter.second;
+    }
+    if (!state.errorMessage.empty()) {
+        result["error_occurred"] = !state.skipped;
+        result["error_message"] = state.errorMessage;
+    }
+    return result;
+}
+
+/**
+ * @brief Builds the context section of the JSON report
+ *
+ * @param executable Path the benchmark binary was invoked as
+ * @return nlohmann::json The context object
+ */
+nlohmann::json contextToJSON(const std::string& executable)
+{
+    std::time_t now = std::time(nullptr);
+    char date[32] = { 0 };
+    std::strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S", std::localtime(&now));
+
+    const char* hostName = std::getenv("HOSTNAME");
+
+    nlohmann::json context;
+    context["date"] = date;
+    context["host_name"] = hostName != nullptr ? hostName : "";
+    context["executable"] = executable;
+    context["num_cpus"] = std::thread::hardware_concurrency();
+#ifdef NDEBUG
+    context["library_build_type"] = "release";
+#else
+    context["library_build_type"] = "debug";
+#endif
+    return context;
+}
+
+/**
+ * @brief Prints one result as a row of the console table
+ *
+ * @param name Benchmark name
+ * @param state The finished benchmark state
+ */
+void printConsoleResult(const std::string& name, const BenchmarkState& state)
+{
+    std::cout << std::left << std::setw(40) << name << std::right;
+    if (!state.errorMessage.empty()) {
+        std::cout << (state.skipped ? " SKIPPED: " : " ERROR: ") << state.errorMessage << "\n";
+        return;
+    }
+
+    double iterations = state.iterations > 0 ? static_cast<double>(state.iterations) : 1.0;
+    std::cout << std::fixed << std::setprecision(0)
+              << std::setw(14) << state.realSeconds * 1e9 / iterations << " ns"
+              << std::setw(14) << state.cpuSeconds * 1e9 / iterations << " ns"
+              << std::setw(12) << state.iterations;
+    if (state.bytesProcessed > 0 && state.realSeconds > 0) {
+        std::cout << std::setprecision(1) << std::setw(12) << state.bytesProcessed / state.realSeconds / (1024 * 1024) << " MiB/s";
+    }
+    std::cout << "\n";
+}
+
+/**
+ * @brief Runs all registered benchmarks selected on the command line
+ *
+ * Benchmarks that fail are reported with an error and do not change the exit
+ * code, matching Google Benchmark.
+ *
+ * @param argc Number of command line arguments
+ * @param argv Command line arguments
+ * @return int Exit code (0 for success, 1 if the results could not be written)
+ */
+int RunBenchmarks(int argc, char* argv[])
+{
+    std::string filter;
+    std::string format = "console";
+    std::string outPath;
+    double minTime = 0.5;
+    std::vector<std::string> args;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg.rfind("--benchmark_filter=", 0) == 0) { filter = arg.substr(19); }
+        else if (arg.rfind("--benchmark_min_time=", 0) == 0) { minTime = std::stod(arg.substr(21)); }
+        else if (arg.rfind("--benchmark_format=", 0) == 0) { format = arg.substr(19); }
+        else if (arg.rfind("--benchmark_out=", 0) == 0) { outPath = arg.substr(16); }
+        else { args.push_back(arg); }
+    }
+
+    nlohmann::json report;
+    report["context"] = contextToJSON(argv[0]);
+    report["benchmarks"] = nlohmann::json::array();
+
+    if (format == "console") {
+        std::cout << std::left << std::setw(40) << "Benchmark" << std::right
+                  << std::setw(17) << "Time" << std::setw(17) << "CPU" << std::setw(12) << "Iterations" << "\n"
+                  << std::string(86, '-') << "\n";
+    }
+
+    for (auto& benchmark : registeredBenchmarks()) {
+        if (!filter.empty() && benchmark.name.find(filter) == std::string::npos) { continue; }
+
+        BenchmarkState state;
+        state.args = args;
+        state.minTime = minTime;
+
+        try {
+            benchmark.function(state);
+        }
+        catch (const std::exception& e) {
+            stopTimer(state);
+            SkipWithError(state, e.what());
+        }
+        if (!state.started && state.errorMessage.empty()) {
+            SkipWithError(state, "Benchmark did not run its timed loop");
+        }
+
+        report["benchmarks"].push_back(resultToJSON(benchmark.name, state));
+        if (format == "console") { printConsoleResult(benchmark.name, state); }
+    }
+
+    if (format == "json") {
+        std::cout << report.dump(2) << std::endl;
+    }
+    if (!outPath.empty()) {
+        std::ofstream out(outPath);
+        out << report.dump(2) << std::endl;
+        if (out.fail()) {
+            std::cout << "Failed to write results to " << outPath << std::endl;
+            return 1;
+        }
+    }
+    return 0;
+}
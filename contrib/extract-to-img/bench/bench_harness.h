@@ -0,0 +1,135 @@
+/**
+ * @file bench_harness.h
+ * @brief Minimal microbenchmark harness for the restore libraries
+ *
+ * This file declares a small benchmark runner modelled on Google Benchmark.
+ * Benchmarks are registered with the BENCHMARK macro and time the body of a
+ * `while (KeepRunning(state))` loop. Results are printed as a table, or as
+ * JSON in the Google Benchmark output schema so they can be tracked across
+ * releases with existing tooling.
+ *
+ * Supported command line flags:
+ *   --benchmark_filter=<substring>   Only run benchmarks whose name contains the substring
+ *   --benchmark_min_time=<seconds>   Minimum time to run each benchmark (default 0.5)
+ *   --benchmark_format=<console|json> Format written to stdout
+ *   --benchmark_out=<file>           Also write JSON results to a file
+ *
+ * The first positional argument names the backup file to benchmark against.
+ * Without it the bundled multi-partition sample is used.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <ctime>
+#include <map>
+#include <string>
+#include <vector>
+
+/**
+ * @brief Backup file used when none is given on the command line
+ *
+ * Relative to the runfiles directory when started with `bazel run`.
+ */
+const char* const DEFAULT_BENCHMARK_BACKUP_FILE = "Backup-Files/Backup-Set-MP/584221F3840B0DBE-MP-Full-03-03.mrimg";
+
+/**
+ * @brief State of a running benchmark
+ *
+ * Passed to each benchmark function. The function times its work with
+ * KeepRunning and reports throughput and errors through the fields below.
+ */
+struct BenchmarkState
+{
+    std::vector<std::string> args;                   // Positional command line arguments
+    uint64_t iterations = 0;                         // Completed timed iterations
+    uint64_t maxIterations = 1000000000;             // Upper bound on iterations
+    double minTime = 0.5;                            // Minimum timed duration in seconds
+    int64_t bytesProcessed = 0;                      // Bytes handled over all iterations
+    std::map<std::string, double> counters;          // Extra values reported with the result
+    std::string errorMessage;                        // Set when the benchmark could not run
+    bool skipped = false;                            // errorMessage explains a skip rather than a failure
+
+    bool started = false;
+    std::chrono::steady_clock::time_point startTime;
+    std::clock_t startCpu = 0;
+    double realSeconds = 0;
+    double cpuSeconds = 0;
+};
+
+/**
+ * @brief Benchmark function signature
+ */
+typedef void (*BenchmarkFunction)(BenchmarkState& state);
+
+/**
+ * @brief Returns the backup file a benchmark should read
+ *
+ * @param state The benchmark state
+ * @return std::string The first positional argument, or the bundled sample
+ */
+std::string benchmarkBackupFile(const BenchmarkState& state);
+
+/**
+ * @brief Controls the timed loop of a benchmark
+ *
+ * The timer starts on the first call, so setup done before the loop is not
+ * measured. Returns false once the minimum time has elapsed.
+ *
+ * @param state The benchmark state
+ * @return true while another iteration should run
+ */
+bool KeepRunning(BenchmarkState& state);
+
+/**
+ * @brief Marks a benchmark as failed and stops its loop
+ *
+ * @param state The benchmark state
+ * @param message Reason the benchmark could not run
+ */
+void SkipWithError(BenchmarkState& state, const std::string& message);
+
+/**
+ * @brief Marks a benchmark as skipped and stops its loop
+ *
+ * Used when the input cannot exercise the benchmark. The result is reported
+ * without an error, matching Google Benchmark's SkipWithMessage.
+ *
+ * @param state The benchmark state
+ * @param message Reason the benchmark was skipped
+ */
+void SkipWithMessage(BenchmarkState& state, const std::string& message);
+
+/**
+ * @brief Registers a benchmark function under a name
+ *
+ * @param name Name reported in the results
+ * @param function The function to run
+ * @return int Always 0, so registration can initialise a static
+ */
+int RegisterBenchmark(const std::string& name, BenchmarkFunction function);
+
+/**
+ * @brief Runs all registered benchmarks selected on the command line
+ *
+ * @param argc Number of command line arguments
+ * @param argv Command line arguments
+ * @return int Exit code (0 for success, 1 if any benchmark failed)
+ */
+int RunBenchmarks(int argc, char* argv[]);
+
+#define BENCHMARK_CONCAT_INNER(a, b) a##b
+#define BENCHMARK_CONCAT(a, b) BENCHMARK_CONCAT_INNER(a, b)
+
+/**
+ * @brief Registers a benchmark function under its own name
+ */
+#define BENCHMARK(function) \
+    static int BENCHMARK_CONCAT(benchmarkRegistration, __LINE__) = RegisterBenchmark(#function, function)
+
+/**
+ * @brief Defines main() to run the registered benchmarks
+ */
+#define BENCHMARK_MAIN() \
+    int main(int argc, char* argv[]) { return RunBenchmarks(argc, argv); }
@@ -0,0 +1,89 @@
+/**
+ * @file block_io_bench.cpp
+ * @brief Benchmarks for reading data blocks and writing them to a target
+ *
+ * Measures the per-block restore path: readDataBlock from the backup file
+ * followed by a positioned write to a scratch image. Only blocks stored in
+ * the benchmarked file itself are used, so no other chain file is needed.
+ */
+
+#include <cstdio>
+
+#include "../libs/restore/restore.h"
+#include "../libs/img_handler/img_handler.h"
+#include "bench_harness.h"
+
+/**
+ * @brief Collects the non-empty blocks stored in a backup file
+ *
+ * @param layout Layout of the backup file
+ * @return std::vector<DataBlockIndexElement> Blocks held in the file itself
+ */
+std::vector<DataBlockIndexElement> collectLocalBlocks(file_structs::File_Layout& layout)
+{
+    std::vector<DataBlockIndexElement> blocks;
+    for (auto& disk : layout.disks) {
+        for (auto& partition : disk.partitions) {
+            for (auto& block : partition.data_block_index) {
+                if (block.block_length != 0 && block.file_number == layout._header.file_number) { blocks.push_back(block); }
+            }
+            for (auto& deltaBlock : partition.delta_data_block_index) {
+                if (deltaBlock.data_block.block_length != 0 && deltaBlock.data_block.file_number == layout._header.file_number) {
+                    blocks.push_back(deltaBlock.data_block);
+                }
+            }
+        }
+    }
+    return blocks;
+}
+
+/**
+ * @brief Times reading one data block and writing it to a scratch image
+ *
+ * The second positional argument names the scratch image, which defaults to
+ * a file in the current directory and is removed afterwards.
+ *
+ * @param state The benchmark state
+ */
+void BM_ReadDataBlockAndWrite(BenchmarkState& state)
+{
+    std::string backupFileName = benchmarkBackupFile(state);
+    std::string targetPath = state.args.size() > 1 ? state.args[1] : "block_io_bench.img";
+
+    file_structs::File_Layout layout;
+    readBackupFileLayout(layout, backupFileName);
+    std::vector<DataBlockIndexElement> blocks = collectLocalBlocks(layout);
+    if (blocks.empty()) {
+        SkipWithError(state, "Backup file holds no data blocks");
+        return;
+    }
+
+    std::ofstream(targetPath, std::ios::binary | std::ios::trunc).close();
+    std::fstream backupFile = openFile(backupFileName);
+    std::fstream targetFile = openFile(targetPath);
+
+    size_t next = 0;
+    int64_t bytesWritten = 0;
+    std::streamoff targetOffset = 0;
+    while (KeepRunning(state)) {
+        auto blockData = readDataBlock(backupFile, blocks[next]);
+        setFilePointer(targetFile, targetOffset, std::ios::beg);
+        writeToFile(targetFile, blockData.get(), blocks[next].block_length);
+
+        bytesWritten += blocks[next].block_length;
+        targetOffset += blocks[next].block_length;
+        if (++next == blocks.size()) {
+            next = 0;
+            targetOffset = 0;
+        }
+    }
+    state.bytesProcessed = bytesWritten;
+    state.counters["blocks"] = static_cast<double>(blocks.size());
+
+    closeFile(backupFile);
+    closeFile(targetFile);
+    std::remove(targetPath.c_str());
+}
+BENCHMARK(BM_ReadDataBlockAndWrite);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,116 @@
+/**
+ * @file img_handler_bench.cpp
+ * @brief Benchmarks for reading backup file layouts
+ *
+ * Measures the three stages of reading a backup file's metadata: the whole
+ * readBackupFileLayout call, the JSON-to-File_Layout conversion on its own,
+ * and reading the data block index. Opening a layout with its partition
+ * indexes deferred is timed against the full read, and the selective JSON parser is compared
+ * with the conversion through a full JSON document.
+ */
+
+#include "../libs/img_handler/img_handler.h"
+#include "bench_harness.h"
+
+/**
+ * @brief Times a complete readBackupFileLayout call
+ *
+ * @param state The benchmark state
+ */
+void BM_ReadBackupFileLayout(BenchmarkState& state)
+{
+    std::string backupFileName = benchmarkBackupFile(state);
+
+    while (KeepRunning(state)) {
+        file_structs::File_Layout layout;
+        readBackupFileLayout(layout, backupFileName);
+    }
+}
+BENCHMARK(BM_ReadBackupFileLayout);
+
+/**
+ * @brief Times opening a layout without loading the partition indexes
+ *
+ * @param state The benchmark state
+ */
+void BM_OpenBackupFileLayout(BenchmarkState& state)
+{
+    std::string backupFileName = benchmarkBackupFile(state);
+
+    while (KeepRunning(state)) {
+        LazyFileLayout layout;
+        openBackupFileLayout(layout, backupFileName);
+    }
+}
+BENCHMARK(BM_OpenBackupFileLayout);
+
+/**
+ * @brief Times converting the $JSON block into a File_Layout
+ *
+ * The JSON is read from the file once before the timed loop.
+ *
+ * @param state The benchmark state
+ */
+void BM_ParseFileLayoutJSON(BenchmarkState& state)
+{
+    std::fstream file = openFile(benchmarkBackupFile(state));
+    std::string strJson = readBackupFileJSON(file);
+    closeFile(file);
+
+    while (KeepRunning(state)) {
+        file_structs::File_Layout layout;
+        parseFileLayoutJSON(layout, strJson);
+    }
+    state.bytesProcessed = static_cast<int64_t>(strJson.size() * state.iterations);
+}
+BENCHMARK(BM_ParseFileLayoutJSON);
+
+/**
+ * @brief Times converting the $JSON block through a full JSON document
+ *
+ * @param state The benchmark state
+ */
+void BM_ParseFileLayoutJSONDOM(BenchmarkState& state)
+{
+    std::fstream file = openFile(benchmarkBackupFile(state));
+    std::string strJson = readBackupFileJSON(file);
+    closeFile(file);
+
+    while (KeepRunning(state)) {
+        file_structs::File_Layout layout;
+        parseFileLayoutJSONDOM(layout, strJson);
+    }
+    state.bytesProcessed = static_cast<int64_t>(strJson.size() * state.iterations);
+}
+BENCHMARK(BM_ParseFileLayoutJSONDOM);
+
+/**
+ * @brief Times reading the track 0 data and data block index
+ *
+ * @param state The benchmark state
+ */
+void BM_ReadDataBlockIndex(BenchmarkState& state)
+{
+    std::fstream file = openFile(benchmarkBackupFile(state));
+    file_structs::File_Layout layout;
+    parseFileLayoutJSON(layout, readBackupFileJSON(file));
+
+    while (KeepRunning(state)) {
+        readDataBlockIndex(file, layout);
+    }
+    closeFile(file);
+
+    int64_t indexBytes = 0;
+    for (auto& disk : layout.disks) {
+        indexBytes += disk.track0.size();
+        for (auto& partition : disk.partitions) {
+            indexBytes += partition.reserved_sectors.size() * sizeof(DataBlockIndexElement);
+            indexBytes += partition.data_block_index.size() * sizeof(DataBlockIndexElement);
+            indexBytes += partition.delta_data_block_index.size() * sizeof(DeltaDataBlockIndexElement);
+        }
+    }
+    state.bytesProcessed = indexBytes * static_cast<int64_t>(state.iterations);
+}
+BENCHMARK(BM_ReadDataBlockIndex);
+
+BENCHMARK_MAIN();
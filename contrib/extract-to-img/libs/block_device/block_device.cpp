@@ -0,0 +1,232 @@
+/**
+ * @file block_device.cpp
+ * @brief Implementation of restoring straight onto a Linux block device
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <linux/fs.h>
+#include <stdexcept>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "block_device.h"
+
+/**
+ * @brief Writes a buffer to a block device, retrying short and interrupted writes
+ *
+ * @param device The opened device
+ * @param offset Offset of the bytes on the device
+ * @param data The bytes to write
+ * @param length Number of bytes
+ */
+void writeBlockDeviceFully(BlockDevice& device, uint64_t offset, const uint8_t* data, size_t length)
+{
+    while (length > 0) {
+        ssize_t written = pwrite(device.fd, data, length, static_cast<off_t>(offset));
+        if (written < 0 && errno == EINTR) { continue; }
+        if (written <= 0) {
+            std::cerr << "Failed to write " << device.path << " at offset " << offset << ": " << strerror(errno) << "\n";
+            throw std::runtime_error("Failed to write block device.");
+        }
+        device.bytesWritten += static_cast<uint64_t>(written);
+        if (noteRangeWritten(device.writeBehind, offset, static_cast<uint64_t>(written))) { startWriteBehind(device.writeBehind); }
+        offset += static_cast<uint64_t>(written);
+        data += written;
+        length -= static_cast<size_t>(written);
+    }
+}
+
+/**
+ * @brief Checks that a range lies on a block device
+ *
+ * @param device The opened device
+ * @param offset Offset of the range
+ * @param length Length of the range
+ */
+void checkBlockDeviceRange(const BlockDevice& device, uint64_t offset, uint64_t length)
+{
+    if (offset > device.size || length > device.size - offset) {
+        std::cerr << "Range at offset " << offset << " of " << length << " bytes is beyond the end of " << device.path << "\n";
+        throw std::runtime_error("Write beyond the end of the block device.");
+    }
+}
+
+/**
+ * @brief Opens a block device for restoring
+ *
+ * @param device Output parameter for the device
+ * @param path Path of the device, such as /dev/sdb or /dev/vg0/data
+ * @param unusedSpace How ranges without backup data are cleared
+ * @param writeBehindBytes Bytes written between writeback batches, or 0 for no hints
+ * @throws std::runtime_error if the path is not a block device or cannot be opened for writing
+ */
+void openBlockDevice(BlockDevice& device, const std::string& path, UnusedSpaceMode unusedSpace, uint64_t writeBehindBytes)
+{
+    device = BlockDevice();
+    device.path = path;
+    device.unusedSpace = unusedSpace;
+
+    device.fd = open(path.c_str(), O_RDWR | O_CLOEXEC);
+    if (device.fd < 0) {
+        std::cerr << "Failed to open " << path << ": " << strerror(errno) << "\n";
+        throw std::runtime_error("Failed to open block device.");
+    }
+
+    struct stat deviceStat;
+    int logicalSectorSize = 0;
+    unsigned int physicalSectorSize = 0;
+    if (fstat(device.fd, &deviceStat) != 0 || !S_ISBLK(deviceStat.st_mode) ||
+        ioctl(device.fd, BLKGETSIZE64, &device.size) != 0 ||
+        ioctl(device.fd, BLKSSZGET, &logicalSectorSize) != 0 ||
+        ioctl(device.fd, BLKPBSZGET, &physicalSectorSize) != 0) {
+        close(device.fd);
+        device.fd = -1;
+        std::cerr << path << " is not a block device\n";
+        throw std::runtime_error("Not a block device.");
+    }
+    device.logicalSectorSize = static_cast<uint32_t>(logicalSectorSize);
+    device.physicalSectorSize = std::max(static_cast<uint32_t>(physicalSectorSize), device.logicalSectorSize);
+    device.chunkSize = std::max<size_t>(device.chunkSize / device.physicalSectorSize, 1) * device.physicalSectorSize;
+    device.pending.reserve(device.chunkSize);
+    openWriteBehindHints(device.writeBehind, path, writeBehindBytes);
+}
+
+/**
+ * @brief Writes the gathered bytes of a block device
+ *
+ * @param device The opened device
+ * @throws std::runtime_error if the bytes cannot be written
+ */
+void flushBlockDevice(BlockDevice& device)
+{
+    if (device.pending.empty()) { return; }
+    writeBlockDeviceFully(device, device.pendingOffset, device.pending.data(), device.pending.size());
+    device.pending.clear();
+}
+
+/**
+ * @brief Writes bytes to a block device
+ *
+ * A write that does not continue the gathered bytes, or would overflow the
+ * chunk, writes them out first. Writes of a whole chunk or more go to the
+ * device directly.
+ *
+ * @param device The opened device
+ * @param offset Offset of the bytes on the device
+ * @param data The bytes to write
+ * @param length Number of bytes
+ * @throws std::runtime_error if the range lies beyond the device or cannot be written
+ */
+void writeBlockDevice(BlockDevice& device, uint64_t offset, const void* data, size_t length)
+{
+    checkBlockDeviceRange(device, offset, length);
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+
+    bool continues = !device.pending.empty() && offset == device.pendingOffset + device.pending.size();
+    if (!continues || device.pending.size() + length > device.chunkSize) { flushBlockDevice(device); }
+
+    if (device.pending.empty() && length >= device.chunkSize) {
+        writeBlockDeviceFully(device, offset, bytes, length);
+        return;
+    }
+    if (device.pending.empty()) { device.pendingOffset = offset; }
+    device.pending.insert(device.pending.end(), bytes, bytes + length);
+    if (device.pending.size() == device.chunkSize) { flushBlockDevice(device); }
+}
+
+/**
+ * @brief Writes zeros over a range of a block device
+ *
+ * @param device The opened device
+ * @param offset Offset of the range on the device
+ * @param length Length of the range in bytes
+ */
+void writeBlockDeviceZeros(BlockDevice& device, uint64_t offset, uint64_t length)
+{
+    std::vector<uint8_t> zeros(static_cast<size_t>(std::min<uint64_t>(length, device.chunkSize)), 0);
+    while (length > 0) {
+        size_t piece = static_cast<size_t>(std::min<uint64_t>(length, zeros.size()));
+        writeBlockDeviceFully(device, offset, zeros.data(), piece);
+        offset += piece;
+        length -= piece;
+    }
+}
+
+/**
+ * @brief Makes a range of a block device read as zeros
+ *
+ * @param device The opened device
+ * @param offset Offset of the range on the device
+ * @param length Length of the range in bytes
+ * @throws std::runtime_error if the range lies beyond the device or cannot be cleared
+ */
+void clearBlockDeviceRange(BlockDevice& device, uint64_t offset, uint64_t length)
+{
+    if (device.unusedSpace == UnusedSpaceMode::eLeave || length == 0) { return; }
+    checkBlockDeviceRange(device, offset, length);
+    flushBlockDevice(device);
+
+    // The ioctls take whole logical sectors; partial sectors at the ends are written
+    uint64_t sectorSize = device.logicalSectorSize;
+    uint64_t end = offset + length;
+    uint64_t alignedStart = (offset + sectorSize - 1) / sectorSize * sectorSize;
+    uint64_t alignedEnd = end / sectorSize * sectorSize;
+    if (alignedStart >= alignedEnd) {
+        writeBlockDeviceZeros(device, offset, length);
+        return;
+    }
+    writeBlockDeviceZeros(device, offset, alignedStart - offset);
+    writeBlockDeviceZeros(device, alignedEnd, end - alignedEnd);
+
+    uint64_t range[2] = { alignedStart, alignedEnd - alignedStart };
+    if (device.unusedSpace == UnusedSpaceMode::eDiscard && !device.discardFailed) {
+        if (ioctl(device.fd, BLKDISCARD, &range) == 0) {
+            device.bytesCleared += range[1];
+            return;
+        }
+        std::cerr << "Discard is not supported by " << device.path << " (" << strerror(errno) << "), zeroing unused space instead\n";
+        device.discardFailed = true;
+    }
+    if (ioctl(device.fd, BLKZEROOUT, &range) == 0) {
+        device.bytesCleared += range[1];
+        return;
+    }
+    writeBlockDeviceZeros(device, range[0], range[1]);
+}
+
+/**
+ * @brief Writes the gathered bytes, flushes the device's cache and closes it
+ *
+ * @param device The device to close
+ * @throws std::runtime_error if the bytes cannot be written or flushed
+ */
+void closeBlockDevice(BlockDevice& device)
+{
+    if (device.fd < 0) { return; }
+    flushBlockDevice(device);
+    closeWriteBehindHints(device.writeBehind);
+    bool synced = fsync(device.fd) == 0;
+    close(device.fd);
+    device.fd = -1;
+    if (!synced) {
+        std::cerr << "Failed to flush " << device.path << ": " << strerror(errno) << "\n";
+        throw std::runtime_error("Failed to flush block device.");
+    }
+}
+
+/**
+ * @brief Describes an opened block device as a restore target
+ *
+ * @param target Output parameter for the target
+ * @param device The opened device, which must outlive target
+ */
+void getBlockDeviceRestoreTarget(RestoreTarget& target, BlockDevice& device)
+{
+    target.write = [&device](uint64_t offset, const void* data, size_t length) { writeBlockDevice(device, offset, data, length); };
+    target.clearRange = [&device](uint64_t offset, uint64_t length) { clearBlockDeviceRange(device, offset, length); };
+}
@@ -0,0 +1,121 @@
+/**
+ * @file block_device.h
+ * @brief Restoring straight onto a Linux block device
+ *
+ * This file declares a restore target that writes to a disk, partition or
+ * logical volume. The logical and physical sector sizes of the device are
+ * queried when it is opened, contiguous writes are gathered into large
+ * chunks, and ranges without backup data are zeroed or discarded by the
+ * device rather than written with zeros.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "../cache_hints/cache_hints.h"
+#include "../restore/restore.h"
+
+/**
+ * @brief Default size of the chunks writes are gathered into
+ */
+const size_t DEFAULT_BLOCK_DEVICE_CHUNK_SIZE = 4 * 1024 * 1024;
+
+/**
+ * @brief How ranges without backup data are cleared on a block device
+ */
+enum class UnusedSpaceMode
+{
+    eZeroOut,   // BLKZEROOUT, which thin and SSD devices serve without writing zeros where they can
+    eDiscard,   // BLKDISCARD, for devices known to read discarded ranges as zeros
+    eLeave      // Left with their previous contents
+};
+
+/**
+ * @brief A block device opened for restoring
+ *
+ * Not safe for concurrent use; restores serialise their writes.
+ */
+struct BlockDevice
+{
+    int fd = -1;                                        // Descriptor of the device
+    std::string path;                                   // Path the device was opened from
+    uint64_t size = 0;                                  // Size of the device in bytes
+    uint32_t logicalSectorSize = 0;                     // Smallest addressable unit of the device
+    uint32_t physicalSectorSize = 0;                    // Unit the device writes without read-modify-write
+    size_t chunkSize = DEFAULT_BLOCK_DEVICE_CHUNK_SIZE; // Largest gathered write, a multiple of physicalSectorSize
+    UnusedSpaceMode unusedSpace = UnusedSpaceMode::eZeroOut;  // How ranges without backup data are cleared
+    bool discardFailed = false;                         // Set once BLKDISCARD is refused, so later ranges are zeroed
+    uint64_t pendingOffset = 0;                         // Device offset of the gathered bytes
+    std::vector<uint8_t> pending;                       // Contiguous bytes gathered but not yet written
+    uint64_t bytesWritten = 0;                          // Bytes written to the device so far
+    uint64_t bytesCleared = 0;                          // Bytes zeroed or discarded so far
+    WriteBehindHints writeBehind;                       // Keeps written pages of the device from piling up in the cache
+};
+
+/**
+ * @brief Opens a block device for restoring
+ *
+ * @param device Output parameter for the device
+ * @param path Path of the device, such as /dev/sdb or /dev/vg0/data
+ * @param unusedSpace How ranges without backup data are cleared
+ * @param writeBehindBytes Bytes written between writeback batches, or 0 for no hints
+ * @throws std::runtime_error if the path is not a block device or cannot be opened for writing
+ */
+void openBlockDevice(BlockDevice& device, const std::string& path, UnusedSpaceMode unusedSpace,
+    uint64_t writeBehindBytes = DEFAULT_WRITE_BEHIND_BYTES);
+
+/**
+ * @brief Writes bytes to a block device
+ *
+ * Bytes that continue the previous write are gathered until a chunk is
+ * full, and are only guaranteed to be on the device after
+ * flushBlockDevice or closeBlockDevice.
+ *
+ * @param device The opened device
+ * @param offset Offset of the bytes on the device
+ * @param data The bytes to write
+ * @param length Number of bytes
+ * @throws std::runtime_error if the range lies beyond the device or cannot be written
+ */
+void writeBlockDevice(BlockDevice& device, uint64_t offset, const void* data, size_t length);
+
+/**
+ * @brief Makes a range of a block device read as zeros
+ *
+ * Uses BLKDISCARD or BLKZEROOUT for the sectors of the range, as chosen by
+ * device.unusedSpace, and writes zeros for partial sectors at its ends and
+ * when the device supports neither.
+ *
+ * @param device The opened device
+ * @param offset Offset of the range on the device
+ * @param length Length of the range in bytes
+ * @throws std::runtime_error if the range lies beyond the device or cannot be cleared
+ */
+void clearBlockDeviceRange(BlockDevice& device, uint64_t offset, uint64_t length);
+
+/**
+ * @brief Writes the gathered bytes of a block device
+ *
+ * @param device The opened device
+ * @throws std::runtime_error if the bytes cannot be written
+ */
+void flushBlockDevice(BlockDevice& device);
+
+/**
+ * @brief Writes the gathered bytes, flushes the device's cache and closes it
+ *
+ * @param device The device to close
+ * @throws std::runtime_error if the bytes cannot be written or flushed
+ */
+void closeBlockDevice(BlockDevice& device);
+
+/**
+ * @brief Describes an opened block device as a restore target
+ *
+ * @param target Output parameter for the target
+ * @param device The opened device, which must outlive target
+ */
+void getBlockDeviceRestoreTarget(RestoreTarget& target, BlockDevice& device);
@@ -0,0 +1,131 @@
+/**
+ * @file cache_hints.h
+ * @brief Page cache hints for restores
+ *
+ * This file declares hints that keep the backup files streaming into the
+ * page cache ahead of the readers and keep restored data from piling up in
+ * it. Readahead hints are issued for the next extents of a planned read
+ * order, up to a window of bytes. Written ranges are handed to writeback
+ * in batches, and each batch is dropped from the cache once the next one
+ * has started, so dirty and clean pages of the target stay bounded.
+ *
+ * Hints never fail a restore. The implementation is platform specific and
+ * issues no hints where the platform has no equivalent.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+/**
+ * @brief Default bytes of planned reads hinted ahead of a reader
+ */
+const uint64_t DEFAULT_READAHEAD_BYTES = 32 * 1024 * 1024;
+
+/**
+ * @brief Default bytes written to a target between writeback batches
+ */
+const uint64_t DEFAULT_WRITE_BEHIND_BYTES = 64 * 1024 * 1024;
+
+/**
+ * @brief A byte range of a file
+ */
+typedef std::pair<uint64_t, uint64_t> FileExtent;
+
+/**
+ * @brief Readahead hints for a file read in a planned order
+ */
+struct ReadaheadHints
+{
+    int fd = -1;                        // Descriptor the hints are issued on, or -1 when hints are off
+    uint64_t windowBytes = 0;           // Planned bytes kept hinted ahead of the reader
+    std::vector<FileExtent> extents;    // Offset and length of each planned read, in read order
+    size_t nextToHint = 0;              // First planned read not yet hinted
+    size_t nextToRead = 0;              // First planned read not yet started
+    uint64_t hintedBytes = 0;           // Bytes hinted but not yet read
+};
+
+/**
+ * @brief Write-behind hints for a file or block device being restored to
+ */
+struct WriteBehindHints
+{
+    int fd = -1;                        // Descriptor the hints are issued on, or -1 when hints are off
+    uint64_t batchBytes = 0;            // Bytes written between writeback batches
+    std::vector<FileExtent> written;    // Ranges written since writeback was last started
+    uint64_t writtenBytes = 0;          // Bytes in written
+    std::vector<FileExtent> writingBack;  // Ranges of the batch whose writeback was last started
+};
+
+/**
+ * @brief Opens readahead hints for a file
+ *
+ * @param hints Output parameter for the hints
+ * @param path Path of the file that will be read
+ * @param windowBytes Planned bytes to keep hinted ahead of the reader, or 0 for no hints
+ */
+void openReadaheadHints(ReadaheadHints& hints, const std::string& path, uint64_t windowBytes);
+
+/**
+ * @brief Adds the next read of the planned order
+ *
+ * @param hints The opened hints
+ * @param offset Offset of the read in the file
+ * @param length Length of the read
+ */
+void planRead(ReadaheadHints& hints, uint64_t offset, uint64_t length);
+
+/**
+ * @brief Hints the planned reads ahead of the next one, which is about to start
+ *
+ * Adjacent planned reads are hinted as one range.
+ *
+ * @param hints The opened hints
+ */
+void adviseNextRead(ReadaheadHints& hints);
+
+/**
+ * @brief Closes readahead hints
+ *
+ * @param hints The hints to close
+ */
+void closeReadaheadHints(ReadaheadHints& hints);
+
+/**
+ * @brief Opens write-behind hints for a file or block device
+ *
+ * @param hints Output parameter for the hints
+ * @param path Path of the file or block device that will be written
+ * @param batchBytes Bytes written between writeback batches, or 0 for no hints
+ */
+void openWriteBehindHints(WriteBehindHints& hints, const std::string& path, uint64_t batchBytes);
+
+/**
+ * @brief Records a range written to the target
+ *
+ * @param hints The opened hints
+ * @param offset Offset of the range
+ * @param length Length of the range
+ * @return true if a batch is complete, and startWriteBehind should be called once the bytes have reached the kernel
+ */
+bool noteRangeWritten(WriteBehindHints& hints, uint64_t offset, uint64_t length);
+
+/**
+ * @brief Starts writeback of the ranges written since the last batch
+ *
+ * Waits for the writeback of the previous batch to complete and drops its
+ * pages from the cache.
+ *
+ * @param hints The opened hints
+ */
+void startWriteBehind(WriteBehindHints& hints);
+
+/**
+ * @brief Writes back and drops every range written, then closes the hints
+ *
+ * @param hints The hints to close
+ */
+void closeWriteBehindHints(WriteBehindHints& hints);
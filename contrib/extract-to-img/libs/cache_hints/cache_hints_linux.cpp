@@ -0,0 +1,188 @@
+/**
+ * @file cache_hints_linux.cpp
+ * @brief Linux implementation of page cache hints for restores
+ *
+ * Readahead uses posix_fadvise(POSIX_FADV_WILLNEED), which starts reading
+ * the range into the page cache without waiting for it. Write-behind uses
+ * sync_file_range to start and wait for writeback and
+ * posix_fadvise(POSIX_FADV_DONTNEED) to drop written-back pages. The page
+ * cache is shared by every descriptor of a file, so the hints are issued
+ * on a descriptor of their own.
+ */
+
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "cache_hints.h"
+
+/**
+ * @brief Sorts ranges and merges those that touch or overlap
+ *
+ * @param extents The ranges to merge
+ */
+void mergeFileExtents(std::vector<FileExtent>& extents)
+{
+    std::sort(extents.begin(), extents.end());
+    size_t merged = 0;
+    for (size_t i = 1; i < extents.size(); i++) {
+        uint64_t mergedEnd = extents[merged].first + extents[merged].second;
+        if (extents[i].first <= mergedEnd) {
+            extents[merged].second = std::max(mergedEnd, extents[i].first + extents[i].second) - extents[merged].first;
+        }
+        else {
+            extents[++merged] = extents[i];
+        }
+    }
+    if (!extents.empty()) { extents.resize(merged + 1); }
+}
+
+/**
+ * @brief Opens readahead hints for a file
+ *
+ * @param hints Output parameter for the hints
+ * @param path Path of the file that will be read
+ * @param windowBytes Planned bytes to keep hinted ahead of the reader, or 0 for no hints
+ */
+void openReadaheadHints(ReadaheadHints& hints, const std::string& path, uint64_t windowBytes)
+{
+    hints = ReadaheadHints();
+    hints.windowBytes = windowBytes;
+    if (windowBytes > 0) { hints.fd = open(path.c_str(), O_RDONLY | O_CLOEXEC); }
+}
+
+/**
+ * @brief Adds the next read of the planned order
+ *
+ * @param hints The opened hints
+ * @param offset Offset of the read in the file
+ * @param length Length of the read
+ */
+void planRead(ReadaheadHints& hints, uint64_t offset, uint64_t length)
+{
+    if (hints.fd < 0 || length == 0) { return; }
+    hints.extents.push_back({ offset, length });
+}
+
+/**
+ * @brief Hints the planned reads ahead of the next one, which is about to start
+ *
+ * @param hints The opened hints
+ */
+void adviseNextRead(ReadaheadHints& hints)
+{
+    if (hints.fd < 0 || hints.nextToRead >= hints.extents.size()) { return; }
+
+    // Hinting starts with the read about to happen, so the first batch covers it too
+    hints.nextToHint = std::max(hints.nextToHint, hints.nextToRead);
+    while (hints.nextToHint < hints.extents.size() && hints.hintedBytes < hints.windowBytes) {
+        uint64_t rangeStart = hints.extents[hints.nextToHint].first;
+        uint64_t rangeEnd = rangeStart;
+        while (hints.nextToHint < hints.extents.size() && hints.hintedBytes < hints.windowBytes &&
+            hints.extents[hints.nextToHint].first == rangeEnd) {
+            rangeEnd += hints.extents[hints.nextToHint].second;
+            hints.hintedBytes += hints.extents[hints.nextToHint].second;
+            hints.nextToHint++;
+        }
+        posix_fadvise(hints.fd, static_cast<off_t>(rangeStart), static_cast<off_t>(rangeEnd - rangeStart), POSIX_FADV_WILLNEED);
+    }
+
+    uint64_t length = hints.extents[hints.nextToRead++].second;
+    hints.hintedBytes -= std::min(hints.hintedBytes, length);
+}
+
+/**
+ * @brief Closes readahead hints
+ *
+ * @param hints The hints to close
+ */
+void closeReadaheadHints(ReadaheadHints& hints)
+{
+    if (hints.fd >= 0) { close(hints.fd); }
+    hints = ReadaheadHints();
+}
+
+/**
+ * @brief Opens write-behind hints for a file or block device
+ *
+ * @param hints Output parameter for the hints
+ * @param path Path of the file or block device that will be written
+ * @param batchBytes Bytes written between writeback batches, or 0 for no hints
+ */
+void openWriteBehindHints(WriteBehindHints& hints, const std::string& path, uint64_t batchBytes)
+{
+    hints = WriteBehindHints();
+    hints.batchBytes = batchBytes;
+    if (batchBytes > 0) { hints.fd = open(path.c_str(), O_RDONLY | O_CLOEXEC); }
+}
+
+/**
+ * @brief Records a range written to the target
+ *
+ * @param hints The opened hints
+ * @param offset Offset of the range
+ * @param length Length of the range
+ * @return true if a batch is complete, and startWriteBehind should be called once the bytes have reached the kernel
+ */
+bool noteRangeWritten(WriteBehindHints& hints, uint64_t offset, uint64_t length)
+{
+    if (hints.fd < 0 || length == 0) { return false; }
+    if (!hints.written.empty() && hints.written.back().first + hints.written.back().second == offset) {
+        hints.written.back().second += length;
+    }
+    else {
+        hints.written.push_back({ offset, length });
+    }
+    hints.writtenBytes += length;
+    return hints.writtenBytes >= hints.batchBytes;
+}
+
+/**
+ * @brief Waits for the writeback of the previous batch and drops its pages
+ *
+ * @param hints The opened hints
+ */
+void dropWrittenBack(WriteBehindHints& hints)
+{
+    for (auto& extent : hints.writingBack) {
+        sync_file_range(hints.fd, static_cast<off64_t>(extent.first), static_cast<off64_t>(extent.second),
+            SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+        posix_fadvise(hints.fd, static_cast<off_t>(extent.first), static_cast<off_t>(extent.second), POSIX_FADV_DONTNEED);
+    }
+    hints.writingBack.clear();
+}
+
+/**
+ * @brief Starts writeback of the ranges written since the last batch
+ *
+ * @param hints The opened hints
+ */
+void startWriteBehind(WriteBehindHints& hints)
+{
+    if (hints.fd < 0) { return; }
+    mergeFileExtents(hints.written);
+    for (auto& extent : hints.written) {
+        sync_file_range(hints.fd, static_cast<off64_t>(extent.first), static_cast<off64_t>(extent.second), SYNC_FILE_RANGE_WRITE);
+    }
+
+    // The previous batch has had a whole batch of writes to complete, so this rarely waits
+    dropWrittenBack(hints);
+    hints.writingBack.swap(hints.written);
+    hints.written.clear();
+    hints.writtenBytes = 0;
+}
+
+/**
+ * @brief Writes back and drops every range written, then closes the hints
+ *
+ * @param hints The hints to close
+ */
+void closeWriteBehindHints(WriteBehindHints& hints)
+{
+    if (hints.fd >= 0) {
+        startWriteBehind(hints);
+        dropWrittenBack(hints);
+        close(hints.fd);
+    }
+    hints = WriteBehindHints();
+}
@@ -0,0 +1,95 @@
+/**
+ * @file cache_hints_win.cpp
+ * @brief Windows implementation of page cache hints for restores
+ *
+ * Windows has no per-range equivalents of the Linux hints, so none are
+ * issued and the hints stay closed.
+ */
+
+#include "cache_hints.h"
+
+/**
+ * @brief Opens readahead hints for a file
+ *
+ * @param hints Output parameter for the hints
+ * @param path Path of the file that will be read
+ * @param windowBytes Planned bytes to keep hinted ahead of the reader, or 0 for no hints
+ */
+void openReadaheadHints(ReadaheadHints& hints, const std::string& path, uint64_t windowBytes)
+{
+    hints = ReadaheadHints();
+}
+
+/**
+ * @brief Adds the next read of the planned order
+ *
+ * @param hints The opened hints
+ * @param offset Offset of the read in the file
+ * @param length Length of the read
+ */
+void planRead(ReadaheadHints& hints, uint64_t offset, uint64_t length)
+{
+}
+
+/**
+ * @brief Hints the planned reads ahead of the next one, which is about to start
+ *
+ * @param hints The opened hints
+ */
+void adviseNextRead(ReadaheadHints& hints)
+{
+}
+
+/**
+ * @brief Closes readahead hints
+ *
+ * @param hints The hints to close
+ */
+void closeReadaheadHints(ReadaheadHints& hints)
+{
+    hints = ReadaheadHints();
+}
+
+/**
+ * @brief Opens write-behind hints for a file or block device
+ *
+ * @param hints Output parameter for the hints
+ * @param path Path of the file or block device that will be written
+ * @param batchBytes Bytes written between writeback batches, or 0 for no hints
+ */
+void openWriteBehindHints(WriteBehindHints& hints, const std::string& path, uint64_t batchBytes)
+{
+    hints = WriteBehindHints();
+}
+
+/**
+ * @brief Records a range written to the target
+ *
+ * @param hints The opened hints
+ * @param offset Offset of the range
+ * @param length Length of the range
+ * @return false, as no batches are kept
+ */
+bool noteRangeWritten(WriteBehindHints& hints, uint64_t offset, uint64_t length)
+{
+    return false;
+}
+
+/**
+ * @brief Starts writeback of the ranges written since the last batch
+ *
+ * @param hints The opened hints
+ */
+void startWriteBehind(WriteBehindHints& hints)
+{
+}
+
+/**
+ * @brief Writes back and drops every range written, then closes the hints
+ *
+ * @param hints The hints to close
+ */
+void closeWriteBehindHints(WriteBehindHints& hints)
+{
+    hints = WriteBehindHints();
+}
@@ -0,0 +1,381 @@
+/**
+ * @file backup_catalog.cpp
+ * @brief Implementation of the repository scanner and backup catalog
+ *
+ * Scanning lists the candidate files first and then reads their headers on
+ * a small pool of threads, since the cost is dominated by one seek to the
+ * footer and one to the $JSON block per file. The catalog is written with
+ * every section aligned to 8 bytes so the mapped arrays can be used in place.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+
+#include "../img_handler/img_handler.h"
+#include "../img_handler/metadata.h"
+#include "backup_catalog.h"
+#include "catalog_file.h"
+
+/**
+ * @brief Returns whether a path has a backup file extension
+ *
+ * @param path The path to check
+ * @return true for .mrimg and .mrbak files, in any case
+ */
+bool isBackupFilePath(const std::filesystem::path& path)
+{
+    std::string extension = path.extension().string();
+    std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+    for (const char* backupExtension : CATALOG_BACKUP_EXTENSIONS) {
+        if (extension == backupExtension) { return true; }
+    }
+    return false;
+}
+
+/**
+ * @brief Reads the header fields of one backup file
+ *
+ * The file is opened read-only so repositories on read-only shares can be
+ * scanned.
+ *
+ * @param path Path of the backup file
+ * @param scanned Output parameter for the metadata
+ * @return false if the file has no backup footer
+ * @throws std::runtime_error or nlohmann::json::exception if the file cannot be parsed
+ */
+bool scanBackupFile(const std::filesystem::path& path, ScannedBackupFile& scanned)
+{
+    std::fstream file(path, std::ios::in | std::ios::binary);
+    if (file.fail()) { throw std::runtime_error("Failed to open file."); }
+
+    file.seekg(0, std::ios::end);
+    std::streamoff fileSize = file.tellg();
+    if (file.fail() || fileSize < static_cast<std::streamoff>(sizeof(uint64_t) + MAGIC_BYTES_VX_SIZE)) { return false; }
+
+    char magicBytes[MAGIC_BYTES_VX_SIZE];
+    file.seekg(-static_cast<std::streamoff>(MAGIC_BYTES_VX_SIZE), std::ios::end);
+    file.read(magicBytes, MAGIC_BYTES_VX_SIZE);
+    if (file.fail() || memcmp(magicBytes, MAGIC_BYTES_VX, MAGIC_BYTES_VX_SIZE) != 0) { return false; }
+
+    file_structs::File_Layout layout;
+    parseFileLayoutJSON(layout, readBackupFileJSON(file));
+
+    scanned.path = path.string();
+    scanned.fileSize = static_cast<uint64_t>(fileSize);
+    scanned.modifiedTime = static_cast<int64_t>(std::filesystem::last_write_time(path).time_since_epoch().count());
+    scanned.header = layout._header;
+    for (auto& disk : layout.disks) {
+        if (!disk.partitions.empty()) {
+            scanned.fileHistory = disk.partitions[0]._header.file_history;
+            break;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Scans a directory tree for backup files and reads their headers
+ *
+ * @param rootPath Directory to scan recursively
+ * @param threadCount Number of files read concurrently
+ * @return std::vector<ScannedBackupFile> The backup files found, in no particular order
+ */
+std::vector<ScannedBackupFile> scanBackupRepository(const std::string& rootPath, size_t threadCount)
+{
+    std::vector<std::filesystem::path> candidates;
+    auto options = std::filesystem::directory_options::skip_permission_denied;
+    for (auto& entry : std::filesystem::recursive_directory_iterator(rootPath, options)) {
+        std::error_code error;
+        if (entry.is_regular_file(error) && isBackupFilePath(entry.path())) {
+            candidates.push_back(entry.path());
+        }
+    }
+
+    std::vector<ScannedBackupFile> files;
+    std::mutex filesLock;
+    std::atomic<size_t> nextCandidate(0);
+
+    auto scanCandidates = [&]() {
+        for (size_t i = nextCandidate++; i < candidates.size(); i = nextCandidate++) {
+            ScannedBackupFile scanned;
+            try {
+                if (!scanBackupFile(candidates[i], scanned)) { continue; }  // Data-only split segment
+            }
+            catch (const std::exception& e) {
+                std::lock_guard<std::mutex> guard(filesLock);
+                std::cerr << "Skipping " << candidates[i].string() << ": " << e.what() << "\n";
+                continue;
+            }
+            std::lock_guard<std::mutex> guard(filesLock);
+            files.push_back(std::move(scanned));
+        }
+    };
+
+    size_t scannerCount = std::min(candidates.size(), std::max<size_t>(threadCount, 1));
+    std::vector<std::thread> scanners;
+    for (size_t i = 1; i < scannerCount; i++) {
+        scanners.emplace_back(scanCandidates);
+    }
+    scanCandidates();
+    for (auto& scanner : scanners) {
+        scanner.join();
+    }
+    return files;
+}
+
+/**
+ * @brief Writes a catalog of scanned backup files
+ *
+ * @param files The scanned backup files, which are sorted by machine and backup time
+ * @param catalogPath Path of the catalog file
+ * @throws std::runtime_error if the catalog cannot be written
+ */
+void writeBackupCatalog(std::vector<ScannedBackupFile>& files, const std::string& catalogPath)
+{
+    std::sort(files.begin(), files.end(), [](const ScannedBackupFile& a, const ScannedBackupFile& b) {
+        if (a.header.netbios_name != b.header.netbios_name) { return a.header.netbios_name < b.header.netbios_name; }
+        if (a.header.backup_time != b.header.backup_time) { return a.header.backup_time < b.header.backup_time; }
+        return a.path < b.path;
+    });
+
+    CatalogStringTable strings;
+    std::vector<CatalogEntry> entries;
+    std::vector<CatalogHistoryEntry> history;
+    entries.reserve(files.size());
+
+    for (auto& file : files) {
+        CatalogEntry entry = {};
+        entry.backupTime = file.header.backup_time;
+        entry.backupsetTime = file.header.backupset_time;
+        entry.fileSize = file.fileSize;
+        entry.modifiedTime = file.modifiedTime;
+        entry.path = addCatalogString(strings, file.path);
+        entry.machine = addCatalogString(strings, file.header.netbios_name);
+        entry.imageId = addCatalogString(strings, file.header.imageid);
+        entry.backupGuid = addCatalogString(strings, file.header.backup_guid);
+        entry.historyBegin = static_cast<uint32_t>(history.size());
+        entry.historyCount = static_cast<uint32_t>(file.fileHistory.size());
+        entry.incrementNumber = file.header.increment_number;
+        entry.fileNumber = file.header.file_number;
+        entry.deltaIndex = file.header.delta_index ? 1 : 0;
+        for (auto& fileHistory : file.fileHistory) {
+            history.push_back({ addCatalogString(strings, fileHistory.file_name), fileHistory.file_number });
+        }
+        entries.push_back(entry);
+    }
+
+    std::vector<uint32_t> imageIndex(entries.size());
+    for (uint32_t i = 0; i < imageIndex.size(); i++) { imageIndex[i] = i; }
+    std::sort(imageIndex.begin(), imageIndex.end(), [&](uint32_t a, uint32_t b) {
+        int order = strcmp(strings.data.c_str() + entries[a].imageId, strings.data.c_str() + entries[b].imageId);
+        if (order != 0) { return order < 0; }
+        if (entries[a].backupTime != entries[b].backupTime) { return entries[a].backupTime < entries[b].backupTime; }
+        return a < b;
+    });
+
+    CatalogHeader header = {};
+    memcpy(header.magic, CATALOG_MAGIC, sizeof(header.magic));
+    header.version = CATALOG_VERSION;
+    header.entryCount = static_cast<uint32_t>(entries.size());
+    header.entriesOffset = alignCatalogOffset(sizeof(CatalogHeader));
+    header.imageIndexOffset = alignCatalogOffset(header.entriesOffset + entries.size() * sizeof(CatalogEntry));
+    header.historyOffset = alignCatalogOffset(header.imageIndexOffset + imageIndex.size() * sizeof(uint32_t));
+    header.historyCount = static_cast<uint32_t>(history.size());
+    header.stringsOffset = alignCatalogOffset(header.historyOffset + history.size() * sizeof(CatalogHistoryEntry));
+    header.stringsLength = strings.data.size();
+
+    std::string temporaryPath = catalogPath + ".tmp";
+    {
+        std::ofstream out(temporaryPath, std::ios::out | std::ios::trunc | std::ios::binary);
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        padCatalogTo(out, header.entriesOffset);
+        out.write(reinterpret_cast<const char*>(entries.data()), entries.size() * sizeof(CatalogEntry));
+        padCatalogTo(out, header.imageIndexOffset);
+        out.write(reinterpret_cast<const char*>(imageIndex.data()), imageIndex.size() * sizeof(uint32_t));
+        padCatalogTo(out, header.historyOffset);
+        out.write(reinterpret_cast<const char*>(history.data()), history.size() * sizeof(CatalogHistoryEntry));
+        padCatalogTo(out, header.stringsOffset);
+        out.write(strings.data.data(), strings.data.size());
+        out.close();
+        if (out.fail()) {
+            std::remove(temporaryPath.c_str());
+            throw std::runtime_error("Failed to write catalog.");
+        }
+    }
+    if (!replaceCatalogFile(temporaryPath, catalogPath)) { throw std::runtime_error("Failed to write catalog."); }
+}
+
+/**
+ * @brief Checks that a section of the catalog lies within the file
+ *
+ * @param catalog The catalog being opened
+ * @param offset Offset of the section
+ * @param count Number of elements in the section
+ * @param elementSize Size of each element
+ * @return true if the section fits
+ */
+bool isCatalogSectionValid(const BackupCatalog& catalog, uint64_t offset, uint64_t count, uint64_t elementSize)
+{
+    uint64_t size = catalog.mapping.size;
+    return offset <= size && offset % CATALOG_SECTION_ALIGNMENT == 0 && count <= (size - offset) / elementSize;
+}
+
+/**
+ * @brief Maps a catalog file and validates its layout
+ *
+ * Every offset stored in the catalog is checked once here, so queries can
+ * use the mapped arrays without further bounds checks.
+ *
+ * @param catalog Output parameter for the opened catalog
+ * @param catalogPath Path of the catalog file
+ * @throws std::runtime_error if the file is not a valid catalog
+ */
+void openBackupCatalog(BackupCatalog& catalog, const std::string& catalogPath)
+{
+    closeBackupCatalog(catalog);
+    mapFile(catalog.mapping, catalogPath);
+
+    try {
+        if (catalog.mapping.size < sizeof(CatalogHeader)) { throw std::runtime_error("Invalid catalog."); }
+        catalog.header = reinterpret_cast<const CatalogHeader*>(catalog.mapping.data);
+        const CatalogHeader& header = *catalog.header;
+
+        if (memcmp(header.magic, CATALOG_MAGIC, sizeof(header.magic)) != 0 || header.version != CATALOG_VERSION) {
+            throw std::runtime_error("Invalid catalog.");
+        }
+        if (!isCatalogSectionValid(catalog, header.entriesOffset, header.entryCount, sizeof(CatalogEntry)) ||
+            !isCatalogSectionValid(catalog, header.imageIndexOffset, header.entryCount, sizeof(uint32_t)) ||
+            !isCatalogSectionValid(catalog, header.historyOffset, header.historyCount, sizeof(CatalogHistoryEntry)) ||
+            !isCatalogSectionValid(catalog, header.stringsOffset, header.stringsLength, 1) || header.stringsLength == 0) {
+            throw std::runtime_error("Invalid catalog.");
+        }
+
+        catalog.entries = reinterpret_cast<const CatalogEntry*>(catalog.mapping.data + header.entriesOffset);
+        catalog.imageIndex = reinterpret_cast<const uint32_t*>(catalog.mapping.data + header.imageIndexOffset);
+        catalog.history = reinterpret_cast<const CatalogHistoryEntry*>(catalog.mapping.data + header.historyOffset);
+        catalog.strings = reinterpret_cast<const char*>(catalog.mapping.data + header.stringsOffset);
+        if (catalog.strings[header.stringsLength - 1] != '\0') { throw std::runtime_error("Invalid catalog."); }
+
+        for (uint32_t i = 0; i < header.entryCount; i++) {
+            const CatalogEntry& entry = catalog.entries[i];
+            if (entry.path >= header.stringsLength || entry.machine >= header.stringsLength || entry.imageId >= header.stringsLength ||
+                entry.backupGuid >= header.stringsLength || entry.historyBegin > header.historyCount ||
+                entry.historyCount > header.historyCount - entry.historyBegin || catalog.imageIndex[i] >= header.entryCount) {
+                throw std::runtime_error("Invalid catalog.");
+            }
+        }
+        for (uint32_t i = 0; i < header.historyCount; i++) {
+            if (catalog.history[i].fileName >= header.stringsLength) { throw std::runtime_error("Invalid catalog."); }
+        }
+    }
+    catch (...) {
+        closeBackupCatalog(catalog);
+        throw;
+    }
+}
+
+/**
+ * @brief Unmaps a catalog
+ *
+ * @param catalog The catalog to close
+ */
+void closeBackupCatalog(BackupCatalog& catalog)
+{
+    unmapFile(catalog.mapping);
+    catalog = BackupCatalog();
+}
+
+/**
+ * @brief Returns a string of the catalog
+ *
+ * @param catalog The opened catalog
+ * @param offset Offset of the string in the string table
+ * @return const char* The NUL-terminated string
+ */
+const char* getCatalogString(const BackupCatalog& catalog, uint32_t offset)
+{
+    return catalog.strings + offset;
+}
+
+/**
+ * @brief Returns the range of a sorted sequence whose key string equals a value
+ *
+ * @param count Number of elements in the sequence
+ * @param keyAt Returns the key string of an element
+ * @param value The value to find
+ * @return CatalogRange The matching range, empty if there is none
+ */
+template <typename KeyAt>
+CatalogRange findCatalogRange(uint32_t count, KeyAt keyAt, const std::string& value)
+{
+    uint32_t low = 0;
+    uint32_t high = count;
+    while (low < high) {
+        uint32_t middle = low + (high - low) / 2;
+        if (strcmp(keyAt(middle), value.c_str()) < 0) { low = middle + 1; }
+        else { high = middle; }
+    }
+
+    CatalogRange range;
+    range.begin = low;
+    high = count;
+    while (low < high) {
+        uint32_t middle = low + (high - low) / 2;
+        if (strcmp(keyAt(middle), value.c_str()) <= 0) { low = middle + 1; }
+        else { high = middle; }
+    }
+    range.end = low;
+    return range;
+}
+
+/**
+ * @brief Returns the entries of a machine, oldest first
+ *
+ * @param catalog The opened catalog
+ * @param machine NetBIOS name of the machine
+ * @return CatalogRange Range of indexes into catalog.entries
+ */
+CatalogRange findMachineEntries(const BackupCatalog& catalog, const std::string& machine)
+{
+    return findCatalogRange(catalog.header->entryCount,
+        [&catalog](uint32_t i) { return getCatalogString(catalog, catalog.entries[i].machine); }, machine);
+}
+
+/**
+ * @brief Returns the entries of a backup set, oldest first
+ *
+ * @param catalog The opened catalog
+ * @param imageId Image ID of the backup set
+ * @return CatalogRange Range of indexes into catalog.imageIndex
+ */
+CatalogRange findImageEntries(const BackupCatalog& catalog, const std::string& imageId)
+{
+    return findCatalogRange(catalog.header->entryCount,
+        [&catalog](uint32_t i) { return getCatalogString(catalog, catalog.entries[catalog.imageIndex[i]].imageId); }, imageId);
+}
+
+/**
+ * @brief Returns the most recent backup file of a machine
+ *
+ * @param catalog The opened catalog
+ * @param machine NetBIOS name or image ID
+ * @return const CatalogEntry* The latest restore point, or nullptr if there is none
+ */
+const CatalogEntry* findLatestRestorePoint(const BackupCatalog& catalog, const std::string& machine)
+{
+    CatalogRange range = findMachineEntries(catalog, machine);
+    if (range.end > range.begin) { return &catalog.entries[range.end - 1]; }
+
+    range = findImageEntries(catalog, machine);
+    if (range.end > range.begin) { return &catalog.entries[catalog.imageIndex[range.end - 1]]; }
+    return nullptr;
+}
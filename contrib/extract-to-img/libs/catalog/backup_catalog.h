@@ -0,0 +1,207 @@
+/**
+ * @file backup_catalog.h
+ * @brief Persistent catalog of the backup files in a repository
+ *
+ * This file declares a scanner that finds backup files under a directory
+ * tree and reads only their footer and $JSON header, and a compact binary
+ * catalog of the results. The catalog is written once and then memory
+ * mapped, so queries such as the latest restore point of a machine are
+ * answered by binary search without parsing any backup file.
+ *
+ * Catalog file layout (little-endian, no padding):
+ *   CatalogHeader
+ *   CatalogEntry[entryCount]          sorted by machine name, then backup time
+ *   uint32_t[entryCount]              entry numbers sorted by image ID, then backup time
+ *   CatalogHistoryEntry[historyCount] file history of every entry
+ *   char[stringsLength]               NUL-terminated strings, starting with ""
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "../img_handler/file_struct.h"
+#include "catalog_mapping.h"
+
+/**
+ * @brief Magic bytes at the start of a catalog file
+ */
+const char CATALOG_MAGIC[] = { 'M', 'R', 'C', 'A', 'T', 'A', 'L', 'G' };
+
+/**
+ * @brief Version of the catalog file layout
+ */
+const uint32_t CATALOG_VERSION = 2;
+
+/**
+ * @brief File extensions the scanner treats as backup files
+ */
+const char* const CATALOG_BACKUP_EXTENSIONS[] = { ".mrimg", ".mrbak" };
+
+#pragma pack(push, 1)
+
+/**
+ * @brief Header at the start of a catalog file
+ */
+struct CatalogHeader
+{
+    char magic[8];              // CATALOG_MAGIC
+    uint32_t version;           // CATALOG_VERSION
+    uint32_t entryCount;        // Number of backup files in the catalog
+    uint64_t entriesOffset;     // Offset of the CatalogEntry array
+    uint64_t imageIndexOffset;  // Offset of the entry numbers sorted by image ID
+    uint64_t historyOffset;     // Offset of the CatalogHistoryEntry array
+    uint32_t historyCount;      // Number of file history entries
+    uint64_t stringsOffset;     // Offset of the string table
+    uint64_t stringsLength;     // Length of the string table in bytes
+};
+
+/**
+ * @brief One backup file in the catalog
+ *
+ * String fields are offsets into the string table.
+ */
+struct CatalogEntry
+{
+    uint64_t backupTime;        // Time the backup was taken
+    uint64_t backupsetTime;     // Time the backup set was started
+    uint64_t fileSize;          // Size of the backup file when scanned
+    int64_t modifiedTime;       // Modification time of the backup file when scanned
+    uint32_t path;              // Path of the backup file
+    uint32_t machine;           // NetBIOS name of the machine that was backed up
+    uint32_t imageId;           // Image ID shared by the files of a backup set
+    uint32_t backupGuid;        // GUID of the backup
+    uint32_t historyBegin;      // First file history entry of the file
+    uint32_t historyCount;      // Number of file history entries of the file
+    int32_t fileNumber;         // File number within the backup set
+    uint16_t incrementNumber;   // Increment number, 0 for the full backup
+    uint8_t deltaIndex;         // 1 if the file holds a delta index
+    uint8_t reserved;           // Always zero
+};
+
+/**
+ * @brief One file history entry of a backup file
+ */
+struct CatalogHistoryEntry
+{
+    uint32_t fileName;          // Path of the chain file, as an offset into the string table
+    int32_t fileNumber;         // File number of the chain file
+};
+
+#pragma pack(pop)
+
+/**
+ * @brief Metadata read from one backup file by the scanner
+ */
+struct ScannedBackupFile
+{
+    std::string path;                                                  // Path of the backup file
+    uint64_t fileSize = 0;                                             // Size of the file
+    int64_t modifiedTime = 0;                                          // Modification time of the file
+    file_structs::Header header;                                       // The $JSON _header fields
+    std::vector<file_structs::Partition::File_History> fileHistory;    // File history of the first partition
+};
+
+/**
+ * @brief A catalog opened for queries
+ */
+struct BackupCatalog
+{
+    MappedFile mapping;                                 // The mapped catalog file
+    const CatalogHeader* header = nullptr;              // Catalog header
+    const CatalogEntry* entries = nullptr;              // Entries sorted by machine, then backup time
+    const uint32_t* imageIndex = nullptr;               // Entry numbers sorted by image ID, then backup time
+    const CatalogHistoryEntry* history = nullptr;       // File history entries
+    const char* strings = nullptr;                      // String table
+};
+
+/**
+ * @brief Range of catalog entries [begin, end)
+ */
+struct CatalogRange
+{
+    uint32_t begin = 0;
+    uint32_t end = 0;
+};
+
+/**
+ * @brief Scans a directory tree for backup files and reads their headers
+ *
+ * Files are read concurrently by up to threadCount threads. Only the footer
+ * and the $JSON block of each file are read; files without a footer, such as
+ * data-only split segments, and files that cannot be parsed are skipped.
+ *
+ * @param rootPath Directory to scan recursively
+ * @param threadCount Number of files read concurrently
+ * @return std::vector<ScannedBackupFile> The backup files found, in no particular order
+ */
+std::vector<ScannedBackupFile> scanBackupRepository(const std::string& rootPath, size_t threadCount);
+
+/**
+ * @brief Writes a catalog of scanned backup files
+ *
+ * The catalog is written next to its final path and renamed into place, so
+ * readers never map a partial catalog.
+ *
+ * @param files The scanned backup files
+ * @param catalogPath Path of the catalog file
+ * @throws std::runtime_error if the catalog cannot be written
+ */
+void writeBackupCatalog(std::vector<ScannedBackupFile>& files, const std::string& catalogPath);
+
+/**
+ * @brief Maps a catalog file and validates its layout
+ *
+ * @param catalog Output parameter for the opened catalog
+ * @param catalogPath Path of the catalog file
+ * @throws std::runtime_error if the file is not a valid catalog
+ */
+void openBackupCatalog(BackupCatalog& catalog, const std::string& catalogPath);
+
+/**
+ * @brief Unmaps a catalog
+ *
+ * @param catalog The catalog to close
+ */
+void closeBackupCatalog(BackupCatalog& catalog);
+
+/**
+ * @brief Returns a string of the catalog
+ *
+ * @param catalog The opened catalog
+ * @param offset Offset of the string in the string table
+ * @return const char* The NUL-terminated string
+ */
+const char* getCatalogString(const BackupCatalog& catalog, uint32_t offset);
+
+/**
+ * @brief Returns the entries of a machine, oldest first
+ *
+ * @param catalog The opened catalog
+ * @param machine NetBIOS name of the machine
+ * @return CatalogRange Range of indexes into catalog.entries
+ */
+CatalogRange findMachineEntries(const BackupCatalog& catalog, const std::string& machine);
+
+/**
+ * @brief Returns the entries of a backup set, oldest first
+ *
+ * @param catalog The opened catalog
+ * @param imageId Image ID of the backup set
+ * @return CatalogRange Range of indexes into catalog.imageIndex
+ */
+CatalogRange findImageEntries(const BackupCatalog& catalog, const std::string& imageId);
+
+/**
+ * @brief Returns the most recent backup file of a machine
+ *
+ * The machine may be given by its NetBIOS name or by the image ID of one of
+ * its backup sets.
+ *
+ * @param catalog The opened catalog
+ * @param machine NetBIOS name or image ID
+ * @return const CatalogEntry* The latest restore point, or nullptr if there is none
+ */
+const CatalogEntry* findLatestRestorePoint(const BackupCatalog& catalog, const std::string& machine);
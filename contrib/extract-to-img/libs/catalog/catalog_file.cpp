@@ -0,0 +1,73 @@
+/**
+ * @file catalog_file.cpp
+ * @brief Implementation of the catalog file writing helpers
+ */
+
+#include <cstdio>
+#include <stdexcept>
+
+#include "catalog_file.h"
+
+/**
+ * @brief Adds a string to a catalog string table
+ *
+ * @param table The string table
+ * @param value The string to add
+ * @return uint32_t Offset of the string in the table
+ * @throws std::runtime_error if the table grows beyond 4 GiB
+ */
+uint32_t addCatalogString(CatalogStringTable& table, const std::string& value)
+{
+    if (value.empty()) { return 0; }
+    auto existing = table.offsets.find(value);
+    if (existing != table.offsets.end()) { return existing->second; }
+
+    if (table.data.size() + value.size() + 1 > UINT32_MAX) { throw std::runtime_error("Catalog string table is too large."); }
+    uint32_t offset = static_cast<uint32_t>(table.data.size());
+    table.data.append(value);
+    table.data.push_back('\0');
+    table.offsets.emplace(value, offset);
+    return offset;
+}
+
+/**
+ * @brief Rounds a file offset up to the catalog section alignment
+ *
+ * @param offset The offset
+ * @return uint64_t The aligned offset
+ */
+uint64_t alignCatalogOffset(uint64_t offset)
+{
+    return (offset + CATALOG_SECTION_ALIGNMENT - 1) / CATALOG_SECTION_ALIGNMENT * CATALOG_SECTION_ALIGNMENT;
+}
+
+/**
+ * @brief Writes zero bytes up to an offset of a catalog file
+ *
+ * @param out The file stream
+ * @param offset Offset the next section starts at
+ */
+void padCatalogTo(std::ofstream& out, uint64_t offset)
+{
+    static const char zeros[CATALOG_SECTION_ALIGNMENT] = { 0 };
+    uint64_t position = static_cast<uint64_t>(out.tellp());
+    out.write(zeros, static_cast<std::streamsize>(offset - position));
+}
+
+/**
+ * @brief Moves a written catalog file into place
+ *
+ * @param temporaryPath Path the file was written to
+ * @param path Final path of the file
+ * @return true if the file was moved into place
+ */
+bool replaceCatalogFile(const std::string& temporaryPath, const std::string& path)
+{
+    if (std::rename(temporaryPath.c_str(), path.c_str()) == 0) { return true; }
+
+    // Windows will not rename over an existing file
+    std::remove(path.c_str());
+    if (std::rename(temporaryPath.c_str(), path.c_str()) == 0) { return true; }
+    std::remove(temporaryPath.c_str());
+    return false;
+}
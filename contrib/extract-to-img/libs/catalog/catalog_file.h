@@ -0,0 +1,70 @@
+/**
+ * @file catalog_file.h
+ * @brief Helpers for writing catalog files
+ *
+ * This file declares the pieces shared by the files that are mapped and
+ * used in place, such as backup catalogs and block map caches: a string
+ * table of NUL-terminated strings, section alignment and moving a finished
+ * file into place over an older one.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <unordered_map>
+
+/**
+ * @brief Alignment of each section of a catalog file
+ */
+const uint64_t CATALOG_SECTION_ALIGNMENT = 8;
+
+/**
+ * @brief String table of a catalog file being written
+ */
+struct CatalogStringTable
+{
+    std::string data = std::string(1, '\0');               // Starts with the empty string
+    std::unordered_map<std::string, uint32_t> offsets;     // Offsets of strings already added
+};
+
+/**
+ * @brief Adds a string to a catalog string table
+ *
+ * Strings already in the table are not added again.
+ *
+ * @param table The string table
+ * @param value The string to add
+ * @return uint32_t Offset of the string in the table
+ * @throws std::runtime_error if the table grows beyond 4 GiB
+ */
+uint32_t addCatalogString(CatalogStringTable& table, const std::string& value);
+
+/**
+ * @brief Rounds a file offset up to the catalog section alignment
+ *
+ * @param offset The offset
+ * @return uint64_t The aligned offset
+ */
+uint64_t alignCatalogOffset(uint64_t offset);
+
+/**
+ * @brief Writes zero bytes up to an offset of a catalog file
+ *
+ * @param out The file stream
+ * @param offset Offset the next section starts at
+ */
+void padCatalogTo(std::ofstream& out, uint64_t offset);
+
+/**
+ * @brief Moves a written catalog file into place
+ *
+ * Any file at the final path is replaced. The temporary file is removed if
+ * it cannot be moved.
+ *
+ * @param temporaryPath Path the file was written to
+ * @param path Final path of the file
+ * @return true if the file was moved into place
+ */
+bool replaceCatalogFile(const std::string& temporaryPath, const std::string& path);
@@ -0,0 +1,42 @@
+/**
+ * @file catalog_mapping.h
+ * @brief Read-only memory mapping of catalog files
+ *
+ * This file declares a minimal read-only file mapping used to open backup
+ * catalogs. The implementation is platform specific.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+/**
+ * @brief A file mapped read-only into memory
+ */
+struct MappedFile
+{
+    const uint8_t* data = nullptr;   // Start of the mapping
+    size_t size = 0;                 // Length of the mapping
+    void* fileHandle = nullptr;      // Platform handle of the file, if kept open
+    void* mappingHandle = nullptr;   // Platform handle of the mapping, if any
+};
+
+/**
+ * @brief Maps a whole file read-only
+ *
+ * @param mapping Output parameter for the mapping
+ * @param path Path of the file
+ * @throws std::runtime_error if the file cannot be opened or mapped
+ */
+void mapFile(MappedFile& mapping, const std::string& path);
+
+/**
+ * @brief Unmaps a file mapped with mapFile
+ *
+ * Does nothing if the file is not mapped.
+ *
+ * @param mapping The mapping to release
+ */
+void unmapFile(MappedFile& mapping);
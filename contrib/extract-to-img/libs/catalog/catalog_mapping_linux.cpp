@@ -0,0 +1,56 @@
+/**
+ * @file catalog_mapping_linux.cpp
+ * @brief Linux implementation of read-only file mapping
+ */
+
+#include <fcntl.h>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "catalog_mapping.h"
+
+/**
+ * @brief Maps a whole file read-only
+ *
+ * @param mapping Output parameter for the mapping
+ * @param path Path of the file
+ * @throws std::runtime_error if the file cannot be opened or mapped
+ */
+void mapFile(MappedFile& mapping, const std::string& path)
+{
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) { throw std::runtime_error("Failed to open file."); }
+
+    struct stat fileStat;
+    if (fstat(fd, &fileStat) != 0) {
+        close(fd);
+        throw std::runtime_error("Failed to open file.");
+    }
+
+    mapping.size = static_cast<size_t>(fileStat.st_size);
+    mapping.data = nullptr;
+    if (mapping.size > 0) {
+        void* data = mmap(nullptr, mapping.size, PROT_READ, MAP_SHARED, fd, 0);
+        if (data == MAP_FAILED) {
+            close(fd);
+            throw std::runtime_error("Failed to map file.");
+        }
+        mapping.data = static_cast<const uint8_t*>(data);
+    }
+    close(fd);  // The mapping stays valid without the descriptor
+}
+
+/**
+ * @brief Unmaps a file mapped with mapFile
+ *
+ * @param mapping The mapping to release
+ */
+void unmapFile(MappedFile& mapping)
+{
+    if (mapping.data != nullptr) {
+        munmap(const_cast<uint8_t*>(mapping.data), mapping.size);
+    }
+    mapping = MappedFile();
+}
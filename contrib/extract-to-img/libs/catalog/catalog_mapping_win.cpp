@@ -0,0 +1,61 @@
+/**
+ * @file catalog_mapping_win.cpp
+ * @brief Windows implementation of read-only file mapping
+ */
+
+#include <stdexcept>
+#include <Windows.h>
+
+#include "catalog_mapping.h"
+
+/**
+ * @brief Maps a whole file read-only
+ *
+ * @param mapping Output parameter for the mapping
+ * @param path Path of the file
+ * @throws std::runtime_error if the file cannot be opened or mapped
+ */
+void mapFile(MappedFile& mapping, const std::string& path)
+{
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) { throw std::runtime_error("Failed to open file."); }
+
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(file, &fileSize)) {
+        CloseHandle(file);
+        throw std::runtime_error("Failed to open file.");
+    }
+
+    mapping = MappedFile();
+    mapping.size = static_cast<size_t>(fileSize.QuadPart);
+    mapping.fileHandle = file;
+    if (mapping.size == 0) { return; }
+
+    HANDLE fileMapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (fileMapping == nullptr) {
+        CloseHandle(file);
+        throw std::runtime_error("Failed to map file.");
+    }
+
+    void* data = MapViewOfFile(fileMapping, FILE_MAP_READ, 0, 0, 0);
+    if (data == nullptr) {
+        CloseHandle(fileMapping);
+        CloseHandle(file);
+        throw std::runtime_error("Failed to map file.");
+    }
+    mapping.data = static_cast<const uint8_t*>(data);
+    mapping.mappingHandle = fileMapping;
+}
+
+/**
+ * @brief Unmaps a file mapped with mapFile
+ *
+ * @param mapping The mapping to release
+ */
+void unmapFile(MappedFile& mapping)
+{
+    if (mapping.data != nullptr) { UnmapViewOfFile(mapping.data); }
+    if (mapping.mappingHandle != nullptr) { CloseHandle(mapping.mappingHandle); }
+    if (mapping.fileHandle != nullptr) { CloseHandle(mapping.fileHandle); }
+    mapping = MappedFile();
+}
@@ -27,7 +27,7 @@ void readFile(std::fstream& file, void* buffer, std::streamsize bytesToRead)
     file.read(static_cast<char*>(buffer), bytesToRead);
     if (file.fail())
     {
-        if (file.eof()) {std::cout << "End of file reached" << std::endl;}
+        if (file.eof()) {std::cerr << "End of file reached\n";}
         throw std::runtime_error("Failed to read file.");
     }
 }
@@ -48,7 +48,7 @@ void setFilePointer(std::fstream& file, std::streamoff offset, std::ios_base::se
     file.seekg(offset, base);
     if (file.fail())
     {
-        std::cout << "Pointer failed to set" << std::endl;
+        std::cerr << "Pointer failed to set\n";
         throw std::runtime_error("Failed to set file pointer.");
     }
 }
@@ -69,7 +69,7 @@ std::fstream openFile(std::string fileName)
     file.open(fileName, std::ios::in | std::ios::out | std::ios::binary);
     if (file.fail())
     {
-        std::cout << "Failed to open file: " + fileName << std::endl;
+        std::cerr << "Failed to open file: " << fileName << "\n";
         throw std::runtime_error("Failed to open file.");
     }
     return file;
@@ -89,7 +89,7 @@ void closeFile(std::fstream& file)
     file.close();
     if (file.fail())
     {
-        std::cout << "Failed to close file" << std::endl;
+        std::cerr << "Failed to close file\n";
         throw std::runtime_error("Failed to close file.");
     }
 }
@@ -111,8 +111,8 @@ void writeToFile(std::fstream& file, void* buffer, std::streamsize bytesToWrite)
     file.write(static_cast<char*>(buffer), bytesToWrite);
     if (file.fail())
     {
-        if (file.eof()) {std::cout << "End of file reached" << std::endl;}
-        std::cout << "Failed to write to file: " << std::endl;
+        if (file.eof()) {std::cerr << "End of file reached\n";}
+        std::cerr << "Failed to write to file\n";
         throw std::runtime_error("Failed to write to file.");
     }
 }
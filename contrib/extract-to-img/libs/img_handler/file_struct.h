@@ -40,7 +40,7 @@ namespace file_structs
             std::string shadow_copy;
             uint64_t start;
             uint32_t total_clusters;
-            ImageEnums::FileType type;
+            ImageEnums::FileSystemType type;
             std::string volume_guid;
             std::string volume_label;
         };
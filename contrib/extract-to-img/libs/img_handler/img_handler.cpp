@@ -7,9 +7,13 @@
  * structure, metadata, and data block index reading.
  */
 
+#include <filesystem>
 #include <fstream>
 #include <iostream>
+#include <system_error>
 #include "file_struct.h"
+#include "img_handler.h"
+#include "layout_json_parser.h"
 #include "metadata.h"
 #include "../file_handler/file_handler.h"
 
@@ -133,6 +137,58 @@ void readDiskMetadata(std::fstream& file, file_structs::File_Layout& fileLayout,
     disk.track0.assign(blockData.get(), blockData.get() + header.BlockLength);
 }
 
+/**
+ * @brief Reads the index of one partition from the file
+ * 
+ * The file pointer must be at the reserved sector count that follows the
+ * partition's $INDEX header.
+ * 
+ * @param file Input file stream
+ * @param fileLayout The file layout the partition belongs to
+ * @param partition Output parameter for the partition's index
+ */
+void readPartitionIndex(std::fstream& file, file_structs::File_Layout& fileLayout, file_structs::Partition::Partition_Layout& partition)
+{
+    int32_t blockCount;
+    readFile(file, &blockCount, sizeof(blockCount));
+
+    // If FAT32, read reserved sectors
+    if (blockCount != 0) {
+        partition.reserved_sectors.resize(blockCount);
+        readFile(file, partition.reserved_sectors.data(), blockCount * sizeof(DataBlockIndexElement));
+    }
+
+    readFile(file, &blockCount, sizeof(blockCount));
+
+    if (fileLayout._header.delta_index) {
+        partition.delta_data_block_index.resize(blockCount);
+        readFile(file, partition.delta_data_block_index.data(), blockCount * sizeof(DeltaDataBlockIndexElement));
+    }
+    else {
+        partition.data_block_index.resize(blockCount);
+        readFile(file, partition.data_block_index.data(), blockCount * sizeof(DataBlockIndexElement));
+    }
+}
+
+/**
+ * @brief Skips over the index of one partition
+ * 
+ * Only the two entry counts are read; the entries themselves are seeked over.
+ * 
+ * @param file Input file stream
+ * @param fileLayout The file layout the partition belongs to
+ */
+void skipPartitionIndex(std::fstream& file, file_structs::File_Layout& fileLayout)
+{
+    int32_t blockCount;
+    readFile(file, &blockCount, sizeof(blockCount));
+    setFilePointer(file, static_cast<std::streamoff>(blockCount) * sizeof(DataBlockIndexElement), std::ios::cur);
+
+    readFile(file, &blockCount, sizeof(blockCount));
+    size_t elementSize = fileLayout._header.delta_index ? sizeof(DeltaDataBlockIndexElement) : sizeof(DataBlockIndexElement);
+    setFilePointer(file, static_cast<std::streamoff>(blockCount) * elementSize, std::ios::cur);
+}
+
 /**
  * @brief Reads the data block index from the file
  * 
@@ -145,51 +201,84 @@ void readDiskMetadata(std::fstream& file, file_structs::File_Layout& fileLayout,
 void readDataBlockIndex(std::fstream& file, file_structs::File_Layout& fileLayout)
 {
     setFilePointer(file, fileLayout._header.index_file_position, std::ios::beg);
-    MetadataBlockHeader header;
 
     for (auto& disk : fileLayout.disks) {
         readDiskMetadata(file, fileLayout, disk);
 
         for (auto& partition : disk.partitions) {
             skipPartitionMetadata(file);    // Skip over bitmap block and index header
-
-            int32_t blockCount;
-            readFile(file, &blockCount, sizeof(blockCount));
-
-            // If FAT32, read reserved sectors
-            if (blockCount != 0) {
-                partition.reserved_sectors.resize(blockCount);
-                readFile(file, partition.reserved_sectors.data(), blockCount * sizeof(DataBlockIndexElement));
-            }
-
-            readFile(file, &blockCount, sizeof(blockCount));
-
-            if (fileLayout._header.delta_index) {
-                partition.delta_data_block_index.resize(blockCount);
-                readFile(file, partition.delta_data_block_index.data(), blockCount * sizeof(DeltaDataBlockIndexElement));
-            }
-            else {
-                partition.data_block_index.resize(blockCount);
-                readFile(file, partition.data_block_index.data(), blockCount * sizeof(DataBlockIndexElement));
-            }
+            readPartitionIndex(file, fileLayout, partition);
         }
     }
 }
 
 /**
- * @brief Reads the complete backup file layout
+ * @brief Checks whether an open file ends with a backup file footer
  * 
- * This is the main function that reads and parses a Macrium Reflect backup file.
- * It reads the footer, header, JSON metadata, and data block index to construct
- * a complete representation of the backup file.
+ * Every file that carries backup metadata ends with the header offset and
+ * the magic bytes. Split backup segments that only hold data blocks do not.
  * 
- * @param layout Output parameter for the file layout
- * @param backupFileName Path to the backup file
+ * @param file Open file stream
+ * @return true if the file ends with the magic bytes
  */
-void readBackupFileLayout(file_structs::File_Layout& layout, std::string backupFileName)
+bool checkBackupFileFooter(std::fstream& file)
+{
+    file.seekg(0, std::ios::end);
+    if (file.fail() || file.tellg() < -calculateFooterOffset()) {
+        file.clear();
+        return false;
+    }
+
+    setFilePointer(file, calculateFooterOffset(), std::ios_base::end);
+
+    uint64_t headerOffset;
+    uint8_t magicBytes[MAGIC_BYTES_VX_SIZE];
+    readFooterData(headerOffset, magicBytes, file);
+
+    return memcmp(magicBytes, MAGIC_BYTES_VX, MAGIC_BYTES_VX_SIZE) == 0;
+}
+
+/**
+ * @brief Checks whether a file ends with a backup file footer
+ * 
+ * @param backupFileName Path to the file to check
+ * @return true if the file ends with the magic bytes
+ */
+bool hasBackupFileFooter(std::string backupFileName)
 {
     std::fstream file = openFile(backupFileName);
+    bool hasFooter = checkBackupFileFooter(file);
+    closeFile(file);
+    return hasFooter;
+}
 
+/**
+ * @brief Returns the file to read a backup file's metadata from
+ * 
+ * @param backupFileName Path to the backup file
+ * @return std::string The sidecar path if it exists and has a footer, otherwise backupFileName
+ */
+std::string findBackupMetadataFile(const std::string& backupFileName)
+{
+    std::string metadataFileName = backupFileName + BACKUP_METADATA_EXTENSION;
+    std::error_code error;
+    if (std::filesystem::is_regular_file(metadataFileName, error) && hasBackupFileFooter(metadataFileName)) {
+        return metadataFileName;
+    }
+    return backupFileName;
+}
+
+/**
+ * @brief Reads the JSON metadata block of an open backup file
+ * 
+ * This function follows the footer to the header offset and reads the
+ * JSON metadata block that starts there.
+ * 
+ * @param file Input file stream
+ * @return std::string JSON string containing the metadata
+ */
+std::string readBackupFileJSON(std::fstream& file)
+{
     setFilePointer(file, calculateFooterOffset(), std::ios_base::end);
 
     uint64_t headerOffset;
@@ -198,11 +287,139 @@ void readBackupFileLayout(file_structs::File_Layout& layout, std::string backupF
     readFooterData(headerOffset, magicBytes, file);
     setFilePointer(file, headerOffset, std::ios::beg);
 
-    std::string strJson = readJSON(file);
+    return readJSON(file);
+}
 
+/**
+ * @brief Converts the JSON metadata into a file layout
+ * 
+ * The layout is filled directly from the parser events, skipping the
+ * _auxiliary_data subtree and any other values the layout does not hold.
+ * 
+ * @param layout Output parameter for the file layout
+ * @param strJson JSON string containing the metadata
+ */
+void parseFileLayoutJSON(file_structs::File_Layout& layout, const std::string& strJson)
+{
+    parseFileLayoutJSONSelective(layout, strJson);
+}
+
+/**
+ * @brief Converts the JSON metadata into a file layout through a JSON document
+ * 
+ * Builds the complete nlohmann::json document before converting it. Kept as
+ * the reference for parseFileLayoutJSON.
+ * 
+ * @param layout Output parameter for the file layout
+ * @param strJson JSON string containing the metadata
+ */
+void parseFileLayoutJSONDOM(file_structs::File_Layout& layout, const std::string& strJson)
+{
     nlohmann::json json = nlohmann::json::parse(strJson);
     layout = json;
+}
+
+/**
+ * @brief Reads the complete backup file layout
+ * 
+ * This is the main function that reads and parses a Macrium Reflect backup file.
+ * It reads the footer, header, JSON metadata, and data block index to construct
+ * a complete representation of the backup file. The metadata sidecar is read
+ * instead when there is one.
+ * 
+ * @param layout Output parameter for the file layout
+ * @param backupFileName Path to the backup file
+ */
+void readBackupFileLayout(file_structs::File_Layout& layout, std::string backupFileName)
+{
+    std::fstream file = openFile(findBackupMetadataFile(backupFileName));
+
+    std::string strJson = readBackupFileJSON(file);
+    parseFileLayoutJSON(layout, strJson);
 
     readDataBlockIndex(file, layout);
     closeFile(file);
 }
+
+/**
+ * @brief Opens a backup file layout without loading the partition indexes
+ * 
+ * The JSON metadata and track 0 data of every disk are read. The index
+ * section is walked once to record where each partition's index starts,
+ * reading only the block headers and entry counts, so each index can later
+ * be loaded on its own. When the backup file has a metadata sidecar, only
+ * the sidecar is opened. The footer is checked on the same open, so each
+ * file is opened once.
+ * 
+ * @param lazyLayout Output parameter for the layout
+ * @param backupFileName Path to the backup file
+ * @param useMetadataSidecar Whether a metadata sidecar is read in place of the backup file
+ * @return false if neither the sidecar nor the backup file has a footer, as for data-only split segments
+ */
+bool openBackupFileLayout(LazyFileLayout& lazyLayout, std::string backupFileName, bool useMetadataSidecar)
+{
+    lazyLayout.backupFileName = backupFileName;
+    lazyLayout.metadataFileName.clear();
+    lazyLayout.indexLocations.clear();
+
+    std::fstream file;
+    std::string sidecarFileName = backupFileName + BACKUP_METADATA_EXTENSION;
+    std::error_code error;
+    if (useMetadataSidecar && std::filesystem::is_regular_file(sidecarFileName, error)) {
+        file = openFile(sidecarFileName);
+        if (checkBackupFileFooter(file)) { lazyLayout.metadataFileName = sidecarFileName; }
+        else { closeFile(file); }
+    }
+    if (lazyLayout.metadataFileName.empty()) {
+        file = openFile(backupFileName);
+        if (!checkBackupFileFooter(file)) {
+            closeFile(file);
+            return false;
+        }
+        lazyLayout.metadataFileName = backupFileName;
+    }
+
+    parseFileLayoutJSON(lazyLayout.layout, readBackupFileJSON(file));
+
+    setFilePointer(file, lazyLayout.layout._header.index_file_position, std::ios::beg);
+    for (auto& disk : lazyLayout.layout.disks) {
+        readDiskMetadata(file, lazyLayout.layout, disk);
+
+        std::vector<PartitionIndexLocation> locations;
+        for (size_t i = 0; i < disk.partitions.size(); i++) {
+            skipPartitionMetadata(file);
+            locations.push_back({ static_cast<std::streamoff>(file.tellg()), false });
+            skipPartitionIndex(file, lazyLayout.layout);
+        }
+        lazyLayout.indexLocations.push_back(locations);
+    }
+    closeFile(file);
+    return true;
+}
+
+/**
+ * @brief Returns a partition of a lazily opened layout with its index loaded
+ * 
+ * The index is read from the backup file, or its metadata sidecar, on the
+ * first call for a partition and kept in the layout for later calls.
+ * 
+ * @param lazyLayout The layout opened with openBackupFileLayout
+ * @param diskIndex Index of the disk in the layout
+ * @param partitionIndex Index of the partition on the disk
+ * @return file_structs::Partition::Partition_Layout& The partition with its index
+ * @throws std::out_of_range if the disk or partition does not exist
+ */
+file_structs::Partition::Partition_Layout& loadPartitionIndex(LazyFileLayout& lazyLayout, size_t diskIndex, size_t partitionIndex)
+{
+    PartitionIndexLocation& location = lazyLayout.indexLocations.at(diskIndex).at(partitionIndex);
+    file_structs::Partition::Partition_Layout& partition = lazyLayout.layout.disks[diskIndex].partitions[partitionIndex];
+    if (location.loaded) { return partition; }
+
+    std::fstream file = openFile(lazyLayout.metadataFileName);
+    setFilePointer(file, location.offset, std::ios::beg);
+    readPartitionIndex(file, lazyLayout.layout, partition);
+    closeFile(file);
+
+    location.loaded = true;
+    return partition;
+}
@@ -7,16 +7,145 @@
  * and organization.
  */
 
+#pragma once
+
+#include <string>
+#include <vector>
+
 #include "file_struct.h"
 #include "../file_handler/file_handler.h"
 
+/**
+ * @brief Extension of the sidecar file holding a copy of a backup file's metadata
+ */
+const char BACKUP_METADATA_EXTENSION[] = ".metadata";
+
+/**
+ * @brief Location of a partition's index in a backup file
+ */
+struct PartitionIndexLocation
+{
+    std::streamoff offset = 0;     // Position of the reserved sector count after the $INDEX header
+    bool loaded = false;           // Whether the index has been read into the layout
+};
+
+/**
+ * @brief A backup file layout whose partition indexes are loaded on demand
+ * 
+ * The JSON metadata and track 0 data are always present in layout. The
+ * reserved sectors and data block indexes of a partition are only filled in
+ * once loadPartitionIndex has been called for it. Not safe for concurrent
+ * loads from several threads.
+ * 
+ * When the backup file has a metadata sidecar, the layout and indexes are
+ * read from the sidecar; the data blocks stay in the backup file.
+ */
+struct LazyFileLayout
+{
+    std::string backupFileName;                                        // Path of the backup file
+    std::string metadataFileName;                                      // Path the metadata is read from
+    file_structs::File_Layout layout;                                  // Metadata and any loaded indexes
+    std::vector<std::vector<PartitionIndexLocation>> indexLocations;   // Index locations by disk, then partition
+};
+
+/**
+ * @brief Reads the JSON metadata block of an open backup file
+ * 
+ * @param file Open backup file stream
+ * @return std::string JSON string containing the metadata
+ */
+std::string readBackupFileJSON(std::fstream& file);
+
+/**
+ * @brief Converts the JSON metadata into a file layout
+ * 
+ * Only the JSON fields are filled in; the data block index and track 0 data
+ * are read separately by readDataBlockIndex.
+ * 
+ * @param layout Reference to the File_Layout structure to populate
+ * @param strJson JSON string containing the metadata
+ */
+void parseFileLayoutJSON(file_structs::File_Layout& layout, const std::string& strJson);
+
+/**
+ * @brief Converts the JSON metadata into a file layout through a JSON document
+ * 
+ * Equivalent to parseFileLayoutJSON but builds the whole JSON document,
+ * including the subtrees the layout does not use.
+ * 
+ * @param layout Reference to the File_Layout structure to populate
+ * @param strJson JSON string containing the metadata
+ */
+void parseFileLayoutJSONDOM(file_structs::File_Layout& layout, const std::string& strJson);
+
+/**
+ * @brief Reads the data block index and track 0 data from a backup file
+ * 
+ * @param file Open backup file stream
+ * @param fileLayout File layout whose disks and partitions receive the index
+ */
+void readDataBlockIndex(std::fstream& file, file_structs::File_Layout& fileLayout);
+
+/**
+ * @brief Returns the file to read a backup file's metadata from
+ * 
+ * Macrium Reflect can write a copy of the footer, $JSON block and indexes of
+ * a backup file to a sidecar named after it with BACKUP_METADATA_EXTENSION
+ * appended. The sidecar is a small file next to the data, so reading it
+ * avoids seeking through large backup files on slow or tiered storage.
+ * 
+ * @param backupFileName Path to the backup file
+ * @return std::string The sidecar path if it exists and has a footer, otherwise backupFileName
+ */
+std::string findBackupMetadataFile(const std::string& backupFileName);
+
 /**
  * @brief Reads and parses the layout information from a backup file
  * 
  * This function reads the backup file's layout information, which includes
  * metadata about the backup structure, partitions, and data organization.
+ * The metadata sidecar is read instead when there is one.
  * 
  * @param layout Reference to the File_Layout structure to populate
  * @param backupFileName Path to the backup file to read
  */
 void readBackupFileLayout(file_structs::File_Layout& layout, std::string backupFileName);
+
+/**
+ * @brief Checks whether a file ends with a backup file footer
+ * 
+ * Split backup segments that only hold data blocks have no footer, so their
+ * layout cannot be read and their blocks are located through the index of
+ * the segment that does carry the metadata.
+ * 
+ * @param backupFileName Path to the file to check
+ * @return true if the file ends with the magic bytes
+ */
+bool hasBackupFileFooter(std::string backupFileName);
+
+/**
+ * @brief Opens a backup file layout without loading the partition indexes
+ * 
+ * Reads the JSON metadata and track 0 data, and records where each
+ * partition's index starts. Use this when only geometry, timestamps or file
+ * history are needed, or when only some partitions' indexes are. The
+ * metadata sidecar is read instead when there is one, unless useMetadataSidecar
+ * is false.
+ * 
+ * @param lazyLayout Output parameter for the layout
+ * @param backupFileName Path to the backup file
+ * @param useMetadataSidecar Whether a metadata sidecar is read in place of the backup file
+ * @return false if the file has no footer, as for split segments that only hold data blocks
+ */
+bool openBackupFileLayout(LazyFileLayout& lazyLayout, std::string backupFileName, bool useMetadataSidecar = true);
+
+/**
+ * @brief Returns a partition of a lazily opened layout with its index loaded
+ * 
+ * @param lazyLayout The layout opened with openBackupFileLayout
+ * @param diskIndex Index of the disk in the layout
+ * @param partitionIndex Index of the partition on the disk
+ * @return file_structs::Partition::Partition_Layout& The partition with its index
+ * @throws std::out_of_range if the disk or partition does not exist
+ */
+file_structs::Partition::Partition_Layout& loadPartitionIndex(LazyFileLayout& lazyLayout, size_t diskIndex, size_t partitionIndex);
@@ -0,0 +1,438 @@
+/**
+ * @file layout_json_parser.cpp
+ * @brief Implementation of the selective SAX parser for the $JSON block
+ *
+ * The parser keeps a stack of the layout structures being filled. Objects
+ * and arrays the layout does not contain are skipped by depth counting, so
+ * no memory is spent on them. Scalar values are converted with the same
+ * nlohmann conversions the DOM path uses, which keeps enum mappings and type
+ * checks identical.
+ */
+
+#include <stdexcept>
+#include <unordered_map>
+#include <vector>
+
+#include "layout_json_parser.h"
+
+/**
+ * @brief Structures of the layout the parser can be filling
+ */
+enum class LayoutContext
+{
+    eRoot,
+    eHeader,
+    eCompression,
+    eEncryption,
+    eDiskArray,
+    eDisk,
+    eDiskDescriptor,
+    eDiskGeometry,
+    eDiskHeader,
+    ePartitionArray,
+    ePartition,
+    eFileSystem,
+    ePartitionGeometry,
+    ePartitionHeader,
+    eFileHistoryArray,
+    eFileHistory,
+    ePartitionTableEntry,
+    eSkip
+};
+
+/**
+ * @brief A structure being filled and where it lives in the layout
+ */
+struct LayoutFrame
+{
+    LayoutContext context;
+    void* target;
+};
+
+/**
+ * @brief Assigns a scalar JSON value to a field of a layout structure
+ */
+template <typename T>
+using FieldSetter = void (*)(T& target, const nlohmann::json& value);
+
+/**
+ * @brief Field setters of a layout structure, by JSON key
+ */
+template <typename T>
+using FieldSetters = std::unordered_map<std::string, FieldSetter<T>>;
+
+/**
+ * @brief Declares the setter of one field
+ *
+ * Assigns through a temporary because the layout structures are packed and
+ * their fields cannot be bound to references.
+ */
+#define LAYOUT_FIELD(Type, field) \
+    { #field, [](Type& target, const nlohmann::json& value) { target.field = value.get<decltype(Type::field)>(); } }
+
+/**
+ * @brief Returns the field setters of Header
+ */
+const FieldSetters<file_structs::Header>& headerSetters()
+{
+    using file_structs::Header;
+    static const FieldSetters<Header> setters = {
+        LAYOUT_FIELD(Header, backup_format), LAYOUT_FIELD(Header, backup_guid), LAYOUT_FIELD(Header, backup_time),
+        LAYOUT_FIELD(Header, backup_type), LAYOUT_FIELD(Header, backupset_time), LAYOUT_FIELD(Header, delta_index),
+        LAYOUT_FIELD(Header, file_number), LAYOUT_FIELD(Header, imaged_disks_count), LAYOUT_FIELD(Header, imageid),
+        LAYOUT_FIELD(Header, increment_number), LAYOUT_FIELD(Header, index_file_position), LAYOUT_FIELD(Header, json_version),
+        LAYOUT_FIELD(Header, netbios_name), LAYOUT_FIELD(Header, split_file)
+    };
+    return setters;
+}
+
+/**
+ * @brief Returns the field setters of Compression
+ */
+const FieldSetters<file_structs::Compression>& compressionSetters()
+{
+    using file_structs::Compression;
+    static const FieldSetters<Compression> setters = {
+        LAYOUT_FIELD(Compression, compression_level), LAYOUT_FIELD(Compression, compression_method)
+    };
+    return setters;
+}
+
+/**
+ * @brief Returns the field setters of Encryption
+ */
+const FieldSetters<file_structs::Encryption>& encryptionSetters()
+{
+    using file_structs::Encryption;
+    static const FieldSetters<Encryption> setters = {
+        LAYOUT_FIELD(Encryption, enable), LAYOUT_FIELD(Encryption, key_iterations)
+    };
+    return setters;
+}
+
+/**
+ * @brief Returns the field setters of Disk::Descriptor
+ */
+const FieldSetters<file_structs::Disk::Descriptor>& diskDescriptorSetters()
+{
+    using file_structs::Disk::Descriptor;
+    static const FieldSetters<Descriptor> setters = {
+        LAYOUT_FIELD(Descriptor, disk_description), LAYOUT_FIELD(Descriptor, disk_manufacturer), LAYOUT_FIELD(Descriptor, disk_productid),
+        LAYOUT_FIELD(Descriptor, disk_revisonno), LAYOUT_FIELD(Descriptor, disk_serialno)
+    };
+    return setters;
+}
+
+/**
+ * @brief Returns the field setters of Disk::Geometry
+ */
+const FieldSetters<file_structs::Disk::Geometry>& diskGeometrySetters()
+{
+    using file_structs::Disk::Geometry;
+    static const FieldSetters<Geometry> setters = {
+        LAYOUT_FIELD(Geometry, bytes_per_sector), LAYOUT_FIELD(Geometry, cylinders), LAYOUT_FIELD(Geometry, disk_size),
+        LAYOUT_FIELD(Geometry, media_type), LAYOUT_FIELD(Geometry, sectors_per_track), LAYOUT_FIELD(Geometry, tracks_per_cylinder)
+    };
+    return setters;
+}
+
+/**
+ * @brief Returns the field setters of Disk::Header
+ */
+const FieldSetters<file_structs::Disk::Header>& diskHeaderSetters()
+{
+    using file_structs::Disk::Header;
+    static const FieldSetters<Header> setters = {
+        LAYOUT_FIELD(Header, disk_format), LAYOUT_FIELD(Header, disk_number), LAYOUT_FIELD(Header, disk_signature),
+        LAYOUT_FIELD(Header, imaged_partition_count)
+    };
+    return setters;
+}
+
+/**
+ * @brief Returns the field setters of Partition::File_System
+ */
+const FieldSetters<file_structs::Partition::File_System>& fileSystemSetters()
+{
+    using file_structs::Partition::File_System;
+    static const FieldSetters<File_System> setters = {
+        LAYOUT_FIELD(File_System, type), LAYOUT_FIELD(File_System, mft_offset), LAYOUT_FIELD(File_System, mft_record_size),
+        LAYOUT_FIELD(File_System, drive_letter), LAYOUT_FIELD(File_System, end), LAYOUT_FIELD(File_System, start),
+        LAYOUT_FIELD(File_System, free_clusters), LAYOUT_FIELD(File_System, lcn0_offset), LAYOUT_FIELD(File_System, sectors_per_cluster),
+        LAYOUT_FIELD(File_System, total_clusters), LAYOUT_FIELD(File_System, volume_guid), LAYOUT_FIELD(File_System, volume_label),
+        LAYOUT_FIELD(File_System, lcn0_file_number), LAYOUT_FIELD(File_System, bitlocker_state), LAYOUT_FIELD(File_System, partition_index),
+        LAYOUT_FIELD(File_System, shadow_copy), LAYOUT_FIELD(File_System, reserved_sectors_byte_length)
+    };
+    return setters;
+}
+
+/**
+ * @brief Returns the field setters of Partition::Geometry
+ */
+const FieldSetters<file_structs::Partition::Geometry>& partitionGeometrySetters()
+{
+    using file_structs::Partition::Geometry;
+    static const FieldSetters<Geometry> setters = {
+        LAYOUT_FIELD(Geometry, start), LAYOUT_FIELD(Geometry, end), LAYOUT_FIELD(Geometry, length), LAYOUT_FIELD(Geometry, boot_sector_offset)
+    };
+    return setters;
+}
+
+/**
+ * @brief Returns the field setters of Partition::Header
+ */
+const FieldSetters<file_structs::Partition::Header>& partitionHeaderSetters()
+{
+    using file_structs::Partition::Header;
+    static const FieldSetters<Header> setters = {
+        LAYOUT_FIELD(Header, block_count), LAYOUT_FIELD(Header, block_size), LAYOUT_FIELD(Header, file_history_count),
+        LAYOUT_FIELD(Header, partition_file_offset), LAYOUT_FIELD(Header, partition_number)
+    };
+    return setters;
+}
+
+/**
+ * @brief Returns the field setters of Partition::File_History
+ */
+const FieldSetters<file_structs::Partition::File_History>& fileHistorySetters()
+{
+    using file_structs::Partition::File_History;
+    static const FieldSetters<File_History> setters = {
+        LAYOUT_FIELD(File_History, file_name), LAYOUT_FIELD(File_History, file_number)
+    };
+    return setters;
+}
+
+/**
+ * @brief Returns the field setters of Partition::Table_Entry
+ */
+const FieldSetters<file_structs::Partition::Table_Entry>& tableEntrySetters()
+{
+    using file_structs::Partition::Table_Entry;
+    static const FieldSetters<Table_Entry> setters = {
+        LAYOUT_FIELD(Table_Entry, boot_sector), LAYOUT_FIELD(Table_Entry, end_cylinder), LAYOUT_FIELD(Table_Entry, end_head),
+        LAYOUT_FIELD(Table_Entry, num_sectors), LAYOUT_FIELD(Table_Entry, partition_type), LAYOUT_FIELD(Table_Entry, start_cylinder),
+        LAYOUT_FIELD(Table_Entry, start_head), LAYOUT_FIELD(Table_Entry, status), LAYOUT_FIELD(Table_Entry, type)
+    };
+    return setters;
+}
+
+#undef LAYOUT_FIELD
+
+/**
+ * @brief Assigns a scalar value to the field of a structure named by a key
+ *
+ * Keys the structure does not have are ignored.
+ *
+ * @param target The structure being filled
+ * @param setters The field setters of the structure
+ * @param key The JSON key of the value
+ * @param value The scalar value
+ */
+template <typename T>
+void setLayoutField(void* target, const FieldSetters<T>& setters, const std::string& key, const nlohmann::json& value)
+{
+    auto setter = setters.find(key);
+    if (setter != setters.end()) { setter->second(*static_cast<T*>(target), value); }
+}
+
+/**
+ * @brief SAX handler that fills a File_Layout
+ */
+struct LayoutSaxHandler
+{
+    file_structs::File_Layout& layout;
+    std::vector<LayoutFrame> frames;
+    std::string currentKey;
+    size_t skipDepth = 0;
+
+    explicit LayoutSaxHandler(file_structs::File_Layout& layout) : layout(layout) {}
+
+    /**
+     * @brief Returns the structure a key of the current object refers to
+     *
+     * @param frame The object being filled
+     * @return LayoutFrame The child structure, or eSkip if the layout does not use it
+     */
+    LayoutFrame childFrame(const LayoutFrame& frame)
+    {
+        switch (frame.context) {
+        case LayoutContext::eRoot: {
+            auto& target = *static_cast<file_structs::File_Layout*>(frame.target);
+            if (currentKey == "_header") { return { LayoutContext::eHeader, &target._header }; }
+            if (currentKey == "_compression") { return { LayoutContext::eCompression, &target._compression }; }
+            if (currentKey == "_encryption") { return { LayoutContext::eEncryption, &target._encryption }; }
+            if (currentKey == "disks") { return { LayoutContext::eDiskArray, &target.disks }; }
+            break;
+        }
+        case LayoutContext::eDisk: {
+            auto& target = *static_cast<file_structs::Disk::Disk_Layout*>(frame.target);
+            if (currentKey == "_descriptor") { return { LayoutContext::eDiskDescriptor, &target._descriptor }; }
+            if (currentKey == "_geometry") { return { LayoutContext::eDiskGeometry, &target._geometry }; }
+            if (currentKey == "_header") { return { LayoutContext::eDiskHeader, &target._header }; }
+            if (currentKey == "partitions") { return { LayoutContext::ePartitionArray, &target.partitions }; }
+            break;
+        }
+        case LayoutContext::ePartition: {
+            auto& target = *static_cast<file_structs::Partition::Partition_Layout*>(frame.target);
+            if (currentKey == "_file_system") { return { LayoutContext::eFileSystem, &target._file_system }; }
+            if (currentKey == "_geometry") { return { LayoutContext::ePartitionGeometry, &target._geometry }; }
+            if (currentKey == "_header") { return { LayoutContext::ePartitionHeader, &target._header }; }
+            if (currentKey == "_partition_table_entry") { return { LayoutContext::ePartitionTableEntry, &target._partition_table_entry }; }
+            break;
+        }
+        case LayoutContext::ePartitionHeader: {
+            auto& target = *static_cast<file_structs::Partition::Header*>(frame.target);
+            if (currentKey == "file_history") { return { LayoutContext::eFileHistoryArray, &target.file_history }; }
+            break;
+        }
+        default:
+            break;
+        }
+        return { LayoutContext::eSkip, nullptr };
+    }
+
+    /**
+     * @brief Appends an element to the array being filled
+     *
+     * @param frame The array being filled
+     * @return LayoutFrame The new element, or eSkip for arrays of other values
+     */
+    LayoutFrame elementFrame(const LayoutFrame& frame)
+    {
+        switch (frame.context) {
+        case LayoutContext::eDiskArray: {
+            auto& disks = *static_cast<std::vector<file_structs::Disk::Disk_Layout>*>(frame.target);
+            disks.emplace_back();
+            return { LayoutContext::eDisk, &disks.back() };
+        }
+        case LayoutContext::ePartitionArray: {
+            auto& partitions = *static_cast<std::vector<file_structs::Partition::Partition_Layout>*>(frame.target);
+            partitions.emplace_back();
+            return { LayoutContext::ePartition, &partitions.back() };
+        }
+        case LayoutContext::eFileHistoryArray: {
+            auto& history = *static_cast<std::vector<file_structs::Partition::File_History>*>(frame.target);
+            history.emplace_back();
+            return { LayoutContext::eFileHistory, &history.back() };
+        }
+        default:
+            return { LayoutContext::eSkip, nullptr };
+        }
+    }
+
+    /**
+     * @brief Returns whether a context is filled from a JSON array
+     *
+     * @param context The context
+     * @return true for array contexts
+     */
+    static bool isArray(LayoutContext context)
+    {
+        return context == LayoutContext::eDiskArray || context == LayoutContext::ePartitionArray || context == LayoutContext::eFileHistoryArray;
+    }
+
+    /**
+     * @brief Enters an object or array
+     *
+     * @param array true when entering an array
+     * @return bool Always true to continue parsing
+     */
+    bool enter(bool array)
+    {
+        if (skipDepth > 0) {
+            skipDepth++;
+            return true;
+        }
+        if (frames.empty()) {
+            if (array) { skipDepth = 1; }
+            else { frames.push_back({ LayoutContext::eRoot, &layout }); }
+            return true;
+        }
+
+        const LayoutFrame& parent = frames.back();
+        LayoutFrame child = isArray(parent.context) ? elementFrame(parent) : childFrame(parent);
+        if (child.context == LayoutContext::eSkip || isArray(child.context) != array) {
+            skipDepth = 1;
+            return true;
+        }
+        frames.push_back(child);
+        return true;
+    }
+
+    /**
+     * @brief Leaves the current object or array
+     *
+     * @return bool Always true to continue parsing
+     */
+    bool leave()
+    {
+        if (skipDepth > 0) { skipDepth--; }
+        else { frames.pop_back(); }
+        return true;
+    }
+
+    /**
+     * @brief Assigns a scalar value to the current structure
+     *
+     * @param value The scalar value
+     * @return bool Always true to continue parsing
+     */
+    bool scalar(const nlohmann::json& value)
+    {
+        if (skipDepth > 0 || frames.empty()) { return true; }
+
+        const LayoutFrame& frame = frames.back();
+        switch (frame.context) {
+        case LayoutContext::eHeader: setLayoutField(frame.target, headerSetters(), currentKey, value); break;
+        case LayoutContext::eCompression: setLayoutField(frame.target, compressionSetters(), currentKey, value); break;
+        case LayoutContext::eEncryption: setLayoutField(frame.target, encryptionSetters(), currentKey, value); break;
+        case LayoutContext::eDiskDescriptor: setLayoutField(frame.target, diskDescriptorSetters(), currentKey, value); break;
+        case LayoutContext::eDiskGeometry: setLayoutField(frame.target, diskGeometrySetters(), currentKey, value); break;
+        case LayoutContext::eDiskHeader: setLayoutField(frame.target, diskHeaderSetters(), currentKey, value); break;
+        case LayoutContext::eFileSystem: setLayoutField(frame.target, fileSystemSetters(), currentKey, value); break;
+        case LayoutContext::ePartitionGeometry: setLayoutField(frame.target, partitionGeometrySetters(), currentKey, value); break;
+        case LayoutContext::ePartitionHeader: setLayoutField(frame.target, partitionHeaderSetters(), currentKey, value); break;
+        case LayoutContext::eFileHistory: setLayoutField(frame.target, fileHistorySetters(), currentKey, value); break;
+        case LayoutContext::ePartitionTableEntry: setLayoutField(frame.target, tableEntrySetters(), currentKey, value); break;
+        default: break;
+        }
+        return true;
+    }
+
+    // nlohmann::json_sax interface
+    bool null() { return scalar(nullptr); }
+    bool boolean(bool value) { return scalar(value); }
+    bool number_integer(nlohmann::json::number_integer_t value) { return scalar(value); }
+    bool number_unsigned(nlohmann::json::number_unsigned_t value) { return scalar(value); }
+    bool number_float(nlohmann::json::number_float_t value, const nlohmann::json::string_t&) { return scalar(value); }
+    bool string(nlohmann::json::string_t& value) { return skipDepth > 0 ? true : scalar(std::move(value)); }
+    bool binary(nlohmann::json::binary_t&) { return true; }
+    bool start_object(std::size_t) { return enter(false); }
+    bool key(nlohmann::json::string_t& value)
+    {
+        if (skipDepth == 0) { currentKey.swap(value); }
+        return true;
+    }
+    bool end_object() { return leave(); }
+    bool start_array(std::size_t) { return enter(true); }
+    bool end_array() { return leave(); }
+    bool parse_error(std::size_t, const std::string&, const nlohmann::detail::exception& ex)
+    {
+        if (auto parseError = dynamic_cast<const nlohmann::json::parse_error*>(&ex)) { throw *parseError; }
+        throw std::runtime_error(ex.what());
+    }
+};
+
+/**
+ * @brief Parses the $JSON metadata block into a file layout
+ *
+ * @param layout Reference to the File_Layout structure to populate
+ * @param strJson JSON string containing the metadata
+ */
+void parseFileLayoutJSONSelective(file_structs::File_Layout& layout, const std::string& strJson)
+{
+    layout = file_structs::File_Layout();
+    LayoutSaxHandler handler(layout);
+    nlohmann::json::sax_parse(strJson, &handler);
+}
@@ -0,0 +1,30 @@
+/**
+ * @file layout_json_parser.h
+ * @brief Selective SAX parser for the $JSON metadata block
+ *
+ * This file declares a parser that fills a file_structs::File_Layout
+ * directly from the SAX events of the $JSON block. No JSON document is built:
+ * known fields are assigned as they are read, and subtrees the layout does
+ * not use, such as _auxiliary_data and its backup_definition, are skipped
+ * without being stored.
+ */
+
+#pragma once
+
+#include <string>
+
+#include "file_struct.h"
+
+/**
+ * @brief Parses the $JSON metadata block into a file layout
+ *
+ * Produces the same layout as converting a parsed nlohmann::json document,
+ * including the enum string mappings and type checks. Fields missing from
+ * the JSON are value-initialised.
+ *
+ * @param layout Reference to the File_Layout structure to populate
+ * @param strJson JSON string containing the metadata
+ * @throws nlohmann::json::parse_error if the JSON is malformed
+ * @throws nlohmann::json::type_error if a field has an unexpected type
+ */
+void parseFileLayoutJSONSelective(file_structs::File_Layout& layout, const std::string& strJson);
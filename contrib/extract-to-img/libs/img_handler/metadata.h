@@ -7,6 +7,8 @@
  * numbers.
  */
 
+#pragma once
+
 #include <cstdint>
 
 /**
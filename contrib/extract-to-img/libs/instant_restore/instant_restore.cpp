@@ -0,0 +1,416 @@
+/**
+ * @file instant_restore.cpp
+ * @brief Implementation of instant restores
+ *
+ * Hydration, writes and the partition readers are serialised by one lock.
+ * Reads and writes waiting for it hold the background hydrator back, so a
+ * chunk the guest is waiting on is composed next rather than after the
+ * chunk the hydrator would take in disk order. Reads of hydrated chunks do
+ * not take the lock.
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "instant_restore.h"
+
+/**
+ * @brief Checks that a byte range lies on the disk
+ *
+ * @param restore The instant restore
+ * @param offset Offset of the range on the disk
+ * @param length Length of the range
+ * @throws std::runtime_error if the range lies outside the disk
+ */
+void checkInstantRestoreRange(const InstantRestore& restore, uint64_t offset, size_t length)
+{
+    if (offset > restore.diskSize || length > restore.diskSize - offset) {
+        std::cerr << "Access of " << length << " bytes at offset " << offset << " is outside the disk\n";
+        throw std::runtime_error("Access outside the disk.");
+    }
+}
+
+/**
+ * @brief Composes a chunk of the disk from track 0 and the partitions
+ *
+ * Partitions are laid over track 0 as the restore writes them, and ranges
+ * outside both are zeros.
+ *
+ * @param restore The instant restore
+ * @param start Offset of the chunk on the disk
+ * @param length Length of the chunk
+ */
+void composeChunk(InstantRestore& restore, uint64_t start, size_t length)
+{
+    uint8_t* chunk = restore.chunkBuffer.data();
+    memset(chunk, 0, length);
+    uint64_t end = start + length;
+
+    if (start < restore.track0.size()) {
+        memcpy(chunk, restore.track0.data() + start, static_cast<size_t>(std::min<uint64_t>(end, restore.track0.size()) - start));
+    }
+    for (size_t i = 0; i < restore.readers.size(); i++) {
+        uint64_t partitionStart = restore.partitionStarts[i];
+        uint64_t partitionEnd = std::min(partitionStart + restore.readers[i]->partitionLength, restore.diskSize);
+        uint64_t from = std::max(start, partitionStart);
+        uint64_t to = std::min(end, partitionEnd);
+        if (from >= to) { continue; }
+        readPartition(*restore.readers[i], from - partitionStart, chunk + (from - start), static_cast<size_t>(to - from));
+    }
+}
+
+/**
+ * @brief Writes a byte range to the target, retrying short and interrupted writes
+ *
+ * @param restore The instant restore
+ * @param offset Offset of the range on the disk
+ * @param data The bytes to write
+ * @param length Number of bytes to write
+ * @throws std::runtime_error if the target cannot be written
+ */
+void writeTarget(InstantRestore& restore, uint64_t offset, const uint8_t* data, size_t length)
+{
+    while (length > 0) {
+        ssize_t written = pwrite(restore.targetFd, data, length, static_cast<off_t>(offset));
+        if (written < 0 && errno == EINTR) { continue; }
+        if (written <= 0) {
+            std::cerr << "Failed to write " << length << " bytes at offset " << offset << " of the target: " << strerror(errno) << "\n";
+            throw std::runtime_error("Failed to write instant restore target.");
+        }
+        data += written;
+        offset += static_cast<uint64_t>(written);
+        length -= static_cast<size_t>(written);
+    }
+}
+
+/**
+ * @brief Reads a byte range from the target, retrying short and interrupted reads
+ *
+ * @param restore The instant restore
+ * @param offset Offset of the range on the disk
+ * @param buffer Buffer that receives the bytes
+ * @param length Number of bytes to read
+ * @throws std::runtime_error if the target cannot be read
+ */
+void readTarget(InstantRestore& restore, uint64_t offset, uint8_t* buffer, size_t length)
+{
+    while (length > 0) {
+        ssize_t bytesRead = pread(restore.targetFd, buffer, length, static_cast<off_t>(offset));
+        if (bytesRead < 0 && errno == EINTR) { continue; }
+        if (bytesRead <= 0) {
+            std::cerr << "Failed to read " << length << " bytes at offset " << offset << " of the target: " << strerror(errno) << "\n";
+            throw std::runtime_error("Failed to read instant restore target.");
+        }
+        buffer += bytesRead;
+        offset += static_cast<uint64_t>(bytesRead);
+        length -= static_cast<size_t>(bytesRead);
+    }
+}
+
+/**
+ * @brief Marks a chunk as hydrated
+ *
+ * Must be called with the hydration lock held.
+ *
+ * @param restore The instant restore
+ * @param chunk Index of the chunk
+ */
+void markChunkHydrated(InstantRestore& restore, uint64_t chunk)
+{
+    if (restore.hydrated[chunk].load(std::memory_order_relaxed)) { return; }
+    restore.hydrated[chunk].store(true, std::memory_order_release);
+    restore.hydratedChunks.fetch_add(1, std::memory_order_relaxed);
+}
+
+/**
+ * @brief Writes the final contents of a chunk to the target unless it is already hydrated
+ *
+ * Must be called with the hydration lock held.
+ *
+ * @param restore The instant restore
+ * @param chunk Index of the chunk
+ * @return true if the chunk was hydrated by this call
+ * @throws std::runtime_error if a block cannot be read or the target cannot be written
+ */
+bool hydrateChunk(InstantRestore& restore, uint64_t chunk)
+{
+    if (restore.hydrated[chunk].load(std::memory_order_relaxed)) { return false; }
+
+    uint64_t start = chunk * restore.chunkSize;
+    size_t length = static_cast<size_t>(std::min<uint64_t>(restore.chunkSize, restore.diskSize - start));
+    composeChunk(restore, start, length);
+
+    const uint8_t* data = restore.chunkBuffer.data();
+    bool zeros = restore.targetReadsAsZeros && std::all_of(data, data + length, [](uint8_t byte) { return byte == 0; });
+    if (!zeros) {
+        writeTarget(restore, start, data, length);
+        restore.bytesWritten.fetch_add(length, std::memory_order_relaxed);
+    }
+    markChunkHydrated(restore, chunk);
+    return true;
+}
+
+/**
+ * @brief Takes the hydration lock for a read or write
+ *
+ * Registers the caller as waiting first, which holds the background
+ * hydrator back until the caller is done.
+ *
+ * @param restore The instant restore
+ * @return std::unique_lock<std::mutex> The held lock
+ */
+std::unique_lock<std::mutex> lockForDemand(InstantRestore& restore)
+{
+    restore.waitingRequests.fetch_add(1);
+    std::unique_lock<std::mutex> lock(restore.hydrationLock);
+    restore.waitingRequests.fetch_sub(1);
+    return lock;
+}
+
+/**
+ * @brief Releases the hydration lock taken for a read or write and lets the hydrator resume
+ *
+ * @param restore The instant restore
+ * @param lock The held lock
+ */
+void unlockForDemand(InstantRestore& restore, std::unique_lock<std::mutex>& lock)
+{
+    lock.unlock();
+    restore.demandServed.notify_all();
+}
+
+/**
+ * @brief Hydrates the chunks of the disk in order until all are hydrated or hydration is stopped
+ *
+ * @param restore The instant restore
+ */
+void runHydrator(InstantRestore& restore)
+{
+    try {
+        for (uint64_t chunk = 0; chunk < restore.chunkCount && !restore.stopping.load(); chunk++) {
+            if (restore.hydrated[chunk].load(std::memory_order_acquire)) { continue; }
+            std::unique_lock<std::mutex> lock(restore.hydrationLock);
+            restore.demandServed.wait(lock, [&restore]() { return restore.waitingRequests.load() == 0 || restore.stopping.load(); });
+            if (restore.stopping.load()) { break; }
+            hydrateChunk(restore, chunk);
+        }
+    }
+    catch (...) {
+        restore.hydratorFailure = std::current_exception();
+    }
+}
+
+/**
+ * @brief Opens a disk of a backup for an instant restore into a target
+ *
+ * @param restore Output parameter for the instant restore
+ * @param backupFilePath Path of the restore point's backup file
+ * @param backupFileLayout Structure containing the backup file layout
+ * @param diskIndex Index of the disk to restore
+ * @param partitionNumbers Partitions to restore, or empty for every partition; other ranges read as zeros
+ * @param targetPath Image file or block device hydrated
+ * @param targetReadsAsZeros Whether the target reads as zeros where it has not been written
+ * @param chunkSize Size of each hydration chunk, a multiple of the sector size
+ * @throws std::runtime_error if a partition is not in the backup, or the backup set or target cannot be opened
+ */
+void openInstantRestore(InstantRestore& restore, const std::string& backupFilePath, file_structs::File_Layout& backupFileLayout, int diskIndex,
+    const std::vector<int32_t>& partitionNumbers, const std::string& targetPath, bool targetReadsAsZeros, uint32_t chunkSize)
+{
+    auto& disk = backupFileLayout.disks[diskIndex];
+    uint32_t bytesPerSector = disk._geometry.bytes_per_sector;
+    if (chunkSize == 0 || bytesPerSector == 0 || chunkSize % bytesPerSector != 0) {
+        std::cerr << "Hydration chunk size " << chunkSize << " is not a multiple of the " << bytesPerSector << " byte sector size\n";
+        throw std::runtime_error("Invalid hydration chunk size.");
+    }
+    for (int32_t partitionNumber : partitionNumbers) {
+        if (std::none_of(disk.partitions.begin(), disk.partitions.end(),
+            [partitionNumber](file_structs::Partition::Partition_Layout& p) { return p._header.partition_number == partitionNumber; })) {
+            std::cerr << "Partition " << partitionNumber << " is not in the backup\n";
+            throw std::runtime_error("Partition to restore not found in backup.");
+        }
+    }
+
+    restore.diskSize = disk._geometry.disk_size / bytesPerSector * bytesPerSector;
+    restore.chunkSize = chunkSize;
+    restore.chunkCount = (restore.diskSize + chunkSize - 1) / chunkSize;
+    restore.track0 = disk.track0;
+    restore.targetReadsAsZeros = targetReadsAsZeros;
+    restore.chunkBuffer.assign(chunkSize, 0);
+    restore.hydrated.reset(new std::atomic<bool>[restore.chunkCount]);
+    for (uint64_t chunk = 0; chunk < restore.chunkCount; chunk++) { restore.hydrated[chunk].store(false, std::memory_order_relaxed); }
+    restore.hydratedChunks.store(0);
+    restore.demandHydratedChunks.store(0);
+    restore.bytesWritten.store(0);
+    restore.stopping.store(false);
+    restore.hydratorFailure = nullptr;
+
+    restore.readers.clear();
+    restore.partitionStarts.clear();
+    for (auto& partition : disk.partitions) {
+        if (!partitionNumbers.empty() &&
+            std::find(partitionNumbers.begin(), partitionNumbers.end(), partition._header.partition_number) == partitionNumbers.end()) {
+            continue;
+        }
+        auto reader = std::make_unique<PartitionReader>();
+        openPartitionReader(*reader, backupFilePath, partition, diskIndex, bytesPerSector);
+        restore.readers.push_back(std::move(reader));
+        restore.partitionStarts.push_back(partition._geometry.start);
+    }
+
+    restore.targetFd = open(targetPath.c_str(), O_RDWR | O_CLOEXEC);
+    off_t targetSize = restore.targetFd < 0 ? -1 : lseek(restore.targetFd, 0, SEEK_END);
+    if (targetSize < 0 || static_cast<uint64_t>(targetSize) < restore.diskSize) {
+        std::cerr << "Failed to open " << targetPath << " as a target of " << restore.diskSize << " bytes: "
+                  << (targetSize < 0 ? strerror(errno) : "too small") << "\n";
+        closeInstantRestore(restore);
+        throw std::runtime_error("Failed to open instant restore target.");
+    }
+}
+
+/**
+ * @brief Starts hydrating the chunks of the disk in the background
+ *
+ * @param restore The opened instant restore
+ */
+void startHydration(InstantRestore& restore)
+{
+    restore.hydrator = std::thread(runHydrator, std::ref(restore));
+}
+
+/**
+ * @brief Reads a byte range of the disk
+ *
+ * @param restore The opened instant restore
+ * @param offset Offset of the range on the disk
+ * @param buffer Buffer that receives the bytes
+ * @param length Number of bytes to read
+ * @throws std::runtime_error if the range lies outside the disk, or a chunk cannot be hydrated or read
+ */
+void readInstantRestore(InstantRestore& restore, uint64_t offset, void* buffer, size_t length)
+{
+    checkInstantRestoreRange(restore, offset, length);
+    if (length == 0) { return; }
+
+    uint64_t firstChunk = offset / restore.chunkSize;
+    uint64_t lastChunk = (offset + length - 1) / restore.chunkSize;
+    bool hydrated = true;
+    for (uint64_t chunk = firstChunk; chunk <= lastChunk && hydrated; chunk++) {
+        hydrated = restore.hydrated[chunk].load(std::memory_order_acquire);
+    }
+    if (!hydrated) {
+        std::unique_lock<std::mutex> lock = lockForDemand(restore);
+        try {
+            for (uint64_t chunk = firstChunk; chunk <= lastChunk; chunk++) {
+                if (hydrateChunk(restore, chunk)) { restore.demandHydratedChunks.fetch_add(1, std::memory_order_relaxed); }
+            }
+        }
+        catch (...) {
+            unlockForDemand(restore, lock);
+            throw;
+        }
+        unlockForDemand(restore, lock);
+    }
+    readTarget(restore, offset, static_cast<uint8_t*>(buffer), length);
+}
+
+/**
+ * @brief Writes a byte range of the disk
+ *
+ * @param restore The opened instant restore
+ * @param offset Offset of the range on the disk
+ * @param data The bytes to write
+ * @param length Number of bytes to write
+ * @throws std::runtime_error if the range lies outside the disk, or a chunk cannot be hydrated or written
+ */
+void writeInstantRestore(InstantRestore& restore, uint64_t offset, const void* data, size_t length)
+{
+    checkInstantRestoreRange(restore, offset, length);
+    if (length == 0) { return; }
+
+    uint64_t end = offset + length;
+    uint64_t firstChunk = offset / restore.chunkSize;
+    uint64_t lastChunk = (end - 1) / restore.chunkSize;
+    std::unique_lock<std::mutex> lock = lockForDemand(restore);
+    try {
+        // Chunks the write covers in part keep the rest of their contents, so they are hydrated first
+        if (offset % restore.chunkSize != 0 && hydrateChunk(restore, firstChunk)) {
+            restore.demandHydratedChunks.fetch_add(1, std::memory_order_relaxed);
+        }
+        if (end % restore.chunkSize != 0 && end != restore.diskSize && hydrateChunk(restore, lastChunk)) {
+            restore.demandHydratedChunks.fetch_add(1, std::memory_order_relaxed);
+        }
+        writeTarget(restore, offset, static_cast<const uint8_t*>(data), length);
+        for (uint64_t chunk = firstChunk; chunk <= lastChunk; chunk++) { markChunkHydrated(restore, chunk); }
+    }
+    catch (...) {
+        unlockForDemand(restore, lock);
+        throw;
+    }
+    unlockForDemand(restore, lock);
+}
+
+/**
+ * @brief Makes the bytes written to the target durable
+ *
+ * @param restore The opened instant restore
+ * @throws std::runtime_error if the target cannot be synced
+ */
+void flushInstantRestore(InstantRestore& restore)
+{
+    if (fdatasync(restore.targetFd) != 0) {
+        std::cerr << "Failed to sync the instant restore target: " << strerror(errno) << "\n";
+        throw std::runtime_error("Failed to sync instant restore target.");
+    }
+}
+
+/**
+ * @brief Returns whether every chunk of the disk has been hydrated
+ *
+ * @param restore The opened instant restore
+ * @return true if the target holds the whole disk
+ */
+bool isHydrationComplete(const InstantRestore& restore)
+{
+    return restore.hydratedChunks.load() == restore.chunkCount;
+}
+
+/**
+ * @brief Waits for the background hydration to finish
+ *
+ * @param restore The instant restore being hydrated
+ * @throws std::runtime_error, or the error that stopped the hydration, if it failed
+ */
+void waitForHydration(InstantRestore& restore)
+{
+    if (restore.hydrator.joinable()) { restore.hydrator.join(); }
+    if (restore.hydratorFailure) { std::rethrow_exception(restore.hydratorFailure); }
+    if (!isHydrationComplete(restore)) { throw std::runtime_error("Hydration was stopped before it completed."); }
+}
+
+/**
+ * @brief Stops the background hydration and closes the backup files and target
+ *
+ * @param restore The instant restore to close
+ */
+void closeInstantRestore(InstantRestore& restore)
+{
+    {
+        std::lock_guard<std::mutex> guard(restore.hydrationLock);
+        restore.stopping.store(true);
+    }
+    restore.demandServed.notify_all();
+    if (restore.hydrator.joinable()) { restore.hydrator.join(); }
+
+    for (auto& reader : restore.readers) { closePartitionReader(*reader); }
+    restore.readers.clear();
+    if (restore.targetFd >= 0) {
+        fdatasync(restore.targetFd);
+        close(restore.targetFd);
+        restore.targetFd = -1;
+    }
+}
@@ -0,0 +1,153 @@
+/**
+ * @file instant_restore.h
+ * @brief Serving a disk from its backup while it is restored in the background
+ *
+ * This file declares an instant restore, which makes a backed up disk
+ * usable at once while the real target is written behind it. The disk is
+ * split into hydration chunks. A background thread hydrates the chunks in
+ * disk order, composing each from track 0 and the partitions' blocks, which
+ * are resolved on demand through partition readers, and writing it to the
+ * target. A read hydrates the chunks it touches ahead of the background
+ * order and is then served from the target; reads of hydrated chunks go to
+ * the target alone. Writes land on the target, so a guest can run from the
+ * disk while it is restored.
+ *
+ * Which chunks are hydrated is kept in memory only. An interrupted instant
+ * restore leaves a partial target and must be started again.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../img_handler/file_struct.h"
+#include "../volume/partition_reader.h"
+
+/**
+ * @brief Default size of the chunks a disk is hydrated in
+ */
+const uint32_t DEFAULT_HYDRATION_CHUNK_SIZE = 1024 * 1024;
+
+/**
+ * @brief A disk served from its backup while it is hydrated into a target
+ *
+ * Reads and writes are safe from several threads.
+ */
+struct InstantRestore
+{
+    std::vector<uint8_t> track0;                            // Track 0 of the disk
+    std::vector<std::unique_ptr<PartitionReader>> readers;  // Readers of the partitions restored
+    std::vector<uint64_t> partitionStarts;                  // Offset of each reader's partition on the disk
+    int targetFd = -1;                                      // The target being hydrated
+    bool targetReadsAsZeros = false;                        // Whether unwritten ranges of the target read as zeros
+    uint64_t diskSize = 0;                                  // Size of the disk in bytes
+    uint32_t chunkSize = DEFAULT_HYDRATION_CHUNK_SIZE;      // Size of each hydration chunk
+    uint64_t chunkCount = 0;                                // Number of hydration chunks
+    std::unique_ptr<std::atomic<bool>[]> hydrated;          // Whether each chunk holds its final contents on the target
+    std::vector<uint8_t> chunkBuffer;                       // Buffer chunks are composed in
+    std::mutex hydrationLock;                               // Serialises hydration, writes and the partition readers
+    std::condition_variable demandServed;                   // Signalled when no reads are waiting to hydrate
+    std::atomic<uint32_t> waitingRequests{ 0 };             // Reads and writes waiting for the hydration lock
+    std::atomic<bool> stopping{ false };                    // Set when the background hydration is stopped
+    std::thread hydrator;                                   // Thread hydrating the chunks in disk order
+    std::exception_ptr hydratorFailure;                     // Error that stopped the background hydration, if any
+    std::atomic<uint64_t> hydratedChunks{ 0 };              // Chunks hydrated so far
+    std::atomic<uint64_t> demandHydratedChunks{ 0 };        // Chunks hydrated ahead of the background order
+    std::atomic<uint64_t> bytesWritten{ 0 };                // Bytes written to the target by hydration
+};
+
+/**
+ * @brief Opens a disk of a backup for an instant restore into a target
+ *
+ * The target must already exist at the disk's size; nothing is written to
+ * it until hydration starts.
+ *
+ * @param restore Output parameter for the instant restore
+ * @param backupFilePath Path of the restore point's backup file
+ * @param backupFileLayout Structure containing the backup file layout
+ * @param diskIndex Index of the disk to restore
+ * @param partitionNumbers Partitions to restore, or empty for every partition; other ranges read as zeros
+ * @param targetPath Image file or block device hydrated
+ * @param targetReadsAsZeros Whether the target reads as zeros where it has not been written, such as a new sparse image, so chunks of zeros need not be written
+ * @param chunkSize Size of each hydration chunk, a multiple of the sector size
+ * @throws std::runtime_error if a partition is not in the backup, or the backup set or target cannot be opened
+ */
+void openInstantRestore(InstantRestore& restore, const std::string& backupFilePath, file_structs::File_Layout& backupFileLayout, int diskIndex,
+    const std::vector<int32_t>& partitionNumbers, const std::string& targetPath, bool targetReadsAsZeros,
+    uint32_t chunkSize = DEFAULT_HYDRATION_CHUNK_SIZE);
+
+/**
+ * @brief Starts hydrating the chunks of the disk in the background
+ *
+ * @param restore The opened instant restore
+ */
+void startHydration(InstantRestore& restore);
+
+/**
+ * @brief Reads a byte range of the disk
+ *
+ * Chunks of the range that are not yet hydrated are hydrated first.
+ *
+ * @param restore The opened instant restore
+ * @param offset Offset of the range on the disk
+ * @param buffer Buffer that receives the bytes
+ * @param length Number of bytes to read
+ * @throws std::runtime_error if the range lies outside the disk, or a chunk cannot be hydrated or read
+ */
+void readInstantRestore(InstantRestore& restore, uint64_t offset, void* buffer, size_t length);
+
+/**
+ * @brief Writes a byte range of the disk
+ *
+ * Chunks the range covers in part are hydrated first; chunks it covers
+ * entirely are taken as hydrated once written.
+ *
+ * @param restore The opened instant restore
+ * @param offset Offset of the range on the disk
+ * @param data The bytes to write
+ * @param length Number of bytes to write
+ * @throws std::runtime_error if the range lies outside the disk, or a chunk cannot be hydrated or written
+ */
+void writeInstantRestore(InstantRestore& restore, uint64_t offset, const void* data, size_t length);
+
+/**
+ * @brief Makes the bytes written to the target durable
+ *
+ * @param restore The opened instant restore
+ * @throws std::runtime_error if the target cannot be synced
+ */
+void flushInstantRestore(InstantRestore& restore);
+
+/**
+ * @brief Returns whether every chunk of the disk has been hydrated
+ *
+ * @param restore The opened instant restore
+ * @return true if the target holds the whole disk
+ */
+bool isHydrationComplete(const InstantRestore& restore);
+
+/**
+ * @brief Waits for the background hydration to finish
+ *
+ * @param restore The instant restore being hydrated
+ * @throws std::runtime_error, or the error that stopped the hydration, if it failed
+ */
+void waitForHydration(InstantRestore& restore);
+
+/**
+ * @brief Stops the background hydration and closes the backup files and target
+ *
+ * The target is synced before it is closed. Chunks not yet hydrated are
+ * left as they are on the target.
+ *
+ * @param restore The instant restore to close
+ */
+void closeInstantRestore(InstantRestore& restore);
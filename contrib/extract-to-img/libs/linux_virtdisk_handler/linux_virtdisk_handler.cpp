@@ -1,79 +1,195 @@
 /**
  * @file linux_virtdisk_handler.cpp
  * @brief Implementation of Linux virtual disk management functions
- * 
+ *
  * This file implements the functionality for creating, mounting, and managing
  * virtual disk images on Linux systems using the loop device interface.
+ * Images are created sparse with ftruncate and attached with the loop
+ * ioctls directly, without running any commands.
  */
 
 #include "linux_virtdisk_handler.h"
-#include <stdio.h>
-#include <stdlib.h>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
 #include <iostream>
+#include <linux/loop.h>
+#include <stdexcept>
+#include <sys/ioctl.h>
+#include <unistd.h>
 
 /**
- * @brief Runs a shell command and captures its output
- * 
- * Executes a shell command and captures its output line by line.
- * The output is stored in the provided string reference.
- * 
- * @param command The shell command to execute
- * @param output Reference to store the command output
+ * @brief Attempts to claim a free loop device before giving up
+ *
+ * Another process can claim the device LOOP_CTL_GET_FREE returned before
+ * it is configured, in which case the next free device is tried.
  */
-void RunCommandWithOutput(std::string command, std::string &output)
+const int LOOP_ATTACH_ATTEMPTS = 16;
+
+/**
+ * @brief Returns whether the kernel has the LOOP_CONFIGURE ioctl
+ *
+ * Kernels older than 5.8 fail unknown loop ioctls with EINVAL, the same
+ * error LOOP_CONFIGURE gives for a configuration the backing file cannot
+ * take. The probe passes no backing file, which LOOP_CONFIGURE rejects
+ * with EBADF before looking at anything else.
+ *
+ * @param loopFd Descriptor of the loop device
+ * @return true unless the probe fails with EINVAL
+ */
+bool hasLoopConfigure(int loopFd)
+{
+    struct loop_config config;
+    memset(&config, 0, sizeof(config));
+    config.fd = static_cast<uint32_t>(-1);
+    return ioctl(loopFd, LOOP_CONFIGURE, &config) == 0 || errno != EINVAL;
+}
+
+/**
+ * @brief Attaches a backing file to a loop device
+ *
+ * Uses LOOP_CONFIGURE, which sets up the device in one step. Kernels
+ * older than 5.8 do not have it, and LOOP_SET_FD followed by
+ * LOOP_SET_STATUS64 is used instead; the block size is then left at 512.
+ * Any other EINVAL from LOOP_CONFIGURE is returned, so the caller can
+ * retry with other flags.
+ *
+ * @param loopFd Descriptor of the loop device
+ * @param imageFd Descriptor of the backing file
+ * @param sectorSize Logical block size the loop device reports
+ * @param flags LO_FLAGS_* the device is configured with
+ * @return int 0 on success, otherwise the errno of the failed ioctl
+ */
+int configureLoopDevice(int loopFd, int imageFd, unsigned long sectorSize, uint32_t flags)
 {
-    FILE *fp = popen(command.c_str(), "r");
-    char c = fgetc(fp);
-    do
-    {
-        output += c;
-        c = fgetc(fp);
-    } while (c != '\n');
-    pclose(fp);
+    struct loop_config config;
+    memset(&config, 0, sizeof(config));
+    config.fd = static_cast<uint32_t>(imageFd);
+    config.block_size = static_cast<uint32_t>(sectorSize);
+    config.info.lo_flags = flags;
+    if (ioctl(loopFd, LOOP_CONFIGURE, &config) == 0) { return 0; }
+    int error = errno;
+    if (error == EINVAL && hasLoopConfigure(loopFd)) { return error; }
+    if (error != EINVAL && error != ENOTTY) { return error; }
+
+    if (ioctl(loopFd, LOOP_SET_FD, imageFd) != 0) { return errno; }
+    struct loop_info64 info;
+    memset(&info, 0, sizeof(info));
+    info.lo_flags = flags & ~static_cast<uint32_t>(LO_FLAGS_DIRECT_IO);
+    if (ioctl(loopFd, LOOP_SET_STATUS64, &info) != 0) {
+        error = errno;
+        ioctl(loopFd, LOOP_CLR_FD, 0);
+        return error;
+    }
+    if ((flags & LO_FLAGS_DIRECT_IO) != 0) { ioctl(loopFd, LOOP_SET_DIRECT_IO, 1UL); }
+    return 0;
 }
 
 /**
  * @brief Creates a new disk image file
- * 
- * Creates a new disk image file filled with zeros using dd command.
- * The image is created with the specified size and sector size.
- * Sets appropriate permissions on the created file.
- * 
+ *
+ * Creates a sparse image file of the specified size, which reads as zeros
+ * and takes no space until it is written. Any existing file is replaced.
+ * The size is rounded down to a whole number of sectors.
+ *
  * @param imgPath Path where the image file should be created
  * @param size Total size of the image in bytes
  * @param sectorSize Size of each sector in bytes
+ * @throws std::runtime_error if the image cannot be created
  */
 void CreateIMG(std::string imgPath, unsigned long long size, unsigned long sectorSize)
 {
-    uint32_t count = size / sectorSize;
-    system(("sudo dd if=/dev/zero of=" + imgPath + " bs=" + std::to_string(sectorSize) + " count=" + std::to_string(count)).c_str());
-    system(("sudo chmod 777 " + imgPath).c_str());
+    unsigned long long imageSize = size / sectorSize * sectorSize;
+    int fd = open(imgPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0 || ftruncate(fd, static_cast<off_t>(imageSize)) != 0) {
+        std::cerr << "Failed to create " << imgPath << ": " << strerror(errno) << "\n";
+        if (fd >= 0) { close(fd); }
+        throw std::runtime_error("Failed to create disk image.");
+    }
+    close(fd);
 }
 
 /**
  * @brief Mounts a disk image using loop device
- * 
- * Mounts an existing disk image file using the loop device interface.
- * The function finds an available loop device and attaches the image to it.
- * 
+ *
+ * Claims a free loop device through /dev/loop-control and attaches the
+ * image to it with partition scanning, so the image's partitions appear as
+ * /dev/loopNpM. Direct I/O is asked for, so image data is not cached both
+ * for the loop device and for the image file; file systems that cannot do
+ * direct I/O fall back to buffered I/O.
+ *
  * @param imgPath Path to the image file to mount
  * @param loopFilePath Output parameter that receives the path to the loop device
+ * @param sectorSize Logical sector size the loop device reports
+ * @throws std::runtime_error if no loop device can be attached
  */
-void MountIMG(std::string imgPath, std::string &loopFilePath)
+void MountIMG(std::string imgPath, std::string &loopFilePath, unsigned long sectorSize)
 {
-    RunCommandWithOutput("sudo losetup -f", loopFilePath);
-    system(("sudo losetup -P " + loopFilePath + " " + imgPath).c_str());
+    int imageFd = open(imgPath.c_str(), O_RDWR | O_CLOEXEC);
+    if (imageFd < 0) {
+        std::cerr << "Failed to open " << imgPath << ": " << strerror(errno) << "\n";
+        throw std::runtime_error("Failed to open disk image.");
+    }
+    int controlFd = open("/dev/loop-control", O_RDWR | O_CLOEXEC);
+    if (controlFd < 0) {
+        std::cerr << "Failed to open /dev/loop-control: " << strerror(errno) << "\n";
+        close(imageFd);
+        throw std::runtime_error("Failed to open loop control device.");
+    }
+
+    uint32_t flags = LO_FLAGS_PARTSCAN | LO_FLAGS_DIRECT_IO;
+    int error = 0;
+    for (int attempt = 0; attempt < LOOP_ATTACH_ATTEMPTS; attempt++) {
+        int loopNumber = ioctl(controlFd, LOOP_CTL_GET_FREE);
+        if (loopNumber < 0) {
+            error = errno;
+            break;
+        }
+        std::string loopPath = "/dev/loop" + std::to_string(loopNumber);
+        int loopFd = open(loopPath.c_str(), O_RDWR | O_CLOEXEC);
+        if (loopFd < 0) {
+            error = errno;
+            break;
+        }
+
+        error = configureLoopDevice(loopFd, imageFd, sectorSize, flags);
+        if (error == EINVAL && (flags & LO_FLAGS_DIRECT_IO) != 0) {
+            // The image's file system cannot do direct I/O at this block size
+            flags &= ~static_cast<uint32_t>(LO_FLAGS_DIRECT_IO);
+            error = configureLoopDevice(loopFd, imageFd, sectorSize, flags);
+        }
+        close(loopFd);
+        if (error == 0) {
+            loopFilePath = loopPath;
+            break;
+        }
+        if (error != EBUSY) { break; }
+    }
+    close(controlFd);
+    close(imageFd);
+
+    if (error != 0) {
+        std::cerr << "Failed to attach " << imgPath << " to a loop device: " << strerror(error) << "\n";
+        throw std::runtime_error("Failed to attach loop device.");
+    }
 }
 
 /**
  * @brief Unmounts a disk image from its loop device
- * 
+ *
  * Detaches a disk image from its loop device, making the loop device
  * available for other uses.
- * 
+ *
  * @param loopFilePath Path to the loop device to detach
+ * @throws std::runtime_error if the device cannot be detached
  */
 void UnmountIMG(std::string loopFilePath)
 {
-    system(("sudo losetup -d" + loopFilePath).c_str());
+    int loopFd = open(loopFilePath.c_str(), O_RDWR | O_CLOEXEC);
+    if (loopFd < 0 || ioctl(loopFd, LOOP_CLR_FD, 0) != 0) {
+        std::cerr << "Failed to detach " << loopFilePath << ": " << strerror(errno) << "\n";
+        if (loopFd >= 0) { close(loopFd); }
+        throw std::runtime_error("Failed to detach loop device.");
+    }
+    close(loopFd);
 }
@@ -11,12 +11,13 @@
 /**
  * @brief Creates a new disk image file
  * 
- * Creates a new disk image file filled with zeros using dd command.
- * The image is created with the specified size and sector size.
+ * Creates a sparse disk image file that reads as zeros, with the
+ * specified size rounded down to whole sectors.
  * 
  * @param imgPath Path where the image file should be created
  * @param size Total size of the image in bytes
  * @param sectorSize Size of each sector in bytes
+ * @throws std::runtime_error if the image cannot be created
  */
 void CreateIMG(std::string imgPath, unsigned long long size, unsigned long sectorSize);
 
@@ -24,12 +25,15 @@ void CreateIMG(std::string imgPath, unsigned long long size, unsigned long secto
  * @brief Mounts a disk image using loop device
  * 
  * Mounts an existing disk image file using the loop device interface.
- * The function finds an available loop device and attaches the image to it.
+ * The function claims an available loop device and attaches the image to
+ * it with partition scanning and, where the file system allows, direct I/O.
  * 
  * @param imgPath Path to the image file to mount
  * @param loopFilePath Output parameter that receives the path to the loop device
+ * @param sectorSize Logical sector size the loop device reports
+ * @throws std::runtime_error if no loop device can be attached
  */
-void MountIMG(std::string imgPath, std::string &loopFilePath);
+void MountIMG(std::string imgPath, std::string &loopFilePath, unsigned long sectorSize = 512);
 
 /**
  * @brief Unmounts a disk image from its loop device
@@ -38,5 +42,6 @@ void MountIMG(std::string imgPath, std::string &loopFilePath);
  * available for other uses.
  * 
  * @param loopFilePath Path to the loop device to detach
+ * @throws std::runtime_error if the device cannot be detached
  */
 void UnmountIMG(std::string loopFilePath);
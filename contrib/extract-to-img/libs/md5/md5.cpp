@@ -0,0 +1,161 @@
+/**
+ * @file md5.cpp
+ * @brief Implementation of the MD5 digest (RFC 1321)
+ * 
+ * This file implements the MD5 message digest used for the hashes stored in
+ * the data block index of a backup file.
+ */
+
+#include <algorithm>
+#include <cstring>
+
+#include "md5.h"
+
+/**
+ * @brief Per-round left rotation amounts
+ */
+static const uint32_t MD5_SHIFTS[64] = {
+    7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22,
+    5, 9, 14, 20, 5, 9, 14, 20, 5, 9, 14, 20, 5, 9, 14, 20,
+    4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23,
+    6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21
+};
+
+/**
+ * @brief Per-round additive constants, floor(abs(sin(i + 1)) * 2^32)
+ */
+static const uint32_t MD5_CONSTANTS[64] = {
+    0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee, 0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,
+    0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be, 0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821,
+    0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa, 0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+    0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed, 0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a,
+    0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c, 0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,
+    0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05, 0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+    0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039, 0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
+    0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1, 0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391
+};
+
+/**
+ * @brief Processes one 64 byte input block
+ * 
+ * @param state The digest state words
+ * @param block The input block
+ */
+static void md5Transform(uint32_t state[4], const uint8_t block[64])
+{
+    uint32_t words[16];
+    for (int i = 0; i < 16; i++) {
+        words[i] = static_cast<uint32_t>(block[i * 4]) | (static_cast<uint32_t>(block[i * 4 + 1]) << 8) |
+            (static_cast<uint32_t>(block[i * 4 + 2]) << 16) | (static_cast<uint32_t>(block[i * 4 + 3]) << 24);
+    }
+
+    uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+    for (int i = 0; i < 64; i++) {
+        uint32_t f;
+        int g;
+        if (i < 16) { f = (b & c) | (~b & d); g = i; }
+        else if (i < 32) { f = (d & b) | (~d & c); g = (5 * i + 1) % 16; }
+        else if (i < 48) { f = b ^ c ^ d; g = (3 * i + 5) % 16; }
+        else { f = c ^ (b | ~d); g = (7 * i) % 16; }
+
+        uint32_t rotated = a + f + MD5_CONSTANTS[i] + words[g];
+        a = d;
+        d = c;
+        c = b;
+        b = b + ((rotated << MD5_SHIFTS[i]) | (rotated >> (32 - MD5_SHIFTS[i])));
+    }
+
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+}
+
+/**
+ * @brief Starts a new MD5 computation
+ * 
+ * @param context The context to initialise
+ */
+void md5Init(MD5Context& context)
+{
+    context.state[0] = 0x67452301;
+    context.state[1] = 0xefcdab89;
+    context.state[2] = 0x98badcfe;
+    context.state[3] = 0x10325476;
+    context.byteCount = 0;
+}
+
+/**
+ * @brief Adds data to an MD5 computation
+ * 
+ * @param context The running context
+ * @param data Pointer to the data to hash
+ * @param length Number of bytes to hash
+ */
+void md5Update(MD5Context& context, const void* data, size_t length)
+{
+    const uint8_t* input = static_cast<const uint8_t*>(data);
+    size_t buffered = static_cast<size_t>(context.byteCount % 64);
+    context.byteCount += length;
+
+    if (buffered > 0) {
+        size_t fill = std::min(length, 64 - buffered);
+        memcpy(context.buffer + buffered, input, fill);
+        input += fill;
+        length -= fill;
+        if (buffered + fill < 64) { return; }
+        md5Transform(context.state, context.buffer);
+    }
+
+    while (length >= 64) {
+        md5Transform(context.state, input);
+        input += 64;
+        length -= 64;
+    }
+    memcpy(context.buffer, input, length);
+}
+
+/**
+ * @brief Finishes an MD5 computation
+ * 
+ * Appends the padding and the message length in bits, then writes the
+ * state words out little-endian.
+ * 
+ * @param context The running context
+ * @param digest Output buffer that receives the 16 byte digest
+ */
+void md5Final(MD5Context& context, uint8_t digest[MD5_DIGEST_LENGTH])
+{
+    uint64_t bitCount = context.byteCount * 8;
+    uint8_t padding[72] = { 0x80 };
+    size_t buffered = static_cast<size_t>(context.byteCount % 64);
+    size_t paddingLength = (buffered < 56) ? (56 - buffered) : (120 - buffered);
+    md5Update(context, padding, paddingLength);
+
+    uint8_t lengthBytes[8];
+    for (int i = 0; i < 8; i++) {
+        lengthBytes[i] = static_cast<uint8_t>(bitCount >> (8 * i));
+    }
+    md5Update(context, lengthBytes, sizeof(lengthBytes));
+
+    for (int i = 0; i < 4; i++) {
+        for (int j = 0; j < 4; j++) {
+            digest[i * 4 + j] = static_cast<uint8_t>(context.state[i] >> (8 * j));
+        }
+    }
+}
+
+/**
+ * @brief Computes the MD5 digest of a buffer
+ * 
+ * @param data Pointer to the data to hash
+ * @param length Number of bytes to hash
+ * @param digest Output buffer that receives the 16 byte digest
+ */
+void computeMD5(const void* data, size_t length, uint8_t digest[MD5_DIGEST_LENGTH])
+{
+    MD5Context context;
+    md5Init(context);
+    md5Update(context, data, length);
+    md5Final(context, digest);
+}
@@ -0,0 +1,61 @@
+/**
+ * @file md5.h
+ * @brief MD5 digest used for data block hashes
+ * 
+ * Each entry of the data block index carries the MD5 digest of the block as
+ * stored in the backup file. This file declares a small MD5 implementation
+ * (RFC 1321) used to produce and check those digests.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * @brief Size of an MD5 digest in bytes
+ */
+const size_t MD5_DIGEST_LENGTH = 16;
+
+/**
+ * @brief Running state of an MD5 computation
+ */
+struct MD5Context
+{
+    uint32_t state[4];      // Digest state words A, B, C and D
+    uint64_t byteCount;     // Total number of bytes hashed
+    uint8_t buffer[64];     // Partial input block
+};
+
+/**
+ * @brief Starts a new MD5 computation
+ * 
+ * @param context The context to initialise
+ */
+void md5Init(MD5Context& context);
+
+/**
+ * @brief Adds data to an MD5 computation
+ * 
+ * @param context The running context
+ * @param data Pointer to the data to hash
+ * @param length Number of bytes to hash
+ */
+void md5Update(MD5Context& context, const void* data, size_t length);
+
+/**
+ * @brief Finishes an MD5 computation
+ * 
+ * @param context The running context
+ * @param digest Output buffer that receives the 16 byte digest
+ */
+void md5Final(MD5Context& context, uint8_t digest[MD5_DIGEST_LENGTH]);
+
+/**
+ * @brief Computes the MD5 digest of a buffer
+ * 
+ * @param data Pointer to the data to hash
+ * @param length Number of bytes to hash
+ * @param digest Output buffer that receives the 16 byte digest
+ */
+void computeMD5(const void* data, size_t length, uint8_t digest[MD5_DIGEST_LENGTH]);
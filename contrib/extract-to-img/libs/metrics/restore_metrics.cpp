@@ -0,0 +1,415 @@
+/**
+ * @file restore_metrics.cpp
+ * @brief Implementation of restore metrics recording and reporting
+ *
+ * This file implements the relaxed atomic updates used on the restore hot
+ * path, percentile estimation from the log-linear latency histograms, and
+ * the JSON and Prometheus report writers.
+ */
+
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+#include "../../dependencies/include/nlohmann/json.hpp"
+#include "restore_metrics.h"
+
+/**
+ * @brief Quantiles written to the reports
+ */
+const double REPORTED_PERCENTILES[] = { 0.5, 0.99 };
+
+/**
+ * @brief Returns the position of the highest set bit of a value
+ *
+ * @param value A non-zero value
+ * @return uint32_t The bit position, from 0 to 63
+ */
+uint32_t highestBit(uint64_t value)
+{
+    uint32_t bit = 0;
+    for (uint32_t shift = 32; shift > 0; shift /= 2) {
+        if (value >> shift) {
+            value >>= shift;
+            bit += shift;
+        }
+    }
+    return bit;
+}
+
+/**
+ * @brief Returns the histogram bucket of a latency
+ *
+ * @param nanoseconds The latency in nanoseconds
+ * @return uint32_t Index into StageMetrics::latencyBuckets
+ */
+uint32_t getLatencyBucket(uint64_t nanoseconds)
+{
+    if (nanoseconds < LATENCY_SUB_BUCKETS) { return static_cast<uint32_t>(nanoseconds); }
+    uint32_t bit = highestBit(nanoseconds);
+    return bit * LATENCY_SUB_BUCKETS + static_cast<uint32_t>((nanoseconds >> (bit - 2)) & (LATENCY_SUB_BUCKETS - 1));
+}
+
+/**
+ * @brief Returns the smallest latency held by a histogram bucket
+ *
+ * @param bucket Index into StageMetrics::latencyBuckets
+ * @return uint64_t The lower bound in nanoseconds
+ */
+uint64_t getBucketLowerBound(uint32_t bucket)
+{
+    if (bucket < LATENCY_SUB_BUCKETS) { return bucket; }
+    uint32_t bit = bucket / LATENCY_SUB_BUCKETS;
+    return (1ULL << bit) + (bucket % LATENCY_SUB_BUCKETS) * (1ULL << (bit - 2));
+}
+
+/**
+ * @brief Returns the range of latencies held by a histogram bucket
+ *
+ * @param bucket Index into StageMetrics::latencyBuckets
+ * @return uint64_t The bucket width in nanoseconds
+ */
+uint64_t getBucketWidth(uint32_t bucket)
+{
+    if (bucket < LATENCY_SUB_BUCKETS) { return 1; }
+    return 1ULL << (bucket / LATENCY_SUB_BUCKETS - 2);
+}
+
+/**
+ * @brief Raises an atomic maximum to at least a value
+ *
+ * @param maximum The maximum to update
+ * @param value The value seen
+ */
+template <typename T>
+void updateMaximum(std::atomic<T>& maximum, T value)
+{
+    T current = maximum.load(std::memory_order_relaxed);
+    while (current < value && !maximum.compare_exchange_weak(current, value, std::memory_order_relaxed)) {}
+}
+
+/**
+ * @brief Returns the current monotonic time
+ *
+ * @return uint64_t Nanoseconds since an arbitrary epoch, never 0
+ */
+uint64_t nowNanoseconds()
+{
+    auto now = std::chrono::steady_clock::now().time_since_epoch();
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(now).count()) | 1;
+}
+
+/**
+ * @brief Returns the start time of an operation
+ *
+ * @param metrics The metrics being recorded, or nullptr when disabled
+ * @return uint64_t Monotonic time in nanoseconds, or 0 when disabled
+ */
+uint64_t startStage(RestoreMetrics* metrics)
+{
+    return metrics != nullptr ? nowNanoseconds() : 0;
+}
+
+/**
+ * @brief Records a completed operation of a stage
+ *
+ * @param metrics The metrics being recorded, or nullptr when disabled
+ * @param stage The stage the operation belongs to
+ * @param startNanoseconds Value returned by startStage for the operation
+ * @param bytes Number of bytes the operation handled
+ */
+void recordStage(RestoreMetrics* metrics, RestoreStage stage, uint64_t startNanoseconds, uint64_t bytes)
+{
+    if (metrics == nullptr) { return; }
+    uint64_t now = nowNanoseconds();
+    uint64_t elapsed = now > startNanoseconds ? now - startNanoseconds : 0;
+
+    StageMetrics& stageMetrics = metrics->stages[static_cast<int>(stage)];
+    stageMetrics.ops.fetch_add(1, std::memory_order_relaxed);
+    stageMetrics.bytes.fetch_add(bytes, std::memory_order_relaxed);
+    stageMetrics.totalNanoseconds.fetch_add(elapsed, std::memory_order_relaxed);
+    stageMetrics.latencyBuckets[getLatencyBucket(elapsed)].fetch_add(1, std::memory_order_relaxed);
+    updateMaximum(stageMetrics.maxNanoseconds, elapsed);
+}
+
+/**
+ * @brief Records an item joining the write queue
+ *
+ * @param metrics The metrics being recorded, or nullptr when disabled
+ */
+void enterWriteQueue(RestoreMetrics* metrics)
+{
+    if (metrics == nullptr) { return; }
+    QueueMetrics& queue = metrics->writeQueue;
+    int64_t depth = queue.depth.fetch_add(1, std::memory_order_relaxed) + 1;
+    queue.samples.fetch_add(1, std::memory_order_relaxed);
+    queue.depthSum.fetch_add(static_cast<uint64_t>(depth), std::memory_order_relaxed);
+    updateMaximum(queue.maxDepth, depth);
+}
+
+/**
+ * @brief Records an item leaving the write queue
+ *
+ * @param metrics The metrics being recorded, or nullptr when disabled
+ */
+void leaveWriteQueue(RestoreMetrics* metrics)
+{
+    if (metrics == nullptr) { return; }
+    metrics->writeQueue.depth.fetch_sub(1, std::memory_order_relaxed);
+}
+
+/**
+ * @brief Returns the read counters of a chain file, creating them if required
+ *
+ * @param metrics The metrics being recorded, or nullptr when disabled
+ * @param filePath Path of the chain file or split segment
+ * @return ChainFileMetrics* The counters, or nullptr when disabled
+ */
+ChainFileMetrics* getChainFileMetrics(RestoreMetrics* metrics, const std::string& filePath)
+{
+    if (metrics == nullptr) { return nullptr; }
+    std::lock_guard<std::mutex> guard(metrics->chainFilesLock);
+    auto& fileMetrics = metrics->chainFiles[filePath];
+    if (fileMetrics == nullptr) { fileMetrics = std::make_unique<ChainFileMetrics>(); }
+    return fileMetrics.get();
+}
+
+/**
+ * @brief Returns the name of a stage as used in reports
+ *
+ * @param stage The stage
+ * @return const char* The stage name, for example "block_read"
+ */
+const char* getStageName(RestoreStage stage)
+{
+    switch (stage) {
+    case RestoreStage::eChainResolution: return "chain_resolution";
+    case RestoreStage::eIndexLoad: return "index_load";
+    case RestoreStage::eBlockRead: return "block_read";
+    case RestoreStage::eVerify: return "verify";
+    case RestoreStage::eWrite: return "write";
+    default: return "unknown";
+    }
+}
+
+/**
+ * @brief Estimates a latency percentile from a stage's histogram
+ *
+ * The percentile is interpolated linearly within the bucket that holds it
+ * and capped at the largest latency seen.
+ *
+ * @param stage The stage metrics
+ * @param percentile The percentile to estimate, between 0 and 1
+ * @return double The estimated latency in seconds
+ */
+double getLatencyPercentile(const StageMetrics& stage, double percentile)
+{
+    uint64_t count = 0;
+    for (uint32_t i = 0; i < LATENCY_BUCKET_COUNT; i++) {
+        count += stage.latencyBuckets[i].load(std::memory_order_relaxed);
+    }
+    if (count == 0) { return 0; }
+
+    double rank = percentile * static_cast<double>(count);
+    uint64_t seen = 0;
+    for (uint32_t i = 0; i < LATENCY_BUCKET_COUNT; i++) {
+        uint64_t bucketCount = stage.latencyBuckets[i].load(std::memory_order_relaxed);
+        if (bucketCount == 0 || static_cast<double>(seen + bucketCount) < rank) {
+            seen += bucketCount;
+            continue;
+        }
+        double fraction = (rank - static_cast<double>(seen)) / static_cast<double>(bucketCount);
+        double nanoseconds = static_cast<double>(getBucketLowerBound(i)) + fraction * static_cast<double>(getBucketWidth(i));
+        double maxNanoseconds = static_cast<double>(stage.maxNanoseconds.load(std::memory_order_relaxed));
+        return (nanoseconds < maxNanoseconds ? nanoseconds : maxNanoseconds) / 1e9;
+    }
+    return static_cast<double>(stage.maxNanoseconds.load(std::memory_order_relaxed)) / 1e9;
+}
+
+/**
+ * @brief Returns the time since metrics recording started
+ *
+ * @param metrics The recorded metrics
+ * @return double Elapsed seconds
+ */
+double getElapsedSeconds(const RestoreMetrics& metrics)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - metrics.startTime).count();
+}
+
+/**
+ * @brief Writes text to a file through a temporary file and a rename
+ *
+ * @param path Final path of the file
+ * @param text Contents to write
+ * @throws std::runtime_error if the file cannot be written
+ */
+void writeFileAtomically(const std::string& path, const std::string& text)
+{
+    std::string temporaryPath = path + ".tmp";
+    {
+        std::ofstream out(temporaryPath, std::ios::out | std::ios::trunc | std::ios::binary);
+        out << text;
+        out.close();
+        if (out.fail()) {
+            std::remove(temporaryPath.c_str());
+            throw std::runtime_error("Failed to write metrics to " + path);
+        }
+    }
+    if (std::rename(temporaryPath.c_str(), path.c_str()) != 0) {
+        // Windows will not rename over an existing file
+        std::remove(path.c_str());
+        if (std::rename(temporaryPath.c_str(), path.c_str()) != 0) {
+            std::remove(temporaryPath.c_str());
+            throw std::runtime_error("Failed to write metrics to " + path);
+        }
+    }
+}
+
+/**
+ * @brief Writes the metrics as a JSON report
+ *
+ * @param metrics The recorded metrics
+ * @param path Path of the report file
+ * @throws std::runtime_error if the report cannot be written
+ */
+void writeMetricsJSON(RestoreMetrics& metrics, const std::string& path)
+{
+    double elapsedSeconds = getElapsedSeconds(metrics);
+
+    nlohmann::json report;
+    report["elapsed_seconds"] = elapsedSeconds;
+
+    nlohmann::json stages = nlohmann::json::object();
+    for (int i = 0; i < static_cast<int>(RestoreStage::eStageCount); i++) {
+        StageMetrics& stage = metrics.stages[i];
+        uint64_t ops = stage.ops.load(std::memory_order_relaxed);
+        uint64_t bytes = stage.bytes.load(std::memory_order_relaxed);
+        double totalSeconds = static_cast<double>(stage.totalNanoseconds.load(std::memory_order_relaxed)) / 1e9;
+
+        nlohmann::json entry;
+        entry["ops"] = ops;
+        entry["bytes"] = bytes;
+        entry["total_seconds"] = totalSeconds;
+        entry["mean_seconds"] = ops > 0 ? totalSeconds / static_cast<double>(ops) : 0.0;
+        entry["p50_seconds"] = getLatencyPercentile(stage, 0.5);
+        entry["p99_seconds"] = getLatencyPercentile(stage, 0.99);
+        entry["max_seconds"] = static_cast<double>(stage.maxNanoseconds.load(std::memory_order_relaxed)) / 1e9;
+        entry["mb_per_second"] = totalSeconds > 0 ? static_cast<double>(bytes) / totalSeconds / 1e6 : 0.0;
+        stages[getStageName(static_cast<RestoreStage>(i))] = entry;
+    }
+    report["stages"] = stages;
+
+    uint64_t samples = metrics.writeQueue.samples.load(std::memory_order_relaxed);
+    nlohmann::json writeQueue;
+    writeQueue["samples"] = samples;
+    writeQueue["max_depth"] = metrics.writeQueue.maxDepth.load(std::memory_order_relaxed);
+    writeQueue["mean_depth"] = samples > 0 ? static_cast<double>(metrics.writeQueue.depthSum.load(std::memory_order_relaxed)) / static_cast<double>(samples) : 0.0;
+    report["queues"]["write"] = writeQueue;
+
+    nlohmann::json chainFiles = nlohmann::json::array();
+    {
+        std::lock_guard<std::mutex> guard(metrics.chainFilesLock);
+        for (auto& chainFile : metrics.chainFiles) {
+            nlohmann::json entry;
+            entry["path"] = chainFile.first;
+            entry["bytes_read"] = chainFile.second->bytesRead.load(std::memory_order_relaxed);
+            entry["blocks_read"] = chainFile.second->blocksRead.load(std::memory_order_relaxed);
+            chainFiles.push_back(entry);
+        }
+    }
+    report["chain_files"] = chainFiles;
+
+    writeFileAtomically(path, report.dump(2) + "\n");
+}
+
+/**
+ * @brief Escapes a Prometheus label value
+ *
+ * @param value The raw value
+ * @return std::string The value with backslashes, quotes and newlines escaped
+ */
+std::string escapeLabelValue(const std::string& value)
+{
+    std::string escaped;
+    escaped.reserve(value.size());
+    for (char c : value) {
+        if (c == '\\') { escaped += "\\\\"; }
+        else if (c == '"') { escaped += "\\\""; }
+        else if (c == '\n') { escaped += "\\n"; }
+        else { escaped += c; }
+    }
+    return escaped;
+}
+
+/**
+ * @brief Writes the HELP and TYPE lines of a Prometheus metric
+ *
+ * @param out The stream to write to
+ * @param name Metric name
+ * @param type Metric type, for example "counter"
+ * @param help Description of the metric
+ */
+void writePrometheusHeader(std::ostringstream& out, const std::string& name, const std::string& type, const std::string& help)
+{
+    out << "# HELP " << name << " " << help << "\n";
+    out << "# TYPE " << name << " " << type << "\n";
+}
+
+/**
+ * @brief Writes the metrics in the Prometheus text exposition format
+ *
+ * @param metrics The recorded metrics
+ * @param path Path of the .prom file
+ * @throws std::runtime_error if the file cannot be written
+ */
+void writeMetricsPrometheus(RestoreMetrics& metrics, const std::string& path)
+{
+    const int stageCount = static_cast<int>(RestoreStage::eStageCount);
+    std::ostringstream out;
+    out.precision(9);
+
+    writePrometheusHeader(out, "macrium_restore_elapsed_seconds", "gauge", "Time since the restore started.");
+    out << "macrium_restore_elapsed_seconds " << getElapsedSeconds(metrics) << "\n";
+
+    writePrometheusHeader(out, "macrium_restore_stage_ops_total", "counter", "Operations completed by each restore stage.");
+    for (int i = 0; i < stageCount; i++) {
+        out << "macrium_restore_stage_ops_total{stage=\"" << getStageName(static_cast<RestoreStage>(i)) << "\"} "
+            << metrics.stages[i].ops.load(std::memory_order_relaxed) << "\n";
+    }
+
+    writePrometheusHeader(out, "macrium_restore_stage_bytes_total", "counter", "Bytes handled by each restore stage.");
+    for (int i = 0; i < stageCount; i++) {
+        out << "macrium_restore_stage_bytes_total{stage=\"" << getStageName(static_cast<RestoreStage>(i)) << "\"} "
+            << metrics.stages[i].bytes.load(std::memory_order_relaxed) << "\n";
+    }
+
+    writePrometheusHeader(out, "macrium_restore_stage_latency_seconds", "summary", "Latency of operations in each restore stage.");
+    for (int i = 0; i < stageCount; i++) {
+        StageMetrics& stage = metrics.stages[i];
+        std::string stageName = getStageName(static_cast<RestoreStage>(i));
+        for (double percentile : REPORTED_PERCENTILES) {
+            out << "macrium_restore_stage_latency_seconds{stage=\"" << stageName << "\",quantile=\"" << percentile << "\"} "
+                << getLatencyPercentile(stage, percentile) << "\n";
+        }
+        out << "macrium_restore_stage_latency_seconds_sum{stage=\"" << stageName << "\"} "
+            << static_cast<double>(stage.totalNanoseconds.load(std::memory_order_relaxed)) / 1e9 << "\n";
+        out << "macrium_restore_stage_latency_seconds_count{stage=\"" << stageName << "\"} "
+            << stage.ops.load(std::memory_order_relaxed) << "\n";
+    }
+
+    writePrometheusHeader(out, "macrium_restore_queue_max_depth", "gauge", "Largest depth seen of each restore queue.");
+    out << "macrium_restore_queue_max_depth{queue=\"write\"} " << metrics.writeQueue.maxDepth.load(std::memory_order_relaxed) << "\n";
+
+    writePrometheusHeader(out, "macrium_restore_chain_file_read_bytes_total", "counter", "Bytes read from each backup chain file.");
+    {
+        std::lock_guard<std::mutex> guard(metrics.chainFilesLock);
+        for (auto& chainFile : metrics.chainFiles) {
+            out << "macrium_restore_chain_file_read_bytes_total{file=\"" << escapeLabelValue(chainFile.first) << "\"} "
+                << chainFile.second->bytesRead.load(std::memory_order_relaxed) << "\n";
+        }
+    }
+
+    writeFileAtomically(path, out.str());
+}
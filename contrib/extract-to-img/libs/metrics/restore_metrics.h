@@ -0,0 +1,177 @@
+/**
+ * @file restore_metrics.h
+ * @brief Per-stage counters and latency histograms for restores
+ *
+ * This file declares the counters recorded while a restore runs: operation
+ * and byte counts and latency histograms for each stage, the depth of the
+ * target write queue, and the volume read from each chain file. All hot path
+ * updates are relaxed atomic increments, so recording is cheap enough to
+ * leave on in production. The results can be written as a JSON report or as
+ * a Prometheus textfile.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+/**
+ * @brief Stages of a restore that are measured separately
+ *
+ * Chain resolution covers building a partition's backup set and includes
+ * the index loads it performs.
+ */
+enum class RestoreStage
+{
+    eChainResolution,
+    eIndexLoad,
+    eBlockRead,
+    eVerify,
+    eWrite,
+    eStageCount
+};
+
+/**
+ * @brief Number of histogram buckets per power of two
+ */
+const uint32_t LATENCY_SUB_BUCKETS = 4;
+
+/**
+ * @brief Number of latency histogram buckets, covering 1 ns to 2^64 ns
+ */
+const uint32_t LATENCY_BUCKET_COUNT = 64 * LATENCY_SUB_BUCKETS;
+
+/**
+ * @brief Counters and latency histogram of one stage
+ *
+ * Latencies are recorded in nanoseconds into log-linear buckets: each power
+ * of two is split into LATENCY_SUB_BUCKETS equal parts, which bounds the
+ * error of reported percentiles to about 20%.
+ */
+struct StageMetrics
+{
+    std::atomic<uint64_t> ops{0};                                   // Completed operations
+    std::atomic<uint64_t> bytes{0};                                 // Bytes handled
+    std::atomic<uint64_t> totalNanoseconds{0};                      // Sum of all latencies
+    std::atomic<uint64_t> maxNanoseconds{0};                        // Largest latency seen
+    std::atomic<uint64_t> latencyBuckets[LATENCY_BUCKET_COUNT] = {};  // Latency histogram
+};
+
+/**
+ * @brief Depth of a queue sampled each time an item joins it
+ */
+struct QueueMetrics
+{
+    std::atomic<int64_t> depth{0};          // Items currently queued or in service
+    std::atomic<int64_t> maxDepth{0};       // Largest depth seen
+    std::atomic<uint64_t> samples{0};       // Number of items that joined the queue
+    std::atomic<uint64_t> depthSum{0};      // Sum of depths seen on joining
+};
+
+/**
+ * @brief Read volume of one chain file or split segment
+ */
+struct ChainFileMetrics
+{
+    std::atomic<uint64_t> bytesRead{0};     // Bytes read from the file
+    std::atomic<uint64_t> blocksRead{0};    // Blocks read from the file
+};
+
+/**
+ * @brief All metrics recorded during a restore
+ */
+struct RestoreMetrics
+{
+    std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();  // When recording started
+    StageMetrics stages[static_cast<int>(RestoreStage::eStageCount)];                     // Per-stage metrics
+    QueueMetrics writeQueue;                                                             // Writers waiting for or holding the target
+    std::map<std::string, std::unique_ptr<ChainFileMetrics>> chainFiles;                 // Read volume by file path
+    std::mutex chainFilesLock;                                                           // Guards insertion into chainFiles
+};
+
+/**
+ * @brief Returns the start time of an operation
+ *
+ * @param metrics The metrics being recorded, or nullptr when disabled
+ * @return uint64_t Monotonic time in nanoseconds, or 0 when disabled
+ */
+uint64_t startStage(RestoreMetrics* metrics);
+
+/**
+ * @brief Records a completed operation of a stage
+ *
+ * @param metrics The metrics being recorded, or nullptr when disabled
+ * @param stage The stage the operation belongs to
+ * @param startNanoseconds Value returned by startStage for the operation
+ * @param bytes Number of bytes the operation handled
+ */
+void recordStage(RestoreMetrics* metrics, RestoreStage stage, uint64_t startNanoseconds, uint64_t bytes);
+
+/**
+ * @brief Records an item joining the write queue
+ *
+ * @param metrics The metrics being recorded, or nullptr when disabled
+ */
+void enterWriteQueue(RestoreMetrics* metrics);
+
+/**
+ * @brief Records an item leaving the write queue
+ *
+ * @param metrics The metrics being recorded, or nullptr when disabled
+ */
+void leaveWriteQueue(RestoreMetrics* metrics);
+
+/**
+ * @brief Returns the read counters of a chain file, creating them if required
+ *
+ * Look the counters up once per run of reads from a file and update them
+ * with relaxed increments; the lookup itself takes a lock.
+ *
+ * @param metrics The metrics being recorded, or nullptr when disabled
+ * @param filePath Path of the chain file or split segment
+ * @return ChainFileMetrics* The counters, or nullptr when disabled
+ */
+ChainFileMetrics* getChainFileMetrics(RestoreMetrics* metrics, const std::string& filePath);
+
+/**
+ * @brief Returns the name of a stage as used in reports
+ *
+ * @param stage The stage
+ * @return const char* The stage name, for example "block_read"
+ */
+const char* getStageName(RestoreStage stage);
+
+/**
+ * @brief Estimates a latency percentile from a stage's histogram
+ *
+ * @param stage The stage metrics
+ * @param percentile The percentile to estimate, between 0 and 1
+ * @return double The estimated latency in seconds
+ */
+double getLatencyPercentile(const StageMetrics& stage, double percentile);
+
+/**
+ * @brief Writes the metrics as a JSON report
+ *
+ * @param metrics The recorded metrics
+ * @param path Path of the report file
+ * @throws std::runtime_error if the report cannot be written
+ */
+void writeMetricsJSON(RestoreMetrics& metrics, const std::string& path);
+
+/**
+ * @brief Writes the metrics in the Prometheus text exposition format
+ *
+ * The file is written next to its final path and renamed into place, so a
+ * node exporter textfile collector never sees a partial file.
+ *
+ * @param metrics The recorded metrics
+ * @param path Path of the .prom file
+ * @throws std::runtime_error if the file cannot be written
+ */
+void writeMetricsPrometheus(RestoreMetrics& metrics, const std::string& path);
@@ -0,0 +1,463 @@
+/**
+ * @file nbd_server.cpp
+ * @brief Implementation of the NBD server
+ *
+ * Follows the NBD protocol's fixed newstyle negotiation and simple replies.
+ * Every integer on the wire is big-endian.
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <vector>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "nbd_server.h"
+
+const uint64_t NBD_INIT_MAGIC = 0x4e42444d41474943ULL;     // "NBDMAGIC"
+const uint64_t NBD_OPTION_MAGIC = 0x49484156454f5054ULL;   // "IHAVEOPT"
+const uint64_t NBD_REPLY_MAGIC = 0x3e889045565a9ULL;
+const uint32_t NBD_REQUEST_MAGIC = 0x25609513;
+const uint32_t NBD_SIMPLE_REPLY_MAGIC = 0x67446698;
+
+const uint16_t NBD_FLAG_FIXED_NEWSTYLE = 1 << 0;
+const uint16_t NBD_FLAG_NO_ZEROES = 1 << 1;
+const uint16_t NBD_FLAG_HAS_FLAGS = 1 << 0;
+const uint16_t NBD_FLAG_READ_ONLY = 1 << 1;
+const uint16_t NBD_FLAG_SEND_FLUSH = 1 << 2;
+const uint16_t NBD_FLAG_SEND_FUA = 1 << 3;
+const uint16_t NBD_CMD_FLAG_FUA = 1 << 0;
+
+const uint32_t NBD_OPT_EXPORT_NAME = 1;
+const uint32_t NBD_OPT_ABORT = 2;
+const uint32_t NBD_OPT_LIST = 3;
+const uint32_t NBD_OPT_INFO = 6;
+const uint32_t NBD_OPT_GO = 7;
+
+const uint32_t NBD_REP_ACK = 1;
+const uint32_t NBD_REP_SERVER = 2;
+const uint32_t NBD_REP_INFO = 3;
+const uint32_t NBD_REP_ERR_UNSUP = 0x80000001;
+const uint32_t NBD_REP_ERR_INVALID = 0x80000003;
+
+const uint16_t NBD_INFO_EXPORT = 0;
+const uint16_t NBD_INFO_BLOCK_SIZE = 3;
+
+const uint16_t NBD_CMD_READ = 0;
+const uint16_t NBD_CMD_WRITE = 1;
+const uint16_t NBD_CMD_DISC = 2;
+const uint16_t NBD_CMD_FLUSH = 3;
+
+const uint32_t NBD_EPERM = 1;
+const uint32_t NBD_EIO = 5;
+const uint32_t NBD_EINVAL = 22;
+
+/**
+ * @brief Largest option payload accepted during negotiation
+ */
+const uint32_t NBD_MAX_OPTION_LENGTH = 4096;
+
+/**
+ * @brief Appends a big-endian integer to a message
+ *
+ * @param message The message being built
+ * @param value The integer
+ * @param size Number of bytes the integer takes on the wire
+ */
+void putNbdInteger(std::vector<uint8_t>& message, uint64_t value, int size)
+{
+    for (int i = size - 1; i >= 0; i--) { message.push_back(static_cast<uint8_t>(value >> (i * 8))); }
+}
+
+/**
+ * @brief Reads a big-endian integer from a message
+ *
+ * @param bytes Start of the integer
+ * @param size Number of bytes the integer takes on the wire
+ * @return uint64_t The integer
+ */
+uint64_t getNbdInteger(const uint8_t* bytes, int size)
+{
+    uint64_t value = 0;
+    for (int i = 0; i < size; i++) { value = (value << 8) | bytes[i]; }
+    return value;
+}
+
+/**
+ * @brief Reads exactly length bytes from a connection
+ *
+ * @param socket The connection
+ * @param buffer Buffer that receives the bytes
+ * @param length Number of bytes to read
+ * @return false if the connection was closed or failed
+ */
+bool receiveNbd(int socket, void* buffer, size_t length)
+{
+    uint8_t* bytes = static_cast<uint8_t*>(buffer);
+    while (length > 0) {
+        ssize_t received = recv(socket, bytes, length, 0);
+        if (received < 0 && errno == EINTR) { continue; }
+        if (received <= 0) { return false; }
+        bytes += received;
+        length -= static_cast<size_t>(received);
+    }
+    return true;
+}
+
+/**
+ * @brief Writes exactly length bytes to a connection
+ *
+ * @param socket The connection
+ * @param data The bytes to write
+ * @param length Number of bytes to write
+ * @return false if the connection was closed or failed
+ */
+bool sendNbd(int socket, const void* data, size_t length)
+{
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    while (length > 0) {
+        ssize_t sent = send(socket, bytes, length, MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR) { continue; }
+        if (sent <= 0) { return false; }
+        bytes += sent;
+        length -= static_cast<size_t>(sent);
+    }
+    return true;
+}
+
+/**
+ * @brief Sends a reply to an option
+ *
+ * @param socket The connection
+ * @param option The option replied to
+ * @param type Type of the reply
+ * @param data Payload of the reply
+ * @return false if the connection failed
+ */
+bool sendNbdOptionReply(int socket, uint32_t option, uint32_t type, const std::vector<uint8_t>& data = {})
+{
+    std::vector<uint8_t> reply;
+    putNbdInteger(reply, NBD_REPLY_MAGIC, 8);
+    putNbdInteger(reply, option, 4);
+    putNbdInteger(reply, type, 4);
+    putNbdInteger(reply, data.size(), 4);
+    reply.insert(reply.end(), data.begin(), data.end());
+    return sendNbd(socket, reply.data(), reply.size());
+}
+
+/**
+ * @brief Returns the transmission flags of an export
+ *
+ * @param diskExport The export
+ * @return uint16_t The flags sent to clients
+ */
+uint16_t getNbdTransmissionFlags(const NbdExport& diskExport)
+{
+    uint16_t flags = NBD_FLAG_HAS_FLAGS;
+    if (!diskExport.write) { flags |= NBD_FLAG_READ_ONLY; }
+    if (diskExport.write && diskExport.flush) { flags |= NBD_FLAG_SEND_FLUSH | NBD_FLAG_SEND_FUA; }
+    return flags;
+}
+
+/**
+ * @brief Returns the preferred block size advertised for an export
+ *
+ * The protocol requires a power of two no larger than the maximum request,
+ * so the export's preferred size is rounded down to one.
+ *
+ * @param diskExport The export
+ * @return uint32_t The preferred block size sent to clients
+ */
+uint32_t getNbdPreferredBlockSize(const NbdExport& diskExport)
+{
+    uint32_t preferred = std::min(std::max<uint32_t>(diskExport.preferredBlockSize, 1), NBD_MAX_REQUEST_LENGTH);
+    uint32_t blockSize = 1;
+    while (blockSize <= preferred / 2) { blockSize *= 2; }
+    return blockSize;
+}
+
+/**
+ * @brief Runs the option haggling of a connection
+ *
+ * The single export answers to any name.
+ *
+ * @param socket The connection
+ * @param diskExport The export served
+ * @return true if the client moved on to transmission
+ */
+bool negotiateNbd(int socket, const NbdExport& diskExport)
+{
+    std::vector<uint8_t> greeting;
+    putNbdInteger(greeting, NBD_INIT_MAGIC, 8);
+    putNbdInteger(greeting, NBD_OPTION_MAGIC, 8);
+    putNbdInteger(greeting, NBD_FLAG_FIXED_NEWSTYLE | NBD_FLAG_NO_ZEROES, 2);
+    uint8_t clientFlagBytes[4];
+    if (!sendNbd(socket, greeting.data(), greeting.size()) || !receiveNbd(socket, clientFlagBytes, sizeof(clientFlagBytes))) { return false; }
+    bool noZeroes = (getNbdInteger(clientFlagBytes, 4) & NBD_FLAG_NO_ZEROES) != 0;
+
+    while (true) {
+        uint8_t header[16];
+        if (!receiveNbd(socket, header, sizeof(header)) || getNbdInteger(header, 8) != NBD_OPTION_MAGIC) { return false; }
+        uint32_t option = static_cast<uint32_t>(getNbdInteger(header + 8, 4));
+        uint32_t length = static_cast<uint32_t>(getNbdInteger(header + 12, 4));
+        if (length > NBD_MAX_OPTION_LENGTH) { return false; }
+        std::vector<uint8_t> data(length);
+        if (!receiveNbd(socket, data.data(), data.size())) { return false; }
+
+        if (option == NBD_OPT_EXPORT_NAME) {
+            std::vector<uint8_t> reply;
+            putNbdInteger(reply, diskExport.size, 8);
+            putNbdInteger(reply, getNbdTransmissionFlags(diskExport), 2);
+            if (!noZeroes) { reply.resize(reply.size() + 124, 0); }
+            return sendNbd(socket, reply.data(), reply.size());
+        }
+        if (option == NBD_OPT_ABORT) {
+            sendNbdOptionReply(socket, option, NBD_REP_ACK);
+            return false;
+        }
+        if (option == NBD_OPT_LIST) {
+            std::vector<uint8_t> name;
+            putNbdInteger(name, 0, 4);
+            if (!sendNbdOptionReply(socket, option, NBD_REP_SERVER, name) || !sendNbdOptionReply(socket, option, NBD_REP_ACK)) { return false; }
+            continue;
+        }
+        if (option == NBD_OPT_INFO || option == NBD_OPT_GO) {
+            if (length < 6 || getNbdInteger(data.data(), 4) + 6 > length) {
+                if (!sendNbdOptionReply(socket, option, NBD_REP_ERR_INVALID)) { return false; }
+                continue;
+            }
+            std::vector<uint8_t> exportInfo;
+            putNbdInteger(exportInfo, NBD_INFO_EXPORT, 2);
+            putNbdInteger(exportInfo, diskExport.size, 8);
+            putNbdInteger(exportInfo, getNbdTransmissionFlags(diskExport), 2);
+            std::vector<uint8_t> blockSizeInfo;
+            putNbdInteger(blockSizeInfo, NBD_INFO_BLOCK_SIZE, 2);
+            putNbdInteger(blockSizeInfo, 1, 4);
+            putNbdInteger(blockSizeInfo, getNbdPreferredBlockSize(diskExport), 4);
+            putNbdInteger(blockSizeInfo, NBD_MAX_REQUEST_LENGTH, 4);
+            if (!sendNbdOptionReply(socket, option, NBD_REP_INFO, exportInfo) || !sendNbdOptionReply(socket, option, NBD_REP_INFO, blockSizeInfo) ||
+                !sendNbdOptionReply(socket, option, NBD_REP_ACK)) {
+                return false;
+            }
+            if (option == NBD_OPT_GO) { return true; }
+            continue;
+        }
+        if (!sendNbdOptionReply(socket, option, NBD_REP_ERR_UNSUP)) { return false; }
+    }
+}
+
+/**
+ * @brief Sends a simple reply to a request
+ *
+ * @param socket The connection
+ * @param error Error of the request, or 0
+ * @param handle Handle of the request
+ * @param data Data read, sent only on success
+ * @param length Number of bytes read
+ * @return false if the connection failed
+ */
+bool sendNbdReply(int socket, uint32_t error, uint64_t handle, const void* data = nullptr, size_t length = 0)
+{
+    std::vector<uint8_t> reply;
+    putNbdInteger(reply, NBD_SIMPLE_REPLY_MAGIC, 4);
+    putNbdInteger(reply, error, 4);
+    putNbdInteger(reply, handle, 8);
+    if (!sendNbd(socket, reply.data(), reply.size())) { return false; }
+    return error != 0 || length == 0 || sendNbd(socket, data, length);
+}
+
+/**
+ * @brief Serves the requests of a connection until the client disconnects
+ *
+ * @param server The server the connection belongs to
+ * @param socket The connection
+ */
+void serveNbdRequests(NbdServer& server, int socket)
+{
+    const NbdExport& diskExport = *server.diskExport;
+    std::vector<uint8_t> buffer;
+    while (!server.stopping.load()) {
+        uint8_t header[28];
+        if (!receiveNbd(socket, header, sizeof(header)) || getNbdInteger(header, 4) != NBD_REQUEST_MAGIC) { return; }
+        uint16_t flags = static_cast<uint16_t>(getNbdInteger(header + 4, 2));
+        uint16_t type = static_cast<uint16_t>(getNbdInteger(header + 6, 2));
+        uint64_t handle = getNbdInteger(header + 8, 8);
+        uint64_t offset = getNbdInteger(header + 16, 8);
+        uint32_t length = static_cast<uint32_t>(getNbdInteger(header + 24, 4));
+        if (type == NBD_CMD_DISC) { return; }
+
+        bool outOfRange = offset > diskExport.size || length > diskExport.size - offset || length > NBD_MAX_REQUEST_LENGTH;
+        if (type == NBD_CMD_WRITE) {
+            // The payload is read even for a failed write, so the stream stays in step
+            if (length > NBD_MAX_REQUEST_LENGTH) { return; }
+            buffer.resize(length);
+            if (!receiveNbd(socket, buffer.data(), length)) { return; }
+        }
+
+        uint32_t error = 0;
+        try {
+            if (type == NBD_CMD_READ) {
+                if (outOfRange) { error = NBD_EINVAL; }
+                else {
+                    buffer.resize(length);
+                    diskExport.read(offset, buffer.data(), length);
+                }
+            }
+            else if (type == NBD_CMD_WRITE) {
+                if (!diskExport.write) { error = NBD_EPERM; }
+                else if (outOfRange) { error = NBD_EINVAL; }
+                else {
+                    diskExport.write(offset, buffer.data(), length);
+                    if ((flags & NBD_CMD_FLAG_FUA) != 0 && diskExport.flush) { diskExport.flush(); }
+                }
+            }
+            else if (type == NBD_CMD_FLUSH) {
+                if (diskExport.flush) { diskExport.flush(); }
+            }
+            else {
+                error = NBD_EINVAL;
+            }
+        }
+        catch (const std::exception& e) {
+            std::cerr << "NBD request at " << offset << " of " << length << " bytes failed: " << e.what() << "\n";
+            error = NBD_EIO;
+        }
+
+        bool sent = type == NBD_CMD_READ ? sendNbdReply(socket, error, handle, buffer.data(), length) : sendNbdReply(socket, error, handle);
+        if (!sent) { return; }
+        server.requestsServed.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+/**
+ * @brief Negotiates and serves a connection, then closes it
+ *
+ * @param server The server the connection belongs to
+ * @param socket The connection
+ */
+void serveNbdConnection(NbdServer& server, int socket)
+{
+    if (negotiateNbd(socket, *server.diskExport)) { serveNbdRequests(server, socket); }
+
+    std::lock_guard<std::mutex> guard(server.connectionsLock);
+    for (auto it = server.connections.begin(); it != server.connections.end(); ++it) {
+        if (*it == socket) {
+            server.connections.erase(it);
+            break;
+        }
+    }
+    close(socket);
+    server.finishedWorkers.push_back(std::this_thread::get_id());
+}
+
+/**
+ * @brief Joins the threads of connections that have closed
+ *
+ * Called for each new connection, so a long-running export does not keep a
+ * thread for every connection it has served.
+ *
+ * @param server The server
+ */
+void joinFinishedNbdWorkers(NbdServer& server)
+{
+    std::vector<std::thread> finished;
+    {
+        std::lock_guard<std::mutex> guard(server.connectionsLock);
+        for (std::thread::id id : server.finishedWorkers) {
+            auto worker = std::find_if(server.workers.begin(), server.workers.end(), [id](const std::thread& t) { return t.get_id() == id; });
+            if (worker == server.workers.end()) { continue; }
+            finished.push_back(std::move(*worker));
+            server.workers.erase(worker);
+        }
+        server.finishedWorkers.clear();
+    }
+    for (auto& worker : finished) { worker.join(); }
+}
+
+/**
+ * @brief Accepts connections until the server is stopped
+ *
+ * @param server The server
+ */
+void acceptNbdConnections(NbdServer& server)
+{
+    while (!server.stopping.load()) {
+        int socket = accept4(server.listenFd, nullptr, nullptr, SOCK_CLOEXEC);
+        if (socket < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) { continue; }
+            return;
+        }
+        joinFinishedNbdWorkers(server);
+        std::lock_guard<std::mutex> guard(server.connectionsLock);
+        if (server.stopping.load()) {
+            close(socket);
+            return;
+        }
+        server.connections.push_back(socket);
+        server.workers.emplace_back(serveNbdConnection, std::ref(server), socket);
+    }
+}
+
+/**
+ * @brief Starts serving an export on a Unix socket
+ *
+ * @param server Output parameter for the server
+ * @param socketPath Path of the socket to listen on
+ * @param diskExport The export to serve, which must outlive the server
+ * @throws std::runtime_error if the socket cannot be created
+ */
+void startNbdServer(NbdServer& server, const std::string& socketPath, const NbdExport& diskExport)
+{
+    sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    if (socketPath.size() >= sizeof(address.sun_path)) {
+        std::cerr << "Socket path " << socketPath << " is too long\n";
+        throw std::runtime_error("NBD socket path too long.");
+    }
+    memcpy(address.sun_path, socketPath.c_str(), socketPath.size());
+
+    unlink(socketPath.c_str());
+    int listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listenFd < 0 || bind(listenFd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 || listen(listenFd, 16) != 0) {
+        std::cerr << "Failed to listen on " << socketPath << ": " << strerror(errno) << "\n";
+        if (listenFd >= 0) { close(listenFd); }
+        throw std::runtime_error("Failed to create NBD socket.");
+    }
+
+    server.socketPath = socketPath;
+    server.listenFd = listenFd;
+    server.diskExport = &diskExport;
+    server.stopping.store(false);
+    server.acceptor = std::thread(acceptNbdConnections, std::ref(server));
+}
+
+/**
+ * @brief Stops an NBD server
+ *
+ * @param server The server to stop
+ */
+void stopNbdServer(NbdServer& server)
+{
+    if (server.listenFd < 0) { return; }
+    server.stopping.store(true);
+    shutdown(server.listenFd, SHUT_RDWR);
+    server.acceptor.join();
+
+    std::vector<std::thread> workers;
+    {
+        std::lock_guard<std::mutex> guard(server.connectionsLock);
+        for (int socket : server.connections) { shutdown(socket, SHUT_RDWR); }
+        workers.swap(server.workers);
+        server.finishedWorkers.clear();
+    }
+    for (auto& worker : workers) { worker.join(); }
+
+    close(server.listenFd);
+    server.listenFd = -1;
+    unlink(server.socketPath.c_str());
+}
@@ -0,0 +1,83 @@
+/**
+ * @file nbd_server.h
+ * @brief Serving a disk over the Network Block Device protocol
+ *
+ * This file declares a small NBD server that listens on a Unix socket and
+ * serves one export through read, write and flush functions. It speaks the
+ * fixed newstyle handshake with the EXPORT_NAME, INFO and GO options, and
+ * the READ, WRITE, FLUSH and DISC commands, which is what nbd-client and
+ * QEMU use. Each connection is served on its own thread, so the functions
+ * must be thread safe.
+ *
+ * The disk can be attached as a kernel block device with
+ * "nbd-client -unix PATH /dev/nbd0", or used by QEMU as
+ * "nbd:unix:PATH".
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * @brief Largest read or write request served, as recommended by the protocol
+ */
+const uint32_t NBD_MAX_REQUEST_LENGTH = 32 * 1024 * 1024;
+
+/**
+ * @brief The disk an NBD server exports
+ *
+ * The functions throw to fail a request; the client gets an I/O error.
+ */
+struct NbdExport
+{
+    uint64_t size = 0;                                              // Size of the disk in bytes
+    uint32_t preferredBlockSize = 4096;                             // Request size the disk serves best, a power of two
+    std::function<void(uint64_t, void*, size_t)> read;              // Reads bytes at an offset of the disk
+    std::function<void(uint64_t, const void*, size_t)> write;       // Writes bytes at an offset, or empty for a read-only export
+    std::function<void()> flush;                                    // Makes written bytes durable, or empty if there is nothing to do
+};
+
+/**
+ * @brief An NBD server listening on a Unix socket
+ */
+struct NbdServer
+{
+    std::string socketPath;                 // Path of the listening socket
+    int listenFd = -1;                      // The listening socket
+    const NbdExport* diskExport = nullptr;  // The export served
+    std::thread acceptor;                   // Thread accepting connections
+    std::mutex connectionsLock;             // Guards connections, workers and finishedWorkers
+    std::vector<int> connections;           // Sockets of the open connections
+    std::vector<std::thread> workers;       // Threads serving the connections
+    std::vector<std::thread::id> finishedWorkers;  // Workers whose connection has closed, waiting to be joined
+    std::atomic<bool> stopping{ false };    // Set when the server is stopped
+    std::atomic<uint64_t> requestsServed{ 0 };  // Requests answered so far
+};
+
+/**
+ * @brief Starts serving an export on a Unix socket
+ *
+ * Any file at socketPath is replaced.
+ *
+ * @param server Output parameter for the server
+ * @param socketPath Path of the socket to listen on
+ * @param diskExport The export to serve, which must outlive the server
+ * @throws std::runtime_error if the socket cannot be created
+ */
+void startNbdServer(NbdServer& server, const std::string& socketPath, const NbdExport& diskExport);
+
+/**
+ * @brief Stops an NBD server
+ *
+ * Closes the listening socket and every connection, waits for the threads
+ * serving them and removes the socket file.
+ *
+ * @param server The server to stop
+ */
+void stopNbdServer(NbdServer& server);
@@ -0,0 +1,183 @@
+/**
+ * @file restore_progress.cpp
+ * @brief Implementation of restore progress reporting
+ *
+ * This file implements the progress counter updates and the reporter thread.
+ * The reporter smooths the throughput it measures between samples so the ETA
+ * does not jump with every short stall of the source or target.
+ */
+
+#include <cstdio>
+
+#include "restore_progress.h"
+
+/**
+ * @brief Weight of the latest sample in the smoothed throughput
+ */
+const double THROUGHPUT_SMOOTHING = 0.3;
+
+/**
+ * @brief Records the partition now being restored
+ *
+ * @param progress The progress counters, or nullptr when not reporting
+ * @param partitionNumber Number of the partition in the backup
+ * @param partitionIndex Position of the partition in the restore, from 1
+ */
+void setCurrentPartition(RestoreProgress* progress, int32_t partitionNumber, uint32_t partitionIndex)
+{
+    if (progress == nullptr) { return; }
+    progress->partitionNumber.store(partitionNumber, std::memory_order_relaxed);
+    progress->partitionIndex.store(partitionIndex, std::memory_order_relaxed);
+}
+
+/**
+ * @brief Replaces an estimate included in the progress total with an exact value
+ *
+ * @param progress The progress counters, or nullptr when not reporting
+ * @param estimatedBytes The estimate previously added to the total
+ * @param actualBytes The exact number of bytes
+ */
+void correctTotalBytes(RestoreProgress* progress, uint64_t estimatedBytes, uint64_t actualBytes)
+{
+    if (progress == nullptr) { return; }
+    // Unsigned wrap-around makes the single addition correct in both directions
+    progress->bytesTotal.fetch_add(actualBytes - estimatedBytes, std::memory_order_relaxed);
+}
+
+/**
+ * @brief Formats a byte count with a decimal unit
+ *
+ * @param bytes The byte count
+ * @return std::string The count, for example "1.2 GB"
+ */
+std::string formatBytes(double bytes)
+{
+    const char* units[] = { "B", "KB", "MB", "GB", "TB", "PB" };
+    int unit = 0;
+    while (bytes >= 1000 && unit < 5) {
+        bytes /= 1000;
+        unit++;
+    }
+    char text[32];
+    std::snprintf(text, sizeof(text), "%.1f %s", bytes, units[unit]);
+    return text;
+}
+
+/**
+ * @brief Formats a duration as hours, minutes and seconds
+ *
+ * @param seconds The duration
+ * @return std::string The duration, for example "01:02:03"
+ */
+std::string formatDuration(double seconds)
+{
+    uint64_t total = static_cast<uint64_t>(seconds + 0.5);
+    char text[32];
+    std::snprintf(text, sizeof(text), "%02llu:%02llu:%02llu", static_cast<unsigned long long>(total / 3600),
+        static_cast<unsigned long long>(total / 60 % 60), static_cast<unsigned long long>(total % 60));
+    return text;
+}
+
+/**
+ * @brief Formats one progress report line
+ *
+ * @param progress The progress counters
+ * @param elapsedSeconds Time since the restore started
+ * @param bytesPerSecond Current throughput
+ * @return std::string The report line
+ */
+std::string formatProgress(const RestoreProgress& progress, double elapsedSeconds, double bytesPerSecond)
+{
+    uint64_t restored = progress.bytesRestored.load(std::memory_order_relaxed);
+    uint64_t total = progress.bytesTotal.load(std::memory_order_relaxed);
+    int32_t partitionNumber = progress.partitionNumber.load(std::memory_order_relaxed);
+
+    std::string line;
+    if (partitionNumber >= 0) {
+        line += "Partition " + std::to_string(partitionNumber) + " (" + std::to_string(progress.partitionIndex.load(std::memory_order_relaxed)) +
+            "/" + std::to_string(progress.partitionCount.load(std::memory_order_relaxed)) + "): ";
+    }
+    line += formatBytes(static_cast<double>(restored));
+    if (total > 0) {
+        char percent[16];
+        std::snprintf(percent, sizeof(percent), "%.1f%%", restored >= total ? 100.0 : 100.0 * restored / total);
+        line += " of " + formatBytes(static_cast<double>(total)) + " (" + percent + ")";
+    }
+    line += ", " + formatBytes(bytesPerSecond) + "/s";
+
+    if (total > restored && bytesPerSecond > 0) {
+        line += ", ETA " + formatDuration(static_cast<double>(total - restored) / bytesPerSecond);
+    }
+    else {
+        line += ", elapsed " + formatDuration(elapsedSeconds);
+    }
+    return line;
+}
+
+/**
+ * @brief Body of the reporter thread
+ *
+ * @param reporter The reporter being run
+ */
+void runProgressReporter(ProgressReporter& reporter)
+{
+    auto lastTime = reporter.startTime;
+    uint64_t lastBytes = reporter.progress->bytesRestored.load(std::memory_order_relaxed);
+    double smoothedRate = 0;
+
+    std::unique_lock<std::mutex> guard(reporter.lock);
+    while (!reporter.wake.wait_for(guard, reporter.interval, [&reporter]() { return reporter.stopping; })) {
+        auto now = std::chrono::steady_clock::now();
+        uint64_t bytes = reporter.progress->bytesRestored.load(std::memory_order_relaxed);
+        double seconds = std::chrono::duration<double>(now - lastTime).count();
+        if (seconds > 0) {
+            double rate = static_cast<double>(bytes - lastBytes) / seconds;
+            smoothedRate = smoothedRate == 0 ? rate : THROUGHPUT_SMOOTHING * rate + (1 - THROUGHPUT_SMOOTHING) * smoothedRate;
+        }
+        lastTime = now;
+        lastBytes = bytes;
+
+        double elapsed = std::chrono::duration<double>(now - reporter.startTime).count();
+        *reporter.out << formatProgress(*reporter.progress, elapsed, smoothedRate) << std::endl;
+    }
+}
+
+/**
+ * @brief Starts a thread that reports progress at a fixed interval
+ *
+ * @param reporter The reporter to start
+ * @param progress The progress counters to report
+ * @param out Stream the reports are written to
+ * @param interval Time between reports
+ */
+void startProgressReporter(ProgressReporter& reporter, RestoreProgress& progress, std::ostream& out, std::chrono::milliseconds interval)
+{
+    reporter.progress = &progress;
+    reporter.out = &out;
+    reporter.interval = interval;
+    reporter.startTime = std::chrono::steady_clock::now();
+    reporter.stopping = false;
+    reporter.thread = std::thread(runProgressReporter, std::ref(reporter));
+}
+
+/**
+ * @brief Stops a reporter thread and writes a final report
+ *
+ * The final report shows the average throughput of the whole restore.
+ *
+ * @param reporter The reporter to stop
+ */
+void stopProgressReporter(ProgressReporter& reporter)
+{
+    if (!reporter.thread.joinable()) { return; }
+    {
+        std::lock_guard<std::mutex> guard(reporter.lock);
+        reporter.stopping = true;
+    }
+    reporter.wake.notify_one();
+    reporter.thread.join();
+
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - reporter.startTime).count();
+    double rate = elapsed > 0 ? reporter.progress->bytesRestored.load(std::memory_order_relaxed) / elapsed : 0;
+    *reporter.out << formatProgress(*reporter.progress, elapsed, rate) << std::endl;
+}
@@ -0,0 +1,118 @@
+/**
+ * @file restore_progress.h
+ * @brief Progress reporting for long running restores
+ *
+ * This file declares the progress counters updated by restore workers and a
+ * reporter thread that samples them at a fixed interval. Workers only perform
+ * relaxed atomic updates, so reporting never takes a lock or flushes a stream
+ * on the restore hot path. Each report shows the bytes restored, the current
+ * throughput, an ETA based on the allocated blocks still to restore, and the
+ * partition being restored.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+
+/**
+ * @brief Default interval between progress reports
+ */
+const std::chrono::milliseconds DEFAULT_PROGRESS_INTERVAL(2000);
+
+/**
+ * @brief Progress counters of a restore
+ *
+ * The total starts as an estimate from the used clusters of each partition
+ * and is corrected to the exact allocated block total as each partition's
+ * backup set is resolved.
+ */
+struct RestoreProgress
+{
+    std::atomic<uint64_t> bytesRestored{0};     // Bytes written to the target so far
+    std::atomic<uint64_t> bytesTotal{0};        // Bytes expected to be written in total
+    std::atomic<int32_t> partitionNumber{-1};   // Partition being restored, or -1 before the first
+    std::atomic<uint32_t> partitionIndex{0};    // Position of that partition in the restore, from 1
+    std::atomic<uint32_t> partitionCount{0};    // Number of partitions being restored
+};
+
+/**
+ * @brief Reporter thread that periodically prints a restore's progress
+ */
+struct ProgressReporter
+{
+    RestoreProgress* progress = nullptr;                     // Counters being reported
+    std::ostream* out = nullptr;                             // Stream reports are written to
+    std::chrono::milliseconds interval = DEFAULT_PROGRESS_INTERVAL;  // Time between reports
+    std::chrono::steady_clock::time_point startTime;         // When reporting started
+    std::thread thread;                                      // The reporter thread
+    std::mutex lock;                                         // Guards stopping
+    std::condition_variable wake;                            // Signalled to stop the reporter
+    bool stopping = false;                                   // Set when the reporter should exit
+};
+
+/**
+ * @brief Adds restored bytes to the progress counters
+ *
+ * @param progress The progress counters, or nullptr when not reporting
+ * @param bytes Number of bytes written to the target
+ */
+inline void addRestoredBytes(RestoreProgress* progress, uint64_t bytes)
+{
+    if (progress != nullptr) { progress->bytesRestored.fetch_add(bytes, std::memory_order_relaxed); }
+}
+
+/**
+ * @brief Records the partition now being restored
+ *
+ * @param progress The progress counters, or nullptr when not reporting
+ * @param partitionNumber Number of the partition in the backup
+ * @param partitionIndex Position of the partition in the restore, from 1
+ */
+void setCurrentPartition(RestoreProgress* progress, int32_t partitionNumber, uint32_t partitionIndex);
+
+/**
+ * @brief Replaces an estimate included in the progress total with an exact value
+ *
+ * @param progress The progress counters, or nullptr when not reporting
+ * @param estimatedBytes The estimate previously added to the total
+ * @param actualBytes The exact number of bytes
+ */
+void correctTotalBytes(RestoreProgress* progress, uint64_t estimatedBytes, uint64_t actualBytes);
+
+/**
+ * @brief Formats one progress report line
+ *
+ * @param progress The progress counters
+ * @param elapsedSeconds Time since the restore started
+ * @param bytesPerSecond Current throughput
+ * @return std::string The report, for example
+ *         "Partition 2 (2/3): 1.2 GB of 4.0 GB (30.0%), 210.5 MB/s, ETA 00:00:13"
+ */
+std::string formatProgress(const RestoreProgress& progress, double elapsedSeconds, double bytesPerSecond);
+
+/**
+ * @brief Starts a thread that reports progress at a fixed interval
+ *
+ * @param reporter The reporter to start
+ * @param progress The progress counters to report
+ * @param out Stream the reports are written to
+ * @param interval Time between reports
+ */
+void startProgressReporter(ProgressReporter& reporter, RestoreProgress& progress, std::ostream& out,
+    std::chrono::milliseconds interval = DEFAULT_PROGRESS_INTERVAL);
+
+/**
+ * @brief Stops a reporter thread and writes a final report
+ *
+ * Does nothing if the reporter was not started.
+ *
+ * @param reporter The reporter to stop
+ */
+void stopProgressReporter(ProgressReporter& reporter);
@@ -0,0 +1,405 @@
+/**
+ * @file qcow2_writer.cpp
+ * @brief Implementation of sparse qcow2 image output for restores
+ *
+ * The image is laid out as the header cluster, the L1 table, then data
+ * clusters and L2 tables in the order they are allocated, and finally the
+ * refcount table and blocks written on close. Every host cluster is
+ * referenced once, except clusters holding compressed data, which are
+ * referenced once for each compressed cluster stored in them.
+ */
+
+#include <algorithm>
+#include <iostream>
+#include <stdexcept>
+
+#ifdef QCOW2_WITH_ZSTD
+#include <zstd.h>
+#endif
+
+#include "../file_handler/file_handler.h"
+#include "qcow2_writer.h"
+
+/**
+ * @brief Header fields of written images
+ */
+const uint32_t QCOW2_MAGIC = 0x514649FB;   // "QFI\xfb"
+const uint32_t QCOW2_VERSION = 3;
+const uint32_t QCOW2_REFCOUNT_ORDER = 4;   // 16-bit refcounts
+const uint32_t QCOW2_HEADER_LENGTH = 112;  // Version 3 header including the compression type
+const uint64_t QCOW2_INCOMPAT_COMPRESSION_TYPE = 1ULL << 3;
+const uint8_t QCOW2_COMPRESSION_TYPE_ZSTD = 1;
+
+/**
+ * @brief Flags of L1 and L2 entries
+ */
+const uint64_t QCOW2_OFLAG_COPIED = 1ULL << 63;
+const uint64_t QCOW2_OFLAG_COMPRESSED = 1ULL << 62;
+const uint64_t QCOW2_OFFSET_MASK = 0x00FFFFFFFFFFFE00ULL;
+
+/**
+ * @brief Entries in an L2 table and in a refcount block
+ */
+const uint64_t QCOW2_L2_ENTRIES = QCOW2_CLUSTER_SIZE / 8;
+const uint64_t QCOW2_REFCOUNT_BLOCK_ENTRIES = QCOW2_CLUSTER_SIZE / 2;
+
+/**
+ * @brief Size of the sectors compressed cluster descriptors count in
+ */
+const uint64_t QCOW2_SECTOR_SIZE = 512;
+
+/**
+ * @brief Stores a big-endian value
+ *
+ * @param data Pointer the value is stored at
+ * @param value The value
+ * @param bytes Width of the value in bytes
+ */
+void storeBigEndian(uint8_t* data, uint64_t value, int bytes)
+{
+    for (int i = bytes - 1; i >= 0; i--) {
+        data[i] = static_cast<uint8_t>(value);
+        value >>= 8;
+    }
+}
+
+/**
+ * @brief Reads a big-endian 64-bit value
+ *
+ * @param data Pointer to the value
+ * @return uint64_t The value
+ */
+uint64_t loadBigEndian64(const uint8_t* data)
+{
+    uint64_t value = 0;
+    for (int i = 0; i < 8; i++) { value = (value << 8) | data[i]; }
+    return value;
+}
+
+/**
+ * @brief Rounds an offset up to a cluster boundary
+ *
+ * @param offset The offset
+ * @return uint64_t The first cluster boundary at or after offset
+ */
+uint64_t alignToCluster(uint64_t offset)
+{
+    return (offset + QCOW2_CLUSTER_SIZE - 1) & ~static_cast<uint64_t>(QCOW2_CLUSTER_SIZE - 1);
+}
+
+/**
+ * @brief Writes bytes at an offset of the image file
+ *
+ * @param writer The open writer
+ * @param offset Offset in the file
+ * @param data The bytes to write
+ * @param length Number of bytes
+ */
+void writeQcow2File(Qcow2Writer& writer, uint64_t offset, const void* data, size_t length)
+{
+    setFilePointer(writer.file, static_cast<std::streamoff>(offset), std::ios::beg);
+    writeToFile(writer.file, const_cast<void*>(data), static_cast<std::streamsize>(length));
+}
+
+/**
+ * @brief Allocates a host cluster at the end of the file
+ *
+ * @param writer The open writer
+ * @return uint64_t Offset of the cluster in the file
+ */
+uint64_t allocateQcow2Cluster(Qcow2Writer& writer)
+{
+    uint64_t offset = alignToCluster(writer.fileEnd);
+    writer.fileEnd = offset + QCOW2_CLUSTER_SIZE;
+    return offset;
+}
+
+/**
+ * @brief Writes an L2 table to its cluster
+ *
+ * @param writer The open writer
+ * @param table The table to write
+ */
+void writeQcow2L2Table(Qcow2Writer& writer, Qcow2L2Table& table)
+{
+    std::vector<uint8_t> buffer(QCOW2_CLUSTER_SIZE);
+    for (uint64_t i = 0; i < QCOW2_L2_ENTRIES; i++) { storeBigEndian(buffer.data() + i * 8, table.entries[i], 8); }
+    writeQcow2File(writer, writer.l1Table[table.l1Index] & QCOW2_OFFSET_MASK, buffer.data(), buffer.size());
+    table.dirty = false;
+}
+
+/**
+ * @brief Returns the L2 table covering a guest cluster, allocating or reading it as needed
+ *
+ * The least recently used table is written back when the cache is full.
+ *
+ * @param writer The open writer
+ * @param guestCluster Index of the guest cluster
+ * @return Qcow2L2Table& The table, valid until the next lookup
+ */
+Qcow2L2Table& getQcow2L2Table(Qcow2Writer& writer, uint64_t guestCluster)
+{
+    uint64_t l1Index = guestCluster / QCOW2_L2_ENTRIES;
+    auto cached = writer.l2Lookup.find(l1Index);
+    if (cached != writer.l2Lookup.end()) {
+        writer.l2Cache.splice(writer.l2Cache.begin(), writer.l2Cache, cached->second);
+        return writer.l2Cache.front();
+    }
+
+    while (writer.l2Cache.size() >= std::max<size_t>(writer.maxCachedL2Tables, 1)) {
+        Qcow2L2Table& evicted = writer.l2Cache.back();
+        if (evicted.dirty) { writeQcow2L2Table(writer, evicted); }
+        writer.l2Lookup.erase(evicted.l1Index);
+        writer.l2Cache.pop_back();
+    }
+
+    Qcow2L2Table table;
+    table.l1Index = l1Index;
+    table.entries.assign(QCOW2_L2_ENTRIES, 0);
+    if (writer.l1Table[l1Index] != 0) {
+        std::vector<uint8_t> buffer(QCOW2_CLUSTER_SIZE);
+        setFilePointer(writer.file, static_cast<std::streamoff>(writer.l1Table[l1Index] & QCOW2_OFFSET_MASK), std::ios::beg);
+        readFile(writer.file, buffer.data(), buffer.size());
+        for (uint64_t i = 0; i < QCOW2_L2_ENTRIES; i++) { table.entries[i] = loadBigEndian64(buffer.data() + i * 8); }
+    }
+    else {
+        writer.l1Table[l1Index] = allocateQcow2Cluster(writer) | QCOW2_OFLAG_COPIED;
+        table.dirty = true;
+    }
+
+    writer.l2Cache.push_front(std::move(table));
+    writer.l2Lookup[l1Index] = writer.l2Cache.begin();
+    return writer.l2Cache.front();
+}
+
+/**
+ * @brief Stores a complete guest cluster, compressed when that saves space
+ *
+ * @param writer The open writer
+ * @param guestCluster Index of the guest cluster
+ * @param data The cluster contents
+ */
+void storeQcow2Cluster(Qcow2Writer& writer, uint64_t guestCluster, const uint8_t* data)
+{
+    Qcow2L2Table& table = getQcow2L2Table(writer, guestCluster);
+    uint64_t& entry = table.entries[guestCluster % QCOW2_L2_ENTRIES];
+    table.dirty = true;
+
+#ifdef QCOW2_WITH_ZSTD
+    std::vector<uint8_t> compressed(ZSTD_compressBound(QCOW2_CLUSTER_SIZE));
+    size_t compressedSize = ZSTD_compress(compressed.data(), compressed.size(), data, QCOW2_CLUSTER_SIZE, writer.compressionLevel);
+    if (!ZSTD_isError(compressedSize) && compressedSize <= QCOW2_CLUSTER_SIZE - QCOW2_SECTOR_SIZE) {
+        uint64_t offset = writer.fileEnd;
+        writeQcow2File(writer, offset, compressed.data(), compressedSize);
+        writer.fileEnd += compressedSize;
+
+        // The descriptor counts the 512-byte sectors after the one holding offset
+        uint64_t firstSector = offset / QCOW2_SECTOR_SIZE;
+        uint64_t extraSectors = (offset + compressedSize - 1) / QCOW2_SECTOR_SIZE - firstSector;
+        uint32_t offsetBits = 62 - (QCOW2_CLUSTER_BITS - 8);
+        entry = QCOW2_OFLAG_COMPRESSED | (extraSectors << offsetBits) | offset;
+
+        uint64_t rangeEnd = (firstSector + extraSectors + 1) * QCOW2_SECTOR_SIZE;
+        for (uint64_t hostCluster = offset / QCOW2_CLUSTER_SIZE; hostCluster * QCOW2_CLUSTER_SIZE < rangeEnd; hostCluster++) {
+            writer.compressedRefcounts[hostCluster]++;
+        }
+        writer.compressedClusters++;
+        return;
+    }
+#endif
+
+    uint64_t hostOffset = allocateQcow2Cluster(writer);
+    entry = hostOffset | QCOW2_OFLAG_COPIED;
+    writeQcow2File(writer, hostOffset, data, QCOW2_CLUSTER_SIZE);
+    writer.dataClusters++;
+}
+
+/**
+ * @brief Creates a qcow2 image
+ *
+ * @param writer Output parameter for the writer
+ * @param path Path of the image, replaced if it exists
+ * @param virtualSize Size of the guest disk in bytes
+ * @param compression Compression of data clusters
+ * @throws std::runtime_error if the file cannot be created, or zstd was asked for in a build without it
+ */
+void openQcow2Writer(Qcow2Writer& writer, const std::string& path, uint64_t virtualSize, Qcow2Compression compression)
+{
+#ifndef QCOW2_WITH_ZSTD
+    if (compression == Qcow2Compression::eZstd) {
+        throw std::runtime_error("zstd compression is not available in this build; enable the zstd module in MODULE.bazel and build with --define=zstd=enabled.");
+    }
+#endif
+
+    writer.path = path;
+    writer.virtualSize = virtualSize;
+    writer.compression = compression;
+    writer.l1Table.assign((virtualSize + QCOW2_CLUSTER_SIZE * QCOW2_L2_ENTRIES - 1) / (QCOW2_CLUSTER_SIZE * QCOW2_L2_ENTRIES), 0);
+    writer.l1Offset = QCOW2_CLUSTER_SIZE;
+    writer.fileEnd = alignToCluster(writer.l1Offset + writer.l1Table.size() * 8);
+
+    std::ofstream(path, std::ios::binary | std::ios::trunc).close();
+    writer.file = openFile(path);
+}
+
+/**
+ * @brief Writes guest bytes to a qcow2 image
+ *
+ * @param writer The open writer
+ * @param offset Offset of the bytes on the guest disk
+ * @param data The bytes to write
+ * @param length Number of bytes
+ * @throws std::runtime_error if the range lies beyond the guest disk or cannot be written
+ */
+void writeQcow2(Qcow2Writer& writer, uint64_t offset, const void* data, size_t length)
+{
+    if (offset > writer.virtualSize || length > writer.virtualSize - offset) {
+        std::cerr << "Write at offset " << offset << " of " << length << " bytes is beyond the end of " << writer.path << "\n";
+        throw std::runtime_error("Write beyond the end of the qcow2 image.");
+    }
+
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    while (length > 0) {
+        uint64_t guestCluster = offset / QCOW2_CLUSTER_SIZE;
+        uint32_t clusterOffset = static_cast<uint32_t>(offset % QCOW2_CLUSTER_SIZE);
+        uint32_t piece = static_cast<uint32_t>(std::min<uint64_t>(length, QCOW2_CLUSTER_SIZE - clusterOffset));
+
+        if (writer.compression == Qcow2Compression::eNone) {
+            Qcow2L2Table& table = getQcow2L2Table(writer, guestCluster);
+            uint64_t& entry = table.entries[guestCluster % QCOW2_L2_ENTRIES];
+            if (entry == 0) {
+                entry = allocateQcow2Cluster(writer) | QCOW2_OFLAG_COPIED;
+                table.dirty = true;
+                writer.dataClusters++;
+            }
+            writeQcow2File(writer, (entry & QCOW2_OFFSET_MASK) + clusterOffset, bytes, piece);
+        }
+        else {
+            if (getQcow2L2Table(writer, guestCluster).entries[guestCluster % QCOW2_L2_ENTRIES] != 0) {
+                std::cerr << "Guest cluster " << guestCluster << " of " << writer.path << " written after it was compressed\n";
+                throw std::runtime_error("Compressed qcow2 cluster written twice.");
+            }
+            Qcow2PendingCluster& pending = writer.pendingClusters[guestCluster];
+            if (pending.data.empty()) { pending.data.assign(QCOW2_CLUSTER_SIZE, 0); }
+            std::copy(bytes, bytes + piece, pending.data.begin() + clusterOffset);
+            pending.bytesWritten += piece;
+            if (pending.bytesWritten >= QCOW2_CLUSTER_SIZE) {
+                storeQcow2Cluster(writer, guestCluster, pending.data.data());
+                writer.pendingClusters.erase(guestCluster);
+            }
+        }
+
+        offset += piece;
+        bytes += piece;
+        length -= piece;
+    }
+}
+
+/**
+ * @brief Writes the refcount table and blocks after the last allocated cluster
+ *
+ * The table and blocks count themselves, so their size is found by
+ * iterating until it stops growing.
+ *
+ * @param writer The open writer
+ * @param tableOffset Output parameter for the offset of the refcount table
+ * @param tableClusters Output parameter for the clusters of the refcount table
+ */
+void writeQcow2Refcounts(Qcow2Writer& writer, uint64_t& tableOffset, uint32_t& tableClusters)
+{
+    uint64_t usedClusters = alignToCluster(writer.fileEnd) / QCOW2_CLUSTER_SIZE;
+    uint64_t blockCount = 0;
+    uint64_t tableClusterCount = 0;
+    for (;;) {
+        uint64_t totalClusters = usedClusters + tableClusterCount + blockCount;
+        uint64_t neededBlocks = (totalClusters + QCOW2_REFCOUNT_BLOCK_ENTRIES - 1) / QCOW2_REFCOUNT_BLOCK_ENTRIES;
+        uint64_t neededTableClusters = (neededBlocks * 8 + QCOW2_CLUSTER_SIZE - 1) / QCOW2_CLUSTER_SIZE;
+        if (neededBlocks == blockCount && neededTableClusters == tableClusterCount) { break; }
+        blockCount = neededBlocks;
+        tableClusterCount = neededTableClusters;
+    }
+    uint64_t totalClusters = usedClusters + tableClusterCount + blockCount;
+    tableOffset = usedClusters * QCOW2_CLUSTER_SIZE;
+    tableClusters = static_cast<uint32_t>(tableClusterCount);
+    uint64_t firstBlockOffset = tableOffset + tableClusterCount * QCOW2_CLUSTER_SIZE;
+
+    std::vector<uint8_t> table(tableClusterCount * QCOW2_CLUSTER_SIZE, 0);
+    std::vector<uint8_t> block(QCOW2_CLUSTER_SIZE);
+    for (uint64_t blockIndex = 0; blockIndex < blockCount; blockIndex++) {
+        std::fill(block.begin(), block.end(), 0);
+        for (uint64_t i = 0; i < QCOW2_REFCOUNT_BLOCK_ENTRIES; i++) {
+            uint64_t hostCluster = blockIndex * QCOW2_REFCOUNT_BLOCK_ENTRIES + i;
+            if (hostCluster >= totalClusters) { break; }
+            auto compressed = writer.compressedRefcounts.find(hostCluster);
+            storeBigEndian(block.data() + i * 2, compressed != writer.compressedRefcounts.end() ? compressed->second : 1, 2);
+        }
+        uint64_t blockOffset = firstBlockOffset + blockIndex * QCOW2_CLUSTER_SIZE;
+        writeQcow2File(writer, blockOffset, block.data(), block.size());
+        storeBigEndian(table.data() + blockIndex * 8, blockOffset, 8);
+    }
+    writeQcow2File(writer, tableOffset, table.data(), table.size());
+    writer.fileEnd = totalClusters * QCOW2_CLUSTER_SIZE;
+}
+
+/**
+ * @brief Completes and closes a qcow2 image
+ *
+ * @param writer The writer to close
+ * @throws std::runtime_error if the image cannot be written
+ */
+void closeQcow2Writer(Qcow2Writer& writer)
+{
+    // Clusters that were never written in full are stored with zeros for the rest
+    std::vector<uint64_t> pendingClusters;
+    for (auto& pending : writer.pendingClusters) { pendingClusters.push_back(pending.first); }
+    std::sort(pendingClusters.begin(), pendingClusters.end());
+    for (uint64_t guestCluster : pendingClusters) {
+        storeQcow2Cluster(writer, guestCluster, writer.pendingClusters[guestCluster].data.data());
+        writer.pendingClusters.erase(guestCluster);
+    }
+
+    for (auto& table : writer.l2Cache) {
+        if (table.dirty) { writeQcow2L2Table(writer, table); }
+    }
+    writer.l2Cache.clear();
+    writer.l2Lookup.clear();
+
+    std::vector<uint8_t> l1(writer.l1Table.size() * 8);
+    for (size_t i = 0; i < writer.l1Table.size(); i++) { storeBigEndian(l1.data() + i * 8, writer.l1Table[i], 8); }
+    if (!l1.empty()) { writeQcow2File(writer, writer.l1Offset, l1.data(), l1.size()); }
+
+    uint64_t refcountTableOffset;
+    uint32_t refcountTableClusters;
+    writeQcow2Refcounts(writer, refcountTableOffset, refcountTableClusters);
+
+    // Header, then the end of the header extensions, padded to a whole cluster
+    std::vector<uint8_t> header(QCOW2_CLUSTER_SIZE, 0);
+    storeBigEndian(header.data() + 0, QCOW2_MAGIC, 4);
+    storeBigEndian(header.data() + 4, QCOW2_VERSION, 4);
+    storeBigEndian(header.data() + 20, QCOW2_CLUSTER_BITS, 4);
+    storeBigEndian(header.data() + 24, writer.virtualSize, 8);
+    storeBigEndian(header.data() + 36, writer.l1Table.size(), 4);
+    storeBigEndian(header.data() + 40, writer.l1Offset, 8);
+    storeBigEndian(header.data() + 48, refcountTableOffset, 8);
+    storeBigEndian(header.data() + 56, refcountTableClusters, 4);
+    if (writer.compression == Qcow2Compression::eZstd) {
+        storeBigEndian(header.data() + 72, QCOW2_INCOMPAT_COMPRESSION_TYPE, 8);
+        header[104] = QCOW2_COMPRESSION_TYPE_ZSTD;
+    }
+    storeBigEndian(header.data() + 96, QCOW2_REFCOUNT_ORDER, 4);
+    storeBigEndian(header.data() + 100, QCOW2_HEADER_LENGTH, 4);
+    writeQcow2File(writer, 0, header.data(), header.size());
+    closeFile(writer.file);
+}
+
+/**
+ * @brief Describes an open qcow2 image as a restore target
+ *
+ * @param target Output parameter for the target
+ * @param writer The open writer, which must outlive target
+ */
+void getQcow2RestoreTarget(RestoreTarget& target, Qcow2Writer& writer)
+{
+    target.write = [&writer](uint64_t offset, const void* data, size_t length) { writeQcow2(writer, offset, data, length); };
+    target.clearRange = nullptr;
+}
@@ -0,0 +1,137 @@
+/**
+ * @file qcow2_writer.h
+ * @brief Sparse qcow2 image output for restores
+ *
+ * This file declares a writer that produces a qcow2 version 3 image directly
+ * from a restore, so restores that feed KVM need neither a raw image nor a
+ * conversion pass. Host clusters are only allocated for guest clusters that
+ * are written; everything else reads as zeros. L2 tables are kept in a
+ * small cache and written back in batches, and the L1 table, refcounts and
+ * header are written when the image is closed.
+ *
+ * Clusters can optionally be compressed with zstd. That needs the zstd
+ * module enabled in MODULE.bazel and the build configured with
+ * --define=zstd=enabled.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <fstream>
+#include <list>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "../restore/restore.h"
+
+/**
+ * @brief Size of the clusters of written images, the qcow2 default
+ */
+const uint32_t QCOW2_CLUSTER_BITS = 16;
+const uint32_t QCOW2_CLUSTER_SIZE = 1u << QCOW2_CLUSTER_BITS;
+
+/**
+ * @brief Default number of L2 tables held in memory before the least recently used is written back
+ */
+const size_t DEFAULT_QCOW2_CACHED_L2_TABLES = 64;
+
+/**
+ * @brief Compression applied to the clusters of a qcow2 image
+ */
+enum class Qcow2Compression
+{
+    eNone,  // Clusters are stored as written
+    eZstd   // Clusters are compressed with zstd where that saves space
+};
+
+/**
+ * @brief An L2 table held in memory
+ */
+struct Qcow2L2Table
+{
+    uint64_t l1Index = 0;               // Index of the table in the L1 table
+    std::vector<uint64_t> entries;      // Entries, in host byte order
+    bool dirty = false;                 // Whether the table differs from the file
+};
+
+/**
+ * @brief A guest cluster being gathered until it is complete and can be compressed
+ */
+struct Qcow2PendingCluster
+{
+    std::vector<uint8_t> data;          // Cluster contents, zeros where not yet written
+    uint32_t bytesWritten = 0;          // Bytes of the cluster written so far
+};
+
+/**
+ * @brief A qcow2 image being written
+ *
+ * Not safe for concurrent use; restores serialise their writes.
+ */
+struct Qcow2Writer
+{
+    std::fstream file;                                          // The image file
+    std::string path;                                           // Path of the image file
+    uint64_t virtualSize = 0;                                   // Size of the guest disk in bytes
+    Qcow2Compression compression = Qcow2Compression::eNone;     // Compression of data clusters
+    int compressionLevel = 3;                                   // zstd compression level
+    uint64_t l1Offset = 0;                                      // Offset of the L1 table in the file
+    std::vector<uint64_t> l1Table;                              // L1 entries, in host byte order
+    uint64_t fileEnd = 0;                                       // Next free byte of the file
+    size_t maxCachedL2Tables = DEFAULT_QCOW2_CACHED_L2_TABLES;  // L2 tables held in memory
+    std::list<Qcow2L2Table> l2Cache;                            // Cached L2 tables, most recently used first
+    std::unordered_map<uint64_t, std::list<Qcow2L2Table>::iterator> l2Lookup;  // Cached tables by L1 index
+    std::unordered_map<uint64_t, Qcow2PendingCluster> pendingClusters;  // Incomplete guest clusters, when compressing
+    std::unordered_map<uint64_t, uint16_t> compressedRefcounts; // References to host clusters holding compressed data
+    uint64_t dataClusters = 0;                                  // Guest clusters stored uncompressed
+    uint64_t compressedClusters = 0;                            // Guest clusters stored compressed
+};
+
+/**
+ * @brief Creates a qcow2 image
+ *
+ * @param writer Output parameter for the writer
+ * @param path Path of the image, replaced if it exists
+ * @param virtualSize Size of the guest disk in bytes
+ * @param compression Compression of data clusters
+ * @throws std::runtime_error if the file cannot be created, or zstd was asked for in a build without it
+ */
+void openQcow2Writer(Qcow2Writer& writer, const std::string& path, uint64_t virtualSize, Qcow2Compression compression);
+
+/**
+ * @brief Writes guest bytes to a qcow2 image
+ *
+ * Without compression, host clusters are allocated on the first write to
+ * a guest cluster and written in place. With compression, a guest cluster
+ * is gathered in memory until it has been written in full, or until the
+ * image is closed.
+ *
+ * @param writer The open writer
+ * @param offset Offset of the bytes on the guest disk
+ * @param data The bytes to write
+ * @param length Number of bytes
+ * @throws std::runtime_error if the range lies beyond the guest disk or cannot be written
+ */
+void writeQcow2(Qcow2Writer& writer, uint64_t offset, const void* data, size_t length);
+
+/**
+ * @brief Completes and closes a qcow2 image
+ *
+ * Writes the remaining gathered clusters, the L2 tables, the L1 table, the
+ * refcount table and blocks, and finally the header.
+ *
+ * @param writer The writer to close
+ * @throws std::runtime_error if the image cannot be written
+ */
+void closeQcow2Writer(Qcow2Writer& writer);
+
+/**
+ * @brief Describes an open qcow2 image as a restore target
+ *
+ * The target has no clearRange function, as unallocated clusters read as zeros.
+ *
+ * @param target Output parameter for the target
+ * @param writer The open writer, which must outlive target
+ */
+void getQcow2RestoreTarget(RestoreTarget& target, Qcow2Writer& writer);
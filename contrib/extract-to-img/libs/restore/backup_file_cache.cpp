@@ -0,0 +1,66 @@
+/**
+ * @file backup_file_cache.cpp
+ * @brief Implementation of the bounded backup file stream cache
+ *
+ * This file implements a least-recently-used cache of open backup file
+ * streams, reopening files on demand and closing the least recently used
+ * file when the configured limit is reached.
+ */
+
+#include <algorithm>
+
+#include "../file_handler/file_handler.h"
+#include "backup_file_cache.h"
+
+/**
+ * @brief Returns an open stream for a backup file, opening it if required
+ *
+ * A cache hit moves the file to the front of the list. On a miss the least
+ * recently used files are evicted until there is room, then the file is
+ * opened and inserted at the front.
+ *
+ * @param cache The cache to look the file up in
+ * @param filePath Path to the backup file
+ * @return BackupFilePtr Open stream for the file
+ * @throws std::runtime_error if the file cannot be opened
+ */
+BackupFilePtr AcquireBackupFile(BackupFileCache& cache, const std::string& filePath)
+{
+    std::lock_guard<std::mutex> guard(cache.lock);
+
+    auto found = cache.entries.find(filePath);
+    if (found != cache.entries.end()) {
+        cache.lru.splice(cache.lru.begin(), cache.lru, found->second);
+        return found->second->file;
+    }
+
+    size_t maxOpenFiles = std::max<size_t>(cache.maxOpenFiles, 1);
+    while (cache.lru.size() >= maxOpenFiles) {
+        // Streams still referenced by a reader are closed when it releases them
+        cache.entries.erase(cache.lru.back().filePath);
+        cache.lru.pop_back();
+    }
+
+    BackupFileCacheEntry entry;
+    entry.filePath = filePath;
+    entry.file = std::make_shared<std::fstream>(openFile(filePath));
+    cache.lru.push_front(entry);
+    cache.entries[filePath] = cache.lru.begin();
+    return entry.file;
+}
+
+/**
+ * @brief Closes every stream held by the cache
+ *
+ * @param cache The cache to empty
+ */
+void CloseBackupFileCache(BackupFileCache& cache)
+{
+    std::lock_guard<std::mutex> guard(cache.lock);
+
+    for (auto& entry : cache.lru) {
+        closeFile(*entry.file);
+    }
+    cache.entries.clear();
+    cache.lru.clear();
+}
@@ -0,0 +1,71 @@
+/**
+ * @file backup_file_cache.h
+ * @brief Bounded cache of open backup file streams
+ *
+ * This file declares a least-recently-used cache of open backup file streams.
+ * A single cache is shared by every partition of a restore so that long
+ * incremental chains never hold more than a fixed number of descriptors open.
+ * Files are reopened on demand when they are requested after being evicted.
+ */
+
+#pragma once
+
+#include <fstream>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+/**
+ * @brief Shared pointer to a backup file stream
+ */
+typedef std::shared_ptr<std::fstream> BackupFilePtr;
+
+/**
+ * @brief Default maximum number of backup files held open at once
+ */
+const size_t DEFAULT_MAX_OPEN_BACKUP_FILES = 64;
+
+/**
+ * @brief An open backup file held by the cache
+ */
+struct BackupFileCacheEntry
+{
+    std::string filePath;    // Path the stream was opened from
+    BackupFilePtr file;      // The open stream
+};
+
+/**
+ * @brief Least-recently-used cache of open backup file streams
+ *
+ * The most recently used file is kept at the front of the list. When a file
+ * is requested and the cache is full, the file at the back is closed.
+ */
+struct BackupFileCache
+{
+    size_t maxOpenFiles = DEFAULT_MAX_OPEN_BACKUP_FILES;                                       // Maximum number of open streams
+    std::list<BackupFileCacheEntry> lru;                                                       // Open streams, most recent first
+    std::unordered_map<std::string, std::list<BackupFileCacheEntry>::iterator> entries;        // Lookup by file path
+    std::mutex lock;                                                                           // Guards lru and entries
+};
+
+/**
+ * @brief Returns an open stream for a backup file, opening it if required
+ *
+ * The returned stream stays valid while the caller holds the pointer, even
+ * if the cache evicts it in the meantime.
+ *
+ * @param cache The cache to look the file up in
+ * @param filePath Path to the backup file
+ * @return BackupFilePtr Open stream for the file
+ * @throws std::runtime_error if the file cannot be opened
+ */
+BackupFilePtr AcquireBackupFile(BackupFileCache& cache, const std::string& filePath);
+
+/**
+ * @brief Closes every stream held by the cache
+ *
+ * @param cache The cache to empty
+ */
+void CloseBackupFileCache(BackupFileCache& cache);
@@ -8,6 +8,13 @@
 
 #include <iostream>
 #include <algorithm>
+#include <atomic>
+#include <exception>
+#include <filesystem>
+#include <functional>
+#include <stdexcept>
+#include <system_error>
+#include <thread>
 
 #include "../file_handler/file_handler.h"
 #include "backup_set.h"
@@ -24,6 +31,163 @@ bool SortByDescFileNumber(file_structs::Partition::File_History& fhistory1, file
     return fhistory1.file_number > fhistory2.file_number;
 }
 
+/**
+ * @brief Returns the size of a partition's block index
+ * 
+ * @param partition The partition layout
+ * @return uint64_t Bytes of data block and delta block index entries
+ */
+uint64_t getIndexByteLength(file_structs::Partition::Partition_Layout& partition)
+{
+    return partition.data_block_index.size() * sizeof(DataBlockIndexElement) +
+        partition.delta_data_block_index.size() * sizeof(DeltaDataBlockIndexElement);
+}
+
+/**
+ * @brief Returns where a file of the chain can be found
+ * 
+ * The file history records the paths the chain was written to, which are
+ * Windows paths when the backup was taken on Windows. When a recorded path
+ * does not exist, the file is looked for by name next to the restore point.
+ * 
+ * @param recordedPath Path recorded in the file history
+ * @param backupFilePath Path of the restore point's backup file
+ * @return std::string The recorded path if it exists, the path next to the restore point if the file or its metadata sidecar is there, otherwise the recorded path
+ */
+std::string resolveChainFilePath(const std::string& recordedPath, const std::string& backupFilePath)
+{
+    std::error_code error;
+    if (std::filesystem::exists(recordedPath, error)) { return recordedPath; }
+
+    size_t separator = recordedPath.find_last_of("\\/");
+    std::string fileName = separator == std::string::npos ? recordedPath : recordedPath.substr(separator + 1);
+    std::string candidate = (std::filesystem::path(backupFilePath).parent_path() / fileName).string();
+    if (std::filesystem::exists(candidate, error) || std::filesystem::exists(candidate + BACKUP_METADATA_EXTENSION, error)) {
+        return candidate;
+    }
+    return recordedPath;
+}
+
+/**
+ * @brief Metadata of a chain file loaded by the layout loader
+ */
+struct ChainFileLayout
+{
+    bool hasFooter = false;             // Whether the file holds metadata rather than only data blocks
+    LazyFileLayout layout;              // The opened layout, when the file has a footer
+    int partitionIndex = -1;            // Index of the resolved partition in the layout, or -1 if it is not there
+    std::exception_ptr failure;         // Error raised while loading the file
+};
+
+/**
+ * @brief Returns the index of a partition on a disk of a layout
+ * 
+ * @param layout The file layout
+ * @param diskIndex Index of the disk in the layout
+ * @param partitionNumber Number of the partition
+ * @return int Index of the partition on the disk, or -1 if it is not there
+ */
+int findPartitionIndex(file_structs::File_Layout& layout, int diskIndex, int32_t partitionNumber)
+{
+    auto& partitions = layout.disks[diskIndex].partitions;
+    for (size_t j = 0; j < partitions.size(); j++) {
+        if (partitions[j]._header.partition_number == partitionNumber) { return static_cast<int>(j); }
+    }
+    return -1;
+}
+
+/**
+ * @brief Checks a full backup's partition index read from a metadata sidecar
+ * 
+ * A sidecar can be written before the backup it describes is complete, and
+ * then holds a partition with no blocks or a partial index. A full backup's
+ * index has one entry per block, so it states how many entries it should
+ * hold and is only trusted when that matches the restore point.
+ * 
+ * @param partition The partition read from the sidecar
+ * @param partitionLayout The partition layout from the restore point
+ * @return true if the index can be used
+ */
+bool isSidecarIndexConsistent(const file_structs::Partition::Partition_Layout& partition,
+    const file_structs::Partition::Partition_Layout& partitionLayout)
+{
+    return partition._header.block_count == partitionLayout._header.block_count &&
+        partition.data_block_index.size() == partition._header.block_count;
+}
+
+/**
+ * @brief Loads the index of the resolved partition from a chain file
+ * 
+ * The index of an increment does not record how many delta entries it
+ * holds, so one read from a metadata sidecar cannot be checked. It is
+ * always read from the backup file, and the sidecar only supplies the JSON
+ * metadata and track 0. A full backup's index is read from its sidecar when
+ * it matches the restore point, and from the backup file otherwise.
+ * 
+ * @param chainFile The chain file, opened and holding the partition
+ * @param partitionLayout The partition layout from the restore point
+ * @param diskIndex The index of the disk containing the partition
+ * @return file_structs::Partition::Partition_Layout& The partition with its index
+ * @throws std::runtime_error if the index cannot be taken from the sidecar and the backup file cannot be read instead
+ */
+file_structs::Partition::Partition_Layout& loadChainFilePartition(ChainFileLayout& chainFile,
+    const file_structs::Partition::Partition_Layout& partitionLayout, int diskIndex)
+{
+    if (chainFile.layout.metadataFileName == chainFile.layout.backupFileName) {
+        return loadPartitionIndex(chainFile.layout, diskIndex, static_cast<size_t>(chainFile.partitionIndex));
+    }
+    if (chainFile.layout.layout._header.delta_index == 0) {
+        auto& partition = loadPartitionIndex(chainFile.layout, diskIndex, static_cast<size_t>(chainFile.partitionIndex));
+        if (isSidecarIndexConsistent(partition, partitionLayout)) { return partition; }
+    }
+
+    std::string backupFileName = chainFile.layout.backupFileName;
+    std::string metadataFileName = chainFile.layout.metadataFileName;
+    std::error_code error;
+    chainFile.layout = LazyFileLayout();
+    if (!std::filesystem::is_regular_file(backupFileName, error) || !openBackupFileLayout(chainFile.layout, backupFileName, false)) {
+        std::cerr << "The index of partition " << partitionLayout._header.partition_number << " cannot be taken from metadata sidecar "
+                  << metadataFileName << " and the backup file " << backupFileName << " cannot be read instead\n";
+        throw std::runtime_error("Inconsistent metadata sidecar.");
+    }
+    chainFile.partitionIndex = findPartitionIndex(chainFile.layout.layout, diskIndex, partitionLayout._header.partition_number);
+    if (chainFile.partitionIndex < 0) {
+        std::cerr << "Partition " << partitionLayout._header.partition_number << " is not in " << backupFileName << "\n";
+        throw std::runtime_error("Inconsistent metadata sidecar.");
+    }
+    return loadPartitionIndex(chainFile.layout, diskIndex, static_cast<size_t>(chainFile.partitionIndex));
+}
+
+/**
+ * @brief Runs a task for each index in a range on up to maxThreads threads
+ * 
+ * The task must not throw; errors are kept by the task for its index.
+ * 
+ * @param count Number of indexes
+ * @param maxThreads Maximum number of threads
+ * @param task Task run once for each index
+ */
+void runConcurrently(size_t count, size_t maxThreads, const std::function<void(size_t)>& task)
+{
+    std::atomic<size_t> next(0);
+    auto worker = [&]() {
+        for (size_t i = next++; i < count; i = next++) { task(i); }
+    };
+
+    size_t threadCount = std::min(count, std::max<size_t>(maxThreads, 1));
+    if (threadCount <= 1) {
+        worker();
+        return;
+    }
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < threadCount; i++) {
+        threads.emplace_back(worker);
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+}
+
 /**
  * @brief Finds and stores the layouts and paths of backup files up to the latest full backup
  * 
@@ -31,47 +195,122 @@ bool SortByDescFileNumber(file_structs::Partition::File_History& fhistory1, file
  * starting from the most recent and working back to the full backup. It only works when
  * the file path of previous backup files has changed.
  * 
+ * Every file in the history is recorded by file number so data blocks can be read from
+ * the segments of split backups. Segments without a footer hold only data blocks and are
+ * not parsed, and segments repeating the metadata of an increment already read are skipped.
+ * Only the index of the partition being resolved is read from each file.
+ * Metadata sidecars are read in place of the backup files when present, but
+ * the indexes of increments are always read from the backup files, as are
+ * full backup indexes in a sidecar that does not match the restore point.
+ * 
+ * The metadata of every file in the history is read concurrently on up to
+ * maxLoaderThreads threads, so the latency of each open and read against
+ * the repository overlaps. The files making up the chain are then picked
+ * in file number order, and their partition indexes are read concurrently.
+ * Errors only fail the resolution for files that are part of the chain.
+ * 
  * @param backupSet The backup set to populate with file information
+ * @param backupFilePath Path of the restore point's backup file
  * @param partitionLayout The partition layout containing file history
  * @param diskIndex The index of the disk to process
+ * @param metrics Metrics to record index loads in, or nullptr
+ * @param maxLoaderThreads Maximum number of chain files read concurrently
+ * @throws std::runtime_error if a chain file cannot be read, the chain has no full backup holding the partition,
+ * or a partition index cannot be taken from a metadata sidecar and its backup file cannot be read
  */
-void FindBackupFiles(PartitionBackupSet& backupSet, file_structs::Partition::Partition_Layout& partitionLayout, int diskIndex)
+void FindBackupFiles(PartitionBackupSet& backupSet, const std::string& backupFilePath, file_structs::Partition::Partition_Layout& partitionLayout,
+    int diskIndex, RestoreMetrics* metrics, size_t maxLoaderThreads)
 {
     // Sort the files in descending order so we go from most recent backup to oldest
-    std::sort(partitionLayout._header.file_history.begin(), partitionLayout._header.file_history.end(), SortByDescFileNumber);
-    
-    for (auto& fileHistory : partitionLayout._header.file_history) {
-        backupSet.filePaths.insert(backupSet.filePaths.begin(), fileHistory.file_name);
-        file_structs::File_Layout fileLayout;
-        readBackupFileLayout(fileLayout, fileHistory.file_name);
-
-        for (auto& partition : fileLayout.disks[diskIndex].partitions) {
-            if (partition._header.partition_number == partitionLayout._header.partition_number) {
-                backupSet.partitionLayouts.insert(backupSet.partitionLayouts.begin(), std::make_unique<file_structs::Partition::Partition_Layout>(partition));
-                break;
-            }
+    auto& fileHistory = partitionLayout._header.file_history;
+    std::sort(fileHistory.begin(), fileHistory.end(), SortByDescFileNumber);
+
+    std::vector<std::string> filePaths;
+    for (auto& historyEntry : fileHistory) {
+        filePaths.push_back(resolveChainFilePath(historyEntry.file_name, backupFilePath));
+        backupSet.segmentPaths[historyEntry.file_number] = filePaths.back();
+    }
+
+    std::vector<ChainFileLayout> chainFiles(filePaths.size());
+    runConcurrently(filePaths.size(), maxLoaderThreads, [&](size_t i) {
+        try {
+            chainFiles[i].hasFooter = openBackupFileLayout(chainFiles[i].layout, filePaths[i]);
         }
+        catch (...) {
+            chainFiles[i].failure = std::current_exception();
+        }
+    });
+
+    // Pick the files of the chain, newest first, as the metadata says
+    std::vector<size_t> chain;
+    int32_t lastIncrement = -1;
+    for (size_t i = 0; i < chainFiles.size(); i++) {
+        if (chainFiles[i].failure) { std::rethrow_exception(chainFiles[i].failure); }
+        if (!chainFiles[i].hasFooter) { continue; } // Data-only split segment
+
+        auto& layout = chainFiles[i].layout.layout;
+        if (layout._header.increment_number == lastIncrement) { continue; } // Another segment of the same increment
+        lastIncrement = layout._header.increment_number;
+        chain.push_back(i);
+
+        chainFiles[i].partitionIndex = findPartitionIndex(layout, diskIndex, partitionLayout._header.partition_number);
+
+        if (layout._header.delta_index == 0) { break; } // Stop at the full backup
+    }
 
-        if (fileLayout._header.delta_index == 0) { return; } // Stop at the full backup
+    // The full backup's index is the base every increment applies to
+    if (chain.empty() || chainFiles[chain.back()].layout.layout._header.delta_index != 0) {
+        std::cerr << "No full backup found in the file history of partition " << partitionLayout._header.partition_number << "\n";
+        throw std::runtime_error("Backup chain has no full backup.");
+    }
+    if (chainFiles[chain.back()].partitionIndex < 0) {
+        std::cerr << "Partition " << partitionLayout._header.partition_number << " is not in the full backup "
+                  << filePaths[chain.back()] << "\n";
+        throw std::runtime_error("Partition missing from full backup.");
+    }
+
+    // Only this partition's index is read from each file
+    runConcurrently(chain.size(), maxLoaderThreads, [&](size_t i) {
+        ChainFileLayout& chainFile = chainFiles[chain[i]];
+        if (chainFile.partitionIndex < 0) { return; }
+        try {
+            uint64_t start = startStage(metrics);
+            auto& partition = loadChainFilePartition(chainFile, partitionLayout, diskIndex);
+            recordStage(metrics, RestoreStage::eIndexLoad, start, getIndexByteLength(partition));
+        }
+        catch (...) {
+            chainFile.failure = std::current_exception();
+        }
+    });
+
+    // Assemble the set oldest first, in the order the chain was written
+    for (auto file = chain.rbegin(); file != chain.rend(); ++file) {
+        ChainFileLayout& chainFile = chainFiles[*file];
+        if (chainFile.failure) { std::rethrow_exception(chainFile.failure); }
+        backupSet.filePaths.push_back(filePaths[*file]);
+        if (chainFile.partitionIndex < 0) { continue; }
+
+        auto& partition = chainFile.layout.layout.disks[diskIndex].partitions[static_cast<size_t>(chainFile.partitionIndex)];
+        backupSet.partitionLayouts.push_back(std::make_unique<file_structs::Partition::Partition_Layout>(std::move(partition)));
     }
 }
 
 /**
  * @brief Creates the initial block-to-file mapping for a backup set
  * 
- * This function opens the first backup file and creates the initial mapping
- * of data blocks to their corresponding backup file.
+ * This function creates the initial mapping of data blocks from the index
+ * of the full backup, which is always the first layout in the set.
  * 
  * @param backupSet The backup set to populate with block mappings
+ * @throws std::runtime_error if the set holds no layouts
  */
 void FillInitialBlockFileMap(PartitionBackupSet& backupSet)
 {
-    BackupFilePtr filePtr = std::make_shared<std::fstream>(openFile(backupSet.filePaths[0]));
-    backupSet.backupFilePtrs.push_back(filePtr);
+    if (backupSet.partitionLayouts.empty()) { throw std::runtime_error("Backup set has no full backup."); }
+    backupSet.backupSetBlockIndex.reserve(backupSet.partitionLayouts[0]->data_block_index.size());
     for (int i = 0; i < backupSet.partitionLayouts[0]->data_block_index.size(); i++) {
         BackupSetBlockIndexElement blockIndexElement;
         blockIndexElement.block = backupSet.partitionLayouts[0]->data_block_index[i];
-        blockIndexElement.file = filePtr;
         backupSet.backupSetBlockIndex.push_back(blockIndexElement);
     }
 }
@@ -80,32 +319,43 @@ void FillInitialBlockFileMap(PartitionBackupSet& backupSet)
  * @brief Adds delta backup information to the block-to-file mapping
  * 
  * This function processes incremental backup files and updates the block mapping
- * to reflect changes in the delta backups.
+ * to reflect changes in the delta backups. Files are not opened here; they are
+ * opened on demand through the backup file cache when blocks are read.
  * 
  * @param backupSet The backup set containing the block mappings to update
+ * @throws std::runtime_error if a delta block lies beyond the full backup's block map
  */
 void AddDeltaToBlockFileMap(PartitionBackupSet& backupSet)
 {
     for (int i = 1; i < backupSet.partitionLayouts.size(); i++) {
-        BackupFilePtr filePtr = std::make_shared<std::fstream>(openFile(backupSet.filePaths[i]));
-        backupSet.backupFilePtrs.push_back(filePtr);
         for (auto& deltaBlock : backupSet.partitionLayouts[i]->delta_data_block_index) {
-            backupSet.backupSetBlockIndex[deltaBlock.block_index].file = filePtr;
+            if (deltaBlock.block_index >= backupSet.backupSetBlockIndex.size()) {
+                std::cerr << "Delta block " << deltaBlock.block_index << " lies beyond the " << backupSet.backupSetBlockIndex.size()
+                          << " blocks of the full backup\n";
+                throw std::runtime_error("Delta block out of range.");
+            }
             backupSet.backupSetBlockIndex[deltaBlock.block_index].block = deltaBlock.data_block;
         }
     }
 }
 
 /**
- * @brief Closes all open backup files in a backup set
+ * @brief Returns an open stream for the backup file holding a block
  * 
- * @param backupSet The backup set containing the files to close
+ * @param backupSet The backup set the block belongs to
+ * @param block The block to locate
+ * @param fileCache The cache of open backup files
+ * @return BackupFilePtr Open stream for the backup file containing the block
+ * @throws std::runtime_error if no file in the set has the block's file number
  */
-void CloseBackupFiles(PartitionBackupSet& backupSet)
+BackupFilePtr GetBackupFile(PartitionBackupSet& backupSet, const DataBlockIndexElement& block, BackupFileCache& fileCache)
 {
-    for(auto& backupFilePtr : backupSet.backupFilePtrs) {
-        closeFile(*backupFilePtr);
+    auto segment = backupSet.segmentPaths.find(block.file_number);
+    if (segment == backupSet.segmentPaths.end()) {
+        std::cerr << "No backup file with file number " << block.file_number << "\n";
+        throw std::runtime_error("Missing backup file.");
     }
+    return AcquireBackupFile(fileCache, segment->second);
 }
 
 /**
@@ -117,12 +367,178 @@ void CloseBackupFiles(PartitionBackupSet& backupSet)
  * 3. Adding delta (incremental) backup information
  * 
  * @param backupSet The backup set structure to populate
+ * @param backupFilePath Path of the restore point's backup file
  * @param partitionLayout The partition layout to build the backup set for
  * @param diskIndex The index of the disk containing the partition
+ * @param metrics Metrics to record chain resolution and index loads in, or nullptr
+ * @param maxLoaderThreads Maximum number of chain files read concurrently
+ * @throws std::runtime_error if the chain cannot be resolved or its indexes do not fit together
  */
-void BuildPartitionBackupSet(PartitionBackupSet& backupSet, file_structs::Partition::Partition_Layout& partitionLayout, int diskIndex)
+void BuildPartitionBackupSet(PartitionBackupSet& backupSet, const std::string& backupFilePath, file_structs::Partition::Partition_Layout& partitionLayout,
+    int diskIndex, RestoreMetrics* metrics, size_t maxLoaderThreads)
 {
-    FindBackupFiles(backupSet, partitionLayout, diskIndex);
+    uint64_t start = startStage(metrics);
+    FindBackupFiles(backupSet, backupFilePath, partitionLayout, diskIndex, metrics, maxLoaderThreads);
     FillInitialBlockFileMap(backupSet);
     AddDeltaToBlockFileMap(backupSet);
+    recordStage(metrics, RestoreStage::eChainResolution, start, 0);
+}
+
+/**
+ * @brief Returns a well mixed hash of a block index
+ * 
+ * @param blockIndex The block index
+ * @return uint64_t The hash, from the splitmix64 finaliser
+ */
+uint64_t hashDeltaBlockIndex(BlockIndex blockIndex)
+{
+    uint64_t hash = blockIndex + 0x9e3779b97f4a7c15ULL;
+    hash = (hash ^ (hash >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    hash = (hash ^ (hash >> 27)) * 0x94d049bb133111ebULL;
+    return hash ^ (hash >> 31);
+}
+
+/**
+ * @brief Builds the filter of a chain file's delta blocks
+ * 
+ * Bits are chosen by double hashing, so each block only needs one hash.
+ * 
+ * @param filter Output parameter for the filter
+ * @param deltaBlocks The file's delta blocks
+ * @param bitsPerBlock Bits of the filter for each delta block, 0 for no filter
+ */
+void buildDeltaBlockFilter(DeltaBlockFilter& filter, const std::vector<DeltaDataBlockIndexElement>& deltaBlocks, uint32_t bitsPerBlock)
+{
+    filter = DeltaBlockFilter();
+    if (bitsPerBlock == 0 || deltaBlocks.empty()) { return; }
+
+    filter.bitCount = static_cast<uint64_t>(deltaBlocks.size()) * bitsPerBlock;
+    filter.hashCount = std::max<uint32_t>(1, (bitsPerBlock * 693 + 500) / 1000); // bitsPerBlock * ln 2 is optimal
+    filter.words.assign((filter.bitCount + 63) / 64, 0);
+    for (auto& deltaBlock : deltaBlocks) {
+        uint64_t hash = hashDeltaBlockIndex(deltaBlock.block_index);
+        uint64_t step = (hash >> 32) | 1;
+        for (uint32_t i = 0; i < filter.hashCount; i++) {
+            uint64_t bit = (hash + i * step) % filter.bitCount;
+            filter.words[bit / 64] |= 1ULL << (bit % 64);
+        }
+    }
+}
+
+/**
+ * @brief Returns whether a chain file may hold a delta for a block
+ * 
+ * @param filter The file's filter
+ * @param blockIndex Index of the block in the block map
+ * @return true if the file may hold the block, always when it has no filter
+ */
+bool mayHoldDeltaBlock(const DeltaBlockFilter& filter, BlockIndex blockIndex)
+{
+    if (filter.bitCount == 0) { return true; }
+
+    uint64_t hash = hashDeltaBlockIndex(blockIndex);
+    uint64_t step = (hash >> 32) | 1;
+    for (uint32_t i = 0; i < filter.hashCount; i++) {
+        uint64_t bit = (hash + i * step) % filter.bitCount;
+        if ((filter.words[bit / 64] & (1ULL << (bit % 64))) == 0) { return false; }
+    }
+    return true;
+}
+
+/**
+ * @brief Compares delta blocks by the block they replace
+ * 
+ * @param block1 First delta block
+ * @param block2 Second delta block
+ * @return true if block1 replaces an earlier block than block2
+ */
+bool SortByBlockIndex(const DeltaDataBlockIndexElement& block1, const DeltaDataBlockIndexElement& block2)
+{
+    return block1.block_index < block2.block_index;
+}
+
+/**
+ * @brief Builds a partition backup set that resolves blocks on demand
+ * 
+ * The delta indexes are sorted stably, so when a file lists a block more
+ * than once the last entry still wins, as it does in AddDeltaToBlockFileMap.
+ * The full backup's index is addressed directly by block, so it must hold
+ * an entry for every block of the partition, and no delta may lie beyond it.
+ * 
+ * @param backupSet The backup set structure to populate
+ * @param backupFilePath Path of the restore point's backup file
+ * @param partitionLayout The partition layout to build the backup set for
+ * @param diskIndex The index of the disk containing the partition
+ * @param metrics Metrics to record chain resolution and index loads in, or nullptr
+ * @param maxLoaderThreads Maximum number of chain files read and indexed concurrently
+ * @param filterBitsPerBlock Bits of each file's filter for each of its delta blocks, 0 for no filters
+ * @throws std::runtime_error if the chain cannot be resolved, the full backup's index does not cover the partition, or a delta block lies beyond it
+ */
+void BuildLazyPartitionBackupSet(PartitionBackupSet& backupSet, const std::string& backupFilePath, file_structs::Partition::Partition_Layout& partitionLayout,
+    int diskIndex, RestoreMetrics* metrics, size_t maxLoaderThreads, uint32_t filterBitsPerBlock)
+{
+    uint64_t start = startStage(metrics);
+    FindBackupFiles(backupSet, backupFilePath, partitionLayout, diskIndex, metrics, maxLoaderThreads);
+    if (backupSet.partitionLayouts.empty()) { throw std::runtime_error("Backup set has no full backup."); }
+    size_t blockCount = backupSet.partitionLayouts[0]->data_block_index.size();
+    if (blockCount != partitionLayout._header.block_count) {
+        std::cerr << "The full backup indexes " << blockCount << " of the " << partitionLayout._header.block_count
+                  << " blocks of partition " << partitionLayout._header.partition_number << "\n";
+        throw std::runtime_error("Full backup index does not match the partition.");
+    }
+
+    backupSet.lazy = true;
+    backupSet.deltaFilters.assign(backupSet.partitionLayouts.size(), DeltaBlockFilter());
+    runConcurrently(backupSet.partitionLayouts.size(), maxLoaderThreads, [&](size_t i) {
+        if (i == 0) { return; } // The full backup's index is addressed directly
+        auto& deltaBlocks = backupSet.partitionLayouts[i]->delta_data_block_index;
+        if (!std::is_sorted(deltaBlocks.begin(), deltaBlocks.end(), SortByBlockIndex)) {
+            std::stable_sort(deltaBlocks.begin(), deltaBlocks.end(), SortByBlockIndex);
+        }
+        buildDeltaBlockFilter(backupSet.deltaFilters[i], deltaBlocks, filterBitsPerBlock);
+    });
+    for (size_t i = 1; i < backupSet.partitionLayouts.size(); i++) {
+        auto& deltaBlocks = backupSet.partitionLayouts[i]->delta_data_block_index;
+        if (!deltaBlocks.empty() && deltaBlocks.back().block_index >= blockCount) {
+            std::cerr << "Delta block " << deltaBlocks.back().block_index << " lies beyond the " << blockCount
+                      << " blocks of the full backup\n";
+            throw std::runtime_error("Delta block out of range.");
+        }
+    }
+    recordStage(metrics, RestoreStage::eChainResolution, start, 0);
+}
+
+/**
+ * @brief Returns the number of blocks in a partition's block map
+ * 
+ * @param backupSet The backup set of the partition
+ * @return size_t Number of blocks, whether or not the set resolves them on demand
+ */
+size_t GetBackupSetBlockCount(const PartitionBackupSet& backupSet)
+{
+    if (!backupSet.lazy) { return backupSet.backupSetBlockIndex.size(); }
+    return backupSet.partitionLayouts.empty() ? 0 : backupSet.partitionLayouts[0]->data_block_index.size();
+}
+
+/**
+ * @brief Returns the stored block holding a block of a partition's block map
+ * 
+ * @param backupSet The backup set of the partition
+ * @param blockIndex Index of the block in the block map
+ * @return const DataBlockIndexElement* The stored block, whose block_length is 0 when no data was backed up, or nullptr if blockIndex is out of range
+ */
+const DataBlockIndexElement* ResolveBackupSetBlock(const PartitionBackupSet& backupSet, BlockIndex blockIndex)
+{
+    if (blockIndex >= GetBackupSetBlockCount(backupSet)) { return nullptr; }
+    if (!backupSet.lazy) { return &backupSet.backupSetBlockIndex[blockIndex].block; }
+
+    for (size_t i = backupSet.partitionLayouts.size() - 1; i > 0; i--) {
+        if (!mayHoldDeltaBlock(backupSet.deltaFilters[i], blockIndex)) { continue; }
+
+        auto& deltaBlocks = backupSet.partitionLayouts[i]->delta_data_block_index;
+        auto next = std::upper_bound(deltaBlocks.begin(), deltaBlocks.end(), blockIndex,
+            [](BlockIndex index, const DeltaDataBlockIndexElement& block) { return index < block.block_index; });
+        if (next != deltaBlocks.begin() && (next - 1)->block_index == blockIndex) { return &(next - 1)->data_block; }
+    }
+    return &backupSet.partitionLayouts[0]->data_block_index[blockIndex];
 }
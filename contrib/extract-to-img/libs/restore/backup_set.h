@@ -7,17 +7,16 @@
  * backups and their associated data blocks.
  */
 
+#pragma once
+
 #include <map>
 #include <vector>
 #include <fstream>
 #include <string>
 
 #include "../img_handler/img_handler.h"
-
-/**
- * @brief Shared pointer to a backup file stream
- */
-typedef std::shared_ptr<std::fstream> BackupFilePtr;
+#include "../metrics/restore_metrics.h"
+#include "backup_file_cache.h"
 
 /**
  * @brief Unique pointer to a partition layout structure
@@ -29,15 +28,39 @@ typedef std::unique_ptr<file_structs::Partition::Partition_Layout> PartitionLayo
  */
 typedef uint32_t BlockIndex;
 
+/**
+ * @brief Default number of chain files whose metadata is read concurrently
+ */
+const size_t DEFAULT_MAX_LAYOUT_LOADER_THREADS = 8;
+
+/**
+ * @brief Default bits of a chain file's delta block filter for each delta block, 0 for no filters
+ */
+const uint32_t DEFAULT_DELTA_FILTER_BITS_PER_BLOCK = 10;
+
+/**
+ * @brief Bloom filter of the blocks a chain file holds deltas for
+ * 
+ * Lets a lookup skip files that cannot hold a block without searching
+ * their delta index.
+ */
+struct DeltaBlockFilter
+{
+    std::vector<uint64_t> words;    // Filter bits
+    uint64_t bitCount = 0;          // Number of bits, 0 when the file has no filter
+    uint32_t hashCount = 0;         // Bits set for each block
+};
+
 /**
  * @brief Structure representing a block index element in a backup set
  * 
- * Maps a data block to its corresponding backup file
+ * Maps a data block to its corresponding backup file. The file holding the
+ * block is identified by block.file_number, which selects an entry of
+ * PartitionBackupSet::segmentPaths.
  */
 struct BackupSetBlockIndexElement
 {
     DataBlockIndexElement block;  // The data block index element
-    BackupFilePtr file;           // Pointer to the backup file containing this block
 };
 
 /**
@@ -49,9 +72,11 @@ struct BackupSetBlockIndexElement
 struct PartitionBackupSet
 {
     std::vector<std::string> filePaths;                    // Paths to all backup files in the set
+    std::map<int32_t, std::string> segmentPaths;           // Path of each backup file or split segment, by file number
     std::vector<PartitionLayoutPtr> partitionLayouts;      // Layout information for each backup
     std::vector<BackupSetBlockIndexElement> backupSetBlockIndex;  // Mapping of blocks to files
-    std::vector<BackupFilePtr> backupFilePtrs;            // Open file handles for backup files
+    bool lazy = false;                                     // Whether blocks are resolved on demand instead of through backupSetBlockIndex
+    std::vector<DeltaBlockFilter> deltaFilters;            // Filter of each layout's delta blocks, when resolved on demand
 };
 
 /**
@@ -62,15 +87,79 @@ struct PartitionBackupSet
  * 2. Creating the initial block-to-file mapping
  * 3. Adding delta (incremental) backup information
  * 
+ * Chain files whose recorded path does not exist are looked for next to the
+ * restore point, and their metadata sidecars are read when present. The
+ * metadata and indexes of the chain files are read on up to
+ * maxLoaderThreads threads.
+ * 
  * @param backupSet The backup set structure to populate
+ * @param backupFilePath Path of the restore point's backup file
  * @param partitionLayout The partition layout to build the backup set for
  * @param diskIndex The index of the disk containing the partition
+ * @param metrics Metrics to record chain resolution and index loads in, or nullptr
+ * @param maxLoaderThreads Maximum number of chain files read concurrently
+ * @throws std::runtime_error if the chain cannot be resolved or its indexes do not fit together
  */
-void BuildPartitionBackupSet(PartitionBackupSet& backupSet, file_structs::Partition::Partition_Layout& partitionLayout, int diskIndex);
+void BuildPartitionBackupSet(PartitionBackupSet& backupSet, const std::string& backupFilePath, file_structs::Partition::Partition_Layout& partitionLayout,
+    int diskIndex, RestoreMetrics* metrics = nullptr, size_t maxLoaderThreads = DEFAULT_MAX_LAYOUT_LOADER_THREADS);
 
 /**
- * @brief Closes all open backup files in a backup set
+ * @brief Builds a partition backup set that resolves blocks on demand
+ * 
+ * Finds the backup files as BuildPartitionBackupSet does, but does not build
+ * backupSetBlockIndex. Instead each chain file's delta index is sorted by
+ * block index once, and a bloom filter of its blocks is built, so a block
+ * is resolved by probing the files newest to oldest. Opening costs a sort
+ * per file rather than a copy of the full index plus every delta, which
+ * suits random access readers that only touch a few blocks.
+ * 
+ * @param backupSet The backup set structure to populate
+ * @param backupFilePath Path of the restore point's backup file
+ * @param partitionLayout The partition layout to build the backup set for
+ * @param diskIndex The index of the disk containing the partition
+ * @param metrics Metrics to record chain resolution and index loads in, or nullptr
+ * @param maxLoaderThreads Maximum number of chain files read and indexed concurrently
+ * @param filterBitsPerBlock Bits of each file's filter for each of its delta blocks, 0 for no filters
+ * @throws std::runtime_error if the chain cannot be resolved, the full backup's index does not cover the partition, or a delta block lies beyond it
+ */
+void BuildLazyPartitionBackupSet(PartitionBackupSet& backupSet, const std::string& backupFilePath, file_structs::Partition::Partition_Layout& partitionLayout,
+    int diskIndex, RestoreMetrics* metrics = nullptr, size_t maxLoaderThreads = DEFAULT_MAX_LAYOUT_LOADER_THREADS,
+    uint32_t filterBitsPerBlock = DEFAULT_DELTA_FILTER_BITS_PER_BLOCK);
+
+/**
+ * @brief Returns the number of blocks in a partition's block map
+ * 
+ * @param backupSet The backup set of the partition
+ * @return size_t Number of blocks, whether or not the set resolves them on demand
+ */
+size_t GetBackupSetBlockCount(const PartitionBackupSet& backupSet);
+
+/**
+ * @brief Returns the stored block holding a block of a partition's block map
+ * 
+ * Works on sets built either way. Sets built by BuildLazyPartitionBackupSet
+ * are probed newest file first: a file is skipped when its filter rules the
+ * block out, and otherwise its sorted delta index is binary searched. Blocks
+ * no increment changed come from the full backup's index.
+ * 
+ * @param backupSet The backup set of the partition
+ * @param blockIndex Index of the block in the block map
+ * @return const DataBlockIndexElement* The stored block, whose block_length is 0 when no data was backed up, or nullptr if blockIndex is out of range
+ */
+const DataBlockIndexElement* ResolveBackupSetBlock(const PartitionBackupSet& backupSet, BlockIndex blockIndex);
+
+/**
+ * @brief Returns an open stream for the backup file holding a block
+ * 
+ * Backup files are opened through the shared cache, so only a bounded number
+ * of chain files are open at once regardless of the chain length. The file
+ * is selected by the block's file number, which also covers blocks stored in
+ * the segments of a split backup.
  * 
- * @param backupSet The backup set containing the files to close
+ * @param backupSet The backup set the block belongs to
+ * @param block The block to locate
+ * @param fileCache The cache of open backup files
+ * @return BackupFilePtr Open stream for the backup file containing the block
+ * @throws std::runtime_error if no file in the set has the block's file number
  */
-void CloseBackupFiles(PartitionBackupSet& backupSet);
+BackupFilePtr GetBackupFile(PartitionBackupSet& backupSet, const DataBlockIndexElement& block, BackupFileCache& fileCache);
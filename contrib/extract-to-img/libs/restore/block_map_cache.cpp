@@ -0,0 +1,263 @@
+/**
+ * @file block_map_cache.cpp
+ * @brief Implementation of the block map sidecar cache
+ *
+ * Validating a cache costs one stat per chain file, and loading a partition
+ * is a single copy of its block map out of the mapping, so a restore point
+ * that has been resolved once starts without reading any chain metadata.
+ */
+
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <system_error>
+
+#include "../catalog/catalog_file.h"
+#include "block_map_cache.h"
+
+static_assert(sizeof(BackupSetBlockIndexElement) == sizeof(DataBlockIndexElement),
+    "Cached block maps are copied directly into the backup set block index");
+
+/**
+ * @brief Returns the default cache path for a backup file
+ *
+ * @param backupFilePath Path of the restore point's backup file
+ * @return std::string The backup file path with BLOCK_MAP_CACHE_EXTENSION appended
+ */
+std::string getDefaultBlockMapCachePath(const std::string& backupFilePath)
+{
+    return backupFilePath + BLOCK_MAP_CACHE_EXTENSION;
+}
+
+/**
+ * @brief Reads the size and modification time of a chain file
+ *
+ * @param path Path of the file
+ * @param fileSize Output parameter for the size
+ * @param modifiedTime Output parameter for the modification time
+ * @return false if the file cannot be examined
+ */
+bool statChainFile(const std::string& path, uint64_t& fileSize, int64_t& modifiedTime)
+{
+    std::error_code error;
+    fileSize = std::filesystem::file_size(path, error);
+    if (error) { return false; }
+    auto writeTime = std::filesystem::last_write_time(path, error);
+    if (error) { return false; }
+    modifiedTime = static_cast<int64_t>(writeTime.time_since_epoch().count());
+    return true;
+}
+
+/**
+ * @brief Checks that a section of the cache lies within the file
+ *
+ * @param cache The cache being opened
+ * @param offset Offset of the section
+ * @param count Number of elements in the section
+ * @param elementSize Size of each element
+ * @return true if the section fits
+ */
+bool isBlockMapCacheSectionValid(const BlockMapCache& cache, uint64_t offset, uint64_t count, uint64_t elementSize)
+{
+    uint64_t size = cache.mapping.size;
+    return offset <= size && offset % CATALOG_SECTION_ALIGNMENT == 0 && count <= (size - offset) / elementSize;
+}
+
+/**
+ * @brief Checks the layout of a mapped cache and sets its array pointers
+ *
+ * @param cache The mapped cache
+ * @return false if the file is not a valid cache
+ */
+bool readBlockMapCacheLayout(BlockMapCache& cache)
+{
+    if (cache.mapping.size < sizeof(BlockMapCacheHeader)) { return false; }
+    cache.header = reinterpret_cast<const BlockMapCacheHeader*>(cache.mapping.data);
+    const BlockMapCacheHeader& header = *cache.header;
+
+    if (memcmp(header.magic, BLOCK_MAP_CACHE_MAGIC, sizeof(header.magic)) != 0 || header.version != BLOCK_MAP_CACHE_VERSION) {
+        return false;
+    }
+    if (!isBlockMapCacheSectionValid(cache, header.partitionsOffset, header.partitionCount, sizeof(BlockMapCachePartition)) ||
+        !isBlockMapCacheSectionValid(cache, header.segmentsOffset, header.segmentCount, sizeof(BlockMapCacheSegment)) ||
+        !isBlockMapCacheSectionValid(cache, header.blocksOffset, header.blockCount, sizeof(DataBlockIndexElement)) ||
+        !isBlockMapCacheSectionValid(cache, header.stringsOffset, header.stringsLength, 1) || header.stringsLength == 0) {
+        return false;
+    }
+
+    cache.partitions = reinterpret_cast<const BlockMapCachePartition*>(cache.mapping.data + header.partitionsOffset);
+    cache.segments = reinterpret_cast<const BlockMapCacheSegment*>(cache.mapping.data + header.segmentsOffset);
+    cache.blocks = reinterpret_cast<const DataBlockIndexElement*>(cache.mapping.data + header.blocksOffset);
+    cache.strings = reinterpret_cast<const char*>(cache.mapping.data + header.stringsOffset);
+    if (cache.strings[header.stringsLength - 1] != '\0' || header.backupGuid >= header.stringsLength) { return false; }
+
+    for (uint32_t i = 0; i < header.partitionCount; i++) {
+        const BlockMapCachePartition& partition = cache.partitions[i];
+        if (partition.segmentBegin > header.segmentCount || partition.segmentCount > header.segmentCount - partition.segmentBegin ||
+            partition.blockBegin > header.blockCount || partition.blockCount > header.blockCount - partition.blockBegin) {
+            return false;
+        }
+    }
+    for (uint32_t i = 0; i < header.segmentCount; i++) {
+        if (cache.segments[i].path >= header.stringsLength) { return false; }
+    }
+    return true;
+}
+
+/**
+ * @brief Opens a block map cache and checks that it is current
+ *
+ * @param cache Output parameter for the opened cache
+ * @param cachePath Path of the cache file
+ * @param backupGuid GUID of the restore point being restored
+ * @param diskIndex Index of the disk being restored
+ * @return false if the cache is missing, invalid or stale
+ */
+bool openBlockMapCache(BlockMapCache& cache, const std::string& cachePath, const std::string& backupGuid, int diskIndex)
+{
+    closeBlockMapCache(cache);
+    std::error_code error;
+    if (!std::filesystem::exists(cachePath, error)) { return false; }
+
+    try {
+        mapFile(cache.mapping, cachePath);
+    }
+    catch (const std::exception&) {
+        std::cerr << "Ignoring unreadable block map cache " << cachePath << "\n";
+        return false;
+    }
+
+    bool current = readBlockMapCacheLayout(cache) && backupGuid == cache.strings + cache.header->backupGuid &&
+        cache.header->diskIndex == diskIndex;
+    for (uint32_t i = 0; current && i < cache.header->segmentCount; i++) {
+        const BlockMapCacheSegment& segment = cache.segments[i];
+        uint64_t fileSize;
+        int64_t modifiedTime;
+        current = statChainFile(cache.strings + segment.path, fileSize, modifiedTime) &&
+            fileSize == segment.fileSize && modifiedTime == segment.modifiedTime;
+    }
+
+    if (!current) {
+        std::cerr << "Ignoring stale block map cache " << cachePath << "\n";
+        closeBlockMapCache(cache);
+    }
+    return current;
+}
+
+/**
+ * @brief Unmaps a block map cache
+ *
+ * @param cache The cache to close
+ */
+void closeBlockMapCache(BlockMapCache& cache)
+{
+    unmapFile(cache.mapping);
+    cache = BlockMapCache();
+}
+
+/**
+ * @brief Fills a partition backup set from a block map cache
+ *
+ * @param cache The opened cache
+ * @param partitionNumber Partition number to look up
+ * @param backupSet The backup set to populate
+ * @return false if the partition is not in the cache
+ */
+bool loadCachedPartitionBackupSet(const BlockMapCache& cache, int32_t partitionNumber, PartitionBackupSet& backupSet)
+{
+    if (cache.header == nullptr) { return false; }
+
+    for (uint32_t i = 0; i < cache.header->partitionCount; i++) {
+        const BlockMapCachePartition& partition = cache.partitions[i];
+        if (partition.partitionNumber != partitionNumber) { continue; }
+
+        for (uint32_t s = partition.segmentBegin; s < partition.segmentBegin + partition.segmentCount; s++) {
+            backupSet.segmentPaths[cache.segments[s].fileNumber] = cache.strings + cache.segments[s].path;
+        }
+        backupSet.backupSetBlockIndex.resize(partition.blockCount);
+        memcpy(backupSet.backupSetBlockIndex.data(), cache.blocks + partition.blockBegin, partition.blockCount * sizeof(DataBlockIndexElement));
+        return true;
+    }
+    return false;
+}
+
+/**
+ * @brief Writes the resolved backup sets of a disk to a block map cache
+ *
+ * @param cachePath Path of the cache file
+ * @param backupGuid GUID of the restore point the sets were resolved for
+ * @param diskIndex Index of the disk the partitions belong to
+ * @param partitionNumbers Partition number of each backup set
+ * @param backupSets The resolved backup sets
+ * @throws std::runtime_error if a chain file cannot be examined or the cache cannot be written
+ */
+void writeBlockMapCache(const std::string& cachePath, const std::string& backupGuid, int diskIndex,
+    const std::vector<int32_t>& partitionNumbers, const std::vector<const PartitionBackupSet*>& backupSets)
+{
+    CatalogStringTable strings;
+    std::vector<BlockMapCachePartition> partitions;
+    std::vector<BlockMapCacheSegment> segments;
+    uint64_t blockCount = 0;
+
+    for (size_t i = 0; i < backupSets.size(); i++) {
+        BlockMapCachePartition partition = {};
+        partition.partitionNumber = partitionNumbers[i];
+        partition.segmentBegin = static_cast<uint32_t>(segments.size());
+        partition.segmentCount = static_cast<uint32_t>(backupSets[i]->segmentPaths.size());
+        partition.blockBegin = blockCount;
+        partition.blockCount = backupSets[i]->backupSetBlockIndex.size();
+        blockCount += partition.blockCount;
+
+        for (auto& segmentPath : backupSets[i]->segmentPaths) {
+            BlockMapCacheSegment segment = {};
+            if (!statChainFile(segmentPath.second, segment.fileSize, segment.modifiedTime)) {
+                std::cerr << "Cannot examine chain file " << segmentPath.second << "\n";
+                throw std::runtime_error("Failed to write block map cache.");
+            }
+            segment.path = addCatalogString(strings, segmentPath.second);
+            segment.fileNumber = segmentPath.first;
+            segments.push_back(segment);
+        }
+        partitions.push_back(partition);
+    }
+
+    BlockMapCacheHeader header = {};
+    memcpy(header.magic, BLOCK_MAP_CACHE_MAGIC, sizeof(header.magic));
+    header.version = BLOCK_MAP_CACHE_VERSION;
+    header.partitionCount = static_cast<uint32_t>(partitions.size());
+    header.segmentCount = static_cast<uint32_t>(segments.size());
+    header.backupGuid = addCatalogString(strings, backupGuid);
+    header.diskIndex = diskIndex;
+    header.partitionsOffset = alignCatalogOffset(sizeof(BlockMapCacheHeader));
+    header.segmentsOffset = alignCatalogOffset(header.partitionsOffset + partitions.size() * sizeof(BlockMapCachePartition));
+    header.blocksOffset = alignCatalogOffset(header.segmentsOffset + segments.size() * sizeof(BlockMapCacheSegment));
+    header.blockCount = blockCount;
+    header.stringsOffset = alignCatalogOffset(header.blocksOffset + blockCount * sizeof(DataBlockIndexElement));
+    header.stringsLength = strings.data.size();
+
+    std::string temporaryPath = cachePath + ".tmp";
+    {
+        std::ofstream out(temporaryPath, std::ios::out | std::ios::trunc | std::ios::binary);
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        padCatalogTo(out, header.partitionsOffset);
+        out.write(reinterpret_cast<const char*>(partitions.data()), partitions.size() * sizeof(BlockMapCachePartition));
+        padCatalogTo(out, header.segmentsOffset);
+        out.write(reinterpret_cast<const char*>(segments.data()), segments.size() * sizeof(BlockMapCacheSegment));
+        padCatalogTo(out, header.blocksOffset);
+        for (auto backupSet : backupSets) {
+            out.write(reinterpret_cast<const char*>(backupSet->backupSetBlockIndex.data()),
+                backupSet->backupSetBlockIndex.size() * sizeof(DataBlockIndexElement));
+        }
+        padCatalogTo(out, header.stringsOffset);
+        out.write(strings.data.data(), strings.data.size());
+        out.close();
+        if (out.fail()) {
+            std::remove(temporaryPath.c_str());
+            throw std::runtime_error("Failed to write block map cache.");
+        }
+    }
+    if (!replaceCatalogFile(temporaryPath, cachePath)) { throw std::runtime_error("Failed to write block map cache."); }
+}
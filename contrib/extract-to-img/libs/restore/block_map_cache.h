@@ -0,0 +1,166 @@
+/**
+ * @file block_map_cache.h
+ * @brief Persistent sidecar cache of resolved backup set block maps
+ *
+ * Resolving a restore point reads the $JSON block and the index of every
+ * file in the chain. This file declares a sidecar cache that stores the
+ * result, the block map and segment paths of each partition, so later runs
+ * against the same restore point can skip chain resolution entirely.
+ *
+ * The cache is keyed by the backup GUID of the restore point and by the
+ * size and modification time of every chain file. A cache whose key does
+ * not match the files on disk is stale and is rebuilt.
+ *
+ * Cache file layout (little-endian, sections aligned to 8 bytes):
+ *   BlockMapCacheHeader
+ *   BlockMapCachePartition[partitionCount]
+ *   BlockMapCacheSegment[segmentCount]   chain files of every partition
+ *   DataBlockIndexElement[blockCount]    block maps of every partition
+ *   char[stringsLength]                  NUL-terminated strings, starting with ""
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "../catalog/catalog_mapping.h"
+#include "backup_set.h"
+
+/**
+ * @brief Magic bytes at the start of a block map cache file
+ */
+const char BLOCK_MAP_CACHE_MAGIC[] = { 'M', 'R', 'B', 'L', 'K', 'M', 'A', 'P' };
+
+/**
+ * @brief Version of the block map cache file layout
+ */
+const uint32_t BLOCK_MAP_CACHE_VERSION = 1;
+
+/**
+ * @brief Extension appended to a backup file name for its default cache path
+ */
+const char BLOCK_MAP_CACHE_EXTENSION[] = ".blockmap";
+
+#pragma pack(push, 1)
+
+/**
+ * @brief Header at the start of a block map cache file
+ */
+struct BlockMapCacheHeader
+{
+    char magic[8];              // BLOCK_MAP_CACHE_MAGIC
+    uint32_t version;           // BLOCK_MAP_CACHE_VERSION
+    uint32_t partitionCount;    // Number of cached partitions
+    uint32_t segmentCount;      // Number of chain file entries
+    uint32_t backupGuid;        // GUID of the restore point the cache was built for
+    int32_t diskIndex;          // Index of the disk the partitions belong to
+    uint32_t reserved;
+    uint64_t partitionsOffset;  // Offset of the BlockMapCachePartition array
+    uint64_t segmentsOffset;    // Offset of the BlockMapCacheSegment array
+    uint64_t blocksOffset;      // Offset of the block map entries
+    uint64_t blockCount;        // Number of block map entries
+    uint64_t stringsOffset;     // Offset of the string table
+    uint64_t stringsLength;     // Length of the string table in bytes
+};
+
+/**
+ * @brief The resolved backup set of one partition
+ */
+struct BlockMapCachePartition
+{
+    int32_t partitionNumber;    // Partition number from the partition header
+    uint32_t segmentBegin;      // First chain file entry of the partition
+    uint32_t segmentCount;      // Number of chain file entries of the partition
+    uint32_t reserved;
+    uint64_t blockBegin;        // First block map entry of the partition
+    uint64_t blockCount;        // Number of block map entries of the partition
+};
+
+/**
+ * @brief One backup file or split segment of a chain
+ */
+struct BlockMapCacheSegment
+{
+    uint64_t fileSize;          // Size of the file when the cache was built
+    int64_t modifiedTime;       // Modification time of the file when the cache was built
+    uint32_t path;              // Path of the file, as an offset into the string table
+    int32_t fileNumber;         // File number the blocks refer to the file by
+};
+
+#pragma pack(pop)
+
+/**
+ * @brief An opened block map cache
+ *
+ * The arrays point into the mapped file.
+ */
+struct BlockMapCache
+{
+    MappedFile mapping;                                  // The mapped cache file
+    const BlockMapCacheHeader* header = nullptr;         // Header of the cache
+    const BlockMapCachePartition* partitions = nullptr;  // Cached partitions
+    const BlockMapCacheSegment* segments = nullptr;      // Chain files of the partitions
+    const DataBlockIndexElement* blocks = nullptr;       // Block maps of the partitions
+    const char* strings = nullptr;                       // String table
+};
+
+/**
+ * @brief Returns the default cache path for a backup file
+ *
+ * @param backupFilePath Path of the restore point's backup file
+ * @return std::string The backup file path with BLOCK_MAP_CACHE_EXTENSION appended
+ */
+std::string getDefaultBlockMapCachePath(const std::string& backupFilePath);
+
+/**
+ * @brief Opens a block map cache and checks that it is current
+ *
+ * The cache is current when it was built for the given restore point and
+ * disk, and every chain file still has the size and modification time
+ * recorded in it.
+ *
+ * @param cache Output parameter for the opened cache
+ * @param cachePath Path of the cache file
+ * @param backupGuid GUID of the restore point being restored
+ * @param diskIndex Index of the disk being restored
+ * @return false if the cache is missing, invalid or stale
+ */
+bool openBlockMapCache(BlockMapCache& cache, const std::string& cachePath, const std::string& backupGuid, int diskIndex);
+
+/**
+ * @brief Unmaps a block map cache
+ *
+ * @param cache The cache to close
+ */
+void closeBlockMapCache(BlockMapCache& cache);
+
+/**
+ * @brief Fills a partition backup set from a block map cache
+ *
+ * Only the block map and segment paths are restored; the per-file layouts
+ * are not cached.
+ *
+ * @param cache The opened cache
+ * @param partitionNumber Partition number to look up
+ * @param backupSet The backup set to populate
+ * @return false if the partition is not in the cache
+ */
+bool loadCachedPartitionBackupSet(const BlockMapCache& cache, int32_t partitionNumber, PartitionBackupSet& backupSet);
+
+/**
+ * @brief Writes the resolved backup sets of a disk to a block map cache
+ *
+ * The file is written to a temporary path and renamed, so a cache being
+ * read by another run is never seen half written.
+ *
+ * @param cachePath Path of the cache file
+ * @param backupGuid GUID of the restore point the sets were resolved for
+ * @param diskIndex Index of the disk the partitions belong to
+ * @param partitionNumbers Partition number of each backup set
+ * @param backupSets The resolved backup sets
+ * @throws std::runtime_error if a chain file cannot be examined or the cache cannot be written
+ */
+void writeBlockMapCache(const std::string& cachePath, const std::string& backupGuid, int diskIndex,
+    const std::vector<int32_t>& partitionNumbers, const std::vector<const PartitionBackupSet*>& backupSets);
@@ -7,10 +7,33 @@
  * writing to target storage, and managing the restoration process.
  */
 
+#include "../md5/md5.h"
 #include "backup_set.h"
+#include "block_map_cache.h"
+#include "restore.h"
 
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <filesystem>
 #include <fstream>
 #include <iostream>
+#include <mutex>
+#include <thread>
+
+/**
+ * @brief A run of consecutive entries in a block read order
+ * 
+ * All blocks in a run are held in the same backup file or split segment.
+ */
+struct BlockReadRun
+{
+    size_t begin;   // First entry of the run
+    size_t end;     // One past the last entry of the run
+};
 
 /**
  * @brief Reads a data block from a backup file
@@ -19,11 +42,10 @@
  * The block is identified by its position and length in the backup file.
  * 
  * @param backupFile Reference to the open backup file stream
- * @param backupFileLayout Structure containing the backup file layout
  * @param block The data block index element containing position and length
  * @return std::unique_ptr<unsigned char[]> Buffer containing the block data
  */
-std::unique_ptr<unsigned char[]> readDataBlock(std::fstream& backupFile, file_structs::File_Layout backupFileLayout, DataBlockIndexElement& block)
+std::unique_ptr<unsigned char[]> readDataBlock(std::fstream& backupFile, DataBlockIndexElement& block)
 {
     std::unique_ptr<unsigned char[]> readBuffer = std::make_unique<unsigned char[]>(block.block_length);
     setFilePointer(backupFile, block.file_position, std::ios::beg);
@@ -32,70 +54,1263 @@ std::unique_ptr<unsigned char[]> readDataBlock(std::fstream& backupFile, file_st
 }
 
 /**
- * @brief Restores a disk from a Macrium Reflect backup file
+ * @brief Checks a data block against the MD5 hash in its index entry
+ * 
+ * Index entries written without a hash have an all-zero digest and are not
+ * checked.
+ * 
+ * @param blockData The block as read from the backup file
+ * @param block The data block index element the block was read for
+ * @throws std::runtime_error if the block does not match its hash
+ */
+void verifyDataBlock(const unsigned char* blockData, const DataBlockIndexElement& block)
+{
+    static const uint8_t noHash[MD5_DIGEST_LENGTH] = { 0 };
+    if (std::memcmp(block.md5_hash, noHash, MD5_DIGEST_LENGTH) == 0) { return; }
+
+    uint8_t digest[MD5_DIGEST_LENGTH];
+    computeMD5(blockData, block.block_length, digest);
+    if (std::memcmp(block.md5_hash, digest, MD5_DIGEST_LENGTH) != 0) {
+        std::cerr << "Hash mismatch for block at position " << block.file_position << " of file number " << block.file_number << "\n";
+        throw std::runtime_error("Data block is corrupt.");
+    }
+}
+
+/**
+ * @brief Returns the range of a partition's block map that the restored shard covers
+ * 
+ * Shards split the block map into options.shardCount ranges of equal block
+ * counts; without sharding the range covers every block.
+ * 
+ * @param options Options controlling the restore
+ * @param blockCount Number of blocks in the block map
+ * @return std::pair<BlockIndex, BlockIndex> First block of the range and one past its last block
+ */
+std::pair<BlockIndex, BlockIndex> getShardBlockRange(const RestoreOptions& options, size_t blockCount)
+{
+    uint64_t shardCount = std::max<uint32_t>(options.shardCount, 1);
+    BlockIndex first = static_cast<BlockIndex>(blockCount * static_cast<uint64_t>(options.shardIndex) / shardCount);
+    BlockIndex end = static_cast<BlockIndex>(blockCount * (static_cast<uint64_t>(options.shardIndex) + 1) / shardCount);
+    return { first, end };
+}
+
+/**
+ * @brief Orders the blocks of a backup set for reading
+ * 
+ * Blocks are grouped by the backup file or split segment that holds them and
+ * sorted by file position within each file. Each chain file is then read sequentially and
+ * only needs to be opened once, however long the chain is. Empty blocks
+ * are left out as there is nothing to restore for them.
+ * 
+ * @param backupSet The backup set to plan the reads for
+ * @param blockRange The blocks to read, as a first block and one past the last
+ * @return std::vector<BlockIndex> Indexes into backupSetBlockIndex in read order
+ */
+std::vector<BlockIndex> planBlockReadOrder(PartitionBackupSet& backupSet, std::pair<BlockIndex, BlockIndex> blockRange)
+{
+    std::vector<BlockIndex> readOrder;
+    readOrder.reserve(blockRange.second - blockRange.first);
+    for (BlockIndex i = blockRange.first; i < blockRange.second; i++) {
+        if (backupSet.backupSetBlockIndex[i].block.block_length != 0) {
+            readOrder.push_back(i);
+        }
+    }
+
+    std::sort(readOrder.begin(), readOrder.end(), [&backupSet](BlockIndex a, BlockIndex b) {
+        auto& blockA = backupSet.backupSetBlockIndex[a];
+        auto& blockB = backupSet.backupSetBlockIndex[b];
+        if (blockA.block.file_number != blockB.block.file_number) { return blockA.block.file_number < blockB.block.file_number; }
+        return blockA.block.file_position < blockB.block.file_position;
+    });
+    return readOrder;
+}
+
+/**
+ * @brief Splits a block read order into runs that share a backup file
+ * 
+ * @param backupSet The backup set the read order was planned for
+ * @param readOrder Block indexes in read order, grouped by file number
+ * @return std::vector<BlockReadRun> One run per backup file or split segment
+ */
+std::vector<BlockReadRun> splitReadOrderByFile(PartitionBackupSet& backupSet, std::vector<BlockIndex>& readOrder)
+{
+    std::vector<BlockReadRun> runs;
+    for (size_t i = 0; i < readOrder.size(); i++) {
+        uint16_t fileNumber = backupSet.backupSetBlockIndex[readOrder[i]].block.file_number;
+        if (runs.empty() || backupSet.backupSetBlockIndex[readOrder[runs.back().begin]].block.file_number != fileNumber) {
+            runs.push_back({ i, i });
+        }
+        runs.back().end = i + 1;
+    }
+    return runs;
+}
+
+/**
+ * @brief Restores the data blocks of a partition
+ * 
+ * Each backup file or split segment is read by a single reader, and up to
+ * options.maxReaderThreads files are read concurrently. Within a file,
+ * blocks are read in file-position order, and the reads planned next are
+ * hinted to the kernel up to options.readaheadBytes ahead of the reader.
+ * Writes to the target are serialised. When options.metrics is set, each read, verification and
+ * write is timed and the bytes read from each chain file are counted. Only
+ * the blocks of the shard selected by options are restored.
+ * 
+ * @param backupSet The backup set of the partition
+ * @param partition The partition layout being restored
+ * @param target The target the partition is written to
+ * @param partitionOffset Offset of the start of the partition in the target
+ * @param fileCache The cache of open backup files
+ * @param options Options controlling the restore
+ * @throws std::runtime_error if a block cannot be read or written
+ */
+void restoreDataBlocks(PartitionBackupSet& backupSet, file_structs::Partition::Partition_Layout& partition, RestoreTarget& target,
+    uint64_t partitionOffset, BackupFileCache& fileCache, const RestoreOptions& options)
+{
+    std::vector<BlockIndex> readOrder = planBlockReadOrder(backupSet, getShardBlockRange(options, backupSet.backupSetBlockIndex.size()));
+    std::vector<BlockReadRun> runs = splitReadOrderByFile(backupSet, readOrder);
+    auto lcn0Start = partitionOffset + (partition._file_system.lcn0_offset - partition._file_system.start);
+
+    RestoreMetrics* metrics = options.metrics;
+    std::mutex targetLock;
+    std::atomic<size_t> nextRun(0);
+    std::atomic<bool> failed(false);
+    std::exception_ptr failure;
+
+    auto readRuns = [&]() {
+        try {
+            for (size_t run = nextRun++; run < runs.size() && !failed; run = nextRun++) {
+                auto& firstBlock = backupSet.backupSetBlockIndex[readOrder[runs[run].begin]].block;
+                BackupFilePtr backupFile = GetBackupFile(backupSet, firstBlock, fileCache);
+                ChainFileMetrics* fileMetrics = getChainFileMetrics(metrics, backupSet.segmentPaths[firstBlock.file_number]);
+                uint64_t runBytes = 0;
+
+                ReadaheadHints readahead;
+                openReadaheadHints(readahead, backupSet.segmentPaths[firstBlock.file_number], options.readaheadBytes);
+                for (size_t i = runs[run].begin; i < runs[run].end; i++) {
+                    auto& block = backupSet.backupSetBlockIndex[readOrder[i]].block;
+                    planRead(readahead, block.file_position, block.block_length);
+                }
+
+                for (size_t i = runs[run].begin; i < runs[run].end && !failed; i++) {
+                    BlockIndex blockIndex = readOrder[i];
+                    auto& backupSetBlock = backupSet.backupSetBlockIndex[blockIndex];
+                    adviseNextRead(readahead);
+                    uint64_t start = startStage(metrics);
+                    auto blockData = readDataBlock(*backupFile, backupSetBlock.block);
+                    recordStage(metrics, RestoreStage::eBlockRead, start, backupSetBlock.block.block_length);
+                    runBytes += backupSetBlock.block.block_length;
+
+                    if (blockData != nullptr)
+                    {
+                        if (options.verifyBlocks) {
+                            start = startStage(metrics);
+                            verifyDataBlock(blockData.get(), backupSetBlock.block);
+                            recordStage(metrics, RestoreStage::eVerify, start, backupSetBlock.block.block_length);
+                        }
+
+                        uint64_t offset = lcn0Start + (static_cast<uint64_t>(partition._header.block_size) * blockIndex);
+                        enterWriteQueue(metrics);
+                        std::lock_guard<std::mutex> guard(targetLock);
+                        start = startStage(metrics);
+                        target.write(offset, blockData.get(), backupSetBlock.block.block_length);
+                        recordStage(metrics, RestoreStage::eWrite, start, backupSetBlock.block.block_length);
+                        leaveWriteQueue(metrics);
+                        addRestoredBytes(options.progress, backupSetBlock.block.block_length);
+                    }
+                }
+
+                closeReadaheadHints(readahead);
+
+                if (fileMetrics != nullptr) {
+                    fileMetrics->bytesRead.fetch_add(runBytes, std::memory_order_relaxed);
+                    fileMetrics->blocksRead.fetch_add(runs[run].end - runs[run].begin, std::memory_order_relaxed);
+                }
+            }
+        }
+        catch (...) {
+            std::lock_guard<std::mutex> guard(targetLock);
+            if (!failed.exchange(true)) { failure = std::current_exception(); }
+        }
+    };
+
+    size_t readerCount = std::min(runs.size(), std::max<size_t>(options.maxReaderThreads, 1));
+    if (readerCount <= 1) {
+        readRuns();
+    }
+    else {
+        std::vector<std::thread> readers;
+        for (size_t i = 0; i < readerCount; i++) {
+            readers.emplace_back(readRuns);
+        }
+        for (auto& reader : readers) {
+            reader.join();
+        }
+    }
+
+    if (failure) { std::rethrow_exception(failure); }
+}
+
+/**
+ * @brief Estimates the bytes a partition restore will write before its backup set is resolved
+ * 
+ * Uses the used clusters recorded for the file system, or the whole
+ * partition when the file system does not record them. A shard is assumed
+ * to write its share of the blocks.
+ * 
+ * @param partition The partition layout
+ * @param bytesPerSector Sector size of the disk
+ * @param options Options controlling the restore
+ * @return uint64_t The estimated number of bytes
+ */
+uint64_t estimatePartitionBytes(file_structs::Partition::Partition_Layout& partition, uint32_t bytesPerSector, const RestoreOptions& options)
+{
+    auto& fileSystem = partition._file_system;
+    uint64_t bytes = static_cast<uint64_t>(partition._header.block_count) * partition._header.block_size;
+    if (fileSystem.total_clusters > fileSystem.free_clusters && fileSystem.free_clusters > 0) {
+        uint64_t clusterSize = static_cast<uint64_t>(fileSystem.sectors_per_cluster) * bytesPerSector;
+        bytes = std::min(bytes, (fileSystem.total_clusters - fileSystem.free_clusters) * clusterSize);
+    }
+    if (options.shardCount > 1) { return bytes / options.shardCount + (options.shardIndex == 0 ? fileSystem.reserved_sectors_byte_length : 0); }
+    return bytes + fileSystem.reserved_sectors_byte_length;
+}
+
+/**
+ * @brief Returns the bytes a partition restore will write
+ * 
+ * @param backupSet The resolved backup set of the partition
+ * @param partition The partition layout
+ * @param options Options controlling the restore
+ * @return uint64_t Bytes of the allocated blocks and the reserved sectors the restored shard writes
+ */
+uint64_t getPartitionRestoreBytes(PartitionBackupSet& backupSet, file_structs::Partition::Partition_Layout& partition, const RestoreOptions& options)
+{
+    uint64_t bytes = options.shardIndex == 0 ? partition._file_system.reserved_sectors_byte_length : 0;
+    auto blockRange = getShardBlockRange(options, backupSet.backupSetBlockIndex.size());
+    for (BlockIndex i = blockRange.first; i < blockRange.second; i++) {
+        bytes += backupSet.backupSetBlockIndex[i].block.block_length;
+    }
+    return bytes;
+}
+
+/**
+ * @brief Returns whether a partition is selected for restore
+ * 
+ * @param options Options controlling the restore
+ * @param partitionNumber Number of the partition in the backup
+ * @return true if options.partitionNumbers is empty or lists the partition
+ */
+bool isPartitionSelected(const RestoreOptions& options, int32_t partitionNumber)
+{
+    return options.partitionNumbers.empty() ||
+        std::find(options.partitionNumbers.begin(), options.partitionNumbers.end(), partitionNumber) != options.partitionNumbers.end();
+}
+
+/**
+ * @brief Resolves the backup set of a partition, from the block map cache when it holds it
+ * 
+ * @param backupSet The backup set to populate
+ * @param blockMapCache The opened block map cache, which may be empty
+ * @param backupFilePath Path to the Macrium Reflect backup file
+ * @param partition The partition layout
+ * @param diskIndex Index of the disk holding the partition
+ * @param options Options controlling the restore
+ * @return false if the set was resolved from the chain files
+ */
+bool resolvePartitionBackupSet(PartitionBackupSet& backupSet, const BlockMapCache& blockMapCache, const std::string& backupFilePath,
+    file_structs::Partition::Partition_Layout& partition, int diskIndex, const RestoreOptions& options)
+{
+    uint64_t resolveStart = startStage(options.metrics);
+    if (loadCachedPartitionBackupSet(blockMapCache, partition._header.partition_number, backupSet)) {
+        recordStage(options.metrics, RestoreStage::eChainResolution, resolveStart, 0);
+        return true;
+    }
+    BuildPartitionBackupSet(backupSet, backupFilePath, partition, diskIndex, options.metrics, options.maxLayoutLoaderThreads);
+    return false;
+}
+
+/**
+ * @brief Clears the ranges of a partition that hold no backup data
+ * 
+ * Runs of blocks that are empty in the block map are passed to the
+ * target's clearRange, so a target that does not already read as zeros
+ * ends up as a restore onto a zeroed image would. Only the blocks of the
+ * restored shard are considered.
+ * 
+ * @param backupSet The resolved backup set of the partition
+ * @param partition The partition layout being restored
+ * @param target The target the partition is written to
+ * @param partitionOffset Offset of the start of the partition in the target
+ * @param options Options controlling the restore
+ */
+void clearUnusedBlocks(PartitionBackupSet& backupSet, file_structs::Partition::Partition_Layout& partition, RestoreTarget& target,
+    uint64_t partitionOffset, const RestoreOptions& options)
+{
+    uint64_t lcn0Start = partitionOffset + (partition._file_system.lcn0_offset - partition._file_system.start);
+    uint64_t partitionEnd = partitionOffset + partition._geometry.length;
+    uint64_t blockSize = partition._header.block_size;
+    auto& blocks = backupSet.backupSetBlockIndex;
+    auto blockRange = getShardBlockRange(options, blocks.size());
+
+    for (BlockIndex first = blockRange.first; first < blockRange.second;) {
+        if (blocks[first].block.block_length != 0) {
+            first++;
+            continue;
+        }
+        BlockIndex end = first + 1;
+        while (end < blockRange.second && blocks[end].block.block_length == 0) { end++; }
+
+        uint64_t rangeStart = lcn0Start + first * blockSize;
+        uint64_t rangeEnd = std::min(lcn0Start + end * blockSize, partitionEnd);
+        if (rangeStart < rangeEnd) { target.clearRange(rangeStart, rangeEnd - rangeStart); }
+        first = end;
+    }
+}
+
+/**
+ * @brief Clears the ranges of a disk outside track 0 and its partitions
+ * 
+ * @param disk The disk layout being restored
+ * @param target The target the disk is written to
+ */
+void clearUnpartitionedSpace(file_structs::Disk::Disk_Layout& disk, RestoreTarget& target)
+{
+    std::vector<std::pair<uint64_t, uint64_t>> usedRanges = { { 0, disk.track0.size() } };
+    for (auto& partition : disk.partitions) {
+        usedRanges.push_back({ partition._geometry.start, partition._geometry.start + partition._geometry.length });
+    }
+    std::sort(usedRanges.begin(), usedRanges.end());
+
+    uint64_t position = 0;
+    for (auto& range : usedRanges) {
+        if (range.first > position) { target.clearRange(position, range.first - position); }
+        position = std::max(position, range.second);
+    }
+    if (disk._geometry.disk_size > position) { target.clearRange(position, disk._geometry.disk_size - position); }
+}
+
+/**
+ * @brief Writes reserved sector bytes, leaving out those other shards own
+ * 
+ * Stored blocks take precedence over the reserved sectors they overlap.
+ * Without sharding that holds because the blocks are written afterwards,
+ * but the blocks of other shards can be written at any time, so the bytes
+ * they cover are not written here. With a clearRange function, ranges of
+ * other shards without backup data are left to them as well.
+ * 
+ * @param backupSet The resolved backup set of the partition
+ * @param partition The partition layout being restored
+ * @param target The target the partition is written to
+ * @param partitionOffset Offset of the start of the partition in the target
+ * @param offset Offset of the bytes in the target
+ * @param data The bytes to write
+ * @param length Number of bytes
+ * @param options Options controlling the restore
+ */
+void writeReservedSectorBytes(PartitionBackupSet& backupSet, file_structs::Partition::Partition_Layout& partition, RestoreTarget& target,
+    uint64_t partitionOffset, uint64_t offset, const unsigned char* data, uint64_t length, const RestoreOptions& options)
+{
+    if (options.shardCount <= 1) {
+        target.write(offset, data, static_cast<size_t>(length));
+        return;
+    }
+
+    uint64_t lcn0Start = partitionOffset + (partition._file_system.lcn0_offset - partition._file_system.start);
+    uint64_t blockSize = partition._header.block_size;
+    auto& blocks = backupSet.backupSetBlockIndex;
+    auto blockRange = getShardBlockRange(options, blocks.size());
+    uint64_t end = offset + length;
+
+    for (uint64_t position = offset; position < end;) {
+        uint64_t pieceEnd = end;
+        bool owned = true;
+        if (position >= lcn0Start && blockSize != 0) {
+            uint64_t blockIndex = (position - lcn0Start) / blockSize;
+            uint64_t blockStart = lcn0Start + blockIndex * blockSize;
+            pieceEnd = std::min(end, blockStart + blockSize);
+            if (blockIndex < blocks.size() && (blockIndex < blockRange.first || blockIndex >= blockRange.second)) {
+                uint32_t blockLength = blocks[blockIndex].block.block_length;
+                if (blockLength != 0 && position < blockStart + blockLength) {
+                    pieceEnd = std::min(end, blockStart + blockLength);
+                    owned = false;
+                }
+                else if (blockLength == 0 && target.clearRange) {
+                    owned = false;
+                }
+            }
+        }
+        else if (position < lcn0Start) {
+            pieceEnd = std::min(end, lcn0Start);
+        }
+
+        if (owned) { target.write(position, data + (position - offset), static_cast<size_t>(pieceEnd - position)); }
+        position = pieceEnd;
+    }
+}
+
+/**
+ * @brief Restores the reserved sectors and data blocks of a partition
+ * 
+ * When the target has a clearRange function, the ranges of the partition
+ * without backup data are cleared once the blocks are written. The
+ * reserved sectors are written by the first shard only.
+ * 
+ * @param backupSet The resolved backup set of the partition
+ * @param partition The partition layout being restored
+ * @param target The target the partition is written to
+ * @param partitionOffset Offset of the start of the partition in the target
+ * @param fileCache The cache of open backup files
+ * @param options Options controlling the restore
+ * @throws std::runtime_error if a block cannot be read or written
+ */
+void restorePartition(PartitionBackupSet& backupSet, file_structs::Partition::Partition_Layout& partition, RestoreTarget& target,
+    uint64_t partitionOffset, BackupFileCache& fileCache, const RestoreOptions& options)
+{
+    // Restore reserved sectors (for FAT32)
+    if (partition._file_system.reserved_sectors_byte_length > 0 && options.shardIndex == 0) {
+        auto totalBytesToWrite = partition._file_system.reserved_sectors_byte_length;
+        uint32_t bytesWritten = 0;
+        for (auto& reservedSectorBlock : partition.reserved_sectors) {
+            if (bytesWritten >= totalBytesToWrite) { break; }
+            BackupFilePtr backupFile = GetBackupFile(backupSet, reservedSectorBlock, fileCache);
+            uint64_t start = startStage(options.metrics);
+            auto blockData = readDataBlock(*backupFile, reservedSectorBlock);
+            recordStage(options.metrics, RestoreStage::eBlockRead, start, reservedSectorBlock.block_length);
+            if (blockData != nullptr) {
+                uint32_t bytesToWrite = std::min(reservedSectorBlock.block_length, totalBytesToWrite - bytesWritten);
+                start = startStage(options.metrics);
+                writeReservedSectorBytes(backupSet, partition, target, partitionOffset, partitionOffset + partition._geometry.boot_sector_offset + bytesWritten,
+                    blockData.get(), bytesToWrite, options);
+                recordStage(options.metrics, RestoreStage::eWrite, start, bytesToWrite);
+                addRestoredBytes(options.progress, bytesToWrite);
+                bytesWritten += bytesToWrite;
+            }
+        }
+    }
+
+    // Restore data blocks
+    restoreDataBlocks(backupSet, partition, target, partitionOffset, fileCache, options);
+
+    if (target.clearRange) { clearUnusedBlocks(backupSet, partition, target, partitionOffset, options); }
+}
+
+/**
+ * @brief Rewrites the block map cache with backup sets resolved from the chain files
+ * 
+ * Partitions that were not restored keep the sets the cache already held
+ * for them, so restoring a subset of the partitions does not drop the rest
+ * from the cache. The cache is closed before it is rewritten. Failing to
+ * write the cache is reported and otherwise ignored.
+ * 
+ * @param blockMapCache The opened block map cache, which may be empty
+ * @param options Options controlling the restore
+ * @param backupFileLayout Structure containing the backup file layout
+ * @param diskIndex Index of the restored disk
+ * @param partitionNumbers Partition number of each resolved backup set
+ * @param backupSets The backup sets resolved by the restore
+ */
+void updateBlockMapCache(BlockMapCache& blockMapCache, const RestoreOptions& options, file_structs::File_Layout& backupFileLayout, int diskIndex,
+    std::vector<int32_t> partitionNumbers, std::vector<const PartitionBackupSet*> backupSets)
+{
+    std::vector<std::unique_ptr<PartitionBackupSet>> keptBackupSets;
+    for (auto& partition : backupFileLayout.disks[diskIndex].partitions) {
+        int32_t partitionNumber = partition._header.partition_number;
+        if (std::find(partitionNumbers.begin(), partitionNumbers.end(), partitionNumber) != partitionNumbers.end()) { continue; }
+
+        auto keptBackupSet = std::make_unique<PartitionBackupSet>();
+        if (loadCachedPartitionBackupSet(blockMapCache, partitionNumber, *keptBackupSet)) {
+            partitionNumbers.push_back(partitionNumber);
+            backupSets.push_back(keptBackupSet.get());
+            keptBackupSets.push_back(std::move(keptBackupSet));
+        }
+    }
+    closeBlockMapCache(blockMapCache);
+
+    try {
+        writeBlockMapCache(options.blockMapCachePath, backupFileLayout._header.backup_guid, diskIndex, partitionNumbers, backupSets);
+    }
+    catch (const std::exception& e) {
+        std::cerr << "Could not write block map cache " << options.blockMapCachePath << ": " << e.what() << "\n";
+    }
+}
+
+/**
+ * @brief Makes a restore target that writes to a file stream
+ * 
+ * The target has no clearRange function, as restores to files go to newly
+ * created images that already read as zeros.
+ * 
+ * @param target Output parameter for the target
+ * @param file The open stream, which must outlive target
+ * @param writeBehind Write-behind hints opened for the file, which must outlive target, or nullptr
+ */
+void getFileRestoreTarget(RestoreTarget& target, std::fstream& file, WriteBehindHints* writeBehind)
+{
+    target.write = [&file, writeBehind](uint64_t offset, const void* data, size_t length) {
+        setFilePointer(file, static_cast<std::streamoff>(offset), std::ios::beg);
+        writeToFile(file, const_cast<void*>(data), static_cast<std::streamsize>(length));
+        if (writeBehind != nullptr && noteRangeWritten(*writeBehind, offset, length)) {
+            file.flush();
+            startWriteBehind(*writeBehind);
+        }
+    };
+    target.clearRange = nullptr;
+}
+
+/**
+ * @brief Restores a disk from a Macrium Reflect backup file to a restore target
  * 
  * This function implements the disk restoration process:
- * 1. Opens the target disk file
- * 2. Writes track 0 data
- * 3. For each partition:
+ * 1. Writes track 0 data
+ * 2. For each selected partition:
  *    - Restores reserved sectors (if present)
  *    - Restores data blocks
- * 4. Closes all files
+ *    - Clears the ranges without backup data, if the target can
+ * 3. Clears the space outside the partitions, if the target can and every
+ *    partition is restored
+ * 4. Closes the backup files
+ * 
+ * Backup files are opened through a cache shared by all partitions, which
+ * holds at most options.maxOpenBackupFiles files open at once. Blocks held in
+ * different backup files or split segments are read concurrently.
+ * 
+ * When options.progress is set, the bytes written and the current partition
+ * are published for a progress reporter. The expected total is estimated
+ * up front and corrected as each partition's backup set is resolved.
+ * 
+ * When options.blockMapCachePath is set, backup sets are loaded from that
+ * cache if it is current. Otherwise they are resolved from the chain files
+ * and the cache is rebuilt once every partition has been restored. Failing
+ * to write the cache does not fail the restore.
+ * 
+ * With options.shardCount above 1 only the shard options.shardIndex is
+ * restored: its range of every partition's block map, plus track 0, the
+ * reserved sectors and the space outside the partitions for the first
+ * shard. Shards restored by separate processes into the same target add up
+ * to a full restore. The block map cache is read but not rewritten, as
+ * shards running at once would race to write it.
  * 
  * @param backupFilePath Path to the Macrium Reflect backup file
- * @param vhdxPath Path to the target disk image or virtual disk
+ * @param target The target the disk is written to
  * @param backupFileLayout Structure containing the backup file layout
  * @param diskIndex Index of the disk to restore in the backup
+ * @param options Options controlling the restore
+ * @throws std::runtime_error if options.shardIndex is not below options.shardCount
  */
-void restoreDisk(std::string backupFilePath, std::string vhdxPath, file_structs::File_Layout& backupFileLayout, int diskIndex){
-    std::fstream diskFile = openFile(vhdxPath);
+void restoreDiskToTarget(std::string backupFilePath, RestoreTarget& target, file_structs::File_Layout& backupFileLayout, int diskIndex,
+    const RestoreOptions& options)
+{
+    if (options.shardIndex >= std::max<uint32_t>(options.shardCount, 1)) {
+        std::cerr << "Shard " << options.shardIndex << " is not below the shard count " << options.shardCount << "\n";
+        throw std::runtime_error("Invalid restore shard.");
+    }
+    bool firstShard = options.shardIndex == 0;
+
+    BackupFileCache fileCache;
+    fileCache.maxOpenFiles = options.maxOpenBackupFiles;
 
     file_structs::Disk::Disk_Layout disk = backupFileLayout.disks[diskIndex];
+    auto& partitions = backupFileLayout.disks[diskIndex].partitions;
+
+    std::vector<size_t> selectedPartitions;
+    std::vector<uint64_t> estimatedBytes;
+    for (size_t partitionIndex = 0; partitionIndex < partitions.size(); partitionIndex++) {
+        if (!isPartitionSelected(options, partitions[partitionIndex]._header.partition_number)) { continue; }
+        selectedPartitions.push_back(partitionIndex);
+        estimatedBytes.push_back(estimatePartitionBytes(partitions[partitionIndex], disk._geometry.bytes_per_sector, options));
+    }
+    for (int32_t partitionNumber : options.partitionNumbers) {
+        if (std::none_of(partitions.begin(), partitions.end(),
+            [partitionNumber](file_structs::Partition::Partition_Layout& p) { return p._header.partition_number == partitionNumber; })) {
+            std::cerr << "Partition " << partitionNumber << " is not in the backup\n";
+            throw std::runtime_error("Partition to restore not found in backup.");
+        }
+    }
+
+    BlockMapCache blockMapCache;
+    bool useBlockMapCache = !options.blockMapCachePath.empty();
+    bool blockMapCacheCurrent = useBlockMapCache &&
+        openBlockMapCache(blockMapCache, options.blockMapCachePath, backupFileLayout._header.backup_guid, diskIndex);
+    bool updateCache = useBlockMapCache && options.shardCount <= 1;
+    std::vector<std::unique_ptr<PartitionBackupSet>> resolvedBackupSets;
+    std::vector<int32_t> resolvedPartitionNumbers;
+    if (options.progress != nullptr) {
+        options.progress->partitionCount.store(static_cast<uint32_t>(estimatedBytes.size()), std::memory_order_relaxed);
+        for (uint64_t bytes : estimatedBytes) { options.progress->bytesTotal.fetch_add(bytes, std::memory_order_relaxed); }
+        if (firstShard) { options.progress->bytesTotal.fetch_add(disk.track0.size(), std::memory_order_relaxed); }
+    }
 
     // Write track 0 data
-    writeToFile(diskFile, disk.track0.data(), (uint32_t)disk.track0.size());
-  
-    // Process each partition
-    for (auto& partition : backupFileLayout.disks[0].partitions)
+    if (firstShard) {
+        target.write(0, disk.track0.data(), disk.track0.size());
+        addRestoredBytes(options.progress, disk.track0.size());
+    }
+
+    // Process each selected partition
+    for (size_t i = 0; i < selectedPartitions.size(); i++)
+    {
+        auto& partition = partitions[selectedPartitions[i]];
+        setCurrentPartition(options.progress, partition._header.partition_number, static_cast<uint32_t>(i + 1));
+
+        auto resolvedBackupSet = std::make_unique<PartitionBackupSet>();
+        PartitionBackupSet& backupSet = *resolvedBackupSet;
+        if (!resolvePartitionBackupSet(backupSet, blockMapCache, backupFilePath, partition, diskIndex, options)) {
+            blockMapCacheCurrent = false;
+        }
+        correctTotalBytes(options.progress, estimatedBytes[i], getPartitionRestoreBytes(backupSet, partition, options));
+
+        restorePartition(backupSet, partition, target, partition._geometry.start, fileCache, options);
+        if (updateCache) {
+            resolvedPartitionNumbers.push_back(partition._header.partition_number);
+            resolvedBackupSets.push_back(std::move(resolvedBackupSet));
+        }
+    }
+    if (target.clearRange && options.partitionNumbers.empty() && firstShard) { clearUnpartitionedSpace(disk, target); }
+    CloseBackupFileCache(fileCache);
+
+    if (updateCache && !blockMapCacheCurrent) {
+        std::vector<const PartitionBackupSet*> backupSets;
+        for (auto& resolvedBackupSet : resolvedBackupSets) { backupSets.push_back(resolvedBackupSet.get()); }
+        updateBlockMapCache(blockMapCache, options, backupFileLayout, diskIndex, resolvedPartitionNumbers, backupSets);
+    }
+    closeBlockMapCache(blockMapCache);
+}
+
+/**
+ * @brief Restores a disk from a Macrium Reflect backup file
+ * 
+ * Opens the target disk file, restores the disk into it with
+ * restoreDiskToTarget and closes it.
+ * 
+ * @param backupFilePath Path to the Macrium Reflect backup file
+ * @param vhdxPath Path to the target disk image or virtual disk
+ * @param backupFileLayout Structure containing the backup file layout
+ * @param diskIndex Index of the disk to restore in the backup
+ * @param options Options controlling the restore
+ */
+void restoreDisk(std::string backupFilePath, std::string vhdxPath, file_structs::File_Layout& backupFileLayout, int diskIndex,
+    const RestoreOptions& options){
+    std::fstream diskFile = openFile(vhdxPath);
+    WriteBehindHints writeBehind;
+    openWriteBehindHints(writeBehind, vhdxPath, options.writeBehindBytes);
+    RestoreTarget target;
+    getFileRestoreTarget(target, diskFile, &writeBehind);
+    restoreDiskToTarget(backupFilePath, target, backupFileLayout, diskIndex, options);
+    closeFile(diskFile);
+    closeWriteBehindHints(writeBehind);
+}
+
+
+/**
+ * @brief Writes one partition into a standalone target
+ */
+typedef std::function<void(RestoreTarget&)> PartitionTargetRestore;
+
+/**
+ * @brief Opens the standalone target of a partition, runs the restore into it and closes it
+ */
+typedef std::function<void(size_t, file_structs::Partition::Partition_Layout&, const PartitionTargetRestore&)> PartitionTargetOpener;
+
+/**
+ * @brief Restores partitions of a disk into standalone targets
+ * 
+ * Partitions are handed to up to options.maxPartitionThreads workers. Each
+ * worker resolves the backup set of its partition and restores it into the
+ * target withTarget opens for it, with options.maxReaderThreads readers, so
+ * I/O is spent only on the partitions asked for. Each worker opens backup
+ * files through its own cache, as partitions of the same chain share files
+ * and streams are not safe to read from several threads; the workers split
+ * options.maxOpenBackupFiles between them. Progress reports the partition
+ * most recently started.
+ * 
+ * @param backupFilePath Path to the Macrium Reflect backup file
+ * @param partitionNumbers The partitions to restore
+ * @param withTarget Opens the target for the partition at an index of partitionNumbers
+ * @param backupFileLayout Structure containing the backup file layout
+ * @param diskIndex Index of the disk holding the partitions
+ * @param options Options controlling the restore
+ * @throws std::runtime_error if a partition is not in the backup or cannot be restored
+ */
+void restoreStandalonePartitions(const std::string& backupFilePath, const std::vector<int32_t>& partitionNumbers, const PartitionTargetOpener& withTarget,
+    file_structs::File_Layout& backupFileLayout, int diskIndex, const RestoreOptions& options)
+{
+    auto& disk = backupFileLayout.disks[diskIndex];
+    std::vector<file_structs::Partition::Partition_Layout*> partitions;
+    std::vector<uint64_t> estimatedBytes;
+    for (int32_t partitionNumber : partitionNumbers) {
+        auto partition = std::find_if(disk.partitions.begin(), disk.partitions.end(),
+            [partitionNumber](file_structs::Partition::Partition_Layout& p) { return p._header.partition_number == partitionNumber; });
+        if (partition == disk.partitions.end()) {
+            std::cerr << "Partition " << partitionNumber << " is not in the backup\n";
+            throw std::runtime_error("Partition to restore not found in backup.");
+        }
+        partitions.push_back(&*partition);
+        estimatedBytes.push_back(estimatePartitionBytes(*partition, disk._geometry.bytes_per_sector, options));
+    }
+
+    BlockMapCache blockMapCache;
+    bool useBlockMapCache = !options.blockMapCachePath.empty();
+    bool blockMapCacheCurrent = useBlockMapCache &&
+        openBlockMapCache(blockMapCache, options.blockMapCachePath, backupFileLayout._header.backup_guid, diskIndex);
+    std::vector<std::unique_ptr<PartitionBackupSet>> resolvedBackupSets(partitions.size());
+    if (options.progress != nullptr) {
+        options.progress->partitionCount.store(static_cast<uint32_t>(partitions.size()), std::memory_order_relaxed);
+        for (uint64_t bytes : estimatedBytes) { options.progress->bytesTotal.fetch_add(bytes, std::memory_order_relaxed); }
+    }
+
+    std::mutex failureLock;
+    std::atomic<size_t> nextPartition(0);
+    std::atomic<bool> failed(false);
+    std::atomic<bool> resolvedFromChain(false);
+    std::exception_ptr failure;
+
+    size_t workerCount = std::min(partitions.size(), std::max<size_t>(options.maxPartitionThreads, 1));
+    size_t workerOpenFiles = std::max<size_t>(options.maxOpenBackupFiles / std::max<size_t>(workerCount, 1), 1);
+    auto restorePartitions = [&]() {
+        BackupFileCache fileCache;
+        fileCache.maxOpenFiles = workerOpenFiles;
+        try {
+            for (size_t i = nextPartition++; i < partitions.size() && !failed; i = nextPartition++) {
+                auto& partition = *partitions[i];
+                setCurrentPartition(options.progress, partition._header.partition_number, static_cast<uint32_t>(i + 1));
+
+                auto backupSet = std::make_unique<PartitionBackupSet>();
+                if (!resolvePartitionBackupSet(*backupSet, blockMapCache, backupFilePath, partition, diskIndex, options)) {
+                    resolvedFromChain = true;
+                }
+                correctTotalBytes(options.progress, estimatedBytes[i], getPartitionRestoreBytes(*backupSet, partition, options));
+
+                withTarget(i, partition, [&](RestoreTarget& target) {
+                    restorePartition(*backupSet, partition, target, 0, fileCache, options);
+                });
+                resolvedBackupSets[i] = std::move(backupSet);
+            }
+        }
+        catch (...) {
+            std::lock_guard<std::mutex> guard(failureLock);
+            if (!failed.exchange(true)) { failure = std::current_exception(); }
+        }
+        CloseBackupFileCache(fileCache);
+    };
+
+    if (workerCount <= 1) {
+        restorePartitions();
+    }
+    else {
+        std::vector<std::thread> workers;
+        for (size_t i = 0; i < workerCount; i++) {
+            workers.emplace_back(restorePartitions);
+        }
+        for (auto& worker : workers) {
+            worker.join();
+        }
+    }
+
+    if (failure) {
+        closeBlockMapCache(blockMapCache);
+        std::rethrow_exception(failure);
+    }
+
+    if (useBlockMapCache && (!blockMapCacheCurrent || resolvedFromChain)) {
+        std::vector<const PartitionBackupSet*> backupSets;
+        for (auto& resolvedBackupSet : resolvedBackupSets) { backupSets.push_back(resolvedBackupSet.get()); }
+        updateBlockMapCache(blockMapCache, options, backupFileLayout, diskIndex, partitionNumbers, backupSets);
+    }
+    closeBlockMapCache(blockMapCache);
+}
+
+/**
+ * @brief Restores partitions of a disk into standalone raw partition images
+ * 
+ * Each image is created, or truncated, to the length of its partition
+ * before its partition is restored into it.
+ * 
+ * @param backupFilePath Path to the Macrium Reflect backup file
+ * @param targets The partitions to restore and their image paths
+ * @param backupFileLayout Structure containing the backup file layout
+ * @param diskIndex Index of the disk holding the partitions
+ * @param options Options controlling the restore
+ * @throws std::runtime_error if a partition is not in the backup or cannot be restored
+ */
+void restorePartitionImages(std::string backupFilePath, const std::vector<PartitionImageTarget>& targets, file_structs::File_Layout& backupFileLayout,
+    int diskIndex, const RestoreOptions& options)
+{
+    std::vector<int32_t> partitionNumbers;
+    for (auto& target : targets) { partitionNumbers.push_back(target.partitionNumber); }
+
+    auto withImage = [&targets, &options](size_t i, file_structs::Partition::Partition_Layout& partition, const PartitionTargetRestore& restore) {
+        std::ofstream(targets[i].imagePath, std::ios::binary | std::ios::trunc).close();
+        std::error_code resizeError;
+        std::filesystem::resize_file(targets[i].imagePath, partition._geometry.length, resizeError);
+        if (resizeError) {
+            std::cerr << "Failed to create partition image " << targets[i].imagePath << ": " << resizeError.message() << "\n";
+            throw std::runtime_error("Failed to create partition image.");
+        }
+
+        std::fstream imageFile = openFile(targets[i].imagePath);
+        WriteBehindHints writeBehind;
+        openWriteBehindHints(writeBehind, targets[i].imagePath, options.writeBehindBytes);
+        RestoreTarget target;
+        getFileRestoreTarget(target, imageFile, &writeBehind);
+        restore(target);
+        closeFile(imageFile);
+        closeWriteBehindHints(writeBehind);
+    };
+    restoreStandalonePartitions(backupFilePath, partitionNumbers, withImage, backupFileLayout, diskIndex, options);
+}
+
+/**
+ * @brief Restores one partition of a disk to the start of a restore target
+ * 
+ * @param backupFilePath Path to the Macrium Reflect backup file
+ * @param partitionNumber Number of the partition in the backup
+ * @param target The target the partition is written to
+ * @param backupFileLayout Structure containing the backup file layout
+ * @param diskIndex Index of the disk holding the partition
+ * @param options Options controlling the restore
+ * @throws std::runtime_error if the partition is not in the backup or cannot be restored
+ */
+void restorePartitionToTarget(std::string backupFilePath, int32_t partitionNumber, RestoreTarget& target, file_structs::File_Layout& backupFileLayout,
+    int diskIndex, const RestoreOptions& options)
+{
+    auto withTarget = [&target](size_t, file_structs::Partition::Partition_Layout&, const PartitionTargetRestore& restore) { restore(target); };
+    restoreStandalonePartitions(backupFilePath, { partitionNumber }, withTarget, backupFileLayout, diskIndex, options);
+}
+
+/**
+ * @brief A run of consecutive bytes of a streamed disk
+ * 
+ * The bytes come from a stored block when block is set, from memory when
+ * memory is set, and are zeros otherwise.
+ */
+struct StreamPiece
+{
+    uint64_t length = 0;                            // Number of bytes
+    PartitionBackupSet* backupSet = nullptr;        // Backup set holding block
+    const DataBlockIndexElement* block = nullptr;   // Stored block holding the bytes, or nullptr
+    uint64_t blockOffset = 0;                       // Offset of the bytes in the stored block
+    const unsigned char* memory = nullptr;          // Bytes held in memory, or nullptr
+};
+
+/**
+ * @brief A piece of a streamed disk in the reorder buffer
+ */
+struct StreamSlot
+{
+    StreamPiece piece;                              // The bytes the slot holds
+    std::unique_ptr<unsigned char[]> data;          // Stored block read for the piece
+    bool ready = false;                             // Whether the bytes can be emitted
+};
+
+/**
+ * @brief The reorder buffer between the block readers and the stream
+ * 
+ * Pieces are queued in disk order. Readers decode queued pieces in that
+ * order, possibly finishing out of order, and the stream emits pieces from
+ * the front of the buffer once they are ready.
+ */
+struct StreamReorderBuffer
+{
+    std::deque<StreamSlot> slots;                   // Queued pieces, in disk order
+    size_t capacity = 0;                            // Pieces held at most
+    size_t nextToDecode = 0;                        // Index in slots of the next piece for a reader
+    uint64_t slotsQueued = 0;                       // Slots added since the stream started
+    uint64_t slotsEmitted = 0;                      // Slots removed since the stream started
+    bool finished = false;                          // Set once no more pieces will be queued
+    std::exception_ptr failure;                     // First error raised by a reader
+    std::mutex lock;                                // Guards the members above
+    std::condition_variable piecesQueued;           // Signalled when a piece is queued or the stream finishes
+    std::condition_variable pieceDecoded;           // Signalled when a piece becomes ready or a reader fails
+};
+
+/**
+ * @brief Returns a page of zeros shared by every stream, which holes are emitted from
+ * 
+ * @return const std::vector<unsigned char>& The zero page
+ */
+const std::vector<unsigned char>& getStreamZeroPage()
+{
+    static const std::vector<unsigned char> zeroPage(STREAM_ZERO_PAGE_SIZE, 0);
+    return zeroPage;
+}
+
+/**
+ * @brief Emits the piece at the front of the reorder buffer
+ * 
+ * The caller must have checked that the front piece is ready. The piece is
+ * removed from the buffer before it is written, so readers are not held up
+ * by a slow sink.
+ * 
+ * @param buffer The reorder buffer
+ * @param sink Receives the bytes of the stream
+ * @param options Options controlling the restore
+ */
+void emitStreamSlot(StreamReorderBuffer& buffer, const RestoreStreamSink& sink, const RestoreOptions& options)
+{
+    StreamSlot slot;
+    {
+        std::lock_guard<std::mutex> guard(buffer.lock);
+        slot = std::move(buffer.slots.front());
+        buffer.slots.pop_front();
+        buffer.slotsEmitted++;
+        if (buffer.nextToDecode > 0) { buffer.nextToDecode--; }
+    }
+
+    uint64_t start = startStage(options.metrics);
+    if (slot.data != nullptr) {
+        sink(slot.data.get() + slot.piece.blockOffset, static_cast<size_t>(slot.piece.length));
+    }
+    else if (slot.piece.memory != nullptr) {
+        sink(slot.piece.memory, static_cast<size_t>(slot.piece.length));
+    }
+    else {
+        const std::vector<unsigned char>& zeroPage = getStreamZeroPage();
+        for (uint64_t remaining = slot.piece.length; remaining > 0;) {
+            size_t chunk = static_cast<size_t>(std::min<uint64_t>(remaining, zeroPage.size()));
+            sink(zeroPage.data(), chunk);
+            remaining -= chunk;
+        }
+    }
+    recordStage(options.metrics, RestoreStage::eWrite, start, slot.piece.length);
+    addRestoredBytes(options.progress, slot.piece.length);
+}
+
+/**
+ * @brief Emits the ready pieces at the front of the reorder buffer
+ * 
+ * @param buffer The reorder buffer
+ * @param sink Receives the bytes of the stream
+ * @param options Options controlling the restore
+ * @param wait Whether to wait for the front piece when it is not ready, so at least one piece is emitted
+ * @throws The first error raised by a reader
+ */
+void emitReadyStreamSlots(StreamReorderBuffer& buffer, const RestoreStreamSink& sink, const RestoreOptions& options, bool wait)
+{
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> guard(buffer.lock);
+            if (wait) {
+                buffer.pieceDecoded.wait(guard, [&buffer]() {
+                    return buffer.failure || buffer.slots.empty() || buffer.slots.front().ready;
+                });
+            }
+            if (buffer.failure) { std::rethrow_exception(buffer.failure); }
+            if (buffer.slots.empty() || !buffer.slots.front().ready) { return; }
+        }
+        emitStreamSlot(buffer, sink, options);
+        wait = false;
+    }
+}
+
+/**
+ * @brief Queues the next piece of the stream, emitting pieces while the buffer is full
+ * 
+ * Adjacent holes are merged into one piece while it waits in the buffer.
+ * 
+ * @param buffer The reorder buffer
+ * @param piece The piece, which follows the previously queued piece on the disk
+ * @param sink Receives the bytes of the stream
+ * @param options Options controlling the restore
+ */
+void queueStreamPiece(StreamReorderBuffer& buffer, const StreamPiece& piece, const RestoreStreamSink& sink, const RestoreOptions& options)
+{
+    if (piece.length == 0) { return; }
+    bool hole = piece.block == nullptr && piece.memory == nullptr;
     {
-        PartitionBackupSet backupSet;
-        BuildPartitionBackupSet(backupSet, partition, diskIndex);
-        std::cout << "Backupset created" << std::endl;
-
-        setFilePointer(diskFile, partition._geometry.start + partition._geometry.boot_sector_offset, std::ios::beg);
-
-        // Restore reserved sectors (for FAT32)
-        if (partition._file_system.reserved_sectors_byte_length > 0) {
-            auto totalBytesToWrite = partition._file_system.reserved_sectors_byte_length;
-            uint32_t bytesWritten = 0;
-            int index = 0;
-            for (auto& reservedSectorBlock : partition.reserved_sectors) {
-                auto blockData = readDataBlock(*backupSet.backupFilePtrs.back().get(), backupFileLayout, reservedSectorBlock);
-                if (blockData != nullptr) {
-                    uint32_t bytesToWrite = std::min(reservedSectorBlock.block_length, totalBytesToWrite - bytesWritten);
-                    writeToFile(diskFile, blockData.get(), bytesToWrite);
+        std::lock_guard<std::mutex> guard(buffer.lock);
+        if (hole && !buffer.slots.empty()) {
+            StreamPiece& last = buffer.slots.back().piece;
+            if (last.block == nullptr && last.memory == nullptr) {
+                last.length += piece.length;
+                return;
+            }
+        }
+    }
+
+    for (;;) {
+        {
+            std::lock_guard<std::mutex> guard(buffer.lock);
+            if (buffer.failure) { std::rethrow_exception(buffer.failure); }
+            if (buffer.slots.size() < buffer.capacity) {
+                buffer.slots.emplace_back();
+                buffer.slots.back().piece = piece;
+                buffer.slots.back().ready = piece.block == nullptr;
+                buffer.slotsQueued++;
+                break;
+            }
+        }
+        emitReadyStreamSlots(buffer, sink, options, true);
+    }
+    if (piece.block != nullptr) { buffer.piecesQueued.notify_one(); }
+    emitReadyStreamSlots(buffer, sink, options, false);
+}
+
+/**
+ * @brief Reads the stored blocks of queued pieces until the stream finishes
+ * 
+ * Each reader opens backup files through its own cache, as streams are
+ * not safe to read from several threads and pieces in disk order hop
+ * between chain files.
+ * 
+ * @param buffer The reorder buffer
+ * @param maxOpenFiles Backup files the reader holds open at once
+ * @param options Options controlling the restore
+ */
+void readStreamPieces(StreamReorderBuffer& buffer, size_t maxOpenFiles, const RestoreOptions& options)
+{
+    BackupFileCache fileCache;
+    fileCache.maxOpenFiles = maxOpenFiles;
+    try {
+        for (;;) {
+            StreamSlot* slot = nullptr;
+            StreamPiece piece;
+            {
+                std::unique_lock<std::mutex> guard(buffer.lock);
+                for (;;) {
+                    while (buffer.nextToDecode < buffer.slots.size() && buffer.slots[buffer.nextToDecode].ready) { buffer.nextToDecode++; }
+                    if (buffer.failure || buffer.nextToDecode < buffer.slots.size() || buffer.finished) { break; }
+                    buffer.piecesQueued.wait(guard);
+                }
+                if (buffer.failure || buffer.nextToDecode >= buffer.slots.size()) { break; }
+                // Slots are only removed once ready, so this one stays put until it is filled
+                slot = &buffer.slots[buffer.nextToDecode++];
+                piece = slot->piece;
+            }
+
+            DataBlockIndexElement block = *piece.block;
+            BackupFilePtr backupFile = GetBackupFile(*piece.backupSet, block, fileCache);
+            uint64_t start = startStage(options.metrics);
+            auto blockData = readDataBlock(*backupFile, block);
+            recordStage(options.metrics, RestoreStage::eBlockRead, start, block.block_length);
+            if (options.verifyBlocks) {
+                start = startStage(options.metrics);
+                verifyDataBlock(blockData.get(), block);
+                recordStage(options.metrics, RestoreStage::eVerify, start, block.block_length);
+            }
+
+            {
+                std::lock_guard<std::mutex> guard(buffer.lock);
+                slot->data = std::move(blockData);
+                slot->ready = true;
+            }
+            buffer.pieceDecoded.notify_all();
+        }
+    }
+    catch (...) {
+        {
+            std::lock_guard<std::mutex> guard(buffer.lock);
+            if (!buffer.failure) { buffer.failure = std::current_exception(); }
+        }
+        buffer.pieceDecoded.notify_all();
+        buffer.piecesQueued.notify_all();
+    }
+    CloseBackupFileCache(fileCache);
+}
+
+/**
+ * @brief Queues the pieces of a partition in disk order
+ * 
+ * Bytes are taken from the stored block covering them, then from the
+ * reserved sectors, and are zeros elsewhere, matching what restoreDisk
+ * leaves in a new image.
+ * 
+ * @param buffer The reorder buffer
+ * @param backupSet The resolved backup set of the partition
+ * @param partition The partition layout being streamed
+ * @param position Offset in the partition to start at
+ * @param sink Receives the bytes of the stream
+ * @param options Options controlling the restore
+ */
+void queuePartitionStream(StreamReorderBuffer& buffer, PartitionBackupSet& backupSet, file_structs::Partition::Partition_Layout& partition,
+    uint64_t position, const RestoreStreamSink& sink, const RestoreOptions& options)
+{
+    uint64_t partitionLength = partition._geometry.length;
+    uint64_t lcn0Offset = partition._file_system.lcn0_offset - partition._file_system.start;
+    uint64_t blockSize = partition._header.block_size;
+    uint64_t bootSectorOffset = partition._geometry.boot_sector_offset;
+    auto& blocks = backupSet.backupSetBlockIndex;
+
+    std::vector<uint64_t> reservedBlockOffsets;
+    uint64_t reservedLength = 0;
+    for (auto& reservedSectorBlock : partition.reserved_sectors) {
+        if (reservedLength >= partition._file_system.reserved_sectors_byte_length) { break; }
+        reservedBlockOffsets.push_back(reservedLength);
+        reservedLength += reservedSectorBlock.block_length;
+    }
+    reservedLength = std::min<uint64_t>(reservedLength, partition._file_system.reserved_sectors_byte_length);
+    uint64_t reservedEnd = bootSectorOffset + reservedLength;
+
+    while (position < partitionLength) {
+        StreamPiece piece;
+        uint64_t end = partitionLength;
+
+        if (position >= lcn0Offset) {
+            uint64_t blockNumber = (position - lcn0Offset) / blockSize;
+            uint64_t blockStart = lcn0Offset + blockNumber * blockSize;
+            if (blockNumber < blocks.size()) {
+                end = std::min(end, blockStart + blockSize);
+                auto& block = blocks[blockNumber].block;
+                if (position - blockStart < block.block_length) {
+                    piece.backupSet = &backupSet;
+                    piece.block = &block;
+                    piece.blockOffset = position - blockStart;
+                    end = std::min(end, blockStart + block.block_length);
                 }
             }
-            std::cout << "Restored reserved sectors" << std::endl;
+        }
+        else {
+            end = std::min(end, lcn0Offset);
         }
 
-        // Restore data blocks
-        int blockIndex = 0;
-        auto lcn0Start = partition._geometry.start + (partition._file_system.lcn0_offset - partition._file_system.start);
-        for (auto& backupSetBlock : backupSet.backupSetBlockIndex)
+        if (piece.block == nullptr && position >= bootSectorOffset && position < reservedEnd) {
+            size_t reservedBlock = static_cast<size_t>(
+                std::upper_bound(reservedBlockOffsets.begin(), reservedBlockOffsets.end(), position - bootSectorOffset) - reservedBlockOffsets.begin()) - 1;
+            uint64_t reservedBlockStart = bootSectorOffset + reservedBlockOffsets[reservedBlock];
+            piece.backupSet = &backupSet;
+            piece.block = &partition.reserved_sectors[reservedBlock];
+            piece.blockOffset = position - reservedBlockStart;
+            end = std::min({ end, reservedEnd, reservedBlockStart + piece.block->block_length });
+        }
+        else if (piece.block == nullptr && position < bootSectorOffset) {
+            end = std::min(end, bootSectorOffset);
+        }
+
+        piece.length = end - position;
+        queueStreamPiece(buffer, piece, sink, options);
+        position = end;
+    }
+}
+
+/**
+ * @brief Streams a disk from a Macrium Reflect backup file in disk order
+ * 
+ * @param backupFilePath Path to the Macrium Reflect backup file
+ * @param sink Receives the bytes of the disk, in order
+ * @param backupFileLayout Structure containing the backup file layout
+ * @param diskIndex Index of the disk to stream in the backup
+ * @param options Options controlling the restore
+ * @throws std::runtime_error if a selected partition is not in the backup, or a block cannot be read
+ */
+void streamDisk(std::string backupFilePath, const RestoreStreamSink& sink, file_structs::File_Layout& backupFileLayout, int diskIndex,
+    const RestoreOptions& options)
+{
+    auto& disk = backupFileLayout.disks[diskIndex];
+    uint64_t diskSize = disk._geometry.disk_size;
+    for (int32_t partitionNumber : options.partitionNumbers) {
+        if (std::none_of(disk.partitions.begin(), disk.partitions.end(),
+            [partitionNumber](file_structs::Partition::Partition_Layout& p) { return p._header.partition_number == partitionNumber; })) {
+            std::cerr << "Partition " << partitionNumber << " is not in the backup\n";
+            throw std::runtime_error("Partition to restore not found in backup.");
+        }
+    }
+
+    std::vector<file_structs::Partition::Partition_Layout*> partitions;
+    for (auto& partition : disk.partitions) {
+        if (isPartitionSelected(options, partition._header.partition_number)) { partitions.push_back(&partition); }
+    }
+    std::sort(partitions.begin(), partitions.end(), [](file_structs::Partition::Partition_Layout* a, file_structs::Partition::Partition_Layout* b) {
+        return a->_geometry.start < b->_geometry.start;
+    });
+
+    BlockMapCache blockMapCache;
+    bool useBlockMapCache = !options.blockMapCachePath.empty();
+    bool blockMapCacheCurrent = useBlockMapCache &&
+        openBlockMapCache(blockMapCache, options.blockMapCachePath, backupFileLayout._header.backup_guid, diskIndex);
+    std::vector<std::unique_ptr<PartitionBackupSet>> resolvedBackupSets;
+    std::vector<int32_t> resolvedPartitionNumbers;
+    if (options.progress != nullptr) {
+        options.progress->partitionCount.store(static_cast<uint32_t>(partitions.size()), std::memory_order_relaxed);
+        options.progress->bytesTotal.fetch_add(diskSize, std::memory_order_relaxed);
+    }
+
+    StreamReorderBuffer buffer;
+    buffer.capacity = std::max<size_t>(options.maxStreamBufferedBlocks, 1);
+    size_t readerCount = std::max<size_t>(options.maxReaderThreads, 1);
+    size_t readerOpenFiles = std::max<size_t>(options.maxOpenBackupFiles / readerCount, 1);
+    std::vector<std::thread> readers;
+    for (size_t i = 0; i < readerCount; i++) {
+        readers.emplace_back(readStreamPieces, std::ref(buffer), readerOpenFiles, std::cref(options));
+    }
+
+    // Queued pieces point into their partition's backup set, so each set is
+    // kept until the last slot queued for it has been emitted
+    std::deque<std::pair<uint64_t, std::unique_ptr<PartitionBackupSet>>> pendingBackupSets;
+    auto releaseEmittedBackupSets = [&]() {
+        uint64_t slotsEmitted = 0;
+        {
+            std::lock_guard<std::mutex> guard(buffer.lock);
+            slotsEmitted = buffer.slotsEmitted;
+        }
+        while (!pendingBackupSets.empty() && pendingBackupSets.front().first <= slotsEmitted) {
+            if (useBlockMapCache) { resolvedBackupSets.push_back(std::move(pendingBackupSets.front().second)); }
+            pendingBackupSets.pop_front();
+        }
+    };
+
+    auto finish = [&buffer, &readers]() {
         {
-            auto blockData = readDataBlock(*(backupSetBlock.file), backupFileLayout, backupSetBlock.block);
+            std::lock_guard<std::mutex> guard(buffer.lock);
+            buffer.finished = true;
+        }
+        buffer.piecesQueued.notify_all();
+        for (auto& reader : readers) { reader.join(); }
+    };
+
+    try {
+        StreamPiece track0;
+        track0.memory = disk.track0.data();
+        track0.length = std::min<uint64_t>(disk.track0.size(), diskSize);
+        queueStreamPiece(buffer, track0, sink, options);
+        uint64_t position = track0.length;
+
+        for (size_t i = 0; i < partitions.size(); i++) {
+            auto& partition = *partitions[i];
+            uint64_t partitionStart = partition._geometry.start;
+            uint64_t partitionEnd = std::min<uint64_t>(partitionStart + partition._geometry.length, diskSize);
+            if (partitionEnd <= position) { continue; }
+            setCurrentPartition(options.progress, partition._header.partition_number, static_cast<uint32_t>(i + 1));
+
+            StreamPiece gap;
+            gap.length = partitionStart > position ? partitionStart - position : 0;
+            queueStreamPiece(buffer, gap, sink, options);
+            position += gap.length;
+
+            auto resolvedBackupSet = std::make_unique<PartitionBackupSet>();
+            if (!resolvePartitionBackupSet(*resolvedBackupSet, blockMapCache, backupFilePath, partition, diskIndex, options)) {
+                blockMapCacheCurrent = false;
+            }
+            queuePartitionStream(buffer, *resolvedBackupSet, partition, position - partitionStart, sink, options);
+            position = std::max(position, partitionStart + partition._geometry.length);
 
-            if (blockData != nullptr && backupSetBlock.block.block_length != 0)
             {
-                std::streamoff offset = lcn0Start + (static_cast<uint64_t>(partition._header.block_size) * blockIndex);
-                setFilePointer(diskFile, offset, std::ios::beg);
-                writeToFile(diskFile, blockData.get(), backupSetBlock.block.block_length);
+                std::lock_guard<std::mutex> guard(buffer.lock);
+                pendingBackupSets.emplace_back(buffer.slotsQueued, std::move(resolvedBackupSet));
             }
-            blockIndex++;
+            if (useBlockMapCache) { resolvedPartitionNumbers.push_back(partition._header.partition_number); }
+            releaseEmittedBackupSets();
+        }
+
+        StreamPiece tail;
+        tail.length = diskSize > position ? diskSize - position : 0;
+        queueStreamPiece(buffer, tail, sink, options);
+        while (!buffer.slots.empty()) { emitReadyStreamSlots(buffer, sink, options, true); }
+        releaseEmittedBackupSets();
+    }
+    catch (...) {
+        {
+            std::lock_guard<std::mutex> guard(buffer.lock);
+            if (!buffer.failure) { buffer.failure = std::current_exception(); }
         }
-        CloseBackupFiles(backupSet);
+        finish();
+        closeBlockMapCache(blockMapCache);
+        throw;
     }
-    std::cout << "Restored all blocks" << std::endl;
-    closeFile(diskFile);
+    finish();
+
+    if (useBlockMapCache && !blockMapCacheCurrent) {
+        std::vector<const PartitionBackupSet*> backupSets;
+        for (auto& resolvedBackupSet : resolvedBackupSets) { backupSets.push_back(resolvedBackupSet.get()); }
+        updateBlockMapCache(blockMapCache, options, backupFileLayout, diskIndex, resolvedPartitionNumbers, backupSets);
+    }
+    closeBlockMapCache(blockMapCache);
 }
@@ -10,7 +10,130 @@
 #pragma once
 
 #include <fstream>
-#include "file_struct.h"
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+#include "../cache_hints/cache_hints.h"
+#include "../img_handler/file_struct.h"
+#include "../metrics/restore_metrics.h"
+#include "../progress/restore_progress.h"
+#include "backup_file_cache.h"
+#include "backup_set.h"
+
+/**
+ * @brief Default number of backup files or split segments read concurrently
+ */
+const size_t DEFAULT_MAX_READER_THREADS = 4;
+
+/**
+ * @brief Default number of partition images restored concurrently
+ */
+const size_t DEFAULT_MAX_PARTITION_THREADS = 2;
+
+/**
+ * @brief Default number of pieces a streamed restore holds in its reorder buffer
+ */
+const size_t DEFAULT_MAX_STREAM_BUFFERED_BLOCKS = 64;
+
+/**
+ * @brief Size of the page of zeros holes in a streamed restore are emitted from
+ */
+const size_t STREAM_ZERO_PAGE_SIZE = 1024 * 1024;
+
+/**
+ * @brief Options controlling how a disk is restored
+ */
+struct RestoreOptions
+{
+    size_t maxOpenBackupFiles = DEFAULT_MAX_OPEN_BACKUP_FILES;   // Cap on backup files held open at once
+    size_t maxReaderThreads = DEFAULT_MAX_READER_THREADS;        // Backup files or split segments read concurrently
+    bool verifyBlocks = false;                                   // Check each block against its MD5 hash before writing
+    RestoreMetrics* metrics = nullptr;                           // Per-stage metrics to record, or nullptr
+    RestoreProgress* progress = nullptr;                         // Progress counters to update, or nullptr
+    std::string blockMapCachePath;                               // Sidecar cache of resolved block maps, or empty to resolve every run
+    std::vector<int32_t> partitionNumbers;                       // Partitions to restore, or empty for every partition
+    size_t maxPartitionThreads = DEFAULT_MAX_PARTITION_THREADS;  // Partition images restored concurrently
+    size_t maxStreamBufferedBlocks = DEFAULT_MAX_STREAM_BUFFERED_BLOCKS;  // Pieces read ahead of a streamed restore's output
+    size_t maxLayoutLoaderThreads = DEFAULT_MAX_LAYOUT_LOADER_THREADS;  // Chain files whose metadata is read concurrently
+    uint64_t readaheadBytes = DEFAULT_READAHEAD_BYTES;           // Planned reads hinted ahead of each reader, or 0 for no hints
+    uint64_t writeBehindBytes = DEFAULT_WRITE_BEHIND_BYTES;      // Bytes written to an image between writeback batches, or 0 for no hints
+    uint32_t shardCount = 1;                                     // Ranges each partition's block map is split into for sharded restores
+    uint32_t shardIndex = 0;                                     // Range restored when shardCount is above 1, from 0
+};
+
+/**
+ * @brief Where a restore writes the disk or partition to
+ * 
+ * Calls are serialised by the restore, so the functions need not be thread safe.
+ */
+struct RestoreTarget
+{
+    std::function<void(uint64_t, const void*, size_t)> write;     // Writes bytes at an offset of the target
+    std::function<void(uint64_t, uint64_t)> clearRange;           // Makes a range read as zeros, or empty if the target already reads as zeros
+};
+
+/**
+ * @brief Receives the bytes of a streamed restore, in disk order
+ */
+typedef std::function<void(const void*, size_t)> RestoreStreamSink;
+
+/**
+ * @brief A standalone image that receives one partition
+ */
+struct PartitionImageTarget
+{
+    int32_t partitionNumber = 0;    // Number of the partition in the backup
+    std::string imagePath;          // Path of the raw partition image to create
+};
+
+/**
+ * @brief Reads a data block from a backup file
+ * 
+ * @param backupFile Reference to the open backup file stream
+ * @param block The data block index element containing position and length
+ * @return std::unique_ptr<unsigned char[]> Buffer containing the block data
+ */
+std::unique_ptr<unsigned char[]> readDataBlock(std::fstream& backupFile, DataBlockIndexElement& block);
+
+/**
+ * @brief Makes a restore target that writes to a file stream
+ * 
+ * The target has no clearRange function, as restores to files go to newly
+ * created images that already read as zeros. With write-behind hints, the
+ * stream is flushed and a writeback batch started whenever a batch of
+ * bytes has been written.
+ * 
+ * @param target Output parameter for the target
+ * @param file The open stream, which must outlive target
+ * @param writeBehind Write-behind hints opened for the file, which must outlive target, or nullptr
+ */
+void getFileRestoreTarget(RestoreTarget& target, std::fstream& file, WriteBehindHints* writeBehind = nullptr);
+
+/**
+ * @brief Restores a disk from a Macrium Reflect backup file to a restore target
+ * 
+ * Track 0 and the selected partitions are written at their offsets on the
+ * disk. When the target has a clearRange function, the ranges of each
+ * restored partition that hold no backup data are cleared through it, and
+ * so is the space outside the partitions when the whole disk is restored.
+ * options.partitionNumbers selects partitions as for restoreDisk.
+ * 
+ * With options.shardCount above 1, only the shard options.shardIndex is
+ * written: that range of each partition's block map, plus track 0, the
+ * reserved sectors and the space outside the partitions for shard 0.
+ * Every shard of the same restore can be written into one target by
+ * separate processes, in any order.
+ * 
+ * @param backupFilePath Path to the Macrium Reflect backup file
+ * @param target The target the disk is written to
+ * @param backupFileLayout Structure containing the backup file layout
+ * @param diskIndex Index of the disk to restore in the backup
+ * @param options Options controlling the restore
+ * @throws std::runtime_error if options.shardIndex is not below options.shardCount
+ */
+void restoreDiskToTarget(std::string backupFilePath, RestoreTarget& target, file_structs::File_Layout& backupFileLayout, int diskIndex,
+    const RestoreOptions& options = RestoreOptions());
 
 /**
  * @brief Restores a disk from a Macrium Reflect backup file
@@ -19,9 +142,80 @@
  * handling both reserved sectors and data blocks. It supports restoring both
  * full and incremental backups.
  * 
+ * When options.partitionNumbers is set, only those partitions are restored
+ * and the rest of the disk is left as it was in the target, so a newly
+ * created image holds them as holes. Track 0 is always written, except
+ * by shards other than the first of a sharded restore. The target is
+ * opened without truncating it, so shards can be restored into it in turn.
+ * 
  * @param backupFilePath Path to the Macrium Reflect backup file
  * @param vhdxPath Path to the target disk image or virtual disk
  * @param backupFileLayout Structure containing the backup file layout
  * @param diskIndex Index of the disk to restore in the backup
+ * @param options Options controlling the restore
+ */
+void restoreDisk(std::string backupFilePath, std::string vhdxPath, file_structs::File_Layout& backupFileLayout, int diskIndex,
+    const RestoreOptions& options = RestoreOptions());
+
+/**
+ * @brief Restores partitions of a disk into standalone raw partition images
+ * 
+ * Each image is created, or truncated, to the length of its partition and
+ * holds the partition from its first sector, as a whole-disk restore would
+ * have written it at the partition's offset. Up to
+ * options.maxPartitionThreads images are restored concurrently, each
+ * reading the backup files through its own cache of open files, and the
+ * caches split options.maxOpenBackupFiles between them.
+ * options.partitionNumbers is ignored.
+ * 
+ * @param backupFilePath Path to the Macrium Reflect backup file
+ * @param targets The partitions to restore and their image paths
+ * @param backupFileLayout Structure containing the backup file layout
+ * @param diskIndex Index of the disk holding the partitions
+ * @param options Options controlling the restore
+ * @throws std::runtime_error if a partition is not in the backup or cannot be restored
+ */
+void restorePartitionImages(std::string backupFilePath, const std::vector<PartitionImageTarget>& targets, file_structs::File_Layout& backupFileLayout,
+    int diskIndex, const RestoreOptions& options = RestoreOptions());
+
+/**
+ * @brief Restores one partition of a disk to the start of a restore target
+ * 
+ * The target receives the partition from its first sector, as a standalone
+ * partition image would. options.partitionNumbers is ignored.
+ * 
+ * @param backupFilePath Path to the Macrium Reflect backup file
+ * @param partitionNumber Number of the partition in the backup
+ * @param target The target the partition is written to
+ * @param backupFileLayout Structure containing the backup file layout
+ * @param diskIndex Index of the disk holding the partition
+ * @param options Options controlling the restore
+ * @throws std::runtime_error if the partition is not in the backup or cannot be restored
+ */
+void restorePartitionToTarget(std::string backupFilePath, int32_t partitionNumber, RestoreTarget& target, file_structs::File_Layout& backupFileLayout,
+    int diskIndex, const RestoreOptions& options = RestoreOptions());
+
+/**
+ * @brief Streams a disk from a Macrium Reflect backup file in disk order
+ * 
+ * The sink receives every byte of the disk exactly once and strictly in
+ * order: track 0, the gaps before each partition, each partition with its
+ * reserved sectors and data blocks, and the space after the last one, so
+ * it can write to a pipe or socket that cannot seek. Holes, including
+ * partitions not selected by options.partitionNumbers, are emitted from a
+ * shared page of zeros.
+ * 
+ * options.maxReaderThreads readers read stored blocks ahead of the output
+ * into a reorder buffer of at most options.maxStreamBufferedBlocks pieces,
+ * each with its own cache of open backup files. Progress counts the bytes
+ * emitted against the size of the disk.
+ * 
+ * @param backupFilePath Path to the Macrium Reflect backup file
+ * @param sink Receives the bytes of the disk, in order
+ * @param backupFileLayout Structure containing the backup file layout
+ * @param diskIndex Index of the disk to stream in the backup
+ * @param options Options controlling the restore
+ * @throws std::runtime_error if a selected partition is not in the backup, or a block cannot be read
  */
-void restoreDisk(std::string backupFilePath, std::string vhdxPath, file_structs::File_Layout& backupFileLayout, int diskIndex);
+void streamDisk(std::string backupFilePath, const RestoreStreamSink& sink, file_structs::File_Layout& backupFileLayout, int diskIndex,
+    const RestoreOptions& options = RestoreOptions());
@@ -0,0 +1,528 @@
+/**
+ * @file shard_restore.cpp
+ * @brief Implementation of sharded restores by several processes
+ *
+ * A shard directory holds plan.json, a shard-N.claim file for every shard
+ * a worker has taken, naming the host and process ID of the worker, and a
+ * shard-N.json manifest for every shard that is complete. Files other processes read are written under a name unique to
+ * the writer and renamed into place.
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+#include <fcntl.h>
+#include <signal.h>
+#include <spawn.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "../../dependencies/include/nlohmann/json.hpp"
+#include "../file_handler/file_handler.h"
+#include "shard_restore.h"
+
+extern char** environ;
+
+/**
+ * @brief Returns the name of this host
+ *
+ * @return std::string The host name, or "localhost" if it cannot be read
+ */
+std::string getShardHostName()
+{
+    char name[256] = {};
+    if (gethostname(name, sizeof(name) - 1) != 0) { return "localhost"; }
+    return name;
+}
+
+/**
+ * @brief Returns the path of a file of a shard
+ *
+ * @param plan The plan of the restore
+ * @param shardIndex The shard
+ * @param extension Extension of the file, including the dot
+ * @return std::string Path of shard-N with the extension in the shard directory
+ */
+std::string getShardFilePath(const ShardPlan& plan, uint32_t shardIndex, const std::string& extension)
+{
+    return (std::filesystem::path(plan.directory) / ("shard-" + std::to_string(shardIndex) + extension)).string();
+}
+
+/**
+ * @brief Writes a file of the shard directory through a uniquely named temporary file and a rename
+ *
+ * @param path Final path of the file
+ * @param text Contents to write
+ * @throws std::runtime_error if the file cannot be written
+ */
+void writeShardFile(const std::string& path, const std::string& text)
+{
+    std::string temporaryPath = path + ".tmp-" + getShardHostName() + "-" + std::to_string(getpid());
+    std::ofstream out(temporaryPath, std::ios::out | std::ios::trunc | std::ios::binary);
+    out << text;
+    out.close();
+    if (out.fail() || std::rename(temporaryPath.c_str(), path.c_str()) != 0) {
+        std::cerr << "Failed to write " << path << ": " << strerror(errno) << "\n";
+        std::remove(temporaryPath.c_str());
+        throw std::runtime_error("Failed to write shard file.");
+    }
+}
+
+/**
+ * @brief Converts a plan to its JSON form, without its directory
+ *
+ * @param plan The plan
+ * @return nlohmann::json The plan as written to plan.json
+ */
+nlohmann::json getShardPlanJSON(const ShardPlan& plan)
+{
+    nlohmann::json json;
+    json["backup_guid"] = plan.backupGuid;
+    json["target_path"] = plan.targetPath;
+    json["disk_index"] = plan.diskIndex;
+    json["shard_count"] = plan.shardCount;
+    json["partition_numbers"] = plan.partitionNumbers;
+    json["unused_space"] = static_cast<int>(plan.unusedSpace);
+    return json;
+}
+
+/**
+ * @brief Writes the plan of a sharded restore into its directory
+ *
+ * @param plan The plan to write
+ * @param resume Whether completed shards of the same restore may be kept
+ * @return true if completed shards were kept
+ * @throws std::runtime_error if the directory or plan cannot be written
+ */
+bool createShardPlan(const ShardPlan& plan, bool resume)
+{
+    if (plan.shardCount == 0) { throw std::runtime_error("A sharded restore needs at least one shard."); }
+
+    std::error_code error;
+    std::filesystem::create_directories(plan.directory, error);
+    if (error) {
+        std::cerr << "Failed to create " << plan.directory << ": " << error.message() << "\n";
+        throw std::runtime_error("Failed to create shard directory.");
+    }
+
+    bool samePlan = false;
+    std::string existingPlanPath = (std::filesystem::path(plan.directory) / SHARD_PLAN_FILE_NAME).string();
+    if (resume && std::filesystem::exists(existingPlanPath, error)) {
+        try {
+            ShardPlan existing;
+            readShardPlan(existing, plan.directory);
+            samePlan = getShardPlanJSON(existing) == getShardPlanJSON(plan);
+        }
+        catch (const std::exception&) {
+            samePlan = false;
+        }
+    }
+
+    // Keep the completed shards of the same restore, so it resumes where it stopped
+    for (auto& entry : std::filesystem::directory_iterator(plan.directory)) {
+        std::string name = entry.path().filename().string();
+        if (name.compare(0, 6, "shard-") != 0) { continue; }
+
+        bool completedShard = false;
+        if (samePlan && name.size() > 6 && name.compare(name.size() - 6, 6, ".claim") == 0) {
+            completedShard = std::filesystem::exists(entry.path().parent_path() / (entry.path().stem().string() + ".json"));
+        }
+        else if (samePlan && name.size() > 5 && name.compare(name.size() - 5, 5, ".json") == 0) {
+            completedShard = true;
+        }
+        if (!completedShard) { std::filesystem::remove(entry.path(), error); }
+    }
+
+    writeShardFile((std::filesystem::path(plan.directory) / SHARD_PLAN_FILE_NAME).string(), getShardPlanJSON(plan).dump(2) + "\n");
+    return samePlan && !readShardManifests(plan).empty();
+}
+
+/**
+ * @brief Reads the plan of a sharded restore from its directory
+ *
+ * @param plan Output parameter for the plan
+ * @param directory The shard directory
+ * @throws std::runtime_error if the directory holds no readable plan
+ */
+void readShardPlan(ShardPlan& plan, const std::string& directory)
+{
+    std::string path = (std::filesystem::path(directory) / SHARD_PLAN_FILE_NAME).string();
+    std::ifstream in(path, std::ios::binary);
+    if (in.fail()) {
+        std::cerr << "Failed to open " << path << "\n";
+        throw std::runtime_error("Failed to open shard plan.");
+    }
+
+    nlohmann::json json = nlohmann::json::parse(in, nullptr, false);
+    if (json.is_discarded() || !json.is_object()) {
+        std::cerr << path << " is not a shard plan\n";
+        throw std::runtime_error("Invalid shard plan.");
+    }
+    plan.directory = directory;
+    plan.backupGuid = json.value("backup_guid", std::string());
+    plan.targetPath = json.value("target_path", std::string());
+    plan.diskIndex = json.value("disk_index", 0);
+    plan.shardCount = json.value("shard_count", 0u);
+    plan.partitionNumbers = json.value("partition_numbers", std::vector<int32_t>());
+    plan.unusedSpace = static_cast<UnusedSpaceMode>(json.value("unused_space", 0));
+    if (plan.shardCount == 0 || plan.targetPath.empty()) {
+        std::cerr << path << " is not a shard plan\n";
+        throw std::runtime_error("Invalid shard plan.");
+    }
+}
+
+/**
+ * @brief Claims the lowest shard no worker has claimed yet
+ *
+ * @param plan The plan of the restore
+ * @param shardIndex Output parameter for the claimed shard
+ * @return false if every shard has been claimed
+ * @throws std::runtime_error if a claim file cannot be created for a reason other than an existing claim
+ */
+bool claimShard(const ShardPlan& plan, uint32_t& shardIndex)
+{
+    std::string owner = getShardHostName() + " " + std::to_string(getpid()) + "\n";
+    for (uint32_t i = 0; i < plan.shardCount; i++) {
+        std::string path = getShardFilePath(plan, i, ".claim");
+        int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+        if (fd < 0 && errno == EEXIST) { continue; }
+        if (fd < 0) {
+            std::cerr << "Failed to create " << path << ": " << strerror(errno) << "\n";
+            throw std::runtime_error("Failed to claim shard.");
+        }
+        // The claim is the file existing; the owner lets a coordinator spot claims of exited workers
+        ssize_t written = write(fd, owner.data(), owner.size());
+        (void)written;
+        close(fd);
+        shardIndex = i;
+        return true;
+    }
+    return false;
+}
+
+/**
+ * @brief Records a shard as complete
+ *
+ * @param plan The plan of the restore
+ * @param manifest The manifest of the restored shard
+ * @throws std::runtime_error if the manifest cannot be written
+ */
+void writeShardManifest(const ShardPlan& plan, const ShardManifest& manifest)
+{
+    nlohmann::json json;
+    json["shard_index"] = manifest.shardIndex;
+    json["shard_count"] = plan.shardCount;
+    json["backup_guid"] = plan.backupGuid;
+    json["host"] = manifest.host;
+    json["process_id"] = manifest.processId;
+    json["bytes_written"] = manifest.bytesWritten;
+    json["bytes_cleared"] = manifest.bytesCleared;
+    json["seconds"] = manifest.seconds;
+    writeShardFile(getShardFilePath(plan, manifest.shardIndex, ".json"), json.dump(2) + "\n");
+}
+
+/**
+ * @brief Reads the manifests of the completed shards
+ *
+ * Manifests that cannot be parsed or belong to another restore are
+ * reported and treated as missing.
+ *
+ * @param plan The plan of the restore
+ * @return std::vector<ShardManifest> Manifests of the completed shards, by shard index
+ */
+std::vector<ShardManifest> readShardManifests(const ShardPlan& plan)
+{
+    std::vector<ShardManifest> manifests;
+    for (uint32_t i = 0; i < plan.shardCount; i++) {
+        std::string path = getShardFilePath(plan, i, ".json");
+        std::ifstream in(path, std::ios::binary);
+        if (in.fail()) { continue; }
+
+        nlohmann::json json = nlohmann::json::parse(in, nullptr, false);
+        if (json.is_discarded() || !json.is_object() || json.value("shard_index", plan.shardCount) != i ||
+            json.value("backup_guid", std::string()) != plan.backupGuid) {
+            std::cerr << "Ignoring invalid shard manifest " << path << "\n";
+            continue;
+        }
+        ShardManifest manifest;
+        manifest.shardIndex = i;
+        manifest.host = json.value("host", std::string());
+        manifest.processId = json.value("process_id", static_cast<int64_t>(0));
+        manifest.bytesWritten = json.value("bytes_written", static_cast<uint64_t>(0));
+        manifest.bytesCleared = json.value("bytes_cleared", static_cast<uint64_t>(0));
+        manifest.seconds = json.value("seconds", 0.0);
+        manifests.push_back(manifest);
+    }
+    return manifests;
+}
+
+/**
+ * @brief Reads the worker that claimed a shard
+ *
+ * @param plan The plan of the restore
+ * @param shardIndex The shard
+ * @param host Output parameter for the host of the worker
+ * @param processId Output parameter for the process ID of the worker
+ * @return false if the shard is not claimed or the claim does not name its worker yet
+ */
+bool readShardClaim(const ShardPlan& plan, uint32_t shardIndex, std::string& host, int64_t& processId)
+{
+    std::ifstream in(getShardFilePath(plan, shardIndex, ".claim"), std::ios::binary);
+    if (in.fail()) { return false; }
+    std::string line;
+    std::getline(in, line);
+    std::istringstream owner(line);
+    return static_cast<bool>(owner >> host >> processId) && processId > 0;
+}
+
+/**
+ * @brief Returns whether a claim names a process on this host that has exited
+ *
+ * Processes on other hosts cannot be checked, so their claims are trusted.
+ *
+ * @param host Host of the claiming worker
+ * @param processId Process ID of the claiming worker
+ * @param localHost Name of this host
+ * @return true if the worker ran on this host and no longer exists
+ */
+bool isExitedShardWorker(const std::string& host, int64_t processId, const std::string& localHost)
+{
+    return host == localHost && kill(static_cast<pid_t>(processId), 0) != 0 && errno == ESRCH;
+}
+
+/**
+ * @brief Returns the shards of a plan that have no manifest
+ *
+ * @param plan The plan of the restore
+ * @param manifests Manifests of the completed shards, by shard index
+ * @return std::vector<uint32_t> The missing shards, in order
+ */
+std::vector<uint32_t> getMissingShards(const ShardPlan& plan, const std::vector<ShardManifest>& manifests)
+{
+    std::vector<uint32_t> missing;
+    size_t next = 0;
+    for (uint32_t i = 0; i < plan.shardCount; i++) {
+        if (next < manifests.size() && manifests[next].shardIndex == i) { next++; }
+        else { missing.push_back(i); }
+    }
+    return missing;
+}
+
+/**
+ * @brief Reports the shards of a plan that have no manifest, and who claimed them
+ *
+ * @param plan The plan of the restore
+ * @param manifests Manifests of the completed shards, by shard index
+ * @param localHost Name of this host
+ */
+void reportMissingShards(const ShardPlan& plan, const std::vector<ShardManifest>& manifests, const std::string& localHost)
+{
+    for (uint32_t shardIndex : getMissingShards(plan, manifests)) {
+        std::string host;
+        int64_t processId = 0;
+        std::cerr << "Shard " << shardIndex << " is missing: ";
+        if (!readShardClaim(plan, shardIndex, host, processId)) { std::cerr << "no worker has claimed it\n"; }
+        else if (isExitedShardWorker(host, processId, localHost)) { std::cerr << "worker " << processId << " on this host exited\n"; }
+        else { std::cerr << "claimed by worker " << processId << " on " << host << "\n"; }
+    }
+    std::cerr << manifests.size() << " of " << plan.shardCount << " shards were restored; run again to resume\n";
+}
+
+/**
+ * @brief Waits until every shard of a plan has a manifest
+ *
+ * The timeout restarts whenever another shard completes, so a long restore
+ * on other hosts is waited for as long as it makes progress.
+ *
+ * @param plan The plan of the restore
+ * @param pollInterval Time between checks of the shard directory
+ * @param timeout Longest time to wait for the next shard to complete
+ * @return std::vector<ShardManifest> Manifests of every shard, by shard index
+ * @throws std::runtime_error if a missing shard's worker has exited or the timeout passes
+ */
+std::vector<ShardManifest> waitForShardManifests(const ShardPlan& plan, std::chrono::milliseconds pollInterval,
+    std::chrono::milliseconds timeout)
+{
+    std::string localHost = getShardHostName();
+    std::vector<ShardManifest> manifests = readShardManifests(plan);
+    size_t reportedCount = plan.shardCount;
+    auto lastProgress = std::chrono::steady_clock::now();
+    while (manifests.size() < plan.shardCount) {
+        if (manifests.size() != reportedCount) {
+            std::cout << "Waiting for " << plan.shardCount - manifests.size() << " shards restored elsewhere" << std::endl;
+            reportedCount = manifests.size();
+            lastProgress = std::chrono::steady_clock::now();
+        }
+        // A worker writes its manifest before exiting, so a shard still missing once its worker is gone was abandoned
+        std::vector<uint32_t> abandonedShards;
+        for (uint32_t shardIndex : getMissingShards(plan, manifests)) {
+            std::string host;
+            int64_t processId = 0;
+            if (readShardClaim(plan, shardIndex, host, processId) && isExitedShardWorker(host, processId, localHost)) {
+                abandonedShards.push_back(shardIndex);
+            }
+        }
+        if (!abandonedShards.empty()) {
+            manifests = readShardManifests(plan);
+            std::vector<uint32_t> missingShards = getMissingShards(plan, manifests);
+            if (std::any_of(abandonedShards.begin(), abandonedShards.end(), [&missingShards](uint32_t shardIndex) {
+                return std::binary_search(missingShards.begin(), missingShards.end(), shardIndex);
+            })) {
+                reportMissingShards(plan, manifests, localHost);
+                throw std::runtime_error("Shard worker exited without completing its shard.");
+            }
+            continue;
+        }
+        if (std::chrono::steady_clock::now() - lastProgress >= timeout) {
+            std::cerr << "No shard completed in " << std::chrono::duration_cast<std::chrono::seconds>(timeout).count() << " s\n";
+            reportMissingShards(plan, manifests, localHost);
+            throw std::runtime_error("Timed out waiting for shards.");
+        }
+        std::this_thread::sleep_for(pollInterval);
+        manifests = readShardManifests(plan);
+    }
+    return manifests;
+}
+
+/**
+ * @brief Returns whether a path names a block device
+ *
+ * @param path The path to check
+ * @return true if the path exists and is a block device
+ */
+bool isBlockDevicePath(const std::string& path)
+{
+    struct stat pathStat;
+    return stat(path.c_str(), &pathStat) == 0 && S_ISBLK(pathStat.st_mode);
+}
+
+/**
+ * @brief Restores one shard of a plan into its target
+ *
+ * @param plan The plan of the restore
+ * @param backupFilePath Path of the backup file on this host
+ * @param backupFileLayout Structure containing the backup file layout
+ * @param options Options controlling the restore, with the shard set
+ * @param manifest Output parameter that receives the bytes written and cleared
+ * @throws std::runtime_error if the shard cannot be restored
+ */
+void restoreShard(const ShardPlan& plan, const std::string& backupFilePath, file_structs::File_Layout& backupFileLayout,
+    const RestoreOptions& options, ShardManifest& manifest)
+{
+    if (isBlockDevicePath(plan.targetPath)) {
+        BlockDevice device;
+        openBlockDevice(device, plan.targetPath, plan.unusedSpace, options.writeBehindBytes);
+        RestoreTarget target;
+        getBlockDeviceRestoreTarget(target, device);
+        try {
+            restoreDiskToTarget(backupFilePath, target, backupFileLayout, plan.diskIndex, options);
+        }
+        catch (...) {
+            closeBlockDevice(device);
+            throw;
+        }
+        closeBlockDevice(device);
+        manifest.bytesWritten = device.bytesWritten;
+        manifest.bytesCleared = device.bytesCleared;
+        return;
+    }
+
+    std::fstream file = openFile(plan.targetPath);
+    WriteBehindHints writeBehind;
+    openWriteBehindHints(writeBehind, plan.targetPath, options.writeBehindBytes);
+    RestoreTarget fileTarget;
+    getFileRestoreTarget(fileTarget, file, &writeBehind);
+    RestoreTarget target;
+    target.write = [&](uint64_t offset, const void* data, size_t length) {
+        fileTarget.write(offset, data, length);
+        manifest.bytesWritten += length;
+    };
+    target.clearRange = nullptr;
+    restoreDiskToTarget(backupFilePath, target, backupFileLayout, plan.diskIndex, options);
+    closeFile(file);
+    closeWriteBehindHints(writeBehind);
+}
+
+/**
+ * @brief Restores shards of a plan until every shard has been claimed
+ *
+ * @param plan The plan of the restore
+ * @param backupFilePath Path of the backup file on this host
+ * @param backupFileLayout Structure containing the backup file layout
+ * @param options Options controlling each shard's restore; the shard and partition fields are set from the plan
+ * @return uint32_t Number of shards this worker restored
+ * @throws std::runtime_error if the backup is not the one planned or a shard cannot be restored
+ */
+uint32_t runShardWorker(const ShardPlan& plan, const std::string& backupFilePath, file_structs::File_Layout& backupFileLayout,
+    const RestoreOptions& options)
+{
+    if (backupFileLayout._header.backup_guid != plan.backupGuid) {
+        std::cerr << backupFilePath << " is backup " << backupFileLayout._header.backup_guid << " but the plan restores " << plan.backupGuid << "\n";
+        throw std::runtime_error("Backup does not match the shard plan.");
+    }
+
+    RestoreOptions shardOptions = options;
+    shardOptions.shardCount = plan.shardCount;
+    shardOptions.partitionNumbers = plan.partitionNumbers;
+
+    uint32_t restoredShards = 0;
+    uint32_t shardIndex = 0;
+    while (claimShard(plan, shardIndex)) {
+        auto start = std::chrono::steady_clock::now();
+        shardOptions.shardIndex = shardIndex;
+
+        ShardManifest manifest;
+        manifest.shardIndex = shardIndex;
+        manifest.host = getShardHostName();
+        manifest.processId = getpid();
+        restoreShard(plan, backupFilePath, backupFileLayout, shardOptions, manifest);
+        manifest.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        writeShardManifest(plan, manifest);
+        restoredShards++;
+    }
+    return restoredShards;
+}
+
+/**
+ * @brief Runs worker processes on this host and waits for them to exit
+ *
+ * @param command Path of the program followed by its arguments, run once for each worker
+ * @param workerCount Number of processes to start
+ * @return size_t Number of processes that failed to start or exited with an error
+ */
+size_t runLocalShardWorkers(const std::vector<std::string>& command, size_t workerCount)
+{
+    std::vector<char*> arguments;
+    for (auto& argument : command) { arguments.push_back(const_cast<char*>(argument.c_str())); }
+    arguments.push_back(nullptr);
+
+    size_t failures = 0;
+    std::vector<pid_t> workers;
+    for (size_t i = 0; i < workerCount; i++) {
+        pid_t worker;
+        int error = posix_spawn(&worker, arguments[0], nullptr, nullptr, arguments.data(), environ);
+        if (error != 0) {
+            std::cerr << "Failed to start " << command[0] << ": " << strerror(error) << "\n";
+            failures++;
+            continue;
+        }
+        workers.push_back(worker);
+    }
+
+    for (pid_t worker : workers) {
+        int status = 0;
+        while (waitpid(worker, &status, 0) < 0 && errno == EINTR) {}
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) { failures++; }
+    }
+    return failures;
+}
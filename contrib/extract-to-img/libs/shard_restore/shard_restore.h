@@ -0,0 +1,178 @@
+/**
+ * @file shard_restore.h
+ * @brief Sharded restores by several processes into one target
+ *
+ * This file declares the pieces of a restore split into shards, each of
+ * which covers a range of every partition's block map (see
+ * RestoreOptions::shardCount). A coordinator writes a plan into a
+ * directory that every worker can reach, such as a share mounted on each
+ * host. Workers on any host claim shards by creating claim files in it,
+ * restore each claimed shard into the shared target with positional writes,
+ * and record a completion manifest for it. A shard whose worker failed has
+ * a claim but no manifest; creating the plan again releases such claims, so
+ * an interrupted restore resumes with the shards that are still missing.
+ * Each claim records the host and process of its worker, so a coordinator
+ * can tell when a worker on its own host has exited without finishing.
+ *
+ * Claims rely on exclusive file creation, which local file systems and
+ * NFS version 3 and later provide.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "../block_device/block_device.h"
+#include "../img_handler/file_struct.h"
+#include "../restore/restore.h"
+
+/**
+ * @brief Default number of shards a restore is split into
+ */
+const uint32_t DEFAULT_RESTORE_SHARDS = 16;
+
+/**
+ * @brief Default number of worker processes a coordinator starts on its own host
+ */
+const size_t DEFAULT_LOCAL_SHARD_WORKERS = 4;
+
+/**
+ * @brief Default time a coordinator waits for the next shard to complete before giving up
+ */
+const std::chrono::seconds DEFAULT_SHARD_WAIT_TIMEOUT(3600);
+
+/**
+ * @brief Name of the plan file in a shard directory
+ */
+const char SHARD_PLAN_FILE_NAME[] = "plan.json";
+
+/**
+ * @brief A sharded restore, as recorded in its shard directory
+ */
+struct ShardPlan
+{
+    std::string directory;                          // Directory holding the plan, claims and manifests
+    std::string backupGuid;                         // GUID of the backup being restored
+    std::string targetPath;                         // Image file or block device every shard is written to
+    int diskIndex = 0;                              // Index of the disk restored
+    uint32_t shardCount = DEFAULT_RESTORE_SHARDS;   // Number of shards
+    std::vector<int32_t> partitionNumbers;          // Partitions restored, or empty for every partition
+    UnusedSpaceMode unusedSpace = UnusedSpaceMode::eZeroOut;  // How a block device's ranges without backup data are cleared
+};
+
+/**
+ * @brief The completion record of a shard
+ */
+struct ShardManifest
+{
+    uint32_t shardIndex = 0;        // The restored shard
+    std::string host;               // Host the shard was restored on
+    int64_t processId = 0;          // Process that restored the shard
+    uint64_t bytesWritten = 0;      // Bytes written to the target
+    uint64_t bytesCleared = 0;      // Bytes cleared on a block device target
+    double seconds = 0;             // Time taken to restore the shard
+};
+
+/**
+ * @brief Writes the plan of a sharded restore into its directory
+ *
+ * Creates the directory if needed. When resuming and the directory already
+ * holds the plan of the same restore, the manifests of completed shards are
+ * kept and the claims of shards without a manifest are released; otherwise
+ * every claim and manifest is removed. No workers may be running on the
+ * directory.
+ *
+ * @param plan The plan to write
+ * @param resume Whether completed shards of the same restore may be kept
+ * @return true if completed shards were kept
+ * @throws std::runtime_error if the directory or plan cannot be written
+ */
+bool createShardPlan(const ShardPlan& plan, bool resume);
+
+/**
+ * @brief Reads the plan of a sharded restore from its directory
+ *
+ * @param plan Output parameter for the plan
+ * @param directory The shard directory
+ * @throws std::runtime_error if the directory holds no readable plan
+ */
+void readShardPlan(ShardPlan& plan, const std::string& directory);
+
+/**
+ * @brief Claims the lowest shard no worker has claimed yet
+ *
+ * @param plan The plan of the restore
+ * @param shardIndex Output parameter for the claimed shard
+ * @return false if every shard has been claimed
+ * @throws std::runtime_error if a claim file cannot be created for a reason other than an existing claim
+ */
+bool claimShard(const ShardPlan& plan, uint32_t& shardIndex);
+
+/**
+ * @brief Records a shard as complete
+ *
+ * The manifest is written under a temporary name and renamed into place,
+ * so readers never see a partial manifest.
+ *
+ * @param plan The plan of the restore
+ * @param manifest The manifest of the restored shard
+ * @throws std::runtime_error if the manifest cannot be written
+ */
+void writeShardManifest(const ShardPlan& plan, const ShardManifest& manifest);
+
+/**
+ * @brief Reads the manifests of the completed shards
+ *
+ * @param plan The plan of the restore
+ * @return std::vector<ShardManifest> Manifests of the completed shards, by shard index
+ */
+std::vector<ShardManifest> readShardManifests(const ShardPlan& plan);
+
+/**
+ * @brief Waits until every shard of a plan has a manifest
+ *
+ * Used once the local workers have exited, for shards still being restored
+ * on other hosts. Gives up when a missing shard is claimed by a process on
+ * this host that has exited, or when no shard completes within the
+ * timeout, reporting the shards still missing. Running the restore again
+ * resumes with them.
+ *
+ * @param plan The plan of the restore
+ * @param pollInterval Time between checks of the shard directory
+ * @param timeout Longest time to wait for the next shard to complete
+ * @return std::vector<ShardManifest> Manifests of every shard, by shard index
+ * @throws std::runtime_error if a missing shard's worker has exited or the timeout passes
+ */
+std::vector<ShardManifest> waitForShardManifests(const ShardPlan& plan, std::chrono::milliseconds pollInterval,
+    std::chrono::milliseconds timeout);
+
+/**
+ * @brief Restores shards of a plan until every shard has been claimed
+ *
+ * Each claimed shard is restored with restoreDiskToTarget into the plan's
+ * target, which must already exist at its full size, and a manifest is
+ * written once it is complete. Block device targets are written through
+ * the block device writer, clearing ranges as the plan says; image files
+ * are written in place without being truncated.
+ *
+ * @param plan The plan of the restore
+ * @param backupFilePath Path of the backup file on this host
+ * @param backupFileLayout Structure containing the backup file layout
+ * @param options Options controlling each shard's restore; the shard and partition fields are set from the plan
+ * @return uint32_t Number of shards this worker restored
+ * @throws std::runtime_error if the backup is not the one planned or a shard cannot be restored
+ */
+uint32_t runShardWorker(const ShardPlan& plan, const std::string& backupFilePath, file_structs::File_Layout& backupFileLayout,
+    const RestoreOptions& options);
+
+/**
+ * @brief Runs worker processes on this host and waits for them to exit
+ *
+ * @param command Path of the program followed by its arguments, run once for each worker
+ * @param workerCount Number of processes to start
+ * @return size_t Number of processes that failed to start or exited with an error
+ */
+size_t runLocalShardWorkers(const std::vector<std::string>& command, size_t workerCount);
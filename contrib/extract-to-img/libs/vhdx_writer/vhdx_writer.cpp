@@ -0,0 +1,387 @@
+/**
+ * @file vhdx_writer.cpp
+ * @brief Implementation of dynamic VHDX image output for restores
+ *
+ * The image is laid out as the first 1 MiB holding the file type
+ * identifier, both headers and both region tables, a 1 MiB log that is
+ * left empty, the 1 MiB metadata region, the BAT rounded up to 1 MiB, and
+ * then payload blocks in the order they are allocated. All fields are
+ * little-endian and every structure with a checksum uses CRC-32C.
+ */
+
+#include <algorithm>
+#include <filesystem>
+#include <iostream>
+#include <random>
+#include <stdexcept>
+
+#include "../file_handler/file_handler.h"
+#include "vhdx_writer.h"
+
+/**
+ * @brief Fixed offsets and sizes of the structures at the start of the file
+ */
+const uint64_t VHDX_MB = 1024 * 1024;
+const uint64_t VHDX_HEADER_OFFSETS[2] = { 64 * 1024, 128 * 1024 };
+const uint64_t VHDX_REGION_TABLE_OFFSETS[2] = { 192 * 1024, 256 * 1024 };
+const uint32_t VHDX_HEADER_SIZE = 4 * 1024;
+const uint32_t VHDX_REGION_TABLE_SIZE = 64 * 1024;
+const uint64_t VHDX_LOG_OFFSET = 1 * VHDX_MB;
+const uint32_t VHDX_LOG_LENGTH = 1 * VHDX_MB;
+const uint64_t VHDX_METADATA_OFFSET = 2 * VHDX_MB;
+const uint32_t VHDX_METADATA_LENGTH = 1 * VHDX_MB;
+const uint64_t VHDX_BAT_OFFSET = 3 * VHDX_MB;
+
+/**
+ * @brief Offset of the first metadata item within the metadata region, after the table
+ */
+const uint32_t VHDX_METADATA_ITEMS_OFFSET = 64 * 1024;
+
+/**
+ * @brief States of payload block BAT entries
+ */
+const uint64_t VHDX_PAYLOAD_BLOCK_NOT_PRESENT = 0;
+const uint64_t VHDX_PAYLOAD_BLOCK_FULLY_PRESENT = 6;
+
+/**
+ * @brief Flags of metadata table entries
+ */
+const uint32_t VHDX_METADATA_IS_VIRTUAL_DISK = 1u << 1;
+const uint32_t VHDX_METADATA_IS_REQUIRED = 1u << 2;
+
+/**
+ * @brief A GUID in the mixed-endian layout VHDX stores them in
+ */
+struct VhdxGuid
+{
+    uint32_t data1;
+    uint16_t data2;
+    uint16_t data3;
+    uint8_t data4[8];
+};
+
+/**
+ * @brief Well-known GUIDs of regions and metadata items
+ */
+const VhdxGuid VHDX_BAT_GUID = { 0x2DC27766, 0xF623, 0x4200, { 0x9D, 0x64, 0x11, 0x5E, 0x9B, 0xFD, 0x4A, 0x08 } };
+const VhdxGuid VHDX_METADATA_GUID = { 0x8B7CA206, 0x4790, 0x4B9A, { 0xB8, 0xFE, 0x57, 0x5F, 0x05, 0x0F, 0x88, 0x6E } };
+const VhdxGuid VHDX_FILE_PARAMETERS_GUID = { 0xCAA16737, 0xFA36, 0x4D43, { 0xB3, 0xB6, 0x33, 0xF0, 0xAA, 0x44, 0xE7, 0x6B } };
+const VhdxGuid VHDX_VIRTUAL_DISK_SIZE_GUID = { 0x2FA54224, 0xCD1B, 0x4876, { 0xB2, 0x11, 0x5D, 0xBE, 0xD8, 0x3B, 0xF4, 0xB8 } };
+const VhdxGuid VHDX_VIRTUAL_DISK_ID_GUID = { 0xBECA12AB, 0xB2E6, 0x4523, { 0x93, 0xEF, 0xC3, 0x09, 0xE0, 0x00, 0xC7, 0x46 } };
+const VhdxGuid VHDX_LOGICAL_SECTOR_SIZE_GUID = { 0x8141BF1D, 0xA96F, 0x4709, { 0xBA, 0x47, 0xF2, 0x33, 0xA8, 0xFA, 0xAB, 0x5F } };
+const VhdxGuid VHDX_PHYSICAL_SECTOR_SIZE_GUID = { 0xCDA348C7, 0x445D, 0x4471, { 0x9C, 0xC9, 0xE9, 0x88, 0x52, 0x51, 0xC5, 0x56 } };
+
+/**
+ * @brief Stores a little-endian value
+ *
+ * @param data Pointer the value is stored at
+ * @param value The value
+ * @param bytes Width of the value in bytes
+ */
+void storeVhdxValue(uint8_t* data, uint64_t value, int bytes)
+{
+    for (int i = 0; i < bytes; i++) {
+        data[i] = static_cast<uint8_t>(value);
+        value >>= 8;
+    }
+}
+
+/**
+ * @brief Stores a GUID
+ *
+ * @param data Pointer the 16 bytes of the GUID are stored at
+ * @param guid The GUID
+ */
+void storeVhdxGuid(uint8_t* data, const VhdxGuid& guid)
+{
+    storeVhdxValue(data, guid.data1, 4);
+    storeVhdxValue(data + 4, guid.data2, 2);
+    storeVhdxValue(data + 6, guid.data3, 2);
+    std::copy(guid.data4, guid.data4 + 8, data + 8);
+}
+
+/**
+ * @brief Generates a random version 4 GUID
+ *
+ * @return VhdxGuid The GUID
+ */
+VhdxGuid generateVhdxGuid()
+{
+    static std::random_device device;
+    static std::mt19937_64 generator(device());
+    uint64_t high = generator();
+    uint64_t low = generator();
+
+    VhdxGuid guid;
+    guid.data1 = static_cast<uint32_t>(high >> 32);
+    guid.data2 = static_cast<uint16_t>(high >> 16);
+    guid.data3 = static_cast<uint16_t>((high & 0x0FFF) | 0x4000);
+    for (int i = 0; i < 8; i++) { guid.data4[i] = static_cast<uint8_t>(low >> (56 - i * 8)); }
+    guid.data4[0] = static_cast<uint8_t>((guid.data4[0] & 0x3F) | 0x80);
+    return guid;
+}
+
+/**
+ * @brief Computes the CRC-32C (Castagnoli) checksum of a buffer
+ *
+ * @param data The bytes to checksum
+ * @param length Number of bytes
+ * @return uint32_t The checksum
+ */
+uint32_t vhdxCrc32c(const uint8_t* data, size_t length)
+{
+    static uint32_t table[256] = {};
+    static bool tableBuilt = false;
+    if (!tableBuilt) {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t value = i;
+            for (int bit = 0; bit < 8; bit++) { value = (value >> 1) ^ ((value & 1) ? 0x82F63B78 : 0); }
+            table[i] = value;
+        }
+        tableBuilt = true;
+    }
+
+    uint32_t crc = 0xFFFFFFFF;
+    for (size_t i = 0; i < length; i++) { crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8); }
+    return crc ^ 0xFFFFFFFF;
+}
+
+/**
+ * @brief Stores the checksum of a structure in its checksum field at offset 4
+ *
+ * @param data The structure, with its checksum field zero
+ */
+void storeVhdxChecksum(std::vector<uint8_t>& data)
+{
+    storeVhdxValue(data.data() + 4, vhdxCrc32c(data.data(), data.size()), 4);
+}
+
+/**
+ * @brief Writes bytes at an offset of the image file
+ *
+ * @param writer The open writer
+ * @param offset Offset in the file
+ * @param data The bytes to write
+ * @param length Number of bytes
+ */
+void writeVhdxFile(VhdxWriter& writer, uint64_t offset, const void* data, size_t length)
+{
+    setFilePointer(writer.file, static_cast<std::streamoff>(offset), std::ios::beg);
+    writeToFile(writer.file, const_cast<void*>(data), static_cast<std::streamsize>(length));
+}
+
+/**
+ * @brief Returns the BAT index of a payload block
+ *
+ * A sector bitmap entry follows every chunkRatio payload entries.
+ *
+ * @param writer The open writer
+ * @param block Index of the payload block
+ * @return uint64_t Index of its BAT entry
+ */
+uint64_t getVhdxBatIndex(const VhdxWriter& writer, uint64_t block)
+{
+    return block + block / writer.chunkRatio;
+}
+
+/**
+ * @brief Creates a dynamic VHDX image
+ *
+ * @param writer Output parameter for the writer
+ * @param path Path of the image, replaced if it exists
+ * @param virtualSize Size of the virtual disk in bytes, a multiple of logicalSectorSize
+ * @param logicalSectorSize Logical sector size of the virtual disk, 512 or 4096
+ * @param blockSize Payload block size, a power of 2 from 1 MiB to 256 MiB
+ * @throws std::runtime_error if the parameters are invalid or the file cannot be created
+ */
+void openVhdxWriter(VhdxWriter& writer, const std::string& path, uint64_t virtualSize, uint32_t logicalSectorSize,
+    uint32_t blockSize)
+{
+    bool blockSizeValid = blockSize >= VHDX_MB && blockSize <= 256 * VHDX_MB && (blockSize & (blockSize - 1)) == 0;
+    if (!blockSizeValid || (logicalSectorSize != 512 && logicalSectorSize != 4096) ||
+        virtualSize == 0 || virtualSize % logicalSectorSize != 0) {
+        std::cerr << "Cannot create " << path << " with a size of " << virtualSize << " bytes, " << logicalSectorSize
+            << "-byte sectors and " << blockSize << "-byte blocks\n";
+        throw std::runtime_error("Invalid VHDX parameters.");
+    }
+
+    writer.path = path;
+    writer.virtualSize = virtualSize;
+    writer.blockSize = blockSize;
+    writer.logicalSectorSize = logicalSectorSize;
+    writer.physicalSectorSize = std::max<uint32_t>(logicalSectorSize, 4096);
+    writer.chunkRatio = (static_cast<uint64_t>(1) << 23) * logicalSectorSize / blockSize;
+
+    uint64_t payloadBlocks = (virtualSize + blockSize - 1) / blockSize;
+    uint64_t batEntries = payloadBlocks + (payloadBlocks - 1) / writer.chunkRatio;
+    writer.bat.assign(batEntries, VHDX_PAYLOAD_BLOCK_NOT_PRESENT);
+    writer.batOffset = VHDX_BAT_OFFSET;
+    writer.batLength = static_cast<uint32_t>((batEntries * 8 + VHDX_MB - 1) / VHDX_MB * VHDX_MB);
+    writer.fileEnd = writer.batOffset + writer.batLength;
+    writer.allocatedBlocks = 0;
+
+    std::ofstream(path, std::ios::binary | std::ios::trunc).close();
+    writer.file = openFile(path);
+}
+
+/**
+ * @brief Writes bytes to a VHDX image
+ *
+ * @param writer The open writer
+ * @param offset Offset of the bytes on the virtual disk
+ * @param data The bytes to write
+ * @param length Number of bytes
+ * @throws std::runtime_error if the range lies beyond the virtual disk or cannot be written
+ */
+void writeVhdx(VhdxWriter& writer, uint64_t offset, const void* data, size_t length)
+{
+    if (offset > writer.virtualSize || length > writer.virtualSize - offset) {
+        std::cerr << "Write at offset " << offset << " of " << length << " bytes is beyond the end of " << writer.path << "\n";
+        throw std::runtime_error("Write beyond the end of the VHDX image.");
+    }
+
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    while (length > 0) {
+        uint64_t block = offset / writer.blockSize;
+        uint32_t blockOffset = static_cast<uint32_t>(offset % writer.blockSize);
+        uint32_t piece = static_cast<uint32_t>(std::min<uint64_t>(length, writer.blockSize - blockOffset));
+
+        // Blocks are whole MiBs, so blocks allocated at the end stay MiB-aligned as required
+        uint64_t& entry = writer.bat[getVhdxBatIndex(writer, block)];
+        if (entry == VHDX_PAYLOAD_BLOCK_NOT_PRESENT) {
+            entry = writer.fileEnd | VHDX_PAYLOAD_BLOCK_FULLY_PRESENT;
+            writer.fileEnd += writer.blockSize;
+            writer.allocatedBlocks++;
+        }
+        writeVhdxFile(writer, (entry & ~(VHDX_MB - 1)) + blockOffset, bytes, piece);
+
+        offset += piece;
+        bytes += piece;
+        length -= piece;
+    }
+}
+
+/**
+ * @brief Writes the metadata table and items
+ *
+ * @param writer The open writer
+ */
+void writeVhdxMetadata(VhdxWriter& writer)
+{
+    struct MetadataItem
+    {
+        const VhdxGuid* guid;
+        uint32_t flags;
+        std::vector<uint8_t> value;
+    };
+
+    std::vector<uint8_t> fileParameters(8, 0);
+    storeVhdxValue(fileParameters.data(), writer.blockSize, 4);
+    std::vector<uint8_t> diskSize(8);
+    storeVhdxValue(diskSize.data(), writer.virtualSize, 8);
+    std::vector<uint8_t> diskId(16);
+    storeVhdxGuid(diskId.data(), generateVhdxGuid());
+    std::vector<uint8_t> logicalSectorSize(4);
+    storeVhdxValue(logicalSectorSize.data(), writer.logicalSectorSize, 4);
+    std::vector<uint8_t> physicalSectorSize(4);
+    storeVhdxValue(physicalSectorSize.data(), writer.physicalSectorSize, 4);
+
+    uint32_t diskItem = VHDX_METADATA_IS_VIRTUAL_DISK | VHDX_METADATA_IS_REQUIRED;
+    std::vector<MetadataItem> items = {
+        { &VHDX_FILE_PARAMETERS_GUID, VHDX_METADATA_IS_REQUIRED, fileParameters },
+        { &VHDX_VIRTUAL_DISK_SIZE_GUID, diskItem, diskSize },
+        { &VHDX_VIRTUAL_DISK_ID_GUID, diskItem, diskId },
+        { &VHDX_LOGICAL_SECTOR_SIZE_GUID, diskItem, logicalSectorSize },
+        { &VHDX_PHYSICAL_SECTOR_SIZE_GUID, diskItem, physicalSectorSize }
+    };
+
+    std::vector<uint8_t> region(VHDX_METADATA_ITEMS_OFFSET + 64 * 1024, 0);
+    std::copy_n("metadata", 8, region.begin());
+    storeVhdxValue(region.data() + 10, items.size(), 2);
+    uint32_t itemOffset = VHDX_METADATA_ITEMS_OFFSET;
+    for (size_t i = 0; i < items.size(); i++) {
+        uint8_t* entry = region.data() + 32 + i * 32;
+        storeVhdxGuid(entry, *items[i].guid);
+        storeVhdxValue(entry + 16, itemOffset, 4);
+        storeVhdxValue(entry + 20, items[i].value.size(), 4);
+        storeVhdxValue(entry + 24, items[i].flags, 4);
+        std::copy(items[i].value.begin(), items[i].value.end(), region.begin() + itemOffset);
+        itemOffset += static_cast<uint32_t>(items[i].value.size());
+    }
+    writeVhdxFile(writer, VHDX_METADATA_OFFSET, region.data(), region.size());
+}
+
+/**
+ * @brief Completes and closes a VHDX image
+ *
+ * @param writer The writer to close
+ * @throws std::runtime_error if the image cannot be written
+ */
+void closeVhdxWriter(VhdxWriter& writer)
+{
+    // The whole BAT goes out in one write rather than one entry per allocation
+    std::vector<uint8_t> bat(writer.batLength, 0);
+    for (size_t i = 0; i < writer.bat.size(); i++) { storeVhdxValue(bat.data() + i * 8, writer.bat[i], 8); }
+    writeVhdxFile(writer, writer.batOffset, bat.data(), bat.size());
+
+    writeVhdxMetadata(writer);
+
+    std::vector<uint8_t> log(VHDX_LOG_LENGTH, 0);
+    writeVhdxFile(writer, VHDX_LOG_OFFSET, log.data(), log.size());
+
+    std::vector<uint8_t> regionTable(VHDX_REGION_TABLE_SIZE, 0);
+    std::copy_n("regi", 4, regionTable.begin());
+    storeVhdxValue(regionTable.data() + 8, 2, 4);
+    storeVhdxGuid(regionTable.data() + 16, VHDX_BAT_GUID);
+    storeVhdxValue(regionTable.data() + 32, writer.batOffset, 8);
+    storeVhdxValue(regionTable.data() + 40, writer.batLength, 4);
+    storeVhdxValue(regionTable.data() + 44, 1, 4);
+    storeVhdxGuid(regionTable.data() + 48, VHDX_METADATA_GUID);
+    storeVhdxValue(regionTable.data() + 64, VHDX_METADATA_OFFSET, 8);
+    storeVhdxValue(regionTable.data() + 72, VHDX_METADATA_LENGTH, 4);
+    storeVhdxValue(regionTable.data() + 76, 1, 4);
+    storeVhdxChecksum(regionTable);
+    for (uint64_t regionTableOffset : VHDX_REGION_TABLE_OFFSETS) {
+        writeVhdxFile(writer, regionTableOffset, regionTable.data(), regionTable.size());
+    }
+
+    // Both headers are valid; the one with the higher sequence number is current
+    VhdxGuid fileWriteGuid = generateVhdxGuid();
+    VhdxGuid dataWriteGuid = generateVhdxGuid();
+    for (int i = 0; i < 2; i++) {
+        std::vector<uint8_t> header(VHDX_HEADER_SIZE, 0);
+        std::copy_n("head", 4, header.begin());
+        storeVhdxValue(header.data() + 8, i, 8);
+        storeVhdxGuid(header.data() + 16, fileWriteGuid);
+        storeVhdxGuid(header.data() + 32, dataWriteGuid);
+        storeVhdxValue(header.data() + 66, 1, 2);
+        storeVhdxValue(header.data() + 68, VHDX_LOG_LENGTH, 4);
+        storeVhdxValue(header.data() + 72, VHDX_LOG_OFFSET, 8);
+        storeVhdxChecksum(header);
+        writeVhdxFile(writer, VHDX_HEADER_OFFSETS[i], header.data(), header.size());
+    }
+
+    std::vector<uint8_t> identifier(VHDX_HEADER_OFFSETS[0], 0);
+    std::copy_n("vhdxfile", 8, identifier.begin());
+    const std::string creator = "extract-to-img";
+    for (size_t i = 0; i < creator.size(); i++) { identifier[8 + i * 2] = static_cast<uint8_t>(creator[i]); }
+    writeVhdxFile(writer, 0, identifier.data(), identifier.size());
+    closeFile(writer.file);
+
+    // The last payload block may only be partly written, but the file must hold all of it
+    if (std::filesystem::file_size(writer.path) < writer.fileEnd) {
+        std::filesystem::resize_file(writer.path, writer.fileEnd);
+    }
+}
+
+/**
+ * @brief Describes an open VHDX image as a restore target
+ *
+ * @param target Output parameter for the target
+ * @param writer The open writer, which must outlive target
+ */
+void getVhdxRestoreTarget(RestoreTarget& target, VhdxWriter& writer)
+{
+    target.write = [&writer](uint64_t offset, const void* data, size_t length) { writeVhdx(writer, offset, data, length); };
+    target.clearRange = nullptr;
+}
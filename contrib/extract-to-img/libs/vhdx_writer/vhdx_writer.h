@@ -0,0 +1,94 @@
+/**
+ * @file vhdx_writer.h
+ * @brief Dynamic VHDX image output for restores
+ *
+ * This file declares a writer that produces a dynamic VHDX file directly
+ * from a restore on any platform, without the Windows virtual disk API.
+ * The file type identifier, headers, region tables, an empty log, the
+ * metadata region and the block allocation table (BAT) are written by the
+ * writer itself. Payload blocks are only allocated for blocks of the disk
+ * that are written; the rest read as zeros. The BAT is kept in memory and
+ * written in one pass when the image is closed.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "../restore/restore.h"
+
+/**
+ * @brief Default payload block size, as used by Hyper-V for dynamic disks
+ */
+const uint32_t DEFAULT_VHDX_BLOCK_SIZE = 32 * 1024 * 1024;
+
+/**
+ * @brief A dynamic VHDX image being written
+ *
+ * Not safe for concurrent use; restores serialise their writes.
+ */
+struct VhdxWriter
+{
+    std::fstream file;                          // The image file
+    std::string path;                           // Path of the image file
+    uint64_t virtualSize = 0;                   // Size of the virtual disk in bytes
+    uint32_t blockSize = DEFAULT_VHDX_BLOCK_SIZE;  // Payload block size
+    uint32_t logicalSectorSize = 512;           // Sector size the virtual disk reports
+    uint32_t physicalSectorSize = 4096;         // Physical sector size the virtual disk reports
+    uint64_t chunkRatio = 0;                    // Payload blocks described by each sector bitmap block
+    uint64_t batOffset = 0;                     // Offset of the BAT in the file
+    uint32_t batLength = 0;                     // Length of the BAT region in bytes
+    std::vector<uint64_t> bat;                  // BAT entries, in host byte order
+    uint64_t fileEnd = 0;                       // Offset the next payload block is allocated at
+    uint64_t allocatedBlocks = 0;               // Payload blocks allocated so far
+};
+
+/**
+ * @brief Creates a dynamic VHDX image
+ *
+ * @param writer Output parameter for the writer
+ * @param path Path of the image, replaced if it exists
+ * @param virtualSize Size of the virtual disk in bytes, a multiple of logicalSectorSize
+ * @param logicalSectorSize Logical sector size of the virtual disk, 512 or 4096
+ * @param blockSize Payload block size, a power of 2 from 1 MiB to 256 MiB
+ * @throws std::runtime_error if the parameters are invalid or the file cannot be created
+ */
+void openVhdxWriter(VhdxWriter& writer, const std::string& path, uint64_t virtualSize, uint32_t logicalSectorSize,
+    uint32_t blockSize = DEFAULT_VHDX_BLOCK_SIZE);
+
+/**
+ * @brief Writes bytes to a VHDX image
+ *
+ * A payload block is allocated at the end of the file on the first write
+ * to it and marked fully present; parts that are never written read as zeros.
+ *
+ * @param writer The open writer
+ * @param offset Offset of the bytes on the virtual disk
+ * @param data The bytes to write
+ * @param length Number of bytes
+ * @throws std::runtime_error if the range lies beyond the virtual disk or cannot be written
+ */
+void writeVhdx(VhdxWriter& writer, uint64_t offset, const void* data, size_t length);
+
+/**
+ * @brief Completes and closes a VHDX image
+ *
+ * Writes the BAT, the metadata region, the region tables and both headers.
+ *
+ * @param writer The writer to close
+ * @throws std::runtime_error if the image cannot be written
+ */
+void closeVhdxWriter(VhdxWriter& writer);
+
+/**
+ * @brief Describes an open VHDX image as a restore target
+ *
+ * The target has no clearRange function, as unallocated blocks read as zeros.
+ *
+ * @param target Output parameter for the target
+ * @param writer The open writer, which must outlive target
+ */
+void getVhdxRestoreTarget(RestoreTarget& target, VhdxWriter& writer);
@@ -0,0 +1,584 @@
+/**
+ * @file ext_reader.cpp
+ * @brief Implementation of ext2, ext3 and ext4 file extraction from backed up partitions
+ *
+ * Block numbers, extent tree headers and directory entry lengths taken
+ * from the volume are bounds checked, so a damaged volume fails with an
+ * error rather than reading outside the volume. Checksums are not verified.
+ */
+
+#include <algorithm>
+#include <iostream>
+#include <stdexcept>
+
+#include "ext_reader.h"
+
+/**
+ * @brief Location and signature of the superblock
+ */
+const uint64_t EXT_SUPERBLOCK_OFFSET = 1024;
+const uint16_t EXT_SUPERBLOCK_MAGIC = 0xEF53;
+
+/**
+ * @brief Feature flags used by the reader
+ */
+const uint32_t EXT_COMPAT_SPARSE_SUPER2 = 0x0200;
+const uint32_t EXT_RO_COMPAT_SPARSE_SUPER = 0x0001;
+const uint32_t EXT_INCOMPAT_COMPRESSION = 0x0001;
+const uint32_t EXT_INCOMPAT_FILETYPE = 0x0002;
+const uint32_t EXT_INCOMPAT_RECOVER = 0x0004;
+const uint32_t EXT_INCOMPAT_JOURNAL_DEV = 0x0008;
+const uint32_t EXT_INCOMPAT_META_BG = 0x0010;
+const uint32_t EXT_INCOMPAT_64BIT = 0x0080;
+const uint32_t EXT_INCOMPAT_DIRDATA = 0x1000;
+
+/**
+ * @brief Incompatible features the reader cannot handle
+ *
+ * Other features, including ones newer than the reader, either do not
+ * change the structures it reads or are checked per file.
+ */
+const uint32_t EXT_INCOMPAT_UNSUPPORTED = EXT_INCOMPAT_COMPRESSION | EXT_INCOMPAT_JOURNAL_DEV | EXT_INCOMPAT_DIRDATA;
+
+/**
+ * @brief Inode flags used by the reader
+ */
+const uint32_t EXT_INODE_ENCRYPTED = 0x00000800;
+const uint32_t EXT_INODE_EXTENTS = 0x00080000;
+const uint32_t EXT_INODE_INLINE_DATA = 0x10000000;
+
+/**
+ * @brief File types of the inode mode
+ */
+const uint16_t EXT_MODE_TYPE_MASK = 0xF000;
+const uint16_t EXT_MODE_DIRECTORY = 0x4000;
+const uint16_t EXT_MODE_REGULAR = 0x8000;
+
+/**
+ * @brief Offset and length of the block map or extent tree root in an inode
+ */
+const size_t EXT_INODE_BLOCK_OFFSET = 0x28;
+const size_t EXT_INODE_BLOCK_LENGTH = 60;
+
+/**
+ * @brief Number of direct block pointers in a block map
+ */
+const uint32_t EXT_DIRECT_BLOCKS = 12;
+
+/**
+ * @brief Extent tree node signature and the deepest tree the reader follows
+ */
+const uint16_t EXT_EXTENT_MAGIC = 0xF30A;
+const uint16_t EXT_MAX_EXTENT_DEPTH = 5;
+
+/**
+ * @brief Length above which an extent is uninitialized
+ */
+const uint16_t EXT_MAX_INITIALIZED_EXTENT = 32768;
+
+/**
+ * @brief Signature and name of the in-inode extended attribute holding the rest of inline data
+ */
+const uint32_t EXT_XATTR_MAGIC = 0xEA020000;
+const uint8_t EXT_XATTR_SYSTEM_INDEX = 7;
+
+/**
+ * @brief Throws the error for a damaged structure
+ *
+ * @param what Description of the damaged structure
+ */
+[[noreturn]] void throwCorruptExt(const std::string& what)
+{
+    std::cerr << "Corrupt ext " << what << "\n";
+    throw std::runtime_error("Corrupt ext volume.");
+}
+
+/**
+ * @brief Reads blocks of the volume
+ *
+ * @param volume The opened volume
+ * @param block First block to read
+ * @param buffer Buffer that receives the bytes
+ * @param length Number of bytes to read
+ */
+void readExtBlocks(ExtVolume& volume, uint64_t block, uint8_t* buffer, size_t length)
+{
+    if (block >= volume.blocksCount || (length + volume.blockSize - 1) / volume.blockSize > volume.blocksCount - block) {
+        throwCorruptExt("block number " + std::to_string(block));
+    }
+    readPartition(*volume.reader, volume.volumeOffset + block * volume.blockSize, buffer, length);
+}
+
+/**
+ * @brief Returns whether a block group holds a superblock backup
+ *
+ * @param volume The opened volume
+ * @param group The block group
+ * @return true if the group starts with a superblock
+ */
+bool extGroupHasSuperblock(const ExtVolume& volume, uint32_t group)
+{
+    if (group == 0) { return true; }
+    if (volume.compatFeatures & EXT_COMPAT_SPARSE_SUPER2) { return group == volume.backupGroups[0] || group == volume.backupGroups[1]; }
+    if (!(volume.roCompatFeatures & EXT_RO_COMPAT_SPARSE_SUPER) || group == 1) { return true; }
+
+    // With sparse_super, backups are kept in groups that are powers of 3, 5 and 7
+    for (uint32_t base : { 3u, 5u, 7u }) {
+        uint64_t power = base;
+        while (power < group) { power *= base; }
+        if (power == group) { return true; }
+    }
+    return false;
+}
+
+/**
+ * @brief Returns the first block of the inode table of a block group
+ *
+ * Reads the group descriptor on first use.
+ *
+ * @param volume The opened volume
+ * @param group The block group
+ * @return uint64_t The first block of the inode table
+ */
+uint64_t getExtInodeTable(ExtVolume& volume, uint32_t group)
+{
+    auto found = volume.inodeTables.find(group);
+    if (found != volume.inodeTables.end()) { return found->second; }
+
+    // Descriptors follow the superblock, except for the ones meta_bg places at the start of each meta group
+    uint32_t descriptorsPerBlock = volume.blockSize / volume.descriptorSize;
+    uint32_t descriptorBlock = group / descriptorsPerBlock;
+    uint64_t block;
+    if ((volume.incompatFeatures & EXT_INCOMPAT_META_BG) && descriptorBlock >= volume.firstMetaGroup) {
+        uint32_t metaGroup = descriptorBlock * descriptorsPerBlock;
+        block = volume.firstDataBlock + static_cast<uint64_t>(metaGroup) * volume.blocksPerGroup + (extGroupHasSuperblock(volume, metaGroup) ? 1 : 0);
+    }
+    else {
+        block = volume.firstDataBlock + 1ULL + descriptorBlock;
+    }
+
+    std::vector<uint8_t> descriptor(volume.descriptorSize);
+    readPartition(*volume.reader, volume.volumeOffset + block * volume.blockSize + (group % descriptorsPerBlock) * volume.descriptorSize,
+        descriptor.data(), descriptor.size());
+    uint64_t inodeTable = readLittleEndian32(descriptor.data() + 0x08);
+    if (volume.descriptorSize >= 64) { inodeTable |= static_cast<uint64_t>(readLittleEndian32(descriptor.data() + 0x28)) << 32; }
+
+    uint64_t tableBlocks = (static_cast<uint64_t>(volume.inodesPerGroup) * volume.inodeSize + volume.blockSize - 1) / volume.blockSize;
+    if (inodeTable == 0 || inodeTable >= volume.blocksCount || tableBlocks > volume.blocksCount - inodeTable) {
+        throwCorruptExt("group descriptor " + std::to_string(group));
+    }
+    volume.inodeTables[group] = inodeTable;
+    return inodeTable;
+}
+
+/**
+ * @brief Opens the ext2, ext3 or ext4 volume of a partition
+ *
+ * @param volume Output parameter for the volume
+ * @param reader Reader of the partition, which must outlive the volume
+ * @throws std::runtime_error if the partition does not hold a supported ext volume
+ */
+void openExtVolume(ExtVolume& volume, PartitionReader& reader)
+{
+    volume = ExtVolume();
+    volume.reader = &reader;
+    volume.volumeOffset = reader.bootSectorOffset;
+
+    uint8_t superblock[1024];
+    readPartition(reader, volume.volumeOffset + EXT_SUPERBLOCK_OFFSET, superblock, sizeof(superblock));
+    if (readLittleEndian16(superblock + 0x38) != EXT_SUPERBLOCK_MAGIC) { throw std::runtime_error("Partition does not hold an ext volume."); }
+
+    volume.inodesCount = readLittleEndian32(superblock + 0x00);
+    volume.blocksCount = readLittleEndian32(superblock + 0x04);
+    volume.firstDataBlock = readLittleEndian32(superblock + 0x14);
+    uint32_t logBlockSize = readLittleEndian32(superblock + 0x18);
+    volume.blocksPerGroup = readLittleEndian32(superblock + 0x20);
+    volume.inodesPerGroup = readLittleEndian32(superblock + 0x28);
+    uint32_t revision = readLittleEndian32(superblock + 0x4C);
+    volume.inodeSize = revision == 0 ? 128 : readLittleEndian16(superblock + 0x58);
+    volume.compatFeatures = revision == 0 ? 0 : readLittleEndian32(superblock + 0x5C);
+    volume.incompatFeatures = revision == 0 ? 0 : readLittleEndian32(superblock + 0x60);
+    volume.roCompatFeatures = revision == 0 ? 0 : readLittleEndian32(superblock + 0x64);
+    volume.firstMetaGroup = readLittleEndian32(superblock + 0x104);
+    volume.backupGroups[0] = readLittleEndian32(superblock + 0x24C);
+    volume.backupGroups[1] = readLittleEndian32(superblock + 0x250);
+    volume.descriptorSize = 32;
+    if (volume.incompatFeatures & EXT_INCOMPAT_64BIT) {
+        volume.blocksCount |= static_cast<uint64_t>(readLittleEndian32(superblock + 0x150)) << 32;
+        volume.descriptorSize = readLittleEndian16(superblock + 0xFE);
+    }
+
+    if (logBlockSize > 6) { throwCorruptExt("superblock, block size"); }
+    volume.blockSize = 1024u << logBlockSize;
+    if (volume.blocksPerGroup == 0 || volume.inodesPerGroup == 0 || volume.firstDataBlock >= volume.blocksCount ||
+        volume.inodeSize < 128 || volume.inodeSize > volume.blockSize || (volume.inodeSize & (volume.inodeSize - 1)) != 0 ||
+        volume.descriptorSize < 32 || volume.descriptorSize > volume.blockSize || (volume.descriptorSize & (volume.descriptorSize - 1)) != 0) {
+        throwCorruptExt("superblock");
+    }
+    if (volume.blocksCount > (reader.partitionLength - volume.volumeOffset) / volume.blockSize) {
+        throwCorruptExt("superblock, blocks beyond the partition");
+    }
+    volume.groupCount = static_cast<uint32_t>((volume.blocksCount - volume.firstDataBlock + volume.blocksPerGroup - 1) / volume.blocksPerGroup);
+
+    if (volume.incompatFeatures & EXT_INCOMPAT_UNSUPPORTED) {
+        std::cerr << "Unsupported ext features: 0x" << std::hex << (volume.incompatFeatures & EXT_INCOMPAT_UNSUPPORTED) << std::dec << "\n";
+        throw std::runtime_error("Unsupported ext volume.");
+    }
+    if (volume.incompatFeatures & EXT_INCOMPAT_RECOVER) {
+        std::cerr << "The ext journal was not replayed; files changed just before the backup may be out of date\n";
+    }
+}
+
+/**
+ * @brief Reads an inode
+ *
+ * @param volume The opened volume
+ * @param number Inode number
+ * @param inode Output parameter for the inode
+ * @throws std::runtime_error if the inode number or its group descriptor is invalid
+ */
+void readExtInode(ExtVolume& volume, uint32_t number, ExtInode& inode)
+{
+    if (number == 0 || number > volume.inodesCount) { throwCorruptExt("inode number " + std::to_string(number)); }
+
+    uint32_t group = (number - 1) / volume.inodesPerGroup;
+    uint32_t index = (number - 1) % volume.inodesPerGroup;
+    uint64_t inodeTable = getExtInodeTable(volume, group);
+
+    inode.number = number;
+    inode.data.resize(volume.inodeSize);
+    readPartition(*volume.reader, volume.volumeOffset + inodeTable * volume.blockSize + static_cast<uint64_t>(index) * volume.inodeSize,
+        inode.data.data(), inode.data.size());
+    inode.mode = readLittleEndian16(inode.data.data() + 0x00);
+    inode.flags = readLittleEndian32(inode.data.data() + 0x20);
+    inode.size = readLittleEndian32(inode.data.data() + 0x04) | (static_cast<uint64_t>(readLittleEndian32(inode.data.data() + 0x6C)) << 32);
+}
+
+/**
+ * @brief Appends a block to a list of runs, extending the last run when contiguous
+ *
+ * @param extents The runs so far
+ * @param extent The run to append
+ */
+void appendExtExtent(std::vector<ExtExtent>& extents, const ExtExtent& extent)
+{
+    if (!extents.empty()) {
+        ExtExtent& last = extents.back();
+        if (last.uninitialized == extent.uninitialized && last.logicalBlock + last.length == extent.logicalBlock &&
+            last.physicalBlock + last.length == extent.physicalBlock) {
+            last.length += extent.length;
+            return;
+        }
+    }
+    extents.push_back(extent);
+}
+
+/**
+ * @brief Collects the extents of an extent tree node and the nodes below it
+ *
+ * @param volume The opened volume
+ * @param node The node, starting with its header
+ * @param length Bytes available for the node
+ * @param depth Depth the node must have
+ * @param blockCount Number of blocks from the start of the file that are needed
+ * @param extents Vector the extents are appended to
+ */
+void readExtExtentNode(ExtVolume& volume, const uint8_t* node, size_t length, uint16_t depth, uint64_t blockCount, std::vector<ExtExtent>& extents)
+{
+    uint16_t entries = readLittleEndian16(node + 2);
+    if (readLittleEndian16(node) != EXT_EXTENT_MAGIC || readLittleEndian16(node + 6) != depth || 12u + entries * 12u > length) {
+        throwCorruptExt("extent tree node");
+    }
+
+    std::vector<uint8_t> child;
+    for (uint16_t i = 0; i < entries; i++) {
+        const uint8_t* entry = node + 12 + i * 12;
+        uint64_t logicalBlock = readLittleEndian32(entry);
+        if (logicalBlock >= blockCount) { break; }
+
+        if (depth == 0) {
+            ExtExtent extent;
+            extent.logicalBlock = logicalBlock;
+            extent.length = readLittleEndian16(entry + 4);
+            if (extent.length > EXT_MAX_INITIALIZED_EXTENT) {
+                extent.length -= EXT_MAX_INITIALIZED_EXTENT;
+                extent.uninitialized = true;
+            }
+            extent.physicalBlock = (static_cast<uint64_t>(readLittleEndian16(entry + 6)) << 32) | readLittleEndian32(entry + 8);
+            if (extent.physicalBlock >= volume.blocksCount || extent.length > volume.blocksCount - extent.physicalBlock ||
+                (!extents.empty() && logicalBlock < extents.back().logicalBlock + extents.back().length)) {
+                throwCorruptExt("extent");
+            }
+            appendExtExtent(extents, extent);
+        }
+        else {
+            uint64_t childBlock = (static_cast<uint64_t>(readLittleEndian16(entry + 8)) << 32) | readLittleEndian32(entry + 4);
+            child.resize(volume.blockSize);
+            readExtBlocks(volume, childBlock, child.data(), child.size());
+            readExtExtentNode(volume, child.data(), child.size(), depth - 1, blockCount, extents);
+        }
+    }
+}
+
+/**
+ * @brief Collects the blocks of a block map pointer and the pointers below it
+ *
+ * @param volume The opened volume
+ * @param pointer The block pointer, 0 for a hole
+ * @param level Levels of indirection below the pointer, 0 for a data block
+ * @param logicalBlock First block of the file the pointer maps
+ * @param blockCount Number of blocks from the start of the file that are needed
+ * @param extents Vector the runs are appended to
+ */
+void readExtBlockMap(ExtVolume& volume, uint32_t pointer, int level, uint64_t logicalBlock, uint64_t blockCount, std::vector<ExtExtent>& extents)
+{
+    if (pointer == 0 || logicalBlock >= blockCount) { return; }
+    if (pointer >= volume.blocksCount) { throwCorruptExt("block map pointer " + std::to_string(pointer)); }
+    if (level == 0) {
+        appendExtExtent(extents, ExtExtent{ logicalBlock, pointer, 1, false });
+        return;
+    }
+
+    uint32_t pointersPerBlock = volume.blockSize / 4;
+    uint64_t span = 1;
+    for (int i = 1; i < level; i++) { span *= pointersPerBlock; }
+
+    std::vector<uint8_t> block(volume.blockSize);
+    readExtBlocks(volume, pointer, block.data(), block.size());
+    for (uint32_t i = 0; i < pointersPerBlock && logicalBlock + i * span < blockCount; i++) {
+        readExtBlockMap(volume, readLittleEndian32(block.data() + i * 4), level - 1, logicalBlock + i * span, blockCount, extents);
+    }
+}
+
+/**
+ * @brief Returns the runs of blocks holding the start of a file
+ *
+ * @param volume The opened volume
+ * @param inode The inode of the file
+ * @param blockCount Number of blocks from the start of the file that are needed
+ * @return std::vector<ExtExtent> The runs, by logical block
+ * @throws std::runtime_error if the extent tree or block map is damaged
+ */
+std::vector<ExtExtent> getExtFileExtents(ExtVolume& volume, const ExtInode& inode, uint64_t blockCount)
+{
+    std::vector<ExtExtent> extents;
+    const uint8_t* root = inode.data.data() + EXT_INODE_BLOCK_OFFSET;
+
+    if (inode.flags & EXT_INODE_EXTENTS) {
+        uint16_t depth = readLittleEndian16(root + 6);
+        if (depth > EXT_MAX_EXTENT_DEPTH) { throwCorruptExt("extent tree depth, inode " + std::to_string(inode.number)); }
+        readExtExtentNode(volume, root, EXT_INODE_BLOCK_LENGTH, depth, blockCount, extents);
+        return extents;
+    }
+
+    // Direct pointers, then single, double and triple indirect blocks
+    uint64_t pointersPerBlock = volume.blockSize / 4;
+    uint64_t logicalBlock = 0;
+    for (uint32_t i = 0; i < EXT_DIRECT_BLOCKS; i++) { readExtBlockMap(volume, readLittleEndian32(root + i * 4), 0, logicalBlock++, blockCount, extents); }
+    uint64_t span = pointersPerBlock;
+    for (int level = 1; level <= 3; level++) {
+        readExtBlockMap(volume, readLittleEndian32(root + (EXT_DIRECT_BLOCKS + level - 1) * 4), level, logicalBlock, blockCount, extents);
+        logicalBlock += span;
+        span *= pointersPerBlock;
+    }
+    return extents;
+}
+
+/**
+ * @brief Returns the contents of a file stored in its inode
+ *
+ * The first 60 bytes are held in place of the block map and the rest in the
+ * system.data extended attribute in the inode body.
+ *
+ * @param inode The inode of the file
+ * @return std::vector<uint8_t> The file contents
+ */
+std::vector<uint8_t> getExtInlineData(const ExtInode& inode)
+{
+    const uint8_t* data = inode.data.data();
+    std::vector<uint8_t> contents(data + EXT_INODE_BLOCK_OFFSET, data + EXT_INODE_BLOCK_OFFSET + EXT_INODE_BLOCK_LENGTH);
+
+    size_t bodyStart = 128 + (inode.data.size() > 128 ? readLittleEndian16(data + 0x80) : 0);
+    if (bodyStart + 4 <= inode.data.size() && readLittleEndian32(data + bodyStart) == EXT_XATTR_MAGIC) {
+        size_t entriesStart = bodyStart + 4;
+        for (size_t offset = entriesStart; offset + 16 <= inode.data.size() && readLittleEndian32(data + offset) != 0;) {
+            uint8_t nameLength = data[offset];
+            size_t valueOffset = entriesStart + readLittleEndian16(data + offset + 2);
+            uint32_t valueSize = readLittleEndian32(data + offset + 8);
+            if (offset + 16 + nameLength > inode.data.size()) { throwCorruptExt("inline data attribute, inode " + std::to_string(inode.number)); }
+            if (data[offset + 1] == EXT_XATTR_SYSTEM_INDEX && nameLength == 4 && memcmp(data + offset + 16, "data", 4) == 0) {
+                if (valueOffset + valueSize > inode.data.size()) { throwCorruptExt("inline data attribute, inode " + std::to_string(inode.number)); }
+                contents.insert(contents.end(), data + valueOffset, data + valueOffset + valueSize);
+                break;
+            }
+            offset += (16 + nameLength + 3) & ~size_t(3);
+        }
+    }
+
+    if (inode.size > contents.size()) { throwCorruptExt("inline data, inode " + std::to_string(inode.number)); }
+    contents.resize(static_cast<size_t>(inode.size));
+    return contents;
+}
+
+/**
+ * @brief Reads a byte range of a file
+ *
+ * Holes and uninitialized extents read as zeros.
+ *
+ * @param volume The opened volume
+ * @param extents Runs of the file, by logical block
+ * @param offset Offset of the range in the file
+ * @param buffer Buffer that receives the bytes
+ * @param length Number of bytes to read
+ */
+void readExtFileRange(ExtVolume& volume, const std::vector<ExtExtent>& extents, uint64_t offset, uint8_t* buffer, size_t length)
+{
+    memset(buffer, 0, length);
+    uint64_t firstBlock = offset / volume.blockSize;
+    auto extent = std::upper_bound(extents.begin(), extents.end(), firstBlock, [](uint64_t block, const ExtExtent& e) { return block < e.logicalBlock; });
+    if (extent != extents.begin()) { --extent; }
+
+    uint64_t end = offset + length;
+    for (; extent != extents.end() && extent->logicalBlock * volume.blockSize < end; ++extent) {
+        uint64_t extentStart = extent->logicalBlock * volume.blockSize;
+        uint64_t extentEnd = extentStart + extent->length * volume.blockSize;
+        uint64_t pieceStart = std::max(offset, extentStart);
+        uint64_t pieceEnd = std::min(end, extentEnd);
+        if (pieceStart >= pieceEnd || extent->uninitialized) { continue; }
+        readPartition(*volume.reader, volume.volumeOffset + extent->physicalBlock * volume.blockSize + (pieceStart - extentStart),
+            buffer + (pieceStart - offset), static_cast<size_t>(pieceEnd - pieceStart));
+    }
+}
+
+/**
+ * @brief Appends the entries of a run of directory entries to a directory listing
+ *
+ * @param volume The opened volume
+ * @param data The directory entries
+ * @param length Length of the run, which entries may not cross
+ * @param listing The entries listed so far
+ */
+void parseExtDirectoryEntries(ExtVolume& volume, const uint8_t* data, size_t length, std::vector<VolumeEntry>& listing)
+{
+    bool hasFileType = (volume.incompatFeatures & EXT_INCOMPAT_FILETYPE) != 0;
+    ExtInode child;
+    for (size_t offset = 0; offset + 8 <= length;) {
+        const uint8_t* entry = data + offset;
+        uint32_t inodeNumber = readLittleEndian32(entry);
+        size_t recordLength = readLittleEndian16(entry + 4);
+        if (volume.blockSize == 65536 && (recordLength == 0 || recordLength == 65535)) { recordLength = 65536; }  // Encoding of a 64 KiB record
+        size_t nameLength = hasFileType ? entry[6] : readLittleEndian16(entry + 6);
+        if (recordLength < 8 || recordLength % 4 != 0 || recordLength > length - offset || 8 + nameLength > recordLength) {
+            throwCorruptExt("directory entry");
+        }
+        offset += recordLength;
+
+        std::string name(reinterpret_cast<const char*>(entry + 8), nameLength);
+        if (inodeNumber == 0 || name == "." || name == "..") { continue; }
+
+        readExtInode(volume, inodeNumber, child);
+        uint16_t type = child.mode & EXT_MODE_TYPE_MASK;
+        if (type != EXT_MODE_DIRECTORY && type != EXT_MODE_REGULAR) { continue; }
+
+        VolumeEntry listed;
+        listed.name = name;
+        listed.id = inodeNumber;
+        listed.isDirectory = type == EXT_MODE_DIRECTORY;
+        listed.size = listed.isDirectory ? 0 : child.size;
+        listing.push_back(listed);
+    }
+}
+
+/**
+ * @brief Lists a directory
+ *
+ * Hashed directories are read linearly; their index nodes look like empty
+ * entries to a linear scan.
+ *
+ * @param volume The opened volume
+ * @param inodeNumber Inode number of the directory
+ * @return std::vector<VolumeEntry> The entries of the directory
+ */
+std::vector<VolumeEntry> listExtDirectory(ExtVolume& volume, uint32_t inodeNumber)
+{
+    ExtInode directory;
+    readExtInode(volume, inodeNumber, directory);
+    if ((directory.mode & EXT_MODE_TYPE_MASK) != EXT_MODE_DIRECTORY) { throwCorruptExt("directory, inode " + std::to_string(inodeNumber) + " is not a directory"); }
+    if (directory.flags & EXT_INODE_ENCRYPTED) {
+        std::cerr << "Directory inode " << inodeNumber << " is encrypted\n";
+        throw std::runtime_error("Encrypted ext directories are not supported.");
+    }
+
+    std::vector<VolumeEntry> listing;
+    if (directory.flags & EXT_INODE_INLINE_DATA) {
+        // The parent inode number comes first, then entries in the block map area and in the attribute
+        std::vector<uint8_t> data = getExtInlineData(directory);
+        size_t blockMapEnd = std::min(data.size(), EXT_INODE_BLOCK_LENGTH);
+        if (blockMapEnd > 4) { parseExtDirectoryEntries(volume, data.data() + 4, blockMapEnd - 4, listing); }
+        if (data.size() > blockMapEnd) { parseExtDirectoryEntries(volume, data.data() + blockMapEnd, data.size() - blockMapEnd, listing); }
+        return listing;
+    }
+
+    uint64_t blockCount = (directory.size + volume.blockSize - 1) / volume.blockSize;
+    if (blockCount > volume.blocksCount) { throwCorruptExt("directory size, inode " + std::to_string(inodeNumber)); }
+    std::vector<ExtExtent> extents = getExtFileExtents(volume, directory, blockCount);
+    std::vector<uint8_t> block(volume.blockSize);
+    for (auto& extent : extents) {
+        for (uint64_t i = 0; i < extent.length && !extent.uninitialized; i++) {
+            readExtBlocks(volume, extent.physicalBlock + i, block.data(), block.size());
+            parseExtDirectoryEntries(volume, block.data(), block.size(), listing);
+        }
+    }
+    return listing;
+}
+
+/**
+ * @brief Writes the contents of a file to a stream
+ *
+ * @param volume The opened volume
+ * @param inodeNumber Inode number of the file
+ * @param out Stream that receives the file contents
+ * @throws std::runtime_error if the file is encrypted or cannot be read
+ */
+void readExtFile(ExtVolume& volume, uint32_t inodeNumber, std::ostream& out)
+{
+    ExtInode inode;
+    readExtInode(volume, inodeNumber, inode);
+    if (inode.flags & EXT_INODE_ENCRYPTED) {
+        std::cerr << "File inode " << inodeNumber << " is encrypted\n";
+        throw std::runtime_error("Encrypted ext files are not supported.");
+    }
+
+    if (inode.flags & EXT_INODE_INLINE_DATA) {
+        std::vector<uint8_t> data = getExtInlineData(inode);
+        out.write(reinterpret_cast<const char*>(data.data()), static_cast<std::streamsize>(data.size()));
+        return;
+    }
+
+    uint64_t blockCount = (inode.size + volume.blockSize - 1) / volume.blockSize;
+    std::vector<ExtExtent> extents = getExtFileExtents(volume, inode, blockCount);
+
+    std::vector<uint8_t> chunk(VOLUME_FILE_CHUNK_SIZE);
+    for (uint64_t position = 0; position < inode.size;) {
+        size_t length = static_cast<size_t>(std::min<uint64_t>(chunk.size(), inode.size - position));
+        readExtFileRange(volume, extents, position, chunk.data(), length);
+        out.write(reinterpret_cast<const char*>(chunk.data()), static_cast<std::streamsize>(length));
+        position += length;
+    }
+}
+
+/**
+ * @brief Describes an opened ext volume as a VolumeFileSystem
+ *
+ * @param fileSystem Output parameter for the file system operations
+ * @param volume The opened volume, which must outlive fileSystem
+ */
+void getExtFileSystem(VolumeFileSystem& fileSystem, ExtVolume& volume)
+{
+    fileSystem.root = VolumeEntry();
+    fileSystem.root.id = EXT_ROOT_INODE;
+    fileSystem.root.isDirectory = true;
+    fileSystem.caseSensitive = true;
+    fileSystem.listDirectory = [&volume](const VolumeEntry& directory) { return listExtDirectory(volume, static_cast<uint32_t>(directory.id)); };
+    fileSystem.readFile = [&volume](const VolumeEntry& file, std::ostream& out) { readExtFile(volume, static_cast<uint32_t>(file.id), out); };
+}
@@ -0,0 +1,141 @@
+/**
+ * @file ext_reader.h
+ * @brief ext2, ext3 and ext4 file extraction from backed up partitions
+ *
+ * This file declares a reader that locates files through the superblock,
+ * group descriptors and inode tables of an ext-family volume and reads
+ * their data through extent trees or indirect block maps straight from the
+ * backup files. Only the group descriptors, inodes, directory blocks, tree
+ * blocks and data blocks of the paths being extracted are read.
+ *
+ * Encrypted files and volumes using compression or an external journal
+ * device are not supported. The journal is not replayed, so files changed
+ * just before an unclean backup may be read in their previous state.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <ostream>
+#include <vector>
+
+#include "partition_reader.h"
+#include "volume_files.h"
+
+/**
+ * @brief Inode number of the root directory
+ */
+const uint32_t EXT_ROOT_INODE = 2;
+
+/**
+ * @brief A run of blocks of a file
+ */
+struct ExtExtent
+{
+    uint64_t logicalBlock = 0;      // First block of the run in the file
+    uint64_t physicalBlock = 0;     // First block of the run on the volume
+    uint64_t length = 0;            // Number of blocks
+    bool uninitialized = false;     // Whether the run is allocated but reads as zeros
+};
+
+/**
+ * @brief An inode read from an inode table
+ */
+struct ExtInode
+{
+    uint32_t number = 0;            // Inode number
+    uint16_t mode = 0;              // File type and permissions
+    uint32_t flags = 0;             // Inode flags
+    uint64_t size = 0;              // Length of the file in bytes
+    std::vector<uint8_t> data;      // The on-disk inode, inodeSize bytes
+};
+
+/**
+ * @brief An ext2, ext3 or ext4 volume opened for reading
+ */
+struct ExtVolume
+{
+    PartitionReader* reader = nullptr;      // Reader of the partition holding the volume
+    uint64_t volumeOffset = 0;              // Offset of the volume in the partition
+    uint32_t blockSize = 0;                 // Block size in bytes
+    uint64_t blocksCount = 0;               // Number of blocks in the volume
+    uint32_t firstDataBlock = 0;            // Block holding the superblock, 1 for 1 KiB blocks and 0 otherwise
+    uint32_t blocksPerGroup = 0;            // Blocks in each block group
+    uint32_t inodesPerGroup = 0;            // Inodes in each block group
+    uint32_t inodesCount = 0;               // Number of inodes in the volume
+    uint32_t inodeSize = 0;                 // Size of an inode table entry in bytes
+    uint32_t descriptorSize = 0;            // Size of a group descriptor in bytes
+    uint32_t groupCount = 0;                // Number of block groups
+    uint32_t compatFeatures = 0;            // Compatible feature flags
+    uint32_t incompatFeatures = 0;          // Incompatible feature flags
+    uint32_t roCompatFeatures = 0;          // Read-only compatible feature flags
+    uint32_t firstMetaGroup = 0;            // First descriptor block laid out by meta_bg
+    uint32_t backupGroups[2] = { 0, 0 };    // Groups holding superblock backups with sparse_super2
+    std::map<uint32_t, uint64_t> inodeTables;  // First block of the inode table of each group looked up so far
+};
+
+/**
+ * @brief Opens the ext2, ext3 or ext4 volume of a partition
+ *
+ * Reads the superblock only; group descriptors are read as inodes of their
+ * groups are needed.
+ *
+ * @param volume Output parameter for the volume
+ * @param reader Reader of the partition, which must outlive the volume
+ * @throws std::runtime_error if the partition does not hold a supported ext volume
+ */
+void openExtVolume(ExtVolume& volume, PartitionReader& reader);
+
+/**
+ * @brief Reads an inode
+ *
+ * @param volume The opened volume
+ * @param number Inode number
+ * @param inode Output parameter for the inode
+ * @throws std::runtime_error if the inode number or its group descriptor is invalid
+ */
+void readExtInode(ExtVolume& volume, uint32_t number, ExtInode& inode);
+
+/**
+ * @brief Returns the runs of blocks holding the start of a file
+ *
+ * Holes are left out.
+ *
+ * @param volume The opened volume
+ * @param inode The inode of the file
+ * @param blockCount Number of blocks from the start of the file that are needed
+ * @return std::vector<ExtExtent> The runs, by logical block
+ * @throws std::runtime_error if the extent tree or block map is damaged
+ */
+std::vector<ExtExtent> getExtFileExtents(ExtVolume& volume, const ExtInode& inode, uint64_t blockCount);
+
+/**
+ * @brief Lists a directory
+ *
+ * Entries for . and .., symbolic links, device nodes, FIFOs and sockets are
+ * left out.
+ *
+ * @param volume The opened volume
+ * @param inodeNumber Inode number of the directory
+ * @return std::vector<VolumeEntry> The entries of the directory
+ */
+std::vector<VolumeEntry> listExtDirectory(ExtVolume& volume, uint32_t inodeNumber);
+
+/**
+ * @brief Writes the contents of a file to a stream
+ *
+ * @param volume The opened volume
+ * @param inodeNumber Inode number of the file
+ * @param out Stream that receives the file contents
+ * @throws std::runtime_error if the file is encrypted or cannot be read
+ */
+void readExtFile(ExtVolume& volume, uint32_t inodeNumber, std::ostream& out);
+
+/**
+ * @brief Describes an opened ext volume as a VolumeFileSystem
+ *
+ * @param fileSystem Output parameter for the file system operations
+ * @param volume The opened volume, which must outlive fileSystem
+ */
+void getExtFileSystem(VolumeFileSystem& fileSystem, ExtVolume& volume);
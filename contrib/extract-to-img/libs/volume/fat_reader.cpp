@@ -0,0 +1,589 @@
+/**
+ * @file fat_reader.cpp
+ * @brief Implementation of FAT12/16/32 and exFAT file extraction from backed up partitions
+ *
+ * Cluster chains are validated as they are followed: a cluster outside the
+ * data area or a chain longer than the volume fails with an error rather
+ * than reading unrelated data or looping forever.
+ */
+
+#include <algorithm>
+#include <iostream>
+#include <stdexcept>
+
+#include "fat_reader.h"
+
+/**
+ * @brief Size of a FAT and exFAT directory entry
+ */
+const size_t FAT_DIRECTORY_ENTRY_SIZE = 32;
+
+/**
+ * @brief Largest directory the reader loads, the exFAT limit of 256 MiB
+ */
+const uint64_t FAT_MAX_DIRECTORY_LENGTH = 256ULL * 1024 * 1024;
+
+/**
+ * @brief FAT directory entry attributes used by the reader
+ */
+const uint8_t FAT_ATTRIBUTE_VOLUME_ID = 0x08;
+const uint8_t FAT_ATTRIBUTE_DIRECTORY = 0x10;
+const uint8_t FAT_ATTRIBUTE_LONG_NAME = 0x0F;
+const uint8_t FAT_ATTRIBUTE_LONG_NAME_MASK = 0x3F;
+
+/**
+ * @brief First name byte of a deleted FAT directory entry
+ */
+const uint8_t FAT_ENTRY_DELETED = 0xE5;
+
+/**
+ * @brief Ordinal flag of the last long name entry, which is stored first
+ */
+const uint8_t FAT_LAST_LONG_ENTRY = 0x40;
+
+/**
+ * @brief Number of UTF-16 code units in a long name entry
+ */
+const size_t FAT_LONG_NAME_UNITS = 13;
+
+/**
+ * @brief Short name case flags of Windows NT, set for names that are all lowercase
+ */
+const uint8_t FAT_LOWERCASE_BASE = 0x08;
+const uint8_t FAT_LOWERCASE_EXTENSION = 0x10;
+
+/**
+ * @brief exFAT directory entry types used by the reader
+ */
+const uint8_t EXFAT_ENTRY_IN_USE = 0x80;
+const uint8_t EXFAT_ENTRY_FILE = 0x85;
+const uint8_t EXFAT_ENTRY_STREAM = 0xC0;
+const uint8_t EXFAT_ENTRY_FILE_NAME = 0xC1;
+
+/**
+ * @brief exFAT file and stream extension flags used by the reader
+ */
+const uint16_t EXFAT_ATTRIBUTE_DIRECTORY = 0x10;
+const uint8_t EXFAT_STREAM_NO_FAT_CHAIN = 0x02;
+
+/**
+ * @brief Number of UTF-16 code units in an exFAT file name entry
+ */
+const size_t EXFAT_NAME_UNITS = 15;
+
+/**
+ * @brief Throws the error for a damaged structure
+ *
+ * @param what Description of the damaged structure
+ */
+[[noreturn]] void throwCorruptFat(const std::string& what)
+{
+    std::cerr << "Corrupt FAT " << what << "\n";
+    throw std::runtime_error("Corrupt FAT volume.");
+}
+
+/**
+ * @brief Returns whether a value is a power of two
+ *
+ * @param value The value
+ * @return true if the value is a non-zero power of two
+ */
+bool isPowerOfTwo(uint64_t value)
+{
+    return value != 0 && (value & (value - 1)) == 0;
+}
+
+/**
+ * @brief Reads the file allocation table entry of a cluster
+ *
+ * The table is read a window at a time, so following a chain reads each
+ * part of the table at most once while the chain stays within it.
+ *
+ * @param volume The opened volume
+ * @param cluster The cluster
+ * @return uint32_t The entry: the next cluster, or an end of chain or bad cluster mark
+ */
+uint32_t readFatTableEntry(FatVolume& volume, uint32_t cluster)
+{
+    uint64_t offset = 0;
+    size_t size = 0;
+    switch (volume.variant) {
+    case FatVariant::eFat12: offset = cluster + cluster / 2; size = 2; break;
+    case FatVariant::eFat16: offset = cluster * 2ULL; size = 2; break;
+    default: offset = cluster * 4ULL; size = 4; break;
+    }
+    if (offset + size > volume.fatLength) { throwCorruptFat("cluster chain, cluster " + std::to_string(cluster) + " is beyond the table"); }
+
+    if (volume.tableWindow.empty() || offset < volume.tableWindowOffset || offset + size > volume.tableWindowOffset + volume.tableWindow.size()) {
+        volume.tableWindowOffset = offset - offset % volume.bytesPerSector;
+        volume.tableWindow.resize(static_cast<size_t>(std::min<uint64_t>(FAT_TABLE_WINDOW_SIZE, volume.fatLength - volume.tableWindowOffset)));
+        readPartition(*volume.reader, volume.volumeOffset + volume.fatOffset + volume.tableWindowOffset, volume.tableWindow.data(), volume.tableWindow.size());
+    }
+
+    const uint8_t* entry = volume.tableWindow.data() + (offset - volume.tableWindowOffset);
+    switch (volume.variant) {
+    case FatVariant::eFat12: return (cluster & 1) ? readLittleEndian16(entry) >> 4 : readLittleEndian16(entry) & 0x0FFF;
+    case FatVariant::eFat16: return readLittleEndian16(entry);
+    case FatVariant::eFat32: return readLittleEndian32(entry) & 0x0FFFFFFF;
+    default: return readLittleEndian32(entry);
+    }
+}
+
+/**
+ * @brief Returns whether a file allocation table entry ends a chain
+ *
+ * Bad cluster marks count as the end, since no data cluster can follow them.
+ *
+ * @param volume The opened volume
+ * @param entry The table entry
+ * @return true if no cluster follows
+ */
+bool isFatChainEnd(const FatVolume& volume, uint32_t entry)
+{
+    switch (volume.variant) {
+    case FatVariant::eFat12: return entry >= 0xFF7;
+    case FatVariant::eFat16: return entry >= 0xFFF7;
+    case FatVariant::eFat32: return entry >= 0x0FFFFFF7;
+    default: return entry >= 0xFFFFFFF7;
+    }
+}
+
+/**
+ * @brief Returns the clusters of a cluster chain as runs
+ *
+ * @param volume The opened volume
+ * @param firstCluster First cluster of the chain
+ * @param maxClusters Number of clusters needed; the chain is not followed any further
+ * @return std::vector<FatClusterRun> The runs, in chain order
+ * @throws std::runtime_error if the chain is broken or loops
+ */
+std::vector<FatClusterRun> getFatClusterRuns(FatVolume& volume, uint32_t firstCluster, uint64_t maxClusters)
+{
+    std::vector<FatClusterRun> runs;
+    uint32_t cluster = firstCluster;
+    for (uint64_t count = 1; count <= maxClusters; count++) {
+        if (cluster < 2 || cluster - 2 >= volume.clusterCount) { throwCorruptFat("cluster chain, invalid cluster " + std::to_string(cluster)); }
+        if (count > volume.clusterCount) { throwCorruptFat("cluster chain, loop from cluster " + std::to_string(firstCluster)); }
+
+        if (!runs.empty() && runs.back().cluster + runs.back().count == cluster) { runs.back().count++; }
+        else { runs.push_back(FatClusterRun{ cluster, 1 }); }
+
+        if (count == maxClusters) { break; }
+        uint32_t next = readFatTableEntry(volume, cluster);
+        if (isFatChainEnd(volume, next)) { break; }
+        cluster = next;
+    }
+    return runs;
+}
+
+/**
+ * @brief Returns the runs holding the first bytes of an allocation
+ *
+ * @param volume The opened volume
+ * @param firstCluster First cluster of the allocation
+ * @param length Number of bytes needed
+ * @param contiguous Whether the clusters are contiguous rather than chained
+ * @return std::vector<FatClusterRun> Runs covering at least length bytes
+ * @throws std::runtime_error if the allocation is shorter than length
+ */
+std::vector<FatClusterRun> getFatAllocationRuns(FatVolume& volume, uint32_t firstCluster, uint64_t length, bool contiguous)
+{
+    uint64_t clusters = (length + volume.clusterSize - 1) / volume.clusterSize;
+    if (clusters == 0) { return {}; }
+
+    if (contiguous) {
+        if (firstCluster < 2 || firstCluster - 2 + clusters > volume.clusterCount) {
+            throwCorruptFat("allocation, clusters beyond the volume from cluster " + std::to_string(firstCluster));
+        }
+        return { FatClusterRun{ firstCluster, static_cast<uint32_t>(clusters) } };
+    }
+
+    std::vector<FatClusterRun> runs = getFatClusterRuns(volume, firstCluster, clusters);
+    uint64_t found = 0;
+    for (auto& run : runs) { found += run.count; }
+    if (found < clusters) { throwCorruptFat("cluster chain, shorter than the file from cluster " + std::to_string(firstCluster)); }
+    return runs;
+}
+
+/**
+ * @brief Reads a byte range of an allocation
+ *
+ * @param volume The opened volume
+ * @param runs Runs of the allocation
+ * @param offset Offset of the range in the allocation
+ * @param buffer Buffer that receives the bytes
+ * @param length Number of bytes to read
+ */
+void readFatRuns(FatVolume& volume, const std::vector<FatClusterRun>& runs, uint64_t offset, uint8_t* buffer, size_t length)
+{
+    uint64_t runStart = 0;
+    for (auto& run : runs) {
+        if (length == 0) { break; }
+        uint64_t runLength = static_cast<uint64_t>(run.count) * volume.clusterSize;
+        if (offset < runStart + runLength) {
+            uint64_t runOffset = offset - runStart;
+            size_t pieceLength = static_cast<size_t>(std::min<uint64_t>(length, runLength - runOffset));
+            readPartition(*volume.reader, volume.volumeOffset + volume.dataOffset + (run.cluster - 2ULL) * volume.clusterSize + runOffset, buffer, pieceLength);
+            buffer += pieceLength;
+            offset += pieceLength;
+            length -= pieceLength;
+        }
+        runStart += runLength;
+    }
+    if (length > 0) { throwCorruptFat("allocation, range not mapped"); }
+}
+
+/**
+ * @brief Opens the FAT12/16/32 volume described by a boot sector
+ *
+ * @param volume The volume being opened
+ * @param bootSector The boot sector
+ * @return false if the boot sector does not describe a FAT volume
+ */
+bool openFatBootSector(FatVolume& volume, const uint8_t* bootSector)
+{
+    uint32_t bytesPerSector = readLittleEndian16(bootSector + 0x0B);
+    uint32_t sectorsPerCluster = bootSector[0x0D];
+    uint32_t reservedSectors = readLittleEndian16(bootSector + 0x0E);
+    uint32_t fatCount = bootSector[0x10];
+    uint32_t rootEntries = readLittleEndian16(bootSector + 0x11);
+    uint32_t fatSectors = readLittleEndian16(bootSector + 0x16);
+    if (fatSectors == 0) { fatSectors = readLittleEndian32(bootSector + 0x24); }
+    uint32_t totalSectors = readLittleEndian16(bootSector + 0x13);
+    if (totalSectors == 0) { totalSectors = readLittleEndian32(bootSector + 0x20); }
+
+    if ((bootSector[0] != 0xEB && bootSector[0] != 0xE9) || bytesPerSector < 512 || bytesPerSector > 4096 || !isPowerOfTwo(bytesPerSector) ||
+        !isPowerOfTwo(sectorsPerCluster) || reservedSectors == 0 || fatCount == 0 || fatSectors == 0) {
+        return false;
+    }
+
+    uint32_t rootSectors = (rootEntries * 32 + bytesPerSector - 1) / bytesPerSector;
+    uint64_t dataSector = reservedSectors + static_cast<uint64_t>(fatCount) * fatSectors + rootSectors;
+    if (dataSector >= totalSectors) { return false; }
+
+    volume.bytesPerSector = bytesPerSector;
+    volume.clusterSize = bytesPerSector * sectorsPerCluster;
+    volume.clusterCount = static_cast<uint32_t>((totalSectors - dataSector) / sectorsPerCluster);
+    volume.fatOffset = static_cast<uint64_t>(reservedSectors) * bytesPerSector;
+    volume.fatLength = static_cast<uint64_t>(fatSectors) * bytesPerSector;
+    volume.rootDirectoryOffset = volume.fatOffset + fatCount * volume.fatLength;
+    volume.rootDirectoryLength = rootSectors * bytesPerSector;
+    volume.dataOffset = dataSector * bytesPerSector;
+
+    // The variant is defined by the number of clusters alone
+    if (volume.clusterCount < 4085) { volume.variant = FatVariant::eFat12; }
+    else if (volume.clusterCount < 65525) { volume.variant = FatVariant::eFat16; }
+    else {
+        volume.variant = FatVariant::eFat32;
+        volume.rootCluster = readLittleEndian32(bootSector + 0x2C);
+    }
+    return true;
+}
+
+/**
+ * @brief Opens the exFAT volume described by a boot sector
+ *
+ * @param volume The volume being opened
+ * @param bootSector The boot sector
+ * @return false if the boot sector does not describe an exFAT volume
+ */
+bool openExFatBootSector(FatVolume& volume, const uint8_t* bootSector)
+{
+    if (memcmp(bootSector + 3, "EXFAT   ", 8) != 0) { return false; }
+
+    uint8_t bytesPerSectorShift = bootSector[0x6C];
+    uint8_t sectorsPerClusterShift = bootSector[0x6D];
+    if (bytesPerSectorShift < 9 || bytesPerSectorShift > 12 || bytesPerSectorShift + sectorsPerClusterShift > 25) { throwCorruptFat("exFAT boot sector"); }
+
+    volume.variant = FatVariant::eExFat;
+    volume.bytesPerSector = 1u << bytesPerSectorShift;
+    volume.clusterSize = 1u << (bytesPerSectorShift + sectorsPerClusterShift);
+    volume.fatOffset = static_cast<uint64_t>(readLittleEndian32(bootSector + 0x50)) << bytesPerSectorShift;
+    volume.fatLength = static_cast<uint64_t>(readLittleEndian32(bootSector + 0x54)) << bytesPerSectorShift;
+    volume.dataOffset = static_cast<uint64_t>(readLittleEndian32(bootSector + 0x58)) << bytesPerSectorShift;
+    volume.clusterCount = readLittleEndian32(bootSector + 0x5C);
+    volume.rootCluster = readLittleEndian32(bootSector + 0x60);
+    return true;
+}
+
+/**
+ * @brief Opens the FAT or exFAT volume of a partition
+ *
+ * @param volume Output parameter for the volume
+ * @param reader Reader of the partition, which must outlive the volume
+ * @throws std::runtime_error if the partition does not hold a FAT or exFAT volume
+ */
+void openFatVolume(FatVolume& volume, PartitionReader& reader)
+{
+    volume = FatVolume();
+    volume.reader = &reader;
+    volume.volumeOffset = reader.bootSectorOffset;
+
+    uint8_t bootSector[512];
+    readPartition(reader, volume.volumeOffset, bootSector, sizeof(bootSector));
+    if (!openExFatBootSector(volume, bootSector) && !openFatBootSector(volume, bootSector)) {
+        throw std::runtime_error("Partition does not hold a FAT or exFAT volume.");
+    }
+
+    uint64_t volumeLength = reader.partitionLength - volume.volumeOffset;
+    if (volume.dataOffset > volumeLength || static_cast<uint64_t>(volume.clusterCount) * volume.clusterSize > volumeLength - volume.dataOffset) {
+        throwCorruptFat("boot sector, clusters beyond the partition");
+    }
+    if (volume.variant == FatVariant::eFat32 || volume.variant == FatVariant::eExFat) {
+        if (volume.rootCluster < 2 || volume.rootCluster - 2 >= volume.clusterCount) { throwCorruptFat("boot sector, root directory cluster"); }
+    }
+}
+
+/**
+ * @brief Reads the entries of a directory
+ *
+ * @param volume The opened volume
+ * @param directory The directory
+ * @return std::vector<uint8_t> The directory entries
+ */
+std::vector<uint8_t> readFatDirectoryData(FatVolume& volume, const VolumeEntry& directory)
+{
+    std::vector<uint8_t> data;
+    if (directory.id == 0 && (volume.variant == FatVariant::eFat12 || volume.variant == FatVariant::eFat16)) {
+        data.resize(volume.rootDirectoryLength);
+        readPartition(*volume.reader, volume.volumeOffset + volume.rootDirectoryOffset, data.data(), data.size());
+        return data;
+    }
+
+    // Directories other than the exFAT ones with a recorded length run to the end of their chain
+    uint64_t length = directory.location & ~EXFAT_CONTIGUOUS_ALLOCATION;
+    std::vector<FatClusterRun> runs;
+    if (length == 0) {
+        runs = getFatClusterRuns(volume, static_cast<uint32_t>(directory.id), UINT64_MAX);
+        for (auto& run : runs) { length += static_cast<uint64_t>(run.count) * volume.clusterSize; }
+    }
+    else {
+        runs = getFatAllocationRuns(volume, static_cast<uint32_t>(directory.id), length, (directory.location & EXFAT_CONTIGUOUS_ALLOCATION) != 0);
+    }
+    if (length > FAT_MAX_DIRECTORY_LENGTH) { throwCorruptFat("directory, longer than the largest directory"); }
+
+    data.resize(static_cast<size_t>(length));
+    readFatRuns(volume, runs, 0, data.data(), data.size());
+    return data;
+}
+
+/**
+ * @brief Returns the short name of a FAT directory entry
+ *
+ * Bytes outside ASCII are replaced with '_', since the OEM code page the
+ * name was written in is not recorded on the volume.
+ *
+ * @param entry The directory entry
+ * @return std::string The name, with the case flags of Windows NT applied
+ */
+std::string getFatShortName(const uint8_t* entry)
+{
+    auto appendPart = [](std::string& name, const uint8_t* part, size_t length, bool lowercase) {
+        while (length > 0 && part[length - 1] == ' ') { length--; }
+        for (size_t i = 0; i < length; i++) {
+            char c = part[i] < 0x80 ? static_cast<char>(part[i]) : '_';
+            name.push_back(lowercase && c >= 'A' && c <= 'Z' ? static_cast<char>(c - 'A' + 'a') : c);
+        }
+    };
+
+    uint8_t base[8];
+    memcpy(base, entry, sizeof(base));
+    if (base[0] == 0x05) { base[0] = FAT_ENTRY_DELETED; }  // 0xE5 as the first character is stored as 0x05
+
+    std::string name;
+    appendPart(name, base, sizeof(base), (entry[0x0C] & FAT_LOWERCASE_BASE) != 0);
+    std::string extension;
+    appendPart(extension, entry + 8, 3, (entry[0x0C] & FAT_LOWERCASE_EXTENSION) != 0);
+    if (!extension.empty()) { name += "." + extension; }
+    return name;
+}
+
+/**
+ * @brief Computes the checksum of a short name that long name entries carry
+ *
+ * @param entry The directory entry holding the short name
+ * @return uint8_t The checksum
+ */
+uint8_t getFatShortNameChecksum(const uint8_t* entry)
+{
+    uint8_t sum = 0;
+    for (int i = 0; i < 11; i++) { sum = static_cast<uint8_t>(((sum & 1) << 7) + (sum >> 1) + entry[i]); }
+    return sum;
+}
+
+/**
+ * @brief Parses the entries of a FAT12/16/32 directory
+ *
+ * @param volume The opened volume
+ * @param data The directory entries
+ * @return std::vector<VolumeEntry> The entries of the directory
+ */
+std::vector<VolumeEntry> parseFatDirectory(const FatVolume& volume, const std::vector<uint8_t>& data)
+{
+    std::vector<VolumeEntry> listing;
+    std::vector<uint8_t> longName;  // UTF-16LE long name gathered from the entries before a short entry
+    uint8_t longNameChecksum = 0;
+    uint8_t nextOrdinal = 0;        // Ordinal the next long name entry must have, 0 when none is expected
+
+    for (size_t offset = 0; offset + FAT_DIRECTORY_ENTRY_SIZE <= data.size(); offset += FAT_DIRECTORY_ENTRY_SIZE) {
+        const uint8_t* entry = data.data() + offset;
+        if (entry[0] == 0) { break; }  // No entries follow
+        if (entry[0] == FAT_ENTRY_DELETED) {
+            longName.clear();
+            continue;
+        }
+
+        uint8_t attributes = entry[0x0B];
+        if ((attributes & FAT_ATTRIBUTE_LONG_NAME_MASK) == FAT_ATTRIBUTE_LONG_NAME) {
+            // Long name entries are stored last part first, each holding 13 code units
+            uint8_t ordinal = entry[0] & 0x1F;
+            if (entry[0] & FAT_LAST_LONG_ENTRY) {
+                longName.assign(ordinal * FAT_LONG_NAME_UNITS * 2, 0);
+                longNameChecksum = entry[0x0D];
+            }
+            else if (longName.empty() || ordinal != nextOrdinal || entry[0x0D] != longNameChecksum) {
+                longName.clear();
+                continue;
+            }
+            if (ordinal == 0) {
+                longName.clear();
+                continue;
+            }
+            uint8_t* part = longName.data() + (ordinal - 1) * FAT_LONG_NAME_UNITS * 2;
+            memcpy(part, entry + 0x01, 10);
+            memcpy(part + 10, entry + 0x0E, 12);
+            memcpy(part + 22, entry + 0x1C, 4);
+            nextOrdinal = ordinal - 1;
+            continue;
+        }
+
+        bool hasLongName = !longName.empty() && nextOrdinal == 0 && longNameChecksum == getFatShortNameChecksum(entry);
+        std::vector<uint8_t> name;
+        name.swap(longName);
+        if (attributes & FAT_ATTRIBUTE_VOLUME_ID) { continue; }
+        if (entry[0] == '.' && (entry[1] == ' ' || (entry[1] == '.' && entry[2] == ' '))) { continue; }  // . and ..
+
+        VolumeEntry child;
+        if (hasLongName) {
+            size_t units = 0;
+            while (units * 2 < name.size() && readLittleEndian16(name.data() + units * 2) != 0) { units++; }
+            child.name = utf16ToUtf8(name.data(), units);
+        }
+        else {
+            child.name = getFatShortName(entry);
+        }
+        child.id = readLittleEndian16(entry + 0x1A);
+        if (volume.variant == FatVariant::eFat32) { child.id |= static_cast<uint32_t>(readLittleEndian16(entry + 0x14)) << 16; }
+        child.isDirectory = (attributes & FAT_ATTRIBUTE_DIRECTORY) != 0;
+        child.size = child.isDirectory ? 0 : readLittleEndian32(entry + 0x1C);
+        listing.push_back(child);
+    }
+    return listing;
+}
+
+/**
+ * @brief Parses the entries of an exFAT directory
+ *
+ * @param data The directory entries
+ * @return std::vector<VolumeEntry> The entries of the directory
+ */
+std::vector<VolumeEntry> parseExFatDirectory(const std::vector<uint8_t>& data)
+{
+    std::vector<VolumeEntry> listing;
+    size_t entryCount = data.size() / FAT_DIRECTORY_ENTRY_SIZE;
+
+    for (size_t index = 0; index < entryCount; index++) {
+        const uint8_t* entry = data.data() + index * FAT_DIRECTORY_ENTRY_SIZE;
+        if (entry[0] == 0) { break; }  // No entries follow
+        if (entry[0] != EXFAT_ENTRY_FILE) { continue; }  // Unused entries and the allocation bitmap, up-case table and label
+
+        // A file entry is followed by its stream extension and file name entries
+        uint8_t secondaryCount = entry[1];
+        if (secondaryCount < 2 || index + secondaryCount >= entryCount) { throwCorruptFat("exFAT file entry set"); }
+        const uint8_t* stream = entry + FAT_DIRECTORY_ENTRY_SIZE;
+        if (stream[0] != EXFAT_ENTRY_STREAM) { throwCorruptFat("exFAT file entry set, missing stream extension"); }
+
+        uint8_t nameLength = stream[3];
+        std::vector<uint8_t> name;
+        for (size_t i = 2; i <= secondaryCount && name.size() < nameLength * 2u; i++) {
+            const uint8_t* nameEntry = entry + i * FAT_DIRECTORY_ENTRY_SIZE;
+            if (nameEntry[0] != EXFAT_ENTRY_FILE_NAME) { break; }
+            name.insert(name.end(), nameEntry + 2, nameEntry + 2 + EXFAT_NAME_UNITS * 2);
+        }
+        if (name.size() < nameLength * 2u) { throwCorruptFat("exFAT file entry set, name"); }
+
+        VolumeEntry child;
+        child.name = utf16ToUtf8(name.data(), nameLength);
+        child.id = readLittleEndian32(stream + 20);
+        child.isDirectory = (readLittleEndian16(entry + 4) & EXFAT_ATTRIBUTE_DIRECTORY) != 0;
+        uint64_t dataLength = readLittleEndian64(stream + 24);
+        uint64_t validLength = std::min(readLittleEndian64(stream + 8), dataLength);
+        child.size = child.isDirectory ? 0 : dataLength;
+        child.location = (child.isDirectory ? dataLength : validLength) & ~EXFAT_CONTIGUOUS_ALLOCATION;
+        if (stream[1] & EXFAT_STREAM_NO_FAT_CHAIN) { child.location |= EXFAT_CONTIGUOUS_ALLOCATION; }
+        if (child.isDirectory && dataLength == 0) { throwCorruptFat("exFAT directory, empty allocation"); }
+        listing.push_back(child);
+
+        index += secondaryCount;
+    }
+    return listing;
+}
+
+/**
+ * @brief Lists a directory
+ *
+ * @param volume The opened volume
+ * @param directory The directory to list
+ * @return std::vector<VolumeEntry> The entries of the directory
+ */
+std::vector<VolumeEntry> listFatDirectory(FatVolume& volume, const VolumeEntry& directory)
+{
+    std::vector<uint8_t> data = readFatDirectoryData(volume, directory);
+    return volume.variant == FatVariant::eExFat ? parseExFatDirectory(data) : parseFatDirectory(volume, data);
+}
+
+/**
+ * @brief Writes the contents of a file to a stream
+ *
+ * On exFAT, the bytes past the valid data length read as zeros.
+ *
+ * @param volume The opened volume
+ * @param file The file to read
+ * @param out Stream that receives the file contents
+ * @throws std::runtime_error if the cluster chain of the file is damaged
+ */
+void readFatFile(FatVolume& volume, const VolumeEntry& file, std::ostream& out)
+{
+    if (file.size == 0) { return; }
+
+    bool exFat = volume.variant == FatVariant::eExFat;
+    uint64_t storedSize = exFat ? std::min(file.location & ~EXFAT_CONTIGUOUS_ALLOCATION, file.size) : file.size;
+    bool contiguous = exFat && (file.location & EXFAT_CONTIGUOUS_ALLOCATION) != 0;
+    std::vector<FatClusterRun> runs = getFatAllocationRuns(volume, static_cast<uint32_t>(file.id), storedSize, contiguous);
+
+    std::vector<uint8_t> chunk(VOLUME_FILE_CHUNK_SIZE);
+    for (uint64_t position = 0; position < file.size;) {
+        size_t length = static_cast<size_t>(std::min<uint64_t>(chunk.size(), file.size - position));
+        size_t stored = position < storedSize ? static_cast<size_t>(std::min<uint64_t>(length, storedSize - position)) : 0;
+        readFatRuns(volume, runs, position, chunk.data(), stored);
+        memset(chunk.data() + stored, 0, length - stored);
+        out.write(reinterpret_cast<const char*>(chunk.data()), static_cast<std::streamsize>(length));
+        position += length;
+    }
+}
+
+/**
+ * @brief Describes an opened FAT or exFAT volume as a VolumeFileSystem
+ *
+ * @param fileSystem Output parameter for the file system operations
+ * @param volume The opened volume, which must outlive fileSystem
+ */
+void getFatFileSystem(VolumeFileSystem& fileSystem, FatVolume& volume)
+{
+    fileSystem.root = VolumeEntry();
+    fileSystem.root.id = volume.rootCluster;
+    fileSystem.root.isDirectory = true;
+    fileSystem.caseSensitive = false;
+    fileSystem.listDirectory = [&volume](const VolumeEntry& directory) { return listFatDirectory(volume, directory); };
+    fileSystem.readFile = [&volume](const VolumeEntry& file, std::ostream& out) { readFatFile(volume, file, out); };
+}
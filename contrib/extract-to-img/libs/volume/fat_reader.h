@@ -0,0 +1,133 @@
+/**
+ * @file fat_reader.h
+ * @brief FAT12/16/32 and exFAT file extraction from backed up partitions
+ *
+ * This file declares a reader that follows the cluster chains of a FAT or
+ * exFAT volume and reads files straight from the backup files. The file
+ * allocation table is read from the volume through the partition reader, a
+ * window of sectors at a time, so only the parts of the table covering the
+ * chains being followed are read along with the directories and files
+ * themselves.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+#include "partition_reader.h"
+#include "volume_files.h"
+
+/**
+ * @brief Number of bytes of the file allocation table kept by a FAT volume
+ */
+const size_t FAT_TABLE_WINDOW_SIZE = 64 * 1024;
+
+/**
+ * @brief Flag in VolumeEntry::location marking an exFAT allocation that has no FAT chain
+ *
+ * The clusters of such an allocation are contiguous. The remaining bits of
+ * the location hold the number of bytes of the allocation to read.
+ */
+const uint64_t EXFAT_CONTIGUOUS_ALLOCATION = 1ULL << 63;
+
+/**
+ * @brief The variants of the FAT file system
+ */
+enum class FatVariant
+{
+    eFat12,
+    eFat16,
+    eFat32,
+    eExFat
+};
+
+/**
+ * @brief A run of consecutive clusters of a cluster chain
+ */
+struct FatClusterRun
+{
+    uint32_t cluster = 0;       // First cluster of the run
+    uint32_t count = 0;         // Number of clusters
+};
+
+/**
+ * @brief A FAT or exFAT volume opened for reading
+ *
+ * Directory entries of the volume describe files as follows: VolumeEntry::id
+ * is the first cluster, or 0 for an empty file and for the fixed root
+ * directory of FAT12/16. On exFAT, VolumeEntry::location holds the length to
+ * read and the EXFAT_CONTIGUOUS_ALLOCATION flag.
+ */
+struct FatVolume
+{
+    PartitionReader* reader = nullptr;      // Reader of the partition holding the volume
+    FatVariant variant = FatVariant::eFat32;  // Variant of the file system
+    uint64_t volumeOffset = 0;              // Offset of the boot sector in the partition
+    uint32_t bytesPerSector = 0;            // Sector size from the boot sector
+    uint32_t clusterSize = 0;               // Cluster size in bytes
+    uint32_t clusterCount = 0;              // Number of clusters in the data area
+    uint64_t fatOffset = 0;                 // Offset of the first file allocation table in the volume
+    uint64_t fatLength = 0;                 // Length of one file allocation table in bytes
+    uint64_t dataOffset = 0;                // Offset of cluster 2 in the volume
+    uint64_t rootDirectoryOffset = 0;       // Offset of the fixed root directory of FAT12/16 in the volume
+    uint32_t rootDirectoryLength = 0;       // Length of the fixed root directory of FAT12/16 in bytes
+    uint32_t rootCluster = 0;               // First cluster of the root directory of FAT32 and exFAT
+    std::vector<uint8_t> tableWindow;       // Recently read part of the file allocation table
+    uint64_t tableWindowOffset = 0;         // Offset of tableWindow in the table
+};
+
+/**
+ * @brief Opens the FAT or exFAT volume of a partition
+ *
+ * The variant is determined from the boot sector: exFAT by its signature and
+ * FAT12, FAT16 and FAT32 by the number of clusters.
+ *
+ * @param volume Output parameter for the volume
+ * @param reader Reader of the partition, which must outlive the volume
+ * @throws std::runtime_error if the partition does not hold a FAT or exFAT volume
+ */
+void openFatVolume(FatVolume& volume, PartitionReader& reader);
+
+/**
+ * @brief Returns the clusters of a cluster chain as runs
+ *
+ * @param volume The opened volume
+ * @param firstCluster First cluster of the chain
+ * @param maxClusters Number of clusters needed; the chain is not followed any further
+ * @return std::vector<FatClusterRun> The runs, in chain order
+ * @throws std::runtime_error if the chain is broken or loops
+ */
+std::vector<FatClusterRun> getFatClusterRuns(FatVolume& volume, uint32_t firstCluster, uint64_t maxClusters);
+
+/**
+ * @brief Lists a directory
+ *
+ * Entries for . and .., volume labels and deleted files are left out. FAT
+ * entries are named by their long name when it is intact, and by their short
+ * name otherwise.
+ *
+ * @param volume The opened volume
+ * @param directory The directory to list
+ * @return std::vector<VolumeEntry> The entries of the directory
+ */
+std::vector<VolumeEntry> listFatDirectory(FatVolume& volume, const VolumeEntry& directory);
+
+/**
+ * @brief Writes the contents of a file to a stream
+ *
+ * @param volume The opened volume
+ * @param file The file to read
+ * @param out Stream that receives the file contents
+ * @throws std::runtime_error if the cluster chain of the file is damaged
+ */
+void readFatFile(FatVolume& volume, const VolumeEntry& file, std::ostream& out);
+
+/**
+ * @brief Describes an opened FAT or exFAT volume as a VolumeFileSystem
+ *
+ * @param fileSystem Output parameter for the file system operations
+ * @param volume The opened volume, which must outlive fileSystem
+ */
+void getFatFileSystem(VolumeFileSystem& fileSystem, FatVolume& volume);
@@ -0,0 +1,532 @@
+/**
+ * @file ntfs_reader.cpp
+ * @brief Implementation of NTFS file extraction from backed up partitions
+ *
+ * MFT records and index blocks are protected by update sequence arrays,
+ * which are checked and undone as the structures are read. Every offset and
+ * length taken from the volume is bounds checked, so a damaged volume fails
+ * with an error rather than reading outside the structures.
+ */
+
+#include <algorithm>
+#include <iostream>
+#include <map>
+#include <set>
+#include <stdexcept>
+
+#include "ntfs_reader.h"
+
+/**
+ * @brief Stride of the update sequence array, which NTFS fixes at 512 bytes
+ */
+const uint32_t NTFS_UPDATE_SEQUENCE_STRIDE = 512;
+
+/**
+ * @brief Attribute flags that the reader cannot decode
+ */
+const uint16_t NTFS_ATTRIBUTE_COMPRESSED = 0x0001;
+const uint16_t NTFS_ATTRIBUTE_ENCRYPTED = 0x4000;
+
+/**
+ * @brief File attribute flag of FILE_NAME marking a directory
+ */
+const uint32_t NTFS_FILE_NAME_DIRECTORY = 0x10000000;
+
+/**
+ * @brief Index entry flag marking the end of an index node
+ */
+const uint16_t NTFS_INDEX_ENTRY_LAST = 0x02;
+
+/**
+ * @brief Namespace of FILE_NAME attributes holding a DOS 8.3 short name
+ */
+const uint8_t NTFS_NAMESPACE_DOS = 2;
+
+/**
+ * @brief Mask of the record number in an MFT file reference
+ */
+const uint64_t NTFS_RECORD_NUMBER_MASK = 0x0000FFFFFFFFFFFFULL;
+
+/**
+ * @brief Throws the error for a damaged structure
+ *
+ * @param what Description of the damaged structure
+ */
+[[noreturn]] void throwCorruptNtfs(const std::string& what)
+{
+    std::cerr << "Corrupt NTFS " << what << "\n";
+    throw std::runtime_error("Corrupt NTFS volume.");
+}
+
+/**
+ * @brief Checks and removes the update sequence of a multi-sector structure
+ *
+ * @param data The structure as read from the volume
+ * @param size Size of the structure
+ * @param magic Signature the structure starts with
+ * @return false if the structure does not start with the signature
+ */
+bool applyNtfsFixups(uint8_t* data, size_t size, const char* magic)
+{
+    if (size < 8 || memcmp(data, magic, 4) != 0) { return false; }
+
+    uint16_t arrayOffset = readLittleEndian16(data + 4);
+    uint16_t arrayCount = readLittleEndian16(data + 6);
+    if (arrayCount == 0 || arrayOffset + arrayCount * 2u > size || (arrayCount - 1u) * NTFS_UPDATE_SEQUENCE_STRIDE > size) {
+        throwCorruptNtfs("update sequence array");
+    }
+
+    const uint8_t* sequence = data + arrayOffset;
+    for (uint32_t i = 1; i < arrayCount; i++) {
+        uint8_t* sectorEnd = data + i * NTFS_UPDATE_SEQUENCE_STRIDE - 2;
+        if (memcmp(sectorEnd, sequence, 2) != 0) { throwCorruptNtfs("update sequence, torn write"); }
+        memcpy(sectorEnd, sequence + i * 2, 2);
+    }
+    return true;
+}
+
+/**
+ * @brief Decodes the mapping pairs of a non-resident attribute
+ *
+ * @param data Start of the mapping pairs
+ * @param length Bytes available for the mapping pairs
+ * @param vcn First virtual cluster of the attribute part
+ * @param runs Vector the decoded runs are appended to
+ */
+void decodeNtfsRuns(const uint8_t* data, size_t length, uint64_t vcn, std::vector<NtfsDataRun>& runs)
+{
+    int64_t lcn = 0;
+    size_t position = 0;
+    while (position < length && data[position] != 0) {
+        uint8_t lengthBytes = data[position] & 0x0F;
+        uint8_t offsetBytes = data[position] >> 4;
+        if (lengthBytes == 0 || lengthBytes > 8 || offsetBytes > 8 || position + 1 + lengthBytes + offsetBytes > length) {
+            throwCorruptNtfs("data run");
+        }
+        position++;
+
+        uint64_t runLength = 0;
+        for (int i = lengthBytes - 1; i >= 0; i--) { runLength = (runLength << 8) | data[position + i]; }
+        position += lengthBytes;
+
+        NtfsDataRun run;
+        run.vcn = vcn;
+        run.length = runLength;
+        run.sparse = offsetBytes == 0;
+        if (!run.sparse) {
+            int64_t delta = (data[position + offsetBytes - 1] & 0x80) ? -1 : 0;  // Sign extend
+            for (int i = offsetBytes - 1; i >= 0; i--) { delta = static_cast<int64_t>((static_cast<uint64_t>(delta) << 8) | data[position + i]); }
+            lcn += delta;
+            if (lcn < 0) { throwCorruptNtfs("data run"); }
+            run.lcn = static_cast<uint64_t>(lcn);
+        }
+        position += offsetBytes;
+
+        runs.push_back(run);
+        vcn += runLength;
+    }
+}
+
+/**
+ * @brief Reads a byte range of a non-resident attribute
+ *
+ * @param volume The opened volume
+ * @param runs Runs of the attribute, by VCN
+ * @param offset Offset of the range in the attribute value
+ * @param buffer Buffer that receives the bytes
+ * @param length Number of bytes to read
+ */
+void readNtfsRuns(NtfsVolume& volume, const std::vector<NtfsDataRun>& runs, uint64_t offset, uint8_t* buffer, size_t length)
+{
+    while (length > 0) {
+        uint64_t vcn = offset / volume.clusterSize;
+        auto run = std::upper_bound(runs.begin(), runs.end(), vcn, [](uint64_t value, const NtfsDataRun& r) { return value < r.vcn; });
+        if (run == runs.begin()) { throwCorruptNtfs("attribute, range not mapped"); }
+        --run;
+        if (vcn >= run->vcn + run->length) { throwCorruptNtfs("attribute, range not mapped"); }
+
+        uint64_t runOffset = offset - run->vcn * volume.clusterSize;
+        size_t pieceLength = static_cast<size_t>(std::min<uint64_t>(length, run->length * volume.clusterSize - runOffset));
+        if (run->sparse) {
+            memset(buffer, 0, pieceLength);
+        }
+        else {
+            readPartition(*volume.reader, volume.volumeOffset + run->lcn * volume.clusterSize + runOffset, buffer, pieceLength);
+        }
+        buffer += pieceLength;
+        offset += pieceLength;
+        length -= pieceLength;
+    }
+}
+
+/**
+ * @brief Reads an MFT record and removes its update sequence
+ *
+ * @param volume The opened volume
+ * @param recordNumber Number of the record
+ * @param record Output parameter for the record
+ * @return false if the record is not in use
+ */
+bool readNtfsRecord(NtfsVolume& volume, uint64_t recordNumber, std::vector<uint8_t>& record)
+{
+    uint64_t offset = recordNumber * volume.recordSize;
+    if (offset >= volume.mftSize) { throwCorruptNtfs("file reference, record " + std::to_string(recordNumber) + " is beyond the MFT"); }
+
+    record.resize(volume.recordSize);
+    readNtfsRuns(volume, volume.mftRuns, offset, record.data(), record.size());
+    if (!applyNtfsFixups(record.data(), record.size(), "FILE")) { return false; }
+    return (readLittleEndian16(record.data() + 0x16) & 0x0001) != 0;
+}
+
+/**
+ * @brief Parses the attributes held in one MFT record
+ *
+ * @param record The record, with its update sequence removed
+ * @param attributes Vector the attributes are appended to
+ * @param startVcns Vector that receives the first VCN of each non-resident attribute part
+ */
+void parseNtfsRecordAttributes(const std::vector<uint8_t>& record, std::vector<NtfsAttribute>& attributes, std::vector<uint64_t>& startVcns)
+{
+    uint32_t usedSize = std::min<uint32_t>(readLittleEndian32(record.data() + 0x18), static_cast<uint32_t>(record.size()));
+    uint32_t offset = readLittleEndian16(record.data() + 0x14);
+
+    while (offset + 16 <= usedSize) {
+        const uint8_t* header = record.data() + offset;
+        uint32_t type = readLittleEndian32(header);
+        if (type == NTFS_END_OF_ATTRIBUTES) { break; }
+        uint32_t length = readLittleEndian32(header + 4);
+        if (length < 16 || length > usedSize - offset) { throwCorruptNtfs("attribute header"); }
+
+        NtfsAttribute attribute;
+        attribute.type = type;
+        attribute.resident = header[8] == 0;
+        attribute.flags = readLittleEndian16(header + 0x0C);
+        uint8_t nameLength = header[9];
+        uint16_t nameOffset = readLittleEndian16(header + 0x0A);
+        if (nameLength > 0) {
+            if (nameOffset + nameLength * 2u > length) { throwCorruptNtfs("attribute name"); }
+            attribute.name = utf16ToUtf8(header + nameOffset, nameLength);
+        }
+
+        uint64_t startVcn = 0;
+        if (attribute.resident) {
+            if (length < 0x18) { throwCorruptNtfs("resident attribute"); }
+            uint32_t valueLength = readLittleEndian32(header + 0x10);
+            uint16_t valueOffset = readLittleEndian16(header + 0x14);
+            if (valueOffset > length || valueLength > length - valueOffset) { throwCorruptNtfs("resident attribute"); }
+            attribute.value.assign(header + valueOffset, header + valueOffset + valueLength);
+            attribute.dataSize = valueLength;
+            attribute.initializedSize = valueLength;
+        }
+        else {
+            if (length < 0x40) { throwCorruptNtfs("non-resident attribute"); }
+            startVcn = readLittleEndian64(header + 0x10);
+            uint16_t runsOffset = readLittleEndian16(header + 0x20);
+            if (runsOffset > length) { throwCorruptNtfs("non-resident attribute"); }
+            if (startVcn == 0) {
+                attribute.dataSize = readLittleEndian64(header + 0x30);
+                attribute.initializedSize = readLittleEndian64(header + 0x38);
+            }
+            decodeNtfsRuns(header + runsOffset, length - runsOffset, startVcn, attribute.runs);
+        }
+
+        attributes.push_back(std::move(attribute));
+        startVcns.push_back(startVcn);
+        offset += length;
+    }
+}
+
+/**
+ * @brief Reads the whole value of an attribute into memory
+ *
+ * @param volume The opened volume
+ * @param attribute The attribute
+ * @return std::vector<uint8_t> The value
+ */
+std::vector<uint8_t> readNtfsAttributeValue(NtfsVolume& volume, const NtfsAttribute& attribute)
+{
+    if (attribute.resident) { return attribute.value; }
+
+    std::vector<uint8_t> value(static_cast<size_t>(attribute.dataSize), 0);
+    size_t initialized = static_cast<size_t>(std::min(attribute.initializedSize, attribute.dataSize));
+    readNtfsRuns(volume, attribute.runs, 0, value.data(), initialized);
+    return value;
+}
+
+/**
+ * @brief Merges the parts of attributes split across several records
+ *
+ * @param attributes The attribute parts, in the order they were read
+ * @param startVcns First VCN of each part
+ * @return std::vector<NtfsAttribute> One attribute per type and name
+ */
+std::vector<NtfsAttribute> mergeNtfsAttributeParts(std::vector<NtfsAttribute>& attributes, std::vector<uint64_t>& startVcns)
+{
+    std::vector<NtfsAttribute> merged;
+    std::map<std::pair<uint32_t, std::string>, size_t> nonResident;
+
+    // Parts are merged in VCN order, starting with the part that holds the sizes
+    std::vector<size_t> order(attributes.size());
+    for (size_t i = 0; i < order.size(); i++) { order[i] = i; }
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return startVcns[a] < startVcns[b]; });
+
+    for (size_t i : order) {
+        NtfsAttribute& attribute = attributes[i];
+        if (attribute.resident) {
+            merged.push_back(std::move(attribute));
+            continue;
+        }
+        auto key = std::make_pair(attribute.type, attribute.name);
+        auto existing = nonResident.find(key);
+        if (existing == nonResident.end()) {
+            nonResident.emplace(key, merged.size());
+            merged.push_back(std::move(attribute));
+        }
+        else {
+            NtfsAttribute& first = merged[existing->second];
+            first.runs.insert(first.runs.end(), attribute.runs.begin(), attribute.runs.end());
+        }
+    }
+    return merged;
+}
+
+/**
+ * @brief Returns the attributes of a file, following its attribute list
+ *
+ * @param volume The opened volume
+ * @param recordNumber MFT record number of the file
+ * @return std::vector<NtfsAttribute> The attributes
+ * @throws std::runtime_error if a record is corrupt
+ */
+std::vector<NtfsAttribute> readNtfsAttributes(NtfsVolume& volume, uint64_t recordNumber)
+{
+    std::vector<uint8_t> record;
+    if (!readNtfsRecord(volume, recordNumber, record)) { throwCorruptNtfs("file reference, record " + std::to_string(recordNumber) + " is not in use"); }
+
+    std::vector<NtfsAttribute> attributes;
+    std::vector<uint64_t> startVcns;
+    parseNtfsRecordAttributes(record, attributes, startVcns);
+
+    auto list = std::find_if(attributes.begin(), attributes.end(), [](const NtfsAttribute& a) { return a.type == NTFS_ATTRIBUTE_LIST; });
+    if (list == attributes.end()) { return mergeNtfsAttributeParts(attributes, startVcns); }
+
+    // Attributes that do not fit in the base record are held in extension records
+    std::vector<uint8_t> listValue = readNtfsAttributeValue(volume, *list);
+    std::set<uint64_t> extensionRecords;
+    for (size_t offset = 0; offset + 0x1A <= listValue.size();) {
+        uint16_t entryLength = readLittleEndian16(listValue.data() + offset + 4);
+        if (entryLength < 0x1A || offset + entryLength > listValue.size()) { throwCorruptNtfs("attribute list"); }
+        uint64_t extension = readLittleEndian64(listValue.data() + offset + 0x10) & NTFS_RECORD_NUMBER_MASK;
+        if (extension != recordNumber) { extensionRecords.insert(extension); }
+        offset += entryLength;
+    }
+
+    for (uint64_t extension : extensionRecords) {
+        if (!readNtfsRecord(volume, extension, record)) { throwCorruptNtfs("attribute list, extension record not in use"); }
+        parseNtfsRecordAttributes(record, attributes, startVcns);
+    }
+    return mergeNtfsAttributeParts(attributes, startVcns);
+}
+
+/**
+ * @brief Opens the NTFS volume of a partition
+ *
+ * @param volume Output parameter for the volume
+ * @param reader Reader of the partition, which must outlive the volume
+ * @throws std::runtime_error if the partition does not hold an NTFS volume
+ */
+void openNtfsVolume(NtfsVolume& volume, PartitionReader& reader)
+{
+    volume = NtfsVolume();
+    volume.reader = &reader;
+    volume.volumeOffset = reader.bootSectorOffset;
+
+    uint8_t bootSector[512];
+    readPartition(reader, volume.volumeOffset, bootSector, sizeof(bootSector));
+    if (memcmp(bootSector + 3, "NTFS    ", 8) != 0) { throw std::runtime_error("Partition does not hold an NTFS volume."); }
+
+    volume.bytesPerSector = readLittleEndian16(bootSector + 0x0B);
+    uint8_t sectorsPerCluster = bootSector[0x0D];
+    uint32_t clusterSectors = sectorsPerCluster > 0x80 ? 1u << (256 - sectorsPerCluster) : sectorsPerCluster;
+    volume.clusterSize = volume.bytesPerSector * clusterSectors;
+    int8_t recordClusters = static_cast<int8_t>(bootSector[0x40]);
+    int8_t indexClusters = static_cast<int8_t>(bootSector[0x44]);
+    volume.recordSize = recordClusters > 0 ? recordClusters * volume.clusterSize : 1u << -recordClusters;
+    volume.indexBlockSize = indexClusters > 0 ? indexClusters * volume.clusterSize : 1u << -indexClusters;
+
+    if (volume.bytesPerSector < 256 || (volume.bytesPerSector & (volume.bytesPerSector - 1)) != 0 ||
+        volume.clusterSize == 0 || volume.clusterSize > 2 * 1024 * 1024 ||
+        volume.recordSize < 256 || volume.recordSize > 65536 || volume.recordSize % NTFS_UPDATE_SEQUENCE_STRIDE != 0) {
+        throwCorruptNtfs("boot sector");
+    }
+
+    // Record 0 describes the MFT itself; its first run is enough to read it
+    uint64_t mftLcn = readLittleEndian64(bootSector + 0x30);
+    volume.mftRuns = { NtfsDataRun{ 0, mftLcn, (volume.recordSize + volume.clusterSize - 1) / volume.clusterSize, false } };
+    volume.mftSize = volume.recordSize;
+
+    // The base record maps at least the start of the MFT, which holds any extension records of $MFT
+    std::vector<uint8_t> record;
+    std::vector<NtfsAttribute> attributes;
+    std::vector<uint64_t> startVcns;
+    if (!readNtfsRecord(volume, 0, record)) { throwCorruptNtfs("$MFT record"); }
+    parseNtfsRecordAttributes(record, attributes, startVcns);
+    for (size_t i = 0; i < attributes.size(); i++) {
+        if (attributes[i].type == NTFS_DATA && attributes[i].name.empty() && !attributes[i].resident && startVcns[i] == 0) {
+            volume.mftRuns = attributes[i].runs;
+            volume.mftSize = attributes[i].dataSize;
+        }
+    }
+
+    attributes = readNtfsAttributes(volume, 0);
+    auto data = std::find_if(attributes.begin(), attributes.end(), [](const NtfsAttribute& a) { return a.type == NTFS_DATA && a.name.empty(); });
+    if (data == attributes.end() || data->resident || data->runs.empty()) { throwCorruptNtfs("$MFT record"); }
+    volume.mftRuns = data->runs;
+    volume.mftSize = data->dataSize;
+}
+
+/**
+ * @brief Appends the entries of one index node to a directory listing
+ *
+ * @param node Start of the index node header
+ * @param available Bytes available from the node header to the end of the buffer
+ * @param directoryRecord MFT record number of the directory being listed
+ * @param entries Entries listed so far, by MFT record number
+ */
+void parseNtfsIndexNode(const uint8_t* node, size_t available, uint64_t directoryRecord, std::map<uint64_t, VolumeEntry>& entries)
+{
+    if (available < 16) { throwCorruptNtfs("index node"); }
+    uint32_t entriesOffset = readLittleEndian32(node);
+    uint32_t entriesEnd = std::min<uint32_t>(readLittleEndian32(node + 4), static_cast<uint32_t>(available));
+
+    for (uint32_t offset = entriesOffset; offset + 16 <= entriesEnd;) {
+        const uint8_t* entry = node + offset;
+        uint16_t entryLength = readLittleEndian16(entry + 8);
+        uint16_t keyLength = readLittleEndian16(entry + 10);
+        uint16_t flags = readLittleEndian16(entry + 12);
+        if (flags & NTFS_INDEX_ENTRY_LAST) { break; }
+        if (entryLength < 16 || offset + entryLength > entriesEnd || 16u + keyLength > entryLength || keyLength < 0x42) {
+            throwCorruptNtfs("index entry");
+        }
+        offset += entryLength;
+
+        const uint8_t* fileName = entry + 16;
+        uint8_t nameLength = fileName[0x40];
+        uint8_t nameSpace = fileName[0x41];
+        if (0x42u + nameLength * 2u > keyLength) { throwCorruptNtfs("index entry name"); }
+        uint64_t recordNumber = readLittleEndian64(entry) & NTFS_RECORD_NUMBER_MASK;
+        if (nameSpace == NTFS_NAMESPACE_DOS || recordNumber < NTFS_RESERVED_RECORDS || recordNumber == directoryRecord) { continue; }
+
+        VolumeEntry volumeEntry;
+        volumeEntry.name = utf16ToUtf8(fileName + 0x42, nameLength);
+        volumeEntry.id = recordNumber;
+        volumeEntry.isDirectory = (readLittleEndian32(fileName + 0x38) & NTFS_FILE_NAME_DIRECTORY) != 0;
+        volumeEntry.size = readLittleEndian64(fileName + 0x30);
+        entries[recordNumber] = volumeEntry;
+    }
+}
+
+/**
+ * @brief Lists a directory
+ *
+ * The index is a B+ tree whose nodes all hold entries, so the root and
+ * every allocated index block are read in turn rather than walking the tree.
+ *
+ * @param volume The opened volume
+ * @param recordNumber MFT record number of the directory
+ * @return std::vector<VolumeEntry> The entries of the directory, ordered by MFT record number
+ */
+std::vector<VolumeEntry> listNtfsDirectory(NtfsVolume& volume, uint64_t recordNumber)
+{
+    std::vector<NtfsAttribute> attributes = readNtfsAttributes(volume, recordNumber);
+    std::map<uint64_t, VolumeEntry> entries;
+    const NtfsAttribute* allocation = nullptr;
+    const NtfsAttribute* bitmap = nullptr;
+    uint32_t indexBlockSize = volume.indexBlockSize;
+
+    for (auto& attribute : attributes) {
+        if (attribute.name != "$I30") { continue; }
+        if (attribute.type == NTFS_INDEX_ROOT) {
+            if (attribute.value.size() < 0x20) { throwCorruptNtfs("index root"); }
+            indexBlockSize = readLittleEndian32(attribute.value.data() + 8);
+            parseNtfsIndexNode(attribute.value.data() + 0x10, attribute.value.size() - 0x10, recordNumber, entries);
+        }
+        else if (attribute.type == NTFS_INDEX_ALLOCATION) {
+            allocation = &attribute;
+        }
+        else if (attribute.type == NTFS_BITMAP) {
+            bitmap = &attribute;
+        }
+    }
+
+    if (allocation != nullptr) {
+        if (indexBlockSize < NTFS_UPDATE_SEQUENCE_STRIDE || indexBlockSize > 65536) { throwCorruptNtfs("index root"); }
+        std::vector<uint8_t> bitmapValue;
+        if (bitmap != nullptr) { bitmapValue = readNtfsAttributeValue(volume, *bitmap); }
+
+        std::vector<uint8_t> block(indexBlockSize);
+        uint64_t blockCount = allocation->dataSize / indexBlockSize;
+        for (uint64_t i = 0; i < blockCount; i++) {
+            if (bitmap != nullptr && (i / 8 >= bitmapValue.size() || (bitmapValue[i / 8] & (1 << (i % 8))) == 0)) { continue; }
+            readNtfsRuns(volume, allocation->runs, i * indexBlockSize, block.data(), block.size());
+            if (!applyNtfsFixups(block.data(), block.size(), "INDX")) { continue; }
+            parseNtfsIndexNode(block.data() + 0x18, block.size() - 0x18, recordNumber, entries);
+        }
+    }
+
+    std::vector<VolumeEntry> listing;
+    listing.reserve(entries.size());
+    for (auto& entry : entries) { listing.push_back(entry.second); }
+    return listing;
+}
+
+/**
+ * @brief Writes the unnamed data stream of a file to a stream
+ *
+ * @param volume The opened volume
+ * @param recordNumber MFT record number of the file
+ * @param out Stream that receives the file contents
+ * @throws std::runtime_error if the file is compressed or encrypted, or cannot be read
+ */
+void readNtfsFile(NtfsVolume& volume, uint64_t recordNumber, std::ostream& out)
+{
+    std::vector<NtfsAttribute> attributes = readNtfsAttributes(volume, recordNumber);
+    auto data = std::find_if(attributes.begin(), attributes.end(), [](const NtfsAttribute& a) { return a.type == NTFS_DATA && a.name.empty(); });
+    if (data == attributes.end()) { return; }  // No unnamed data stream, such as a reparse point
+
+    if (data->resident) {
+        out.write(reinterpret_cast<const char*>(data->value.data()), static_cast<std::streamsize>(data->value.size()));
+        return;
+    }
+    if (data->flags & (NTFS_ATTRIBUTE_COMPRESSED | NTFS_ATTRIBUTE_ENCRYPTED)) {
+        std::cerr << "File record " << recordNumber << " is compressed or encrypted\n";
+        throw std::runtime_error("Compressed and encrypted NTFS files are not supported.");
+    }
+
+    std::vector<uint8_t> chunk(VOLUME_FILE_CHUNK_SIZE);
+    uint64_t initializedSize = std::min(data->initializedSize, data->dataSize);
+    for (uint64_t position = 0; position < data->dataSize;) {
+        size_t length = static_cast<size_t>(std::min<uint64_t>(chunk.size(), data->dataSize - position));
+        size_t stored = position < initializedSize ? static_cast<size_t>(std::min<uint64_t>(length, initializedSize - position)) : 0;
+        readNtfsRuns(volume, data->runs, position, chunk.data(), stored);
+        memset(chunk.data() + stored, 0, length - stored);
+        out.write(reinterpret_cast<const char*>(chunk.data()), static_cast<std::streamsize>(length));
+        position += length;
+    }
+}
+
+/**
+ * @brief Describes an opened NTFS volume as a VolumeFileSystem
+ *
+ * @param fileSystem Output parameter for the file system operations
+ * @param volume The opened volume, which must outlive fileSystem
+ */
+void getNtfsFileSystem(VolumeFileSystem& fileSystem, NtfsVolume& volume)
+{
+    fileSystem.root = VolumeEntry();
+    fileSystem.root.id = NTFS_ROOT_RECORD;
+    fileSystem.root.isDirectory = true;
+    fileSystem.caseSensitive = false;
+    fileSystem.listDirectory = [&volume](const VolumeEntry& directory) { return listNtfsDirectory(volume, directory.id); };
+    fileSystem.readFile = [&volume](const VolumeEntry& file, std::ostream& out) { readNtfsFile(volume, file.id, out); };
+}
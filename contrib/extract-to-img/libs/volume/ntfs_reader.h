@@ -0,0 +1,136 @@
+/**
+ * @file ntfs_reader.h
+ * @brief NTFS file extraction from backed up partitions
+ *
+ * This file declares a reader that locates files through the master file
+ * table of an NTFS partition and reads their data runs straight from the
+ * backup files. Only the MFT records, directory index blocks and clusters
+ * of the files being extracted are read.
+ *
+ * Compressed and encrypted files are not supported.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+#include "partition_reader.h"
+#include "volume_files.h"
+
+/**
+ * @brief MFT record number of the root directory
+ */
+const uint64_t NTFS_ROOT_RECORD = 5;
+
+/**
+ * @brief Number of MFT records reserved for NTFS metadata files
+ */
+const uint64_t NTFS_RESERVED_RECORDS = 16;
+
+/**
+ * @brief NTFS attribute types used by the reader
+ */
+const uint32_t NTFS_ATTRIBUTE_LIST = 0x20;
+const uint32_t NTFS_FILE_NAME = 0x30;
+const uint32_t NTFS_DATA = 0x80;
+const uint32_t NTFS_INDEX_ROOT = 0x90;
+const uint32_t NTFS_INDEX_ALLOCATION = 0xA0;
+const uint32_t NTFS_BITMAP = 0xB0;
+const uint32_t NTFS_END_OF_ATTRIBUTES = 0xFFFFFFFF;
+
+/**
+ * @brief A run of clusters of a non-resident attribute
+ */
+struct NtfsDataRun
+{
+    uint64_t vcn = 0;           // First virtual cluster of the run
+    uint64_t lcn = 0;           // First logical cluster of the run, unless sparse
+    uint64_t length = 0;        // Number of clusters
+    bool sparse = false;        // Whether the run is unallocated and reads as zeros
+};
+
+/**
+ * @brief An attribute of an MFT record
+ *
+ * For non-resident attributes split across several records by an attribute
+ * list, the runs of every part are merged.
+ */
+struct NtfsAttribute
+{
+    uint32_t type = 0;                      // Attribute type
+    std::string name;                       // Attribute name, UTF-8, empty for the unnamed stream
+    uint16_t flags = 0;                     // Compressed, encrypted and sparse flags
+    bool resident = false;                  // Whether the value is held in the record
+    std::vector<uint8_t> value;             // Value of a resident attribute
+    std::vector<NtfsDataRun> runs;          // Runs of a non-resident attribute, by VCN
+    uint64_t dataSize = 0;                  // Length of the value in bytes
+    uint64_t initializedSize = 0;           // Bytes of the value that have been written; the rest reads as zeros
+};
+
+/**
+ * @brief An NTFS volume opened for reading
+ */
+struct NtfsVolume
+{
+    PartitionReader* reader = nullptr;      // Reader of the partition holding the volume
+    uint64_t volumeOffset = 0;              // Offset of the boot sector in the partition
+    uint32_t bytesPerSector = 0;            // Sector size from the boot sector
+    uint32_t clusterSize = 0;               // Cluster size in bytes
+    uint32_t recordSize = 0;                // MFT record size in bytes
+    uint32_t indexBlockSize = 0;            // Directory index block size in bytes
+    std::vector<NtfsDataRun> mftRuns;       // Runs of the $MFT data stream
+    uint64_t mftSize = 0;                   // Length of the $MFT data stream in bytes
+};
+
+/**
+ * @brief Opens the NTFS volume of a partition
+ *
+ * Reads the boot sector and the $MFT record to locate the master file table.
+ *
+ * @param volume Output parameter for the volume
+ * @param reader Reader of the partition, which must outlive the volume
+ * @throws std::runtime_error if the partition does not hold an NTFS volume
+ */
+void openNtfsVolume(NtfsVolume& volume, PartitionReader& reader);
+
+/**
+ * @brief Returns the attributes of a file, following its attribute list
+ *
+ * @param volume The opened volume
+ * @param recordNumber MFT record number of the file
+ * @return std::vector<NtfsAttribute> The attributes
+ * @throws std::runtime_error if a record is corrupt
+ */
+std::vector<NtfsAttribute> readNtfsAttributes(NtfsVolume& volume, uint64_t recordNumber);
+
+/**
+ * @brief Lists a directory
+ *
+ * Entries for NTFS metadata files, DOS short names and the directory itself
+ * are left out.
+ *
+ * @param volume The opened volume
+ * @param recordNumber MFT record number of the directory
+ * @return std::vector<VolumeEntry> The entries of the directory
+ */
+std::vector<VolumeEntry> listNtfsDirectory(NtfsVolume& volume, uint64_t recordNumber);
+
+/**
+ * @brief Writes the unnamed data stream of a file to a stream
+ *
+ * @param volume The opened volume
+ * @param recordNumber MFT record number of the file
+ * @param out Stream that receives the file contents
+ * @throws std::runtime_error if the file is compressed or encrypted, or cannot be read
+ */
+void readNtfsFile(NtfsVolume& volume, uint64_t recordNumber, std::ostream& out);
+
+/**
+ * @brief Describes an opened NTFS volume as a VolumeFileSystem
+ *
+ * @param fileSystem Output parameter for the file system operations
+ * @param volume The opened volume, which must outlive fileSystem
+ */
+void getNtfsFileSystem(VolumeFileSystem& fileSystem, NtfsVolume& volume);
@@ -0,0 +1,185 @@
+/**
+ * @file partition_reader.cpp
+ * @brief Implementation of random access reads through a backup set
+ *
+ * File system metadata is read in small pieces that cluster together, such
+ * as consecutive MFT records or inode table entries, so the last few blocks
+ * read are kept decoded and reused.
+ */
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+
+#include "../file_handler/file_handler.h"
+#include "partition_reader.h"
+
+/**
+ * @brief Reads a stored block from its backup file
+ *
+ * @param reader The reader the block is read for
+ * @param block The block to read
+ * @param buffer Buffer that receives block.block_length bytes
+ */
+void readStoredBlock(PartitionReader& reader, const DataBlockIndexElement& block, uint8_t* buffer)
+{
+    BackupFilePtr backupFile = GetBackupFile(reader.backupSet, block, reader.fileCache);
+    setFilePointer(*backupFile, block.file_position, std::ios::beg);
+    readFile(*backupFile, buffer, block.block_length);
+    reader.bytesRead += block.block_length;
+    reader.blocksRead++;
+}
+
+/**
+ * @brief Opens a partition of a backup for random access reads
+ *
+ * @param reader Output parameter for the reader
+ * @param backupFilePath Path of the restore point's backup file
+ * @param partition The partition layout from the restore point
+ * @param diskIndex Index of the disk holding the partition
+ * @param bytesPerSector Sector size of the disk
+ * @throws std::runtime_error if the backup set cannot be resolved
+ */
+void openPartitionReader(PartitionReader& reader, const std::string& backupFilePath, file_structs::Partition::Partition_Layout& partition,
+    int diskIndex, uint32_t bytesPerSector)
+{
+    BuildLazyPartitionBackupSet(reader.backupSet, backupFilePath, partition, diskIndex);
+
+    reader.partitionLength = partition._geometry.length;
+    reader.bootSectorOffset = partition._geometry.boot_sector_offset;
+    reader.lcn0Offset = partition._file_system.lcn0_offset - partition._file_system.start;
+    reader.blockSize = partition._header.block_size;
+    reader.bytesPerSector = bytesPerSector;
+    reader.blockCount = GetBackupSetBlockCount(reader.backupSet);
+    if (reader.blockSize == 0) { throw std::runtime_error("Invalid partition block size."); }
+
+    // Reserved sectors are read on demand like the data blocks; on FAT they hold the allocation tables, which can be large
+    reader.reservedLength = partition._file_system.reserved_sectors_byte_length;
+    reader.reservedSectorBlocks.clear();
+    reader.reservedBlockOffsets.clear();
+    uint64_t reservedOffset = 0;
+    for (auto& reservedSectorBlock : partition.reserved_sectors) {
+        if (reservedOffset >= reader.reservedLength) { break; }
+        reader.reservedSectorBlocks.push_back(reservedSectorBlock);
+        reader.reservedBlockOffsets.push_back(reservedOffset);
+        reservedOffset += reservedSectorBlock.block_length;
+    }
+    reader.reservedLength = std::min(reader.reservedLength, reservedOffset);
+}
+
+/**
+ * @brief Returns a stored block, reading it if it is not cached
+ *
+ * Blocks of the block map are only resolved to their backup file when they
+ * are not cached.
+ *
+ * @param reader The opened reader
+ * @param reserved Whether the block holds reserved sectors rather than a block of the block map
+ * @param blockIndex Index of the block in the block map or in the reserved sector blocks
+ * @return const std::vector<uint8_t>* The block contents, padded with zeros to the block size, or nullptr if no data was backed up for the block
+ */
+const std::vector<uint8_t>* getPartitionBlock(PartitionReader& reader, bool reserved, BlockIndex blockIndex)
+{
+    reader.useCount++;
+    for (auto& cached : reader.blockCache) {
+        if (cached.reserved == reserved && cached.blockIndex == blockIndex) {
+            cached.lastUse = reader.useCount;
+            return &cached.data;
+        }
+    }
+
+    const DataBlockIndexElement* block = reserved ? &reader.reservedSectorBlocks[blockIndex] : ResolveBackupSetBlock(reader.backupSet, blockIndex);
+    if (block == nullptr || block->block_length == 0) { return nullptr; }
+
+    CachedPartitionBlock* slot;
+    if (reader.blockCache.size() < std::max<size_t>(reader.maxCachedBlocks, 1)) {
+        reader.blockCache.emplace_back();
+        slot = &reader.blockCache.back();
+    }
+    else {
+        slot = &*std::min_element(reader.blockCache.begin(), reader.blockCache.end(),
+            [](const CachedPartitionBlock& a, const CachedPartitionBlock& b) { return a.lastUse < b.lastUse; });
+    }
+
+    slot->reserved = reserved;
+    slot->blockIndex = blockIndex;
+    slot->lastUse = reader.useCount;
+    slot->data.assign(std::max(reader.blockSize, block->block_length), 0);
+    readStoredBlock(reader, *block, slot->data.data());
+    return &slot->data;
+}
+
+/**
+ * @brief Reads a byte range of a partition
+ *
+ * Stored blocks take precedence over the reserved sectors, as they do when
+ * restoreDisk writes both.
+ *
+ * @param reader The opened reader
+ * @param offset Offset of the range in the partition
+ * @param buffer Buffer that receives the bytes
+ * @param length Number of bytes to read
+ * @throws std::runtime_error if the range lies outside the partition or a block cannot be read
+ */
+void readPartition(PartitionReader& reader, uint64_t offset, void* buffer, size_t length)
+{
+    if (offset > reader.partitionLength || length > reader.partitionLength - offset) {
+        std::cerr << "Read of " << length << " bytes at offset " << offset << " is outside the partition\n";
+        throw std::runtime_error("Read outside the partition.");
+    }
+
+    uint8_t* out = static_cast<uint8_t*>(buffer);
+    uint64_t reservedEnd = reader.bootSectorOffset + reader.reservedLength;
+
+    while (length > 0) {
+        size_t pieceLength = length;
+        bool copied = false;
+
+        if (offset >= reader.lcn0Offset) {
+            uint64_t blockNumber = (offset - reader.lcn0Offset) / reader.blockSize;
+            uint64_t blockOffset = (offset - reader.lcn0Offset) % reader.blockSize;
+            pieceLength = static_cast<size_t>(std::min<uint64_t>(length, reader.blockSize - blockOffset));
+            const std::vector<uint8_t>* data = blockNumber < reader.blockCount ?
+                getPartitionBlock(reader, false, static_cast<BlockIndex>(blockNumber)) : nullptr;
+            if (data != nullptr) {
+                memcpy(out, data->data() + blockOffset, pieceLength);
+                copied = true;
+            }
+        }
+        else {
+            pieceLength = static_cast<size_t>(std::min<uint64_t>(length, reader.lcn0Offset - offset));
+        }
+
+        if (!copied && offset >= reader.bootSectorOffset && offset < reservedEnd) {
+            uint64_t reservedOffset = offset - reader.bootSectorOffset;
+            auto next = std::upper_bound(reader.reservedBlockOffsets.begin(), reader.reservedBlockOffsets.end(), reservedOffset);
+            size_t reservedBlock = static_cast<size_t>(next - reader.reservedBlockOffsets.begin()) - 1;
+            uint64_t blockOffset = reservedOffset - reader.reservedBlockOffsets[reservedBlock];
+            pieceLength = static_cast<size_t>(std::min<uint64_t>({ pieceLength, reservedEnd - offset,
+                reader.reservedSectorBlocks[reservedBlock].block_length - blockOffset }));
+            const std::vector<uint8_t>* data = getPartitionBlock(reader, true, static_cast<BlockIndex>(reservedBlock));
+            memcpy(out, data->data() + blockOffset, pieceLength);
+            copied = true;
+        }
+        else if (!copied && offset < reader.bootSectorOffset) {
+            pieceLength = static_cast<size_t>(std::min<uint64_t>(pieceLength, reader.bootSectorOffset - offset));
+        }
+
+        if (!copied) { memset(out, 0, pieceLength); }
+        out += pieceLength;
+        offset += pieceLength;
+        length -= pieceLength;
+    }
+}
+
+/**
+ * @brief Closes the backup files and drops the cached blocks of a reader
+ *
+ * @param reader The reader to close
+ */
+void closePartitionReader(PartitionReader& reader)
+{
+    CloseBackupFileCache(reader.fileCache);
+    reader.blockCache.clear();
+}
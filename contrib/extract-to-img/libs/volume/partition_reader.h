@@ -0,0 +1,103 @@
+/**
+ * @file partition_reader.h
+ * @brief Random access to a partition through its backup set
+ *
+ * This file declares a reader that serves byte ranges of a backed up
+ * partition straight from the backup files. The block map of the backup set
+ * is not built; each block is resolved to the chain file holding it when it
+ * is first read, so opening a partition costs little even on long chains.
+ * Only the blocks covering a requested range are read, so file system
+ * readers can walk their metadata and extract single files without
+ * restoring the partition.
+ *
+ * Offsets are relative to the start of the partition and follow the layout
+ * restoreDisk writes: the reserved sectors at the boot sector offset, then
+ * block i of the block map at the LCN 0 offset plus i block sizes. Ranges
+ * that are not held in the backup read as zeros.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "../img_handler/file_struct.h"
+#include "../restore/backup_file_cache.h"
+#include "../restore/backup_set.h"
+
+/**
+ * @brief Default number of decoded blocks kept by a partition reader
+ */
+const size_t DEFAULT_MAX_CACHED_BLOCKS = 16;
+
+/**
+ * @brief A data block held in a partition reader's cache
+ */
+struct CachedPartitionBlock
+{
+    bool reserved = false;              // Whether the block holds reserved sectors rather than a block of the block map
+    BlockIndex blockIndex = 0;          // Index of the block in the block map or in the reserved sector blocks
+    uint64_t lastUse = 0;               // Reader use count when the block was last read from
+    std::vector<uint8_t> data;          // Block contents, padded to the block size
+};
+
+/**
+ * @brief A partition opened for random access reads
+ *
+ * Not safe for concurrent reads from several threads.
+ */
+struct PartitionReader
+{
+    PartitionBackupSet backupSet;                   // Resolved backup set of the partition
+    BackupFileCache fileCache;                      // Backup files opened by the reader
+    uint64_t partitionLength = 0;                   // Length of the partition in bytes
+    uint64_t bootSectorOffset = 0;                  // Offset of the boot sector in the partition
+    uint64_t lcn0Offset = 0;                        // Offset of the first block in the partition
+    uint32_t blockSize = 0;                         // Size of each block of the block map
+    size_t blockCount = 0;                          // Number of blocks in the block map
+    uint32_t bytesPerSector = 0;                    // Sector size of the disk
+    uint64_t reservedLength = 0;                    // Length of the reserved sectors stored before the blocks, if any
+    std::vector<DataBlockIndexElement> reservedSectorBlocks;  // Stored blocks of the reserved sectors
+    std::vector<uint64_t> reservedBlockOffsets;     // Offset of each reserved sector block in the reserved sectors
+    std::vector<CachedPartitionBlock> blockCache;   // Recently read blocks
+    size_t maxCachedBlocks = DEFAULT_MAX_CACHED_BLOCKS;  // Maximum number of cached blocks
+    uint64_t useCount = 0;                          // Number of block lookups, for least-recently-used eviction
+    uint64_t bytesRead = 0;                         // Bytes read from backup files so far
+    uint64_t blocksRead = 0;                        // Blocks read from backup files so far
+};
+
+/**
+ * @brief Opens a partition of a backup for random access reads
+ *
+ * Finds the backup files of the partition and indexes their delta blocks
+ * for on-demand resolution. Neither the reserved sectors nor the data
+ * blocks are read until they are requested.
+ *
+ * @param reader Output parameter for the reader
+ * @param backupFilePath Path of the restore point's backup file
+ * @param partition The partition layout from the restore point
+ * @param diskIndex Index of the disk holding the partition
+ * @param bytesPerSector Sector size of the disk
+ * @throws std::runtime_error if the backup set cannot be resolved
+ */
+void openPartitionReader(PartitionReader& reader, const std::string& backupFilePath, file_structs::Partition::Partition_Layout& partition,
+    int diskIndex, uint32_t bytesPerSector);
+
+/**
+ * @brief Reads a byte range of a partition
+ *
+ * @param reader The opened reader
+ * @param offset Offset of the range in the partition
+ * @param buffer Buffer that receives the bytes
+ * @param length Number of bytes to read
+ * @throws std::runtime_error if the range lies outside the partition or a block cannot be read
+ */
+void readPartition(PartitionReader& reader, uint64_t offset, void* buffer, size_t length);
+
+/**
+ * @brief Closes the backup files and drops the cached blocks of a reader
+ *
+ * @param reader The reader to close
+ */
+void closePartitionReader(PartitionReader& reader);
@@ -0,0 +1,158 @@
+/**
+ * @file volume_files.cpp
+ * @brief Implementation of file system independent file extraction
+ */
+
+#include <algorithm>
+#include <cctype>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+
+#include "volume_files.h"
+
+/**
+ * @brief Appends a code point to a UTF-8 string
+ *
+ * @param out The string to append to
+ * @param codePoint The code point
+ */
+void appendUtf8(std::string& out, uint32_t codePoint)
+{
+    if (codePoint < 0x80) {
+        out.push_back(static_cast<char>(codePoint));
+    }
+    else if (codePoint < 0x800) {
+        out.push_back(static_cast<char>(0xC0 | (codePoint >> 6)));
+        out.push_back(static_cast<char>(0x80 | (codePoint & 0x3F)));
+    }
+    else if (codePoint < 0x10000) {
+        out.push_back(static_cast<char>(0xE0 | (codePoint >> 12)));
+        out.push_back(static_cast<char>(0x80 | ((codePoint >> 6) & 0x3F)));
+        out.push_back(static_cast<char>(0x80 | (codePoint & 0x3F)));
+    }
+    else {
+        out.push_back(static_cast<char>(0xF0 | (codePoint >> 18)));
+        out.push_back(static_cast<char>(0x80 | ((codePoint >> 12) & 0x3F)));
+        out.push_back(static_cast<char>(0x80 | ((codePoint >> 6) & 0x3F)));
+        out.push_back(static_cast<char>(0x80 | (codePoint & 0x3F)));
+    }
+}
+
+/**
+ * @brief Converts a UTF-16LE name to UTF-8
+ *
+ * @param data Pointer to the UTF-16LE code units
+ * @param length Number of code units
+ * @return std::string The name in UTF-8
+ */
+std::string utf16ToUtf8(const uint8_t* data, size_t length)
+{
+    std::string out;
+    out.reserve(length);
+    for (size_t i = 0; i < length; i++) {
+        uint32_t unit = readLittleEndian16(data + i * 2);
+        if (unit >= 0xD800 && unit < 0xDC00 && i + 1 < length) {
+            uint32_t low = readLittleEndian16(data + (i + 1) * 2);
+            if (low >= 0xDC00 && low < 0xE000) {
+                appendUtf8(out, 0x10000 + ((unit - 0xD800) << 10) + (low - 0xDC00));
+                i++;
+                continue;
+            }
+        }
+        appendUtf8(out, (unit >= 0xD800 && unit < 0xE000) ? 0xFFFD : unit);
+    }
+    return out;
+}
+
+/**
+ * @brief Compares two names
+ *
+ * Case-insensitive comparison folds ASCII letters only, which covers the
+ * names of system and user directories in practice.
+ *
+ * @param a First name
+ * @param b Second name
+ * @param caseSensitive Whether to compare case sensitively
+ * @return true if the names match
+ */
+bool volumeNamesMatch(const std::string& a, const std::string& b, bool caseSensitive)
+{
+    if (caseSensitive) { return a == b; }
+    return a.size() == b.size() && std::equal(a.begin(), a.end(), b.begin(), [](unsigned char x, unsigned char y) {
+        return std::tolower(x) == std::tolower(y);
+    });
+}
+
+/**
+ * @brief Looks up a path on a volume
+ *
+ * @param fileSystem The volume
+ * @param path The path to look up
+ * @param entry Output parameter for the entry
+ * @return false if a component of the path does not exist
+ */
+bool findVolumePath(const VolumeFileSystem& fileSystem, const std::string& path, VolumeEntry& entry)
+{
+    entry = fileSystem.root;
+    size_t position = 0;
+    while (position < path.size()) {
+        size_t separator = path.find_first_of("/\\", position);
+        if (separator == std::string::npos) { separator = path.size(); }
+        std::string component = path.substr(position, separator - position);
+        position = separator + 1;
+        if (component.empty() || component == ".") { continue; }
+
+        if (!entry.isDirectory) { return false; }
+        bool found = false;
+        for (auto& child : fileSystem.listDirectory(entry)) {
+            if (volumeNamesMatch(child.name, component, fileSystem.caseSensitive)) {
+                entry = child;
+                found = true;
+                break;
+            }
+        }
+        if (!found) { return false; }
+    }
+    return true;
+}
+
+/**
+ * @brief Extracts a file, or a directory and everything below it, to a local directory
+ *
+ * The root directory is extracted into outputDir itself rather than into a
+ * subdirectory of it.
+ *
+ * @param fileSystem The volume
+ * @param entry The file or directory to extract
+ * @param outputDir Local directory that receives the entry
+ * @return uint64_t Number of files extracted
+ * @throws std::runtime_error if a file cannot be read or written
+ */
+uint64_t extractVolumeEntry(const VolumeFileSystem& fileSystem, const VolumeEntry& entry, const std::filesystem::path& outputDir)
+{
+    std::filesystem::path target = entry.name.empty() ? outputDir : outputDir / std::filesystem::u8path(entry.name);
+
+    if (entry.isDirectory) {
+        std::filesystem::create_directories(target);
+        uint64_t fileCount = 0;
+        for (auto& child : fileSystem.listDirectory(entry)) {
+            fileCount += extractVolumeEntry(fileSystem, child, target);
+        }
+        return fileCount;
+    }
+
+    std::filesystem::create_directories(outputDir);
+    std::ofstream out(target, std::ios::out | std::ios::trunc | std::ios::binary);
+    if (!out) {
+        std::cerr << "Failed to create " << target.string() << "\n";
+        throw std::runtime_error("Failed to create file.");
+    }
+    fileSystem.readFile(entry, out);
+    out.close();
+    if (out.fail()) {
+        std::cerr << "Failed to write " << target.string() << "\n";
+        throw std::runtime_error("Failed to write file.");
+    }
+    return 1;
+}
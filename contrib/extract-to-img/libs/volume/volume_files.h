@@ -0,0 +1,106 @@
+/**
+ * @file volume_files.h
+ * @brief File system independent file extraction from backed up volumes
+ *
+ * Each file system reader describes its volume as a VolumeFileSystem: the
+ * root directory and functions to list a directory and read a file. Path
+ * lookup and extraction of files and directory trees to the local file
+ * system are implemented once on top of that.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <functional>
+#include <ostream>
+#include <string>
+#include <vector>
+
+/**
+ * @brief Size of the pieces file contents are read and written in
+ */
+const size_t VOLUME_FILE_CHUNK_SIZE = 1024 * 1024;
+
+/**
+ * @brief A file or directory of a backed up volume
+ */
+struct VolumeEntry
+{
+    std::string name;           // Name of the entry in its directory, UTF-8
+    uint64_t id = 0;            // File system specific identifier, such as an MFT record or inode number
+    uint64_t location = 0;      // Additional file system specific location, such as a first cluster
+    bool isDirectory = false;   // Whether the entry is a directory
+    uint64_t size = 0;          // Length of the file in bytes
+};
+
+/**
+ * @brief The operations of a file system reader
+ */
+struct VolumeFileSystem
+{
+    VolumeEntry root;                                                               // The root directory
+    bool caseSensitive = false;                                                     // Whether names are compared case sensitively
+    std::function<std::vector<VolumeEntry>(const VolumeEntry&)> listDirectory;      // Returns the entries of a directory, without . and ..
+    std::function<void(const VolumeEntry&, std::ostream&)> readFile;                // Writes the contents of a file to a stream
+};
+
+/**
+ * @brief Reads a little-endian 16-bit value
+ *
+ * @param data Pointer to the value
+ * @return uint16_t The value
+ */
+inline uint16_t readLittleEndian16(const uint8_t* data) { return static_cast<uint16_t>(data[0] | (data[1] << 8)); }
+
+/**
+ * @brief Reads a little-endian 32-bit value
+ *
+ * @param data Pointer to the value
+ * @return uint32_t The value
+ */
+inline uint32_t readLittleEndian32(const uint8_t* data) { return readLittleEndian16(data) | (static_cast<uint32_t>(readLittleEndian16(data + 2)) << 16); }
+
+/**
+ * @brief Reads a little-endian 64-bit value
+ *
+ * @param data Pointer to the value
+ * @return uint64_t The value
+ */
+inline uint64_t readLittleEndian64(const uint8_t* data) { return readLittleEndian32(data) | (static_cast<uint64_t>(readLittleEndian32(data + 4)) << 32); }
+
+/**
+ * @brief Converts a UTF-16LE name to UTF-8
+ *
+ * Unpaired surrogates are replaced with U+FFFD.
+ *
+ * @param data Pointer to the UTF-16LE code units
+ * @param length Number of code units
+ * @return std::string The name in UTF-8
+ */
+std::string utf16ToUtf8(const uint8_t* data, size_t length);
+
+/**
+ * @brief Looks up a path on a volume
+ *
+ * Components may be separated by '/' or '\\'. An empty path or "/" is the
+ * root directory.
+ *
+ * @param fileSystem The volume
+ * @param path The path to look up
+ * @param entry Output parameter for the entry
+ * @return false if a component of the path does not exist
+ */
+bool findVolumePath(const VolumeFileSystem& fileSystem, const std::string& path, VolumeEntry& entry);
+
+/**
+ * @brief Extracts a file, or a directory and everything below it, to a local directory
+ *
+ * @param fileSystem The volume
+ * @param entry The file or directory to extract
+ * @param outputDir Local directory that receives the entry
+ * @return uint64_t Number of files extracted
+ * @throws std::runtime_error if a file cannot be read or written
+ */
+uint64_t extractVolumeEntry(const VolumeFileSystem& fileSystem, const VolumeEntry& entry, const std::filesystem::path& outputDir);
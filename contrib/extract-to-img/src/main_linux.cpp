@@ -7,15 +7,74 @@
  * them as loop devices for data access.
  */
 
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <functional>
 #include <iostream>
 #include <filesystem>
+#include <sstream>
 #include <string>
+#include <unistd.h>
+#include <vector>
 
 #include "../libs/img_handler/file_struct.h"
 #include "../libs/img_handler/img_handler.h"
+#include "../libs/restore/block_map_cache.h"
 #include "../libs/restore/restore.h"
 
+#include "../libs/block_device/block_device.h"
+#include "../libs/instant_restore/instant_restore.h"
 #include "../libs/linux_virtdisk_handler/linux_virtdisk_handler.h"
+#include "../libs/nbd_server/nbd_server.h"
+#include "../libs/qcow2_writer/qcow2_writer.h"
+#include "../libs/shard_restore/shard_restore.h"
+#include "../libs/vhdx_writer/vhdx_writer.h"
+
+/**
+ * @brief Runs a restore while a separate thread reports its progress to stderr
+ * 
+ * @param options Options controlling the restore; nothing is reported without options.progress
+ * @param progressInterval Time between progress reports
+ * @param restore The restore to run
+ */
+void runWithProgress(const RestoreOptions& options, std::chrono::milliseconds progressInterval, const std::function<void()>& restore)
+{
+    ProgressReporter reporter;
+    if (options.progress != nullptr) {
+        startProgressReporter(reporter, *options.progress, std::cerr, progressInterval);
+    }
+    try {
+        restore();
+    }
+    catch (...) {
+        stopProgressReporter(reporter);
+        throw;
+    }
+    stopProgressReporter(reporter);
+}
+
+/**
+ * @brief Writes the restore metrics reports that were asked for
+ * 
+ * @param options Options the restore ran with; nothing is written without options.metrics
+ * @param metricsJSONPath Path of the JSON metrics report, or empty
+ * @param metricsPrometheusPath Path of the Prometheus metrics textfile, or empty
+ * @param messages Stream the reports written are announced on
+ */
+void writeMetricsReports(const RestoreOptions& options, const std::string& metricsJSONPath, const std::string& metricsPrometheusPath,
+    std::ostream& messages = std::cout)
+{
+    if (options.metrics != nullptr && !metricsJSONPath.empty()) {
+        writeMetricsJSON(*options.metrics, metricsJSONPath);
+        messages << "Wrote metrics to " << metricsJSONPath << std::endl;
+    }
+    if (options.metrics != nullptr && !metricsPrometheusPath.empty()) {
+        writeMetricsPrometheus(*options.metrics, metricsPrometheusPath);
+        messages << "Wrote metrics to " << metricsPrometheusPath << std::endl;
+    }
+}
 
 /**
  * @brief Handles the restoration process on Linux systems
@@ -23,34 +82,71 @@
  * This function performs the following steps:
  * 1. Reads the backup file layout
  * 2. Creates a raw disk image file
- * 3. Restores the backup to the image file
+ * 3. Restores the backup to the image file, reporting progress to stderr
  * 4. Mounts the image as a loop device
  * 5. Waits for user input before unmounting
  * 
+ * Restore metrics are written once the image is restored, when a report
+ * path is given.
+ * 
+ * When partitionImages is set, the partitions in options.partitionNumbers
+ * are restored into standalone images named partition<N>.img instead, and
+ * nothing is mounted.
+ * 
  * @param backupFileName Path to the Macrium Reflect backup file
+ * @param options Options controlling the restore
+ * @param partitionImages Whether to restore standalone partition images rather than the disk
+ * @param metricsJSONPath Path of the JSON metrics report, or empty
+ * @param metricsPrometheusPath Path of the Prometheus metrics textfile, or empty
+ * @param progressInterval Time between progress reports
  */
-void handleLinuxRestore(std::string backupFileName)
+void handleLinuxRestore(std::string backupFileName, const RestoreOptions& options, bool partitionImages, const std::string& metricsJSONPath,
+    const std::string& metricsPrometheusPath, std::chrono::milliseconds progressInterval)
 {
     // Read the backup file structure
     file_structs::File_Layout fileLayout;
     readBackupFileLayout(fileLayout, backupFileName);
 
-    // Create output image file in current directory
+    // Create output image files in current directory
     std::filesystem::path curPath = std::filesystem::current_path();
     std::string imgPath = curPath.string() + "/test.img";
-
-    // Create empty image file with correct geometry
-    CreateIMG(imgPath, fileLayout.disks[0]._geometry.disk_size, fileLayout.disks[0]._geometry.bytes_per_sector);
+    std::vector<PartitionImageTarget> partitionTargets;
+    if (partitionImages) {
+        for (int32_t partitionNumber : options.partitionNumbers) {
+            partitionTargets.push_back({ partitionNumber, curPath.string() + "/partition" + std::to_string(partitionNumber) + ".img" });
+        }
+    }
+    else {
+        // Create empty image file with correct geometry
+        CreateIMG(imgPath, fileLayout.disks[0]._geometry.disk_size, fileLayout.disks[0]._geometry.bytes_per_sector);
+    }
 
     std::cout << "Working directory: " << curPath << std::endl;
 
-    // Restore backup to image file
+    // Restore backup to image files, reporting progress from a separate thread
     std::string loopFilePath;
-    restoreDisk(backupFileName, imgPath, fileLayout, 0);
-    std::cout << "Restored backup to .img file" << std::endl;
+    runWithProgress(options, progressInterval, [&]() {
+        if (partitionImages) {
+            restorePartitionImages(backupFileName, partitionTargets, fileLayout, 0, options);
+        }
+        else {
+            restoreDisk(backupFileName, imgPath, fileLayout, 0, options);
+        }
+    });
+    if (partitionImages) {
+        for (auto& target : partitionTargets) {
+            std::cout << "Restored partition " << target.partitionNumber << " to " << target.imagePath << std::endl;
+        }
+    }
+    else {
+        std::cout << "Restored backup to .img file" << std::endl;
+    }
+
+    writeMetricsReports(options, metricsJSONPath, metricsPrometheusPath);
+    if (partitionImages) { return; }
 
     // Mount the image file
-    MountIMG(imgPath, loopFilePath);
+    MountIMG(imgPath, loopFilePath, fileLayout.disks[0]._geometry.bytes_per_sector);
     std::cout << "Mounted .img to: " << loopFilePath << std::endl;
 
     // Wait for user input before unmounting
@@ -62,6 +158,486 @@ void handleLinuxRestore(std::string backupFileName)
     std::cout << "Unmounted .img" << std::endl;
 }
 
+/**
+ * @brief Restores a backup straight onto a block device
+ * 
+ * The disk, or with partitionImage the single partition in
+ * options.partitionNumbers, is written from the start of the device. Ranges
+ * of the restored partitions that hold no backup data are cleared as
+ * unusedSpace says rather than written with zeros. Nothing is mounted.
+ * 
+ * @param backupFileName Path to the Macrium Reflect backup file
+ * @param devicePath Path of the block device to restore onto
+ * @param unusedSpace How ranges without backup data are cleared
+ * @param options Options controlling the restore
+ * @param partitionImage Whether to write a single partition rather than the disk
+ * @param metricsJSONPath Path of the JSON metrics report, or empty
+ * @param metricsPrometheusPath Path of the Prometheus metrics textfile, or empty
+ * @param progressInterval Time between progress reports
+ * @throws std::runtime_error if the device is too small or cannot be written
+ */
+void handleDeviceRestore(std::string backupFileName, const std::string& devicePath, UnusedSpaceMode unusedSpace, const RestoreOptions& options,
+    bool partitionImage, const std::string& metricsJSONPath, const std::string& metricsPrometheusPath, std::chrono::milliseconds progressInterval)
+{
+    file_structs::File_Layout fileLayout;
+    readBackupFileLayout(fileLayout, backupFileName);
+
+    uint64_t requiredSize = fileLayout.disks[0]._geometry.disk_size;
+    if (partitionImage) {
+        for (auto& partition : fileLayout.disks[0].partitions) {
+            if (partition._header.partition_number == options.partitionNumbers[0]) { requiredSize = partition._geometry.length; }
+        }
+    }
+
+    BlockDevice device;
+    openBlockDevice(device, devicePath, unusedSpace, options.writeBehindBytes);
+    std::cout << "Restoring to " << devicePath << ": " << device.size << " bytes, " << device.logicalSectorSize << " byte logical and "
+              << device.physicalSectorSize << " byte physical sectors" << std::endl;
+    if (device.size < requiredSize) {
+        closeBlockDevice(device);
+        std::cerr << devicePath << " holds " << device.size << " bytes but the restore needs " << requiredSize << "\n";
+        throw std::runtime_error("Block device is too small.");
+    }
+
+    RestoreTarget target;
+    getBlockDeviceRestoreTarget(target, device);
+    try {
+        runWithProgress(options, progressInterval, [&]() {
+            if (partitionImage) {
+                restorePartitionToTarget(backupFileName, options.partitionNumbers[0], target, fileLayout, 0, options);
+            }
+            else {
+                restoreDiskToTarget(backupFileName, target, fileLayout, 0, options);
+            }
+        });
+    }
+    catch (...) {
+        closeBlockDevice(device);
+        throw;
+    }
+    closeBlockDevice(device);
+    std::cout << "Restored backup to " << devicePath << ": wrote " << device.bytesWritten << " bytes, cleared " << device.bytesCleared
+              << " bytes" << std::endl;
+
+    writeMetricsReports(options, metricsJSONPath, metricsPrometheusPath);
+}
+
+/**
+ * @brief Restores a backup into a sparse qcow2 image
+ * 
+ * The image is written as test.qcow2 in the current directory, with host
+ * clusters only for the data in the backup, ready to attach to a KVM
+ * guest. Nothing is mounted.
+ * 
+ * @param backupFileName Path to the Macrium Reflect backup file
+ * @param compression Compression of the image's clusters
+ * @param options Options controlling the restore
+ * @param metricsJSONPath Path of the JSON metrics report, or empty
+ * @param metricsPrometheusPath Path of the Prometheus metrics textfile, or empty
+ * @param progressInterval Time between progress reports
+ */
+void handleQcow2Restore(std::string backupFileName, Qcow2Compression compression, const RestoreOptions& options, const std::string& metricsJSONPath,
+    const std::string& metricsPrometheusPath, std::chrono::milliseconds progressInterval)
+{
+    file_structs::File_Layout fileLayout;
+    readBackupFileLayout(fileLayout, backupFileName);
+
+    std::string imagePath = std::filesystem::current_path().string() + "/test.qcow2";
+    Qcow2Writer writer;
+    openQcow2Writer(writer, imagePath, fileLayout.disks[0]._geometry.disk_size, compression);
+
+    RestoreTarget target;
+    getQcow2RestoreTarget(target, writer);
+    runWithProgress(options, progressInterval, [&]() { restoreDiskToTarget(backupFileName, target, fileLayout, 0, options); });
+    closeQcow2Writer(writer);
+    std::cout << "Restored backup to " << imagePath << ": " << writer.dataClusters << " clusters stored, " << writer.compressedClusters
+              << " compressed" << std::endl;
+
+    writeMetricsReports(options, metricsJSONPath, metricsPrometheusPath);
+}
+
+/**
+ * @brief Restores a backup into a dynamic VHDX image
+ * 
+ * The image is written as test.vhdx in the current directory, with payload
+ * blocks only for the parts of the disk holding backup data, ready to
+ * attach to a Hyper-V guest or copy to Windows. Nothing is mounted.
+ * 
+ * @param backupFileName Path to the Macrium Reflect backup file
+ * @param options Options controlling the restore
+ * @param metricsJSONPath Path of the JSON metrics report, or empty
+ * @param metricsPrometheusPath Path of the Prometheus metrics textfile, or empty
+ * @param progressInterval Time between progress reports
+ */
+void handleVhdxRestore(std::string backupFileName, const RestoreOptions& options, const std::string& metricsJSONPath,
+    const std::string& metricsPrometheusPath, std::chrono::milliseconds progressInterval)
+{
+    file_structs::File_Layout fileLayout;
+    readBackupFileLayout(fileLayout, backupFileName);
+
+    std::string imagePath = std::filesystem::current_path().string() + "/test.vhdx";
+    VhdxWriter writer;
+    openVhdxWriter(writer, imagePath, fileLayout.disks[0]._geometry.disk_size, fileLayout.disks[0]._geometry.bytes_per_sector);
+
+    RestoreTarget target;
+    getVhdxRestoreTarget(target, writer);
+    runWithProgress(options, progressInterval, [&]() { restoreDiskToTarget(backupFileName, target, fileLayout, 0, options); });
+    closeVhdxWriter(writer);
+    std::cout << "Restored backup to " << imagePath << ": " << writer.allocatedBlocks << " payload blocks allocated" << std::endl;
+
+    writeMetricsReports(options, metricsJSONPath, metricsPrometheusPath);
+}
+
+/**
+ * @brief Options passed on to the worker processes of a sharded restore
+ */
+const char* const SHARD_WORKER_OPTIONS[] = { "--max-open-files=", "--readers=", "--verify", "--readahead-mb=", "--write-behind-mb=",
+    "--layout-loaders=", "--block-map-cache" };
+
+/**
+ * @brief Time between checks for shards restored on other hosts
+ */
+const std::chrono::milliseconds SHARD_POLL_INTERVAL(1000);
+
+/**
+ * @brief Restores a backup in shards written by worker processes
+ * 
+ * The disk is written to devicePath, or otherwise to test.img in the
+ * current directory, which is created unless a restore with the same plan
+ * is being resumed into it. The plan is written to shardDirectory, and
+ * workerCount worker processes of this program are started to restore the
+ * shards. Workers started on other hosts with --shard-worker on the same
+ * directory and target share the work; once the local workers exit, the
+ * shards still being restored elsewhere are waited for. Nothing is mounted.
+ * 
+ * @param backupFileName Path to the Macrium Reflect backup file
+ * @param workerArguments Options passed on to each worker
+ * @param devicePath Path of the block device to restore onto, or empty for test.img
+ * @param unusedSpace How a device's ranges without backup data are cleared
+ * @param options Options controlling the restore
+ * @param shardCount Number of shards
+ * @param shardDirectory Directory holding the plan, claims and manifests
+ * @param workerCount Worker processes started on this host
+ * @param waitTimeout Longest time to wait for the next shard restored elsewhere to complete
+ * @throws std::runtime_error if a worker fails or the remaining shards stop completing; running again resumes with the incomplete shards
+ */
+void handleShardedRestore(std::string backupFileName, const std::vector<std::string>& workerArguments, const std::string& devicePath,
+    UnusedSpaceMode unusedSpace, const RestoreOptions& options, uint32_t shardCount, const std::string& shardDirectory, size_t workerCount,
+    std::chrono::seconds waitTimeout)
+{
+    file_structs::File_Layout fileLayout;
+    readBackupFileLayout(fileLayout, backupFileName);
+    uint64_t diskSize = fileLayout.disks[0]._geometry.disk_size;
+
+    ShardPlan plan;
+    plan.directory = std::filesystem::absolute(shardDirectory).string();
+    plan.backupGuid = fileLayout._header.backup_guid;
+    plan.targetPath = devicePath.empty() ? std::filesystem::current_path().string() + "/test.img" : devicePath;
+    plan.shardCount = shardCount;
+    plan.partitionNumbers = options.partitionNumbers;
+    plan.unusedSpace = unusedSpace;
+
+    std::error_code error;
+    bool imageReady = !devicePath.empty() || std::filesystem::file_size(plan.targetPath, error) == diskSize / fileLayout.disks[0]._geometry.bytes_per_sector *
+        fileLayout.disks[0]._geometry.bytes_per_sector;
+    bool resumed = createShardPlan(plan, imageReady);
+    if (!resumed && devicePath.empty()) {
+        CreateIMG(plan.targetPath, diskSize, fileLayout.disks[0]._geometry.bytes_per_sector);
+    }
+    std::cout << (resumed ? "Resuming" : "Starting") << " restore of " << shardCount << " shards to " << plan.targetPath << ", plan in "
+              << plan.directory << std::endl;
+
+    std::vector<std::string> command = { "/proc/self/exe", backupFileName, "--shard-worker=" + plan.directory, "--progress=0" };
+    command.insert(command.end(), workerArguments.begin(), workerArguments.end());
+    if (runLocalShardWorkers(command, workerCount) != 0) {
+        std::vector<ShardManifest> manifests = readShardManifests(plan);
+        std::cerr << manifests.size() << " of " << shardCount << " shards were restored; run again to resume\n";
+        throw std::runtime_error("Shard workers failed.");
+    }
+
+    std::vector<ShardManifest> manifests = waitForShardManifests(plan, SHARD_POLL_INTERVAL, waitTimeout);
+    uint64_t bytesWritten = 0;
+    uint64_t bytesCleared = 0;
+    double slowestShard = 0;
+    for (auto& manifest : manifests) {
+        bytesWritten += manifest.bytesWritten;
+        bytesCleared += manifest.bytesCleared;
+        slowestShard = std::max(slowestShard, manifest.seconds);
+    }
+    std::cout << "Restored backup to " << plan.targetPath << " in " << shardCount << " shards: wrote " << bytesWritten << " bytes, cleared "
+              << bytesCleared << " bytes, slowest shard " << slowestShard << " s" << std::endl;
+}
+
+/**
+ * @brief Restores shards of a sharded restore until none are left to claim
+ * 
+ * @param backupFileName Path to the Macrium Reflect backup file on this host
+ * @param shardDirectory Directory holding the plan, claims and manifests
+ * @param options Options controlling the restore of each shard
+ */
+void handleShardWorker(std::string backupFileName, const std::string& shardDirectory, const RestoreOptions& options)
+{
+    ShardPlan plan;
+    readShardPlan(plan, shardDirectory);
+    file_structs::File_Layout fileLayout;
+    readBackupFileLayout(fileLayout, backupFileName);
+
+    uint32_t restoredShards = runShardWorker(plan, backupFileName, fileLayout, options);
+    std::cout << "Worker " << getpid() << " restored " << restoredShards << " shards" << std::endl;
+}
+
+/**
+ * @brief Serves a backup's disk over NBD while it is restored in the background
+ * 
+ * The disk is exported on a Unix socket at once, and restored behind the
+ * export into devicePath, or otherwise into a new test.img in the current
+ * directory. Blocks the guest reads are restored first; its writes land on
+ * the target. Once Enter is pressed the export is stopped and the restore
+ * is finished before returning.
+ * 
+ * @param backupFileName Path to the Macrium Reflect backup file
+ * @param socketPath Path of the Unix socket the disk is served on
+ * @param devicePath Path of the block device to restore onto, or empty for test.img
+ * @param options Options controlling the restore; the partitions restored are honoured
+ * @param chunkSize Size of the chunks the disk is restored in
+ * @throws std::runtime_error if the target cannot be opened or a chunk cannot be restored
+ */
+void handleInstantRestore(std::string backupFileName, const std::string& socketPath, const std::string& devicePath, const RestoreOptions& options,
+    uint32_t chunkSize)
+{
+    file_structs::File_Layout fileLayout;
+    readBackupFileLayout(fileLayout, backupFileName);
+
+    std::string targetPath = devicePath.empty() ? std::filesystem::current_path().string() + "/test.img" : devicePath;
+    if (devicePath.empty()) {
+        CreateIMG(targetPath, fileLayout.disks[0]._geometry.disk_size, fileLayout.disks[0]._geometry.bytes_per_sector);
+    }
+
+    InstantRestore restore;
+    openInstantRestore(restore, backupFileName, fileLayout, 0, options.partitionNumbers, targetPath, devicePath.empty(), chunkSize);
+
+    NbdExport diskExport;
+    diskExport.size = restore.diskSize;
+    diskExport.preferredBlockSize = chunkSize;
+    diskExport.read = [&restore](uint64_t offset, void* buffer, size_t length) { readInstantRestore(restore, offset, buffer, length); };
+    diskExport.write = [&restore](uint64_t offset, const void* data, size_t length) { writeInstantRestore(restore, offset, data, length); };
+    diskExport.flush = [&restore]() { flushInstantRestore(restore); };
+
+    NbdServer server;
+    try {
+        startNbdServer(server, socketPath, diskExport);
+        startHydration(restore);
+    }
+    catch (...) {
+        closeInstantRestore(restore);
+        throw;
+    }
+    std::cout << "Serving the disk on " << socketPath << " while restoring it to " << targetPath << std::endl;
+    std::cout << "Attach it with: nbd-client -unix " << socketPath << " /dev/nbd0" << std::endl;
+    std::cout << "Press Enter to stop serving and finish the restore..." << std::endl;
+    std::cin.get();
+
+    stopNbdServer(server);
+    std::cout << "Stopped serving after " << server.requestsServed.load() << " requests; finishing the restore of "
+              << restore.chunkCount - restore.hydratedChunks.load() << " of " << restore.chunkCount << " chunks" << std::endl;
+    try {
+        waitForHydration(restore);
+    }
+    catch (...) {
+        closeInstantRestore(restore);
+        throw;
+    }
+    closeInstantRestore(restore);
+    std::cout << "Restored backup to " << targetPath << ": wrote " << restore.bytesWritten.load() << " bytes, "
+              << restore.demandHydratedChunks.load() << " chunks restored on demand" << std::endl;
+}
+
+/**
+ * @brief Writes bytes to standard output, retrying short and interrupted writes
+ * 
+ * @param data The bytes to write
+ * @param length Number of bytes
+ * @throws std::runtime_error if standard output cannot be written, such as when the reader has gone
+ */
+void writeStandardOutput(const void* data, size_t length)
+{
+    const char* bytes = static_cast<const char*>(data);
+    while (length > 0) {
+        ssize_t written = write(STDOUT_FILENO, bytes, length);
+        if (written < 0 && errno == EINTR) { continue; }
+        if (written <= 0) {
+            std::cerr << "Failed to write to standard output: " << strerror(errno) << "\n";
+            throw std::runtime_error("Failed to write to standard output.");
+        }
+        bytes += written;
+        length -= static_cast<size_t>(written);
+    }
+}
+
+/**
+ * @brief Streams a raw disk image of a backup to standard output
+ * 
+ * The image is written strictly in order, so it can be piped into tools
+ * such as ssh, pv or zstd without being staged on disk. Everything else is
+ * reported on stderr.
+ * 
+ * @param backupFileName Path to the Macrium Reflect backup file
+ * @param options Options controlling the restore
+ * @param metricsJSONPath Path of the JSON metrics report, or empty
+ * @param metricsPrometheusPath Path of the Prometheus metrics textfile, or empty
+ * @param progressInterval Time between progress reports
+ */
+void handleStreamRestore(std::string backupFileName, const RestoreOptions& options, const std::string& metricsJSONPath,
+    const std::string& metricsPrometheusPath, std::chrono::milliseconds progressInterval)
+{
+    file_structs::File_Layout fileLayout;
+    readBackupFileLayout(fileLayout, backupFileName);
+
+    runWithProgress(options, progressInterval, [&]() { streamDisk(backupFileName, writeStandardOutput, fileLayout, 0, options); });
+    std::cerr << "Streamed " << fileLayout.disks[0]._geometry.disk_size << " bytes to standard output" << std::endl;
+
+    writeMetricsReports(options, metricsJSONPath, metricsPrometheusPath, std::cerr);
+}
+
+/**
+ * @brief Reads the value of a "--name=value" command line option
+ * 
+ * @param arg The command line argument to check
+ * @param name The option name, including the leading dashes
+ * @param value Output parameter that receives the option value
+ * @return true if the argument is the named option
+ */
+bool readOption(const std::string& arg, const std::string& name, std::string& value)
+{
+    std::string prefix = name + "=";
+    if (arg.compare(0, prefix.size(), prefix) != 0) { return false; }
+    value = arg.substr(prefix.size());
+    return true;
+}
+
+/**
+ * @brief Prints the command line usage
+ * 
+ * @param programName Name the program was invoked as
+ */
+void printUsage(const char* programName)
+{
+    std::cout << "Usage: " << programName << " <backup_file> [options]" << std::endl;
+    std::cout << "  --max-open-files=N   Maximum number of backup files held open at once (default "
+              << DEFAULT_MAX_OPEN_BACKUP_FILES << ")" << std::endl;
+    std::cout << "  --readers=N          Backup files or split segments read concurrently (default "
+              << DEFAULT_MAX_READER_THREADS << ")" << std::endl;
+    std::cout << "  --progress=SECONDS   Interval between progress reports, 0 to disable (default "
+              << DEFAULT_PROGRESS_INTERVAL.count() / 1000.0 << ")" << std::endl;
+    std::cout << "  --verify             Check each block against its MD5 hash before writing it" << std::endl;
+    std::cout << "  --metrics-json=PATH  Write per-stage restore metrics as JSON" << std::endl;
+    std::cout << "  --metrics-prom=PATH  Write per-stage restore metrics as a Prometheus textfile" << std::endl;
+    std::cout << "  --partitions=N[,N]   Restore only these partition numbers, leaving the rest of the disk as holes" << std::endl;
+    std::cout << "  --partition-images   Restore the selected partitions into standalone partition<N>.img files" << std::endl;
+    std::cout << "  --partition-threads=N" << std::endl;
+    std::cout << "                       Partition images restored concurrently (default "
+              << DEFAULT_MAX_PARTITION_THREADS << ")" << std::endl;
+    std::cout << "  --format=FORMAT      Image written to the current directory: raw (test.img, mounted), qcow2"
+              << " (test.qcow2) or vhdx (test.vhdx)" << std::endl;
+    std::cout << "  --compress=zstd      Compress the clusters of a qcow2 image; needs --format=qcow2" << std::endl;
+    std::cout << "  --device=PATH        Restore onto a block device instead of test.img, without mounting it;" << std::endl;
+    std::cout << "                       with --partition-images the single selected partition is written to it" << std::endl;
+    std::cout << "  --unused=MODE        How a device's ranges without backup data are cleared: zero, discard or keep"
+              << " (default zero)" << std::endl;
+    std::cout << "  --stdout             Stream the raw disk image to standard output in disk order, without mounting it"
+              << std::endl;
+    std::cout << "  --stream-buffer=N    Blocks read ahead of the output when streaming (default "
+              << DEFAULT_MAX_STREAM_BUFFERED_BLOCKS << ")" << std::endl;
+    std::cout << "  --readahead-mb=N     Planned backup reads hinted to the kernel ahead of each reader, 0 to disable (default "
+              << DEFAULT_READAHEAD_BYTES / (1024 * 1024) << ")" << std::endl;
+    std::cout << "  --write-behind-mb=N  Bytes written between writebacks that drop restored data from the page cache,"
+              << " 0 to disable (default " << DEFAULT_WRITE_BEHIND_BYTES / (1024 * 1024) << ")" << std::endl;
+    std::cout << "  --layout-loaders=N   Chain files whose metadata is read concurrently (default "
+              << DEFAULT_MAX_LAYOUT_LOADER_THREADS << ")" << std::endl;
+    std::cout << "  --shards=N           Restore the raw image or --device in N shards written by worker processes (default "
+              << DEFAULT_RESTORE_SHARDS << " with --shard-dir)" << std::endl;
+    std::cout << "  --shard-dir=DIR      Directory for the shard plan, claims and manifests, shared with workers on other hosts"
+              << std::endl;
+    std::cout << "  --shard-workers=N    Worker processes started on this host, 0 to wait for other hosts (default "
+              << DEFAULT_LOCAL_SHARD_WORKERS << ")" << std::endl;
+    std::cout << "  --shard-worker=DIR   Restore shards of the plan in DIR until none are left to claim" << std::endl;
+    std::cout << "  --shard-wait=SECONDS Give up when no shard restored elsewhere completes for this long (default "
+              << DEFAULT_SHARD_WAIT_TIMEOUT.count() << ")" << std::endl;
+    std::cout << "  --instant=SOCKET     Serve the disk over NBD on a Unix socket at once while restoring it to test.img"
+              << " or --device in the background" << std::endl;
+    std::cout << "  --instant-chunk-kb=N Size of the chunks an instant restore restores and serves at a time, a power of two"
+              << " up to " << NBD_MAX_REQUEST_LENGTH / 1024 << " (default " << DEFAULT_HYDRATION_CHUNK_SIZE / 1024 << ")" << std::endl;
+    std::cout << "  --block-map-cache[=PATH]" << std::endl;
+    std::cout << "                       Reuse the resolved block map from a sidecar cache (default <backup_file>"
+              << BLOCK_MAP_CACHE_EXTENSION << ")" << std::endl;
+}
+
+/**
+ * @brief Largest value accepted for options counting threads or processes
+ */
+const uint64_t MAX_THREAD_OPTION = 1024;
+
+/**
+ * @brief Largest value accepted for options counting files, blocks, shards or mebibytes
+ */
+const uint64_t MAX_COUNT_OPTION = 1024 * 1024;
+
+/**
+ * @brief Largest interval accepted between progress reports, in seconds
+ */
+const double MAX_PROGRESS_INTERVAL_SECONDS = 24 * 60 * 60;
+
+/**
+ * @brief Parses a whole number option value
+ * 
+ * Only decimal digits are accepted, so signs, spaces and trailing text are
+ * rejected rather than wrapped or ignored.
+ * 
+ * @param text The option value
+ * @param minimum Smallest value accepted
+ * @param maximum Largest value accepted
+ * @param number Output parameter that receives the value
+ * @return true if the value is a whole number from minimum to maximum
+ */
+bool parseNumber(const std::string& text, uint64_t minimum, uint64_t maximum, uint64_t& number)
+{
+    if (text.empty() || text.size() > 19 || text.find_first_not_of("0123456789") != std::string::npos) { return false; }
+    number = std::stoull(text);
+    return number >= minimum && number <= maximum;
+}
+
+/**
+ * @brief Parses an option value holding a number of seconds
+ * 
+ * @param text The option value, with an optional fraction
+ * @param interval Output parameter that receives the interval
+ * @return true if the value is a number of seconds from 0 to MAX_PROGRESS_INTERVAL_SECONDS
+ */
+bool parseSeconds(const std::string& text, std::chrono::milliseconds& interval)
+{
+    if (text.empty() || text.find_first_not_of("0123456789.") != std::string::npos || text.find('.') != text.rfind('.') || text == ".") {
+        return false;
+    }
+    double seconds = std::stod(text);
+    if (seconds > MAX_PROGRESS_INTERVAL_SECONDS) { return false; }
+    interval = std::chrono::milliseconds(static_cast<int64_t>(seconds * 1000));
+    return true;
+}
+
+/**
+ * @brief Reports an option whose value is not valid
+ * 
+ * @param name The option name, including the leading dashes
+ * @param programName Name the program was invoked as
+ * @return int The exit code for the error
+ */
+int reportInvalidValue(const std::string& name, const char* programName)
+{
+    std::cout << "Error: invalid value for " << name << std::endl;
+    printUsage(programName);
+    return 1;
+}
+
 /**
  * @brief Main entry point for Linux implementation
  * 
@@ -71,13 +647,237 @@ void handleLinuxRestore(std::string backupFileName)
  */
 int main(int argc, char *argv[])
 {
-    if (argc == 1) {
+    std::string backupFileName;
+    std::string metricsJSONPath;
+    std::string metricsPrometheusPath;
+    std::chrono::milliseconds progressInterval = DEFAULT_PROGRESS_INTERVAL;
+    bool useBlockMapCache = false;
+    bool partitionImages = false;
+    std::string devicePath;
+    std::string format = "raw";
+    bool toStandardOutput = false;
+    Qcow2Compression compression = Qcow2Compression::eNone;
+    UnusedSpaceMode unusedSpace = UnusedSpaceMode::eZeroOut;
+    uint32_t shardCount = 0;
+    std::string shardDirectory;
+    size_t shardWorkers = DEFAULT_LOCAL_SHARD_WORKERS;
+    std::chrono::seconds shardWaitTimeout = DEFAULT_SHARD_WAIT_TIMEOUT;
+    std::string shardWorkerDirectory;
+    std::vector<std::string> shardWorkerArguments;
+    std::string instantSocketPath;
+    uint32_t instantChunkSize = DEFAULT_HYDRATION_CHUNK_SIZE;
+    RestoreOptions options;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        std::string value;
+        uint64_t number = 0;
+        if (readOption(arg, "--max-open-files", value)) {
+            if (!parseNumber(value, 1, MAX_COUNT_OPTION, number)) { return reportInvalidValue("--max-open-files", argv[0]); }
+            options.maxOpenBackupFiles = static_cast<size_t>(number);
+        }
+        else if (readOption(arg, "--readers", value)) {
+            if (!parseNumber(value, 1, MAX_THREAD_OPTION, number)) { return reportInvalidValue("--readers", argv[0]); }
+            options.maxReaderThreads = static_cast<size_t>(number);
+        }
+        else if (readOption(arg, "--progress", value)) {
+            if (!parseSeconds(value, progressInterval)) { return reportInvalidValue("--progress", argv[0]); }
+        }
+        else if (arg == "--verify") {
+            options.verifyBlocks = true;
+        }
+        else if (readOption(arg, "--metrics-json", value)) {
+            metricsJSONPath = value;
+        }
+        else if (readOption(arg, "--metrics-prom", value)) {
+            metricsPrometheusPath = value;
+        }
+        else if (readOption(arg, "--partitions", value)) {
+            std::stringstream list(value);
+            for (std::string item; std::getline(list, item, ',');) {
+                if (!parseNumber(item, 0, INT32_MAX, number)) { return reportInvalidValue("--partitions", argv[0]); }
+                options.partitionNumbers.push_back(static_cast<int32_t>(number));
+            }
+        }
+        else if (arg == "--partition-images") {
+            partitionImages = true;
+        }
+        else if (readOption(arg, "--partition-threads", value)) {
+            if (!parseNumber(value, 1, MAX_THREAD_OPTION, number)) { return reportInvalidValue("--partition-threads", argv[0]); }
+            options.maxPartitionThreads = static_cast<size_t>(number);
+        }
+        else if (readOption(arg, "--format", value) && (value == "raw" || value == "qcow2" || value == "vhdx")) {
+            format = value;
+        }
+        else if (arg == "--compress=zstd") {
+            compression = Qcow2Compression::eZstd;
+        }
+        else if (readOption(arg, "--device", value)) {
+            devicePath = value;
+        }
+        else if (readOption(arg, "--unused", value) && (value == "zero" || value == "discard" || value == "keep")) {
+            unusedSpace = value == "zero" ? UnusedSpaceMode::eZeroOut : value == "discard" ? UnusedSpaceMode::eDiscard : UnusedSpaceMode::eLeave;
+        }
+        else if (arg == "--stdout") {
+            toStandardOutput = true;
+        }
+        else if (readOption(arg, "--stream-buffer", value)) {
+            if (!parseNumber(value, 1, MAX_COUNT_OPTION, number)) { return reportInvalidValue("--stream-buffer", argv[0]); }
+            options.maxStreamBufferedBlocks = static_cast<size_t>(number);
+        }
+        else if (readOption(arg, "--readahead-mb", value)) {
+            if (!parseNumber(value, 0, MAX_COUNT_OPTION, number)) { return reportInvalidValue("--readahead-mb", argv[0]); }
+            options.readaheadBytes = number * 1024 * 1024;
+        }
+        else if (readOption(arg, "--write-behind-mb", value)) {
+            if (!parseNumber(value, 0, MAX_COUNT_OPTION, number)) { return reportInvalidValue("--write-behind-mb", argv[0]); }
+            options.writeBehindBytes = number * 1024 * 1024;
+        }
+        else if (readOption(arg, "--layout-loaders", value)) {
+            if (!parseNumber(value, 1, MAX_THREAD_OPTION, number)) { return reportInvalidValue("--layout-loaders", argv[0]); }
+            options.maxLayoutLoaderThreads = static_cast<size_t>(number);
+        }
+        else if (readOption(arg, "--shards", value)) {
+            if (!parseNumber(value, 1, MAX_COUNT_OPTION, number)) { return reportInvalidValue("--shards", argv[0]); }
+            shardCount = static_cast<uint32_t>(number);
+        }
+        else if (readOption(arg, "--shard-dir", value)) {
+            shardDirectory = value;
+        }
+        else if (readOption(arg, "--shard-workers", value)) {
+            if (!parseNumber(value, 0, MAX_THREAD_OPTION, number)) { return reportInvalidValue("--shard-workers", argv[0]); }
+            shardWorkers = static_cast<size_t>(number);
+        }
+        else if (readOption(arg, "--shard-worker", value)) {
+            shardWorkerDirectory = value;
+        }
+        else if (readOption(arg, "--shard-wait", value)) {
+            if (!parseNumber(value, 1, MAX_COUNT_OPTION, number)) { return reportInvalidValue("--shard-wait", argv[0]); }
+            shardWaitTimeout = std::chrono::seconds(number);
+        }
+        else if (readOption(arg, "--instant", value)) {
+            instantSocketPath = value;
+        }
+        else if (readOption(arg, "--instant-chunk-kb", value)) {
+            // The chunk size is advertised as the NBD preferred block size, which must be a power of two no larger than a request
+            if (!parseNumber(value, 1, NBD_MAX_REQUEST_LENGTH / 1024, number) || (number & (number - 1)) != 0) {
+                return reportInvalidValue("--instant-chunk-kb", argv[0]);
+            }
+            instantChunkSize = static_cast<uint32_t>(number * 1024);
+        }
+        else if (arg == "--block-map-cache") {
+            useBlockMapCache = true;
+        }
+        else if (readOption(arg, "--block-map-cache", value)) {
+            options.blockMapCachePath = value;
+        }
+        else if (arg.compare(0, 2, "--") == 0) {
+            std::cout << "Error: Unknown option " << arg << std::endl;
+            printUsage(argv[0]);
+            return 1;
+        }
+        else {
+            backupFileName = arg;
+        }
+    }
+    for (int i = 1; i < argc; i++) {
+        for (const char* workerOption : SHARD_WORKER_OPTIONS) {
+            if (std::string(argv[i]).compare(0, strlen(workerOption), workerOption) == 0) { shardWorkerArguments.push_back(argv[i]); }
+        }
+    }
+
+    if (backupFileName.empty()) {
         std::cout << "Error: No backup file specified" << std::endl;
-        std::cout << "Usage: " << argv[0] << " <backup_file>" << std::endl;
+        printUsage(argv[0]);
         return 1;
     }
 
-    std::string backupFileName = argv[1];
-    handleLinuxRestore(backupFileName);
+    if (partitionImages && options.partitionNumbers.empty()) {
+        std::cout << "Error: --partition-images needs --partitions" << std::endl;
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    if (!devicePath.empty() && partitionImages && options.partitionNumbers.size() != 1) {
+        std::cout << "Error: --device with --partition-images needs exactly one partition" << std::endl;
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    if (compression != Qcow2Compression::eNone && format != "qcow2") {
+        std::cout << "Error: --compress needs --format=qcow2, the only output format that stores compressed clusters" << std::endl;
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    if (format != "raw" && (partitionImages || !devicePath.empty())) {
+        std::cout << "Error: --format=" << format << " cannot be combined with --partition-images or --device" << std::endl;
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    if (toStandardOutput && (format != "raw" || partitionImages || !devicePath.empty())) {
+        std::cout << "Error: --stdout cannot be combined with --format, --partition-images or --device" << std::endl;
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    bool sharded = shardCount > 0 || !shardDirectory.empty();
+    if (sharded && (format != "raw" || partitionImages || toStandardOutput)) {
+        std::cout << "Error: --shards cannot be combined with --format, --partition-images or --stdout" << std::endl;
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    if (!instantSocketPath.empty() && (format != "raw" || partitionImages || toStandardOutput || sharded)) {
+        std::cout << "Error: --instant cannot be combined with --format, --partition-images, --stdout or --shards" << std::endl;
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    if (useBlockMapCache && options.blockMapCachePath.empty()) {
+        options.blockMapCachePath = getDefaultBlockMapCachePath(backupFileName);
+    }
+
+    RestoreMetrics metrics;
+    if (!metricsJSONPath.empty() || !metricsPrometheusPath.empty()) {
+        options.metrics = &metrics;
+    }
+
+    RestoreProgress progress;
+    if (progressInterval.count() > 0) {
+        options.progress = &progress;
+    }
+
+    if (!shardWorkerDirectory.empty()) {
+        handleShardWorker(backupFileName, shardWorkerDirectory, options);
+        return 0;
+    }
+    if (!instantSocketPath.empty()) {
+        handleInstantRestore(backupFileName, instantSocketPath, devicePath, options, instantChunkSize);
+        return 0;
+    }
+    if (sharded) {
+        handleShardedRestore(backupFileName, shardWorkerArguments, devicePath, unusedSpace, options, shardCount > 0 ? shardCount : DEFAULT_RESTORE_SHARDS,
+            shardDirectory.empty() ? "restore-shards" : shardDirectory, shardWorkers, shardWaitTimeout);
+        return 0;
+    }
+    if (toStandardOutput) {
+        handleStreamRestore(backupFileName, options, metricsJSONPath, metricsPrometheusPath, progressInterval);
+        return 0;
+    }
+    if (format == "qcow2") {
+        handleQcow2Restore(backupFileName, compression, options, metricsJSONPath, metricsPrometheusPath, progressInterval);
+        return 0;
+    }
+    if (format == "vhdx") {
+        handleVhdxRestore(backupFileName, options, metricsJSONPath, metricsPrometheusPath, progressInterval);
+        return 0;
+    }
+    if (!devicePath.empty()) {
+        handleDeviceRestore(backupFileName, devicePath, unusedSpace, options, partitionImages, metricsJSONPath, metricsPrometheusPath, progressInterval);
+        return 0;
+    }
+    handleLinuxRestore(backupFileName, options, partitionImages, metricsJSONPath, metricsPrometheusPath, progressInterval);
     return 0;
 }
@@ -0,0 +1,150 @@
+/**
+ * @file backup_catalog.cpp
+ * @brief Command line tool to build and query backup catalogs
+ *
+ * `build` scans a repository in parallel and writes a catalog of every
+ * backup file found. `latest` and `list` answer queries from the mapped
+ * catalog without opening any backup file.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <ctime>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../../libs/catalog/backup_catalog.h"
+
+/**
+ * @brief Reads the value of a "--name=value" command line option
+ *
+ * @param arg The command line argument to check
+ * @param name The option name, including the leading dashes
+ * @param value Output parameter that receives the option value
+ * @return true if the argument is the named option
+ */
+bool readOption(const std::string& arg, const std::string& name, std::string& value)
+{
+    std::string prefix = name + "=";
+    if (arg.compare(0, prefix.size(), prefix) != 0) { return false; }
+    value = arg.substr(prefix.size());
+    return true;
+}
+
+/**
+ * @brief Prints the command line usage
+ *
+ * @param programName Name the program was invoked as
+ */
+void printUsage(const char* programName)
+{
+    std::cout << "Usage: " << programName << " build <directory> <catalog> [--threads=N]" << std::endl;
+    std::cout << "       " << programName << " latest <catalog> <machine or image ID>" << std::endl;
+    std::cout << "       " << programName << " list <catalog> [machine]" << std::endl;
+}
+
+/**
+ * @brief Formats a backup time as UTC
+ *
+ * @param time Seconds since the Unix epoch
+ * @return std::string The time, for example "2024-09-09 17:02:01"
+ */
+std::string formatBackupTime(uint64_t time)
+{
+    std::time_t seconds = static_cast<std::time_t>(time);
+    std::tm* utc = std::gmtime(&seconds);
+    if (utc == nullptr) { return std::to_string(time); }
+
+    char text[32];
+    std::strftime(text, sizeof(text), "%Y-%m-%d %H:%M:%S", utc);
+    return text;
+}
+
+/**
+ * @brief Prints one catalog entry
+ *
+ * @param catalog The opened catalog
+ * @param entry The entry to print
+ */
+void printEntry(const BackupCatalog& catalog, const CatalogEntry& entry)
+{
+    std::cout << formatBackupTime(entry.backupTime) << "  " << getCatalogString(catalog, entry.machine)
+              << "  " << getCatalogString(catalog, entry.imageId) << "  " << (entry.deltaIndex ? "inc " : "full")
+              << " " << entry.incrementNumber << "  " << getCatalogString(catalog, entry.path) << "\n";
+}
+
+/**
+ * @brief Scans a repository and writes its catalog
+ *
+ * @param rootPath Directory to scan
+ * @param catalogPath Path of the catalog to write
+ * @param threadCount Number of files read concurrently
+ * @return int Exit code
+ */
+int buildCatalog(const std::string& rootPath, const std::string& catalogPath, size_t threadCount)
+{
+    auto startTime = std::chrono::steady_clock::now();
+    std::vector<ScannedBackupFile> files = scanBackupRepository(rootPath, threadCount);
+    writeBackupCatalog(files, catalogPath);
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+    std::cout << "Catalogued " << files.size() << " backup files in " << seconds << " s" << std::endl;
+    return 0;
+}
+
+/**
+ * @brief Main entry point of the catalog tool
+ *
+ * @param argc Number of command line arguments
+ * @param argv Command line arguments
+ * @return int Exit code (0 for success, 1 for error)
+ */
+int main(int argc, char* argv[])
+{
+    std::vector<std::string> args;
+    size_t threadCount = std::max<size_t>(std::thread::hardware_concurrency(), 4);
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        std::string value;
+        if (readOption(arg, "--threads", value)) { threadCount = std::stoul(value); }
+        else if (arg.compare(0, 2, "--") == 0) {
+            std::cout << "Error: Unknown option " << arg << std::endl;
+            printUsage(argv[0]);
+            return 1;
+        }
+        else { args.push_back(arg); }
+    }
+
+    if (args.size() == 3 && args[0] == "build") {
+        return buildCatalog(args[1], args[2], threadCount);
+    }
+    if ((args.size() == 3 && args[0] == "latest") || ((args.size() == 2 || args.size() == 3) && args[0] == "list")) {
+        BackupCatalog catalog;
+        openBackupCatalog(catalog, args[1]);
+
+        if (args[0] == "latest") {
+            const CatalogEntry* entry = findLatestRestorePoint(catalog, args[2]);
+            if (entry == nullptr) {
+                std::cout << "No backups found for " << args[2] << std::endl;
+                closeBackupCatalog(catalog);
+                return 1;
+            }
+            printEntry(catalog, *entry);
+        }
+        else {
+            CatalogRange range = { 0, catalog.header->entryCount };
+            if (args.size() == 3) { range = findMachineEntries(catalog, args[2]); }
+            for (uint32_t i = range.begin; i < range.end; i++) {
+                printEntry(catalog, catalog.entries[i]);
+            }
+        }
+        closeBackupCatalog(catalog);
+        return 0;
+    }
+
+    printUsage(argv[0]);
+    return 1;
+}
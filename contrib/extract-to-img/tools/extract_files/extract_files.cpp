@@ -0,0 +1,223 @@
+/**
+ * @file extract_files.cpp
+ * @brief Command line tool to list and extract files from a backup
+ *
+ * Files and directories of NTFS, FAT, exFAT and ext2/3/4 volumes are read
+ * straight from the backup files through the resolved block map of their
+ * partition, so single files can be recovered without restoring the disk. Only the blocks holding the file
+ * system metadata that is walked and the extracted files are read.
+ */
+
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "../../libs/img_handler/img_handler.h"
+#include "../../libs/volume/ext_reader.h"
+#include "../../libs/volume/fat_reader.h"
+#include "../../libs/volume/ntfs_reader.h"
+#include "../../libs/volume/partition_reader.h"
+#include "../../libs/volume/volume_files.h"
+
+/**
+ * @brief A partition opened with the reader for its file system
+ */
+struct OpenedVolume
+{
+    PartitionReader reader;         // Reader of the partition
+    NtfsVolume ntfs;                // Volume state for NTFS partitions
+    FatVolume fat;                  // Volume state for FAT and exFAT partitions
+    ExtVolume ext;                  // Volume state for ext2, ext3 and ext4 partitions
+    VolumeFileSystem fileSystem;    // File system operations on the volume
+};
+
+/**
+ * @brief Reads the value of a "--name=value" command line option
+ *
+ * @param arg The command line argument to check
+ * @param name The option name, including the leading dashes
+ * @param value Output parameter that receives the option value
+ * @return true if the argument is the named option
+ */
+bool readOption(const std::string& arg, const std::string& name, std::string& value)
+{
+    std::string prefix = name + "=";
+    if (arg.compare(0, prefix.size(), prefix) != 0) { return false; }
+    value = arg.substr(prefix.size());
+    return true;
+}
+
+/**
+ * @brief Prints the command line usage
+ *
+ * @param programName Name the program was invoked as
+ */
+void printUsage(const char* programName)
+{
+    std::cout << "Usage: " << programName << " <backup_file> partitions" << std::endl;
+    std::cout << "       " << programName << " <backup_file> list [path] [--partition=N]" << std::endl;
+    std::cout << "       " << programName << " <backup_file> extract <path> <output_dir> [--partition=N]" << std::endl;
+    std::cout << "  --partition=N   Partition number to read (default: first partition with a supported file system)" << std::endl;
+}
+
+/**
+ * @brief Returns whether files can be extracted from a file system
+ *
+ * @param type The file system type
+ * @return true if the tool has a reader for the file system
+ */
+bool isSupportedFileSystem(ImageEnums::FileSystemType type)
+{
+    switch (type) {
+    case ImageEnums::FileSystemType::eFileSystemNTFS:
+    case ImageEnums::FileSystemType::eFileSystemFAT12:
+    case ImageEnums::FileSystemType::eFileSystemFAT16:
+    case ImageEnums::FileSystemType::eFileSystemFAT32:
+    case ImageEnums::FileSystemType::eFileSystemExFAT:
+    case ImageEnums::FileSystemType::eFileSystemLinuxExt:
+        return true;
+    default:
+        return false;
+    }
+}
+
+/**
+ * @brief Opens a partition with the reader for its file system
+ *
+ * @param volume Output parameter for the opened volume
+ * @param backupFileName Path of the restore point's backup file
+ * @param disk The disk holding the partition
+ * @param partition The partition to open
+ * @throws std::runtime_error if the file system is not supported or cannot be read
+ */
+void openVolume(OpenedVolume& volume, const std::string& backupFileName, file_structs::Disk::Disk_Layout& disk,
+    file_structs::Partition::Partition_Layout& partition)
+{
+    openPartitionReader(volume.reader, backupFileName, partition, 0, disk._geometry.bytes_per_sector);
+
+    switch (partition._file_system.type) {
+    case ImageEnums::FileSystemType::eFileSystemNTFS:
+        openNtfsVolume(volume.ntfs, volume.reader);
+        getNtfsFileSystem(volume.fileSystem, volume.ntfs);
+        break;
+    case ImageEnums::FileSystemType::eFileSystemFAT12:
+    case ImageEnums::FileSystemType::eFileSystemFAT16:
+    case ImageEnums::FileSystemType::eFileSystemFAT32:
+    case ImageEnums::FileSystemType::eFileSystemExFAT:
+        openFatVolume(volume.fat, volume.reader);
+        getFatFileSystem(volume.fileSystem, volume.fat);
+        break;
+    case ImageEnums::FileSystemType::eFileSystemLinuxExt:
+        openExtVolume(volume.ext, volume.reader);
+        getExtFileSystem(volume.fileSystem, volume.ext);
+        break;
+    default:
+        throw std::runtime_error("Extracting files from this file system is not supported.");
+    }
+}
+
+/**
+ * @brief Prints the partitions of the first disk
+ *
+ * @param disk The disk to print
+ */
+void printPartitions(file_structs::Disk::Disk_Layout& disk)
+{
+    for (auto& partition : disk.partitions) {
+        std::cout << "Partition " << partition._header.partition_number << ": " << nlohmann::json(partition._file_system.type).get<std::string>()
+                  << ", " << partition._geometry.length << " bytes";
+        if (!partition._file_system.volume_label.empty()) { std::cout << ", \"" << partition._file_system.volume_label << "\""; }
+        std::cout << (isSupportedFileSystem(partition._file_system.type) ? "" : " (not supported)") << std::endl;
+    }
+}
+
+/**
+ * @brief Prints a summary of the backup data read
+ *
+ * @param reader The reader used
+ */
+void printReadSummary(const PartitionReader& reader)
+{
+    std::cerr << "Read " << reader.bytesRead << " bytes in " << reader.blocksRead << " blocks from backup files" << std::endl;
+}
+
+/**
+ * @brief Main entry point of the extraction tool
+ *
+ * @param argc Number of command line arguments
+ * @param argv Command line arguments
+ * @return int Exit code (0 for success, 1 for error)
+ */
+int main(int argc, char* argv[])
+{
+    std::vector<std::string> args;
+    int32_t partitionNumber = -1;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        std::string value;
+        if (readOption(arg, "--partition", value)) { partitionNumber = std::stoi(value); }
+        else if (arg.compare(0, 2, "--") == 0) {
+            std::cout << "Error: Unknown option " << arg << std::endl;
+            printUsage(argv[0]);
+            return 1;
+        }
+        else { args.push_back(arg); }
+    }
+
+    bool validCommand = args.size() >= 2 &&
+        ((args[1] == "partitions" && args.size() == 2) || (args[1] == "list" && args.size() <= 3) || (args[1] == "extract" && args.size() == 4));
+    if (!validCommand) {
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    file_structs::File_Layout fileLayout;
+    readBackupFileLayout(fileLayout, args[0]);
+    auto& disk = fileLayout.disks[0];
+
+    if (args[1] == "partitions") {
+        printPartitions(disk);
+        return 0;
+    }
+
+    file_structs::Partition::Partition_Layout* partition = nullptr;
+    for (auto& candidate : disk.partitions) {
+        bool selected = partitionNumber < 0 ? isSupportedFileSystem(candidate._file_system.type) : candidate._header.partition_number == partitionNumber;
+        if (selected) {
+            partition = &candidate;
+            break;
+        }
+    }
+    if (partition == nullptr) {
+        std::cout << "Error: No partition to read; available partitions are:" << std::endl;
+        printPartitions(disk);
+        return 1;
+    }
+
+    auto volume = std::make_unique<OpenedVolume>();
+    openVolume(*volume, args[0], disk, *partition);
+
+    std::string path = args.size() >= 3 ? args[2] : "";
+    VolumeEntry entry;
+    if (!findVolumePath(volume->fileSystem, path, entry)) {
+        std::cout << "Error: " << path << " not found" << std::endl;
+        closePartitionReader(volume->reader);
+        return 1;
+    }
+
+    if (args[1] == "list") {
+        std::vector<VolumeEntry> entries = entry.isDirectory ? volume->fileSystem.listDirectory(entry) : std::vector<VolumeEntry>{ entry };
+        for (auto& child : entries) {
+            std::cout << (child.isDirectory ? "d " : "- ") << child.size << "\t" << child.name << std::endl;
+        }
+    }
+    else {
+        uint64_t fileCount = extractVolumeEntry(volume->fileSystem, entry, args[3]);
+        std::cout << "Extracted " << fileCount << " files to " << args[3] << std::endl;
+    }
+    printReadSummary(volume->reader);
+    closePartitionReader(volume->reader);
+    return 0;
+}
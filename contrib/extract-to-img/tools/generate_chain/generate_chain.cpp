@@ -0,0 +1,692 @@
+/**
+ * @file generate_chain.cpp
+ * @brief Generator for synthetic Macrium Reflect backup chains
+ *
+ * This tool writes a full backup followed by any number of incremental
+ * backups using the same on-disk layout that img_handler parses: data blocks,
+ * then the $TRACK0, $BITMAP and $INDEX metadata blocks at the index position,
+ * then the $JSON metadata block and the footer. Disk size, partition count,
+ * block size, chain depth, change rate and compression are configurable, so
+ * chains of any size can be produced for scale testing and benchmarking.
+ *
+ * Block contents are generated deterministically from the seed, so the same
+ * options always produce the same chain. Optionally the raw disk image that a
+ * restore of the newest file should produce is written alongside, for
+ * verifying restores.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "../../libs/file_handler/file_handler.h"
+#include "../../libs/img_handler/file_struct.h"
+#include "../../libs/img_handler/metadata.h"
+#include "../../libs/md5/md5.h"
+
+/**
+ * @brief Size of the track 0 data written before the first partition
+ */
+const uint32_t TRACK0_SIZE = 63 * 512;
+
+/**
+ * @brief Alignment of partition starts, as used by current partitioning tools
+ */
+const uint64_t PARTITION_ALIGNMENT = 1024 * 1024;
+
+/**
+ * @brief Options controlling the generated chain
+ */
+struct GeneratorOptions
+{
+    std::string outputDir;                                                      // Directory that receives the chain
+    std::string imageId;                                                        // Image ID used in file names and metadata
+    uint64_t diskSize = 1024ULL * 1024 * 1024;                                  // Size of the imaged disk in bytes
+    uint32_t partitionCount = 1;                                                // Number of partitions on the disk
+    uint32_t blockSize = 65536;                                                 // Size of each data block in bytes
+    uint32_t depth = 0;                                                         // Number of incremental backups after the full
+    double usedRate = 0.7;                                                      // Fraction of blocks holding data in the full backup
+    double changeRate = 0.05;                                                   // Fraction of blocks changed by each incremental
+    double compressibleRate = 0.0;                                              // Fraction of each block filled with zeros
+    ImageEnums::CompressionType compression = ImageEnums::CompressionType::eNone;  // Compression level recorded in the metadata
+    bool hashBlocks = true;                                                     // Store the MD5 digest of each block
+    uint64_t seed = 1;                                                          // Seed for all generated content
+    std::string expectedImagePath;                                              // Optional raw image of the newest restore point
+};
+
+/**
+ * @brief Placement of a generated partition on the disk
+ */
+struct SyntheticPartition
+{
+    uint64_t start;         // Byte offset of the partition on the disk
+    uint32_t blockCount;    // Number of data blocks in the partition
+};
+
+/**
+ * @brief Mixes a 64-bit value (splitmix64 finaliser)
+ *
+ * @param value The value to mix
+ * @return uint64_t The mixed value
+ */
+uint64_t mixBits(uint64_t value)
+{
+    value += 0x9e3779b97f4a7c15ULL;
+    value = (value ^ (value >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    value = (value ^ (value >> 27)) * 0x94d049bb133111ebULL;
+    return value ^ (value >> 31);
+}
+
+/**
+ * @brief Returns the next value of a xorshift64* generator
+ *
+ * @param state Generator state, must not be zero
+ * @return uint64_t The next pseudo-random value
+ */
+uint64_t nextRandom(uint64_t& state)
+{
+    state ^= state >> 12;
+    state ^= state << 25;
+    state ^= state >> 27;
+    return state * 0x2545f4914f6cdd1dULL;
+}
+
+/**
+ * @brief Derives a generator seed from the chain seed and a block position
+ *
+ * @param seed The chain seed
+ * @param increment Increment number of the backup file
+ * @param partition Partition index
+ * @param block Block index within the partition
+ * @return uint64_t A non-zero seed
+ */
+uint64_t blockSeed(uint64_t seed, uint32_t increment, uint32_t partition, uint64_t block)
+{
+    uint64_t value = mixBits(seed ^ mixBits((static_cast<uint64_t>(increment) << 40) ^ (static_cast<uint64_t>(partition) << 32) ^ block));
+    return value != 0 ? value : 1;
+}
+
+/**
+ * @brief Fills a block with deterministic content
+ *
+ * The start of the block is pseudo-random and the remainder, controlled by
+ * compressibleRate, is zero.
+ *
+ * @param buffer The block buffer, blockSize bytes long
+ * @param options The generator options
+ * @param seed Seed for this block's content
+ */
+void fillBlock(std::vector<uint8_t>& buffer, const GeneratorOptions& options, uint64_t seed)
+{
+    size_t randomBytes = static_cast<size_t>(buffer.size() * (1.0 - options.compressibleRate)) & ~static_cast<size_t>(7);
+    uint64_t state = seed;
+    for (size_t i = 0; i < randomBytes; i += 8) {
+        uint64_t value = nextRandom(state);
+        memcpy(buffer.data() + i, &value, sizeof(value));
+    }
+    std::fill(buffer.begin() + randomBytes, buffer.end(), 0);
+}
+
+/**
+ * @brief Decides whether a block holds data in the full backup
+ *
+ * @param options The generator options
+ * @param partition Partition index
+ * @param block Block index within the partition
+ * @return true if the block is in use
+ */
+bool isBlockUsed(const GeneratorOptions& options, uint32_t partition, uint64_t block)
+{
+    uint64_t value = blockSeed(options.seed, 0xffffff, partition, block);
+    return static_cast<double>(value >> 11) / static_cast<double>(1ULL << 53) < options.usedRate;
+}
+
+/**
+ * @brief Picks the blocks changed by an incremental backup
+ *
+ * @param options The generator options
+ * @param increment Increment number of the backup
+ * @param partitionIndex Partition index
+ * @param blockCount Number of blocks in the partition
+ * @return std::vector<uint32_t> Sorted, unique block indexes
+ */
+std::vector<uint32_t> pickChangedBlocks(const GeneratorOptions& options, uint32_t increment, uint32_t partitionIndex, uint32_t blockCount)
+{
+    uint64_t changeCount = static_cast<uint64_t>(blockCount * options.changeRate + 0.5);
+    uint64_t state = blockSeed(options.seed, increment, partitionIndex, 0xfffffffffULL);
+
+    std::vector<uint32_t> changed;
+    changed.reserve(changeCount);
+    for (uint64_t i = 0; i < changeCount; i++) {
+        changed.push_back(static_cast<uint32_t>(nextRandom(state) % blockCount));
+    }
+    std::sort(changed.begin(), changed.end());
+    changed.erase(std::unique(changed.begin(), changed.end()), changed.end());
+    return changed;
+}
+
+/**
+ * @brief Lays out the partitions evenly across the disk
+ *
+ * Partitions start on 1 MiB boundaries after track 0 and their sizes are a
+ * whole number of blocks. The last 1 MiB of the disk is left unused, as it
+ * would be for the backup GPT.
+ *
+ * @param options The generator options
+ * @return std::vector<SyntheticPartition> The partitions, in disk order
+ * @throws std::runtime_error if the disk is too small for the partitions
+ */
+std::vector<SyntheticPartition> layoutPartitions(const GeneratorOptions& options)
+{
+    uint64_t usable = options.diskSize > 2 * PARTITION_ALIGNMENT ? options.diskSize - 2 * PARTITION_ALIGNMENT : 0;
+    uint64_t partitionSpan = (usable / options.partitionCount) / PARTITION_ALIGNMENT * PARTITION_ALIGNMENT;
+    uint64_t blockCount = partitionSpan / options.blockSize;
+    if (blockCount == 0 || blockCount > UINT32_MAX) {
+        std::cout << "Disk size does not give each partition a usable number of blocks" << std::endl;
+        throw std::runtime_error("Invalid disk layout.");
+    }
+
+    std::vector<SyntheticPartition> partitions;
+    for (uint32_t i = 0; i < options.partitionCount; i++) {
+        partitions.push_back({ PARTITION_ALIGNMENT + i * partitionSpan, static_cast<uint32_t>(blockCount) });
+    }
+    return partitions;
+}
+
+/**
+ * @brief Builds deterministic track 0 data with a protective MBR signature
+ *
+ * @param options The generator options
+ * @return std::vector<uint8_t> The track 0 data
+ */
+std::vector<uint8_t> buildTrack0(const GeneratorOptions& options)
+{
+    std::vector<uint8_t> track0(TRACK0_SIZE);
+    uint64_t state = blockSeed(options.seed, 0xfffffe, 0, 0);
+    for (auto& byte : track0) {
+        byte = static_cast<uint8_t>(nextRandom(state));
+    }
+    track0[510] = 0x55;
+    track0[511] = 0xAA;
+    return track0;
+}
+
+/**
+ * @brief Formats a GUID string from the chain seed
+ *
+ * @param seed The value to derive the GUID from
+ * @return std::string The GUID in 8-4-4-4-12 form
+ */
+std::string formatGuid(uint64_t seed)
+{
+    uint64_t high = mixBits(seed);
+    uint64_t low = mixBits(high);
+    char guid[40];
+    snprintf(guid, sizeof(guid), "%08x-%04x-%04x-%04x-%012llx",
+        static_cast<uint32_t>(high >> 32), static_cast<uint32_t>((high >> 16) & 0xffff), static_cast<uint32_t>(high & 0xffff),
+        static_cast<uint32_t>(low >> 48), static_cast<unsigned long long>(low & 0xffffffffffffULL));
+    return guid;
+}
+
+/**
+ * @brief Returns the path of a backup file in the chain
+ *
+ * @param options The generator options
+ * @param increment Increment number of the file
+ * @return std::string Absolute path of the file
+ */
+std::string backupFilePath(const GeneratorOptions& options, uint32_t increment)
+{
+    char name[64];
+    snprintf(name, sizeof(name), "-%02u-%02u.mrimg", increment, increment);
+    return std::filesystem::absolute(std::filesystem::path(options.outputDir) / (options.imageId + name)).string();
+}
+
+/**
+ * @brief Creates an empty file and opens it for writing
+ *
+ * @param path Path of the file to create
+ * @return std::fstream The open file
+ */
+std::fstream createFile(const std::string& path)
+{
+    std::ofstream(path, std::ios::binary | std::ios::trunc).close();
+    return openFile(path);
+}
+
+/**
+ * @brief Writes a metadata block header
+ *
+ * @param file The file to write to
+ * @param blockName One of the block name constants from metadata.h
+ * @param blockLength Length of the data that follows the header
+ * @param lastBlock Whether this is the last block of its group
+ */
+void writeMetadataHeader(std::fstream& file, const char* blockName, uint32_t blockLength, bool lastBlock)
+{
+    MetadataBlockHeader header;
+    memcpy(header.BlockName, blockName, BLOCK_NAME_LENGTH);
+    header.BlockLength = blockLength;
+    header.Flags = {};
+    header.Flags.LastBlock = lastBlock ? 1 : 0;
+    writeToFile(file, &header, sizeof(header));
+}
+
+/**
+ * @brief Builds the JSON metadata for one backup file
+ *
+ * The layout is serialised through the same file_structs definitions the
+ * reader uses, plus an _auxiliary_data section like the one real backups
+ * carry.
+ *
+ * @param options The generator options
+ * @param partitions The partition placement
+ * @param increment Increment number of the file
+ * @param indexFilePosition Offset of the $TRACK0 block
+ * @param history File history up to and including this file
+ * @return std::string The JSON text
+ */
+std::string buildJSON(const GeneratorOptions& options, const std::vector<SyntheticPartition>& partitions, uint32_t increment,
+    uint64_t indexFilePosition, const std::vector<file_structs::Partition::File_History>& history)
+{
+    file_structs::File_Layout layout{};
+    layout._header.backup_format = "partition";
+    layout._header.backup_guid = formatGuid(options.seed);
+    layout._header.backupset_time = 1700000000;
+    layout._header.backup_time = layout._header.backupset_time + 3600ULL * increment;
+    layout._header.backup_type = "inc";
+    layout._header.delta_index = increment > 0;
+    layout._header.file_number = static_cast<uint16_t>(increment);
+    layout._header.imaged_disks_count = 1;
+    layout._header.imageid = options.imageId;
+    layout._header.increment_number = static_cast<uint16_t>(increment);
+    layout._header.index_file_position = indexFilePosition;
+    layout._header.json_version = 1;
+    layout._header.netbios_name = "SYNTHETIC";
+    layout._header.split_file = false;
+
+    layout._compression.compression_level = nlohmann::json(options.compression).get<std::string>();
+    layout._compression.compression_method = "zstd";
+    layout._encryption.enable = false;
+
+    file_structs::Disk::Disk_Layout disk{};
+    disk._descriptor.disk_description = "Synthetic Disk";
+    disk._geometry.bytes_per_sector = 512;
+    disk._geometry.disk_size = options.diskSize;
+    disk._geometry.media_type = "fixed_media";
+    disk._geometry.sectors_per_track = 63;
+    disk._geometry.tracks_per_cylinder = 255;
+    disk._geometry.cylinders = options.diskSize / (512ULL * 63 * 255);
+    disk._header.disk_format = "gpt";
+    disk._header.disk_signature = formatGuid(options.seed + 1);
+    disk._header.imaged_partition_count = static_cast<int32_t>(partitions.size());
+
+    for (uint32_t i = 0; i < partitions.size(); i++) {
+        uint64_t length = static_cast<uint64_t>(partitions[i].blockCount) * options.blockSize;
+
+        file_structs::Partition::Partition_Layout partition{};
+        partition._file_system.type = ImageEnums::FileSystemType::eFileSystemNTFS;
+        partition._file_system.start = partitions[i].start;
+        partition._file_system.end = partitions[i].start + length - 1;
+        partition._file_system.lcn0_offset = partitions[i].start;
+        partition._file_system.lcn0_file_number = static_cast<uint16_t>(increment);
+        partition._file_system.sectors_per_cluster = 8;
+        partition._file_system.total_clusters = static_cast<uint32_t>(length / 4096);
+        partition._file_system.partition_index = i;
+        partition._file_system.volume_label = "Synthetic " + std::to_string(i);
+
+        partition._geometry.start = partitions[i].start;
+        partition._geometry.end = partitions[i].start + length - 1;
+        partition._geometry.length = length;
+
+        partition._header.block_count = partitions[i].blockCount;
+        partition._header.block_size = options.blockSize;
+        partition._header.file_history = history;
+        partition._header.file_history_count = static_cast<uint32_t>(history.size());
+        partition._header.partition_number = static_cast<int32_t>(i);
+
+        partition._partition_table_entry.boot_sector = static_cast<uint32_t>(partitions[i].start / 512);
+        partition._partition_table_entry.num_sectors = static_cast<uint32_t>(length / 512);
+        partition._partition_table_entry.partition_type = ImageEnums::PartitionType::Primary;
+        partition._partition_table_entry.type = 7;
+
+        disk.partitions.push_back(partition);
+    }
+    layout.disks.push_back(disk);
+
+    nlohmann::json json = layout;
+
+    std::vector<uint32_t> partitionNumbers;
+    for (uint32_t i = 0; i < partitions.size(); i++) { partitionNumbers.push_back(i); }
+    json["_auxiliary_data"] = {
+        {"backup_definition", {
+            {"backup_definition_file", "synthetic.xml"},
+            {"backup_format", "partition"},
+            {"compression_level", layout._compression.compression_level},
+            {"disks", {{{"number", 0}, {"partitions", partitionNumbers}, {"signature", disk._header.disk_signature}}}},
+            {"file_type", "image"},
+            {"filename", history.back().file_name},
+            {"intelligent_sector_copy", true}}},
+        {"bootable", false},
+        {"destination", history.back().file_name},
+        {"macrium_reflect", {{"build", 0}, {"file_version", 10}, {"major", 10}, {"minor", 0}}},
+        {"target_drive_type", "local"}
+    };
+    return json.dump();
+}
+
+/**
+ * @brief Writes one backup file of the chain
+ *
+ * @param options The generator options
+ * @param partitions The partition placement
+ * @param track0 The track 0 data
+ * @param increment Increment number of the file, 0 for the full backup
+ * @param history File history, which receives this file's entry
+ * @param expectedImage Optional raw image to apply the written blocks to
+ * @return uint64_t Number of bytes written to the backup file
+ */
+uint64_t writeBackupFile(const GeneratorOptions& options, const std::vector<SyntheticPartition>& partitions, std::vector<uint8_t>& track0,
+    uint32_t increment, std::vector<file_structs::Partition::File_History>& history, std::fstream* expectedImage)
+{
+    std::string path = backupFilePath(options, increment);
+    history.push_back({ path, static_cast<int32_t>(increment) });
+
+    std::fstream file = createFile(path);
+    std::vector<uint8_t> block(options.blockSize);
+    uint64_t position = 0;
+
+    std::vector<std::vector<DataBlockIndexElement>> fullIndexes(partitions.size());
+    std::vector<std::vector<DeltaDataBlockIndexElement>> deltaIndexes(partitions.size());
+
+    // Data blocks
+    for (uint32_t p = 0; p < partitions.size(); p++) {
+        std::vector<uint32_t> blocksToWrite;
+        if (increment == 0) {
+            fullIndexes[p].resize(partitions[p].blockCount);
+            memset(fullIndexes[p].data(), 0, fullIndexes[p].size() * sizeof(DataBlockIndexElement));
+            for (uint32_t b = 0; b < partitions[p].blockCount; b++) {
+                if (isBlockUsed(options, p, b)) { blocksToWrite.push_back(b); }
+            }
+        }
+        else {
+            blocksToWrite = pickChangedBlocks(options, increment, p, partitions[p].blockCount);
+        }
+
+        for (uint32_t b : blocksToWrite) {
+            fillBlock(block, options, blockSeed(options.seed, increment, p, b));
+
+            DataBlockIndexElement element;
+            memset(&element, 0, sizeof(element));
+            element.file_position = static_cast<int64_t>(position);
+            element.block_length = options.blockSize;
+            element.file_number = static_cast<uint16_t>(increment);
+            if (options.hashBlocks) { computeMD5(block.data(), block.size(), element.md5_hash); }
+
+            writeToFile(file, block.data(), block.size());
+            position += block.size();
+
+            if (increment == 0) {
+                fullIndexes[p][b] = element;
+            }
+            else {
+                deltaIndexes[p].push_back({ element, b });
+            }
+
+            if (expectedImage != nullptr) {
+                setFilePointer(*expectedImage, partitions[p].start + static_cast<uint64_t>(b) * options.blockSize, std::ios::beg);
+                writeToFile(*expectedImage, block.data(), block.size());
+            }
+        }
+    }
+
+    // Track 0 and the per-partition index
+    uint64_t indexFilePosition = position;
+    writeMetadataHeader(file, TRACK_0, static_cast<uint32_t>(track0.size()), true);
+    writeToFile(file, track0.data(), track0.size());
+
+    for (uint32_t p = 0; p < partitions.size(); p++) {
+        int32_t reservedCount = 0;
+        int32_t blockCount = static_cast<int32_t>(increment == 0 ? fullIndexes[p].size() : deltaIndexes[p].size());
+        uint64_t indexBytes = increment == 0 ? fullIndexes[p].size() * sizeof(DataBlockIndexElement) : deltaIndexes[p].size() * sizeof(DeltaDataBlockIndexElement);
+
+        writeMetadataHeader(file, BITMAP_HEADER, 0, false);
+        writeMetadataHeader(file, IDX_HEADER, static_cast<uint32_t>(sizeof(reservedCount) + sizeof(blockCount) + indexBytes), true);
+        writeToFile(file, &reservedCount, sizeof(reservedCount));
+        writeToFile(file, &blockCount, sizeof(blockCount));
+        if (increment == 0) {
+            writeToFile(file, fullIndexes[p].data(), static_cast<std::streamsize>(indexBytes));
+        }
+        else if (!deltaIndexes[p].empty()) {
+            writeToFile(file, deltaIndexes[p].data(), static_cast<std::streamsize>(indexBytes));
+        }
+    }
+
+    // JSON header and footer
+    uint64_t headerOffset = static_cast<uint64_t>(file.tellp());
+    std::string strJson = buildJSON(options, partitions, increment, indexFilePosition, history);
+    writeMetadataHeader(file, JSON_HEADER, static_cast<uint32_t>(strJson.size()), true);
+    writeToFile(file, &strJson[0], strJson.size());
+
+    writeToFile(file, &headerOffset, sizeof(headerOffset));
+    writeToFile(file, const_cast<char*>(MAGIC_BYTES_VX), MAGIC_BYTES_VX_SIZE);
+
+    uint64_t fileSize = static_cast<uint64_t>(file.tellp());
+    closeFile(file);
+    std::cout << path << " (" << fileSize << " bytes)" << std::endl;
+    return fileSize;
+}
+
+/**
+ * @brief Parses an option value holding a decimal number
+ *
+ * @param text The option value
+ * @param minimum Smallest accepted value
+ * @param maximum Largest accepted value
+ * @param number Output parameter that receives the number
+ * @return true if the value is a number in the accepted range
+ */
+bool parseNumber(const std::string& text, uint64_t minimum, uint64_t maximum, uint64_t& number)
+{
+    if (text.empty() || text.size() > 19 || text.find_first_not_of("0123456789") != std::string::npos) { return false; }
+    number = std::stoull(text);
+    return number >= minimum && number <= maximum;
+}
+
+/**
+ * @brief Parses a size with an optional K, M, G or T binary suffix
+ *
+ * @param text The size text, for example "64K" or "1T"
+ * @param minimum Smallest accepted size in bytes
+ * @param maximum Largest accepted size in bytes
+ * @param size Output parameter that receives the size in bytes
+ * @return true if the value is a size in the accepted range
+ */
+bool parseSize(const std::string& text, uint64_t minimum, uint64_t maximum, uint64_t& size)
+{
+    size_t digits = text.find_first_not_of("0123456789");
+    if (digits == std::string::npos) { digits = text.size(); }
+    if (digits == 0 || digits > 19 || text.size() > digits + 1) { return false; }
+
+    uint64_t value = std::stoull(text.substr(0, digits));
+    unsigned int shift = 0;
+    if (digits < text.size()) {
+        switch (toupper(text[digits])) {
+            case 'T': shift = 40; break;
+            case 'G': shift = 30; break;
+            case 'M': shift = 20; break;
+            case 'K': shift = 10; break;
+            default: return false;
+        }
+    }
+    if (value > (UINT64_MAX >> shift)) { return false; }
+    size = value << shift;
+    return size >= minimum && size <= maximum;
+}
+
+/**
+ * @brief Parses an option value holding a fraction from 0 to 1
+ *
+ * @param text The option value, for example "0.05"
+ * @param fraction Output parameter that receives the fraction
+ * @return true if the value is a decimal number from 0 to 1
+ */
+bool parseFraction(const std::string& text, double& fraction)
+{
+    if (text.empty() || text.size() > 32 || text.find_first_not_of("0123456789.") != std::string::npos || text.find('.') != text.rfind('.') || text == ".") {
+        return false;
+    }
+    fraction = std::stod(text);
+    return fraction <= 1.0;
+}
+
+/**
+ * @brief Reads the value of a "--name=value" command line option
+ *
+ * @param arg The command line argument to check
+ * @param name The option name, including the leading dashes
+ * @param value Output parameter that receives the option value
+ * @return true if the argument is the named option
+ */
+bool readOption(const std::string& arg, const std::string& name, std::string& value)
+{
+    std::string prefix = name + "=";
+    if (arg.compare(0, prefix.size(), prefix) != 0) { return false; }
+    value = arg.substr(prefix.size());
+    return true;
+}
+
+/**
+ * @brief Prints the command line usage
+ *
+ * @param programName Name the program was invoked as
+ */
+void printUsage(const char* programName)
+{
+    std::cout << "Usage: " << programName << " --output=<dir> [options]" << std::endl;
+    std::cout << "  --disk-size=SIZE       Size of the imaged disk, e.g. 64G or 1T (default 1G)" << std::endl;
+    std::cout << "  --partitions=N         Number of partitions (default 1)" << std::endl;
+    std::cout << "  --block-size=SIZE      Data block size (default 64K)" << std::endl;
+    std::cout << "  --depth=N              Number of incremental backups after the full (default 0)" << std::endl;
+    std::cout << "  --used=F               Fraction of blocks holding data in the full backup (default 0.7)" << std::endl;
+    std::cout << "  --change-rate=F        Fraction of blocks changed by each incremental (default 0.05)" << std::endl;
+    std::cout << "  --compression=LEVEL    none, medium or high, recorded in the metadata (default none)" << std::endl;
+    std::cout << "  --compressible=F       Fraction of each block filled with zeros (default 0)" << std::endl;
+    std::cout << "  --image-id=ID          Image ID used for file names (default derived from the seed)" << std::endl;
+    std::cout << "  --seed=N               Seed for generated content (default 1)" << std::endl;
+    std::cout << "  --no-md5               Leave block hashes empty to speed up generation" << std::endl;
+    std::cout << "  --expected=PATH        Also write the raw disk image a restore should produce" << std::endl;
+}
+
+/**
+ * @brief Reports an option whose value is not valid
+ *
+ * @param name The option name, including the leading dashes
+ * @param programName Name the program was invoked as
+ * @return int The exit code for the error
+ */
+int reportInvalidValue(const std::string& name, const char* programName)
+{
+    std::cout << "Error: invalid value for " << name << std::endl;
+    printUsage(programName);
+    return 1;
+}
+
+/**
+ * @brief Main entry point of the chain generator
+ *
+ * @param argc Number of command line arguments
+ * @param argv Command line arguments
+ * @return int Exit code (0 for success, 1 for error)
+ */
+int main(int argc, char* argv[])
+{
+    GeneratorOptions options;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        std::string value;
+        uint64_t number = 0;
+        if (readOption(arg, "--output", value)) { options.outputDir = value; }
+        else if (readOption(arg, "--disk-size", value)) {
+            if (!parseSize(value, 1, UINT64_MAX, options.diskSize)) { return reportInvalidValue("--disk-size", argv[0]); }
+        }
+        else if (readOption(arg, "--partitions", value)) {
+            if (!parseNumber(value, 1, UINT16_MAX, number)) { return reportInvalidValue("--partitions", argv[0]); }
+            options.partitionCount = static_cast<uint32_t>(number);
+        }
+        else if (readOption(arg, "--block-size", value)) {
+            if (!parseSize(value, 512, UINT32_MAX, number) || number % 512 != 0) { return reportInvalidValue("--block-size", argv[0]); }
+            options.blockSize = static_cast<uint32_t>(number);
+        }
+        else if (readOption(arg, "--depth", value)) {
+            if (!parseNumber(value, 0, UINT16_MAX, number)) { return reportInvalidValue("--depth", argv[0]); }
+            options.depth = static_cast<uint32_t>(number);
+        }
+        else if (readOption(arg, "--used", value)) {
+            if (!parseFraction(value, options.usedRate)) { return reportInvalidValue("--used", argv[0]); }
+        }
+        else if (readOption(arg, "--change-rate", value)) {
+            if (!parseFraction(value, options.changeRate)) { return reportInvalidValue("--change-rate", argv[0]); }
+        }
+        else if (readOption(arg, "--compression", value)) {
+            if (value != "none" && value != "medium" && value != "high") { return reportInvalidValue("--compression", argv[0]); }
+            options.compression = nlohmann::json(value).get<ImageEnums::CompressionType>();
+        }
+        else if (readOption(arg, "--compressible", value)) {
+            if (!parseFraction(value, options.compressibleRate)) { return reportInvalidValue("--compressible", argv[0]); }
+        }
+        else if (readOption(arg, "--image-id", value)) { options.imageId = value; }
+        else if (readOption(arg, "--seed", value)) {
+            if (!parseNumber(value, 0, UINT64_MAX, options.seed)) { return reportInvalidValue("--seed", argv[0]); }
+        }
+        else if (readOption(arg, "--expected", value)) { options.expectedImagePath = value; }
+        else if (arg == "--no-md5") { options.hashBlocks = false; }
+        else {
+            std::cout << "Error: Unknown option " << arg << std::endl;
+            printUsage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (options.outputDir.empty()) {
+        std::cout << "Error: --output is required" << std::endl;
+        printUsage(argv[0]);
+        return 1;
+    }
+    if (options.imageId.empty()) {
+        char imageId[17];
+        snprintf(imageId, sizeof(imageId), "%016llX", static_cast<unsigned long long>(mixBits(options.seed)));
+        options.imageId = imageId;
+    }
+
+    std::filesystem::create_directories(options.outputDir);
+    std::vector<SyntheticPartition> partitions = layoutPartitions(options);
+    std::vector<uint8_t> track0 = buildTrack0(options);
+
+    std::fstream expectedImage;
+    if (!options.expectedImagePath.empty()) {
+        expectedImage = createFile(options.expectedImagePath);
+        setFilePointer(expectedImage, options.diskSize - 1, std::ios::beg);
+        uint8_t zero = 0;
+        writeToFile(expectedImage, &zero, sizeof(zero));
+        setFilePointer(expectedImage, 0, std::ios::beg);
+        writeToFile(expectedImage, track0.data(), track0.size());
+    }
+
+    auto startTime = std::chrono::steady_clock::now();
+    std::vector<file_structs::Partition::File_History> history;
+    uint64_t totalBytes = 0;
+    for (uint32_t increment = 0; increment <= options.depth; increment++) {
+        totalBytes += writeBackupFile(options, partitions, track0, increment, history, expectedImage.is_open() ? &expectedImage : nullptr);
+    }
+    if (expectedImage.is_open()) { closeFile(expectedImage); }
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+    std::cout << "Wrote " << history.size() << " backup files, " << totalBytes << " bytes in " << seconds << " s" << std::endl;
+    return 0;
+}